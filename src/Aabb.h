@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+#include <cfloat>
+
+
+// An axis aligned bounding box.
+struct Aabb
+{
+    DirectX::XMFLOAT3 min_corner;
+    DirectX::XMFLOAT3 max_corner;
+};
+
+// The box around the box when it is transformed, e.g. from model space to world space.
+inline Aabb transformed_aabb(const Aabb& box, DirectX::FXMMATRIX transform)
+{
+    using namespace DirectX;
+    const XMVECTOR min_corner = XMLoadFloat3(&box.min_corner);
+    const XMVECTOR max_corner = XMLoadFloat3(&box.max_corner);
+    const XMVECTOR center = XMVector3Transform((min_corner + max_corner) * 0.5f, transform);
+    const XMVECTOR extent = (max_corner - min_corner) * 0.5f;
+    // DirectXMath uses row vectors, so the rows are the transformed axes.
+    const XMVECTOR transformed_extent =
+        XMVectorAbs(transform.r[0]) * XMVectorSplatX(extent) +
+        XMVectorAbs(transform.r[1]) * XMVectorSplatY(extent) +
+        XMVectorAbs(transform.r[2]) * XMVectorSplatZ(extent);
+    Aabb result;
+    XMStoreFloat3(&result.min_corner, center - transformed_extent);
+    XMStoreFloat3(&result.max_corner, center + transformed_extent);
+    return result;
+}
+
+inline float component(const DirectX::XMFLOAT3& v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+inline bool intersects_sphere(const Aabb& box, DirectX::FXMVECTOR center, float radius)
+{
+    using namespace DirectX;
+    const XMVECTOR closest = XMVectorMax(XMLoadFloat3(&box.min_corner),
+        XMVectorMin(center, XMLoadFloat3(&box.max_corner)));
+    return XMVectorGetX(XMVector3LengthSq(center - closest)) <= radius * radius;
+}
+
+// The distance along the ray to where it enters the box, or FLT_MAX if it misses it. A ray
+// that starts in the box enters it at 0.
+inline float ray_distance(const DirectX::XMFLOAT3& origin, const DirectX::XMFLOAT3& direction,
+    const Aabb& box)
+{
+    float t_min = 0.0f;
+    float t_max = FLT_MAX;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float o = component(origin, axis);
+        const float d = component(direction, axis);
+        const float low = component(box.min_corner, axis);
+        const float high = component(box.max_corner, axis);
+        if (d == 0.0f)
+        {
+            if (o < low || o > high)
+                return FLT_MAX;
+            continue;
+        }
+        const float t1 = (low - o) / d;
+        const float t2 = (high - o) / d;
+        t_min = std::max(t_min, std::min(t1, t2));
+        t_max = std::min(t_max, std::max(t1, t2));
+    }
+    return t_min <= t_max ? t_min : FLT_MAX;
+}
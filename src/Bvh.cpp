@@ -0,0 +1,386 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Bvh.h"
+#include "Frustum.h"
+#include "Job_system.h"
+
+#include <cfloat>
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    constexpr int bins_count = 16;
+    // The split with the lowest cost is compared to making the node a leaf, where each box is
+    // tested, which costs 1. Leaves are at most this big, though, whatever the cost.
+    constexpr float traversal_cost = 1.0f;
+    constexpr UINT max_leaf_boxes = 8;
+    // The top of the tree is built with its binning split over the job system, and the
+    // subtrees of at least this many boxes are built as jobs of their own.
+    constexpr UINT boxes_per_binning_job = 16384;
+    constexpr UINT min_boxes_for_subtree_job = 4096;
+
+    struct Bounds
+    {
+        XMVECTOR min_corner = XMVectorReplicate(FLT_MAX);
+        XMVECTOR max_corner = XMVectorReplicate(-FLT_MAX);
+
+        void add(FXMVECTOR min_point, FXMVECTOR max_point)
+        {
+            min_corner = XMVectorMin(min_corner, min_point);
+            max_corner = XMVectorMax(max_corner, max_point);
+        }
+        void add(const Bounds& b) { add(b.min_corner, b.max_corner); }
+        float half_area() const
+        {
+            const XMVECTOR e = XMVectorMax(max_corner - min_corner, XMVectorZero());
+            return XMVectorGetX(e) * XMVectorGetY(e) + XMVectorGetY(e) * XMVectorGetZ(e) +
+                XMVectorGetZ(e) * XMVectorGetX(e);
+        }
+    };
+
+    struct Bins
+    {
+        Bounds bounds[3][bins_count];
+        UINT counts[3][bins_count] = {};
+    };
+
+    struct Node_bounds
+    {
+        Bounds boxes;
+        Bounds centroids;
+    };
+}
+
+class Bvh::Builder
+{
+public:
+    Builder(Bvh& bvh, const vector<Aabb>& boxes);
+    void build(UINT node, UINT first, UINT count);
+    UINT nodes_used() const { return m_nodes_used; }
+    const vector<UINT>& order() const { return m_order; }
+private:
+    // Calls function(begin, end, result) for consecutive ranges of the boxes, in parallel
+    // when there are many, and returns the results.
+    template <typename Result, typename Function>
+    vector<Result> for_ranges(UINT first, UINT count, Function function);
+    void make_leaf(UINT node, UINT first, UINT count);
+
+    Bvh& m_bvh;
+    const vector<Aabb>& m_boxes;
+    vector<XMFLOAT3> m_centroids;
+    vector<UINT> m_order; // The boxes are sorted into the leaves through this.
+    std::atomic<UINT> m_nodes_used;
+};
+
+Bvh::Builder::Builder(Bvh& bvh, const vector<Aabb>& boxes) : m_bvh(bvh), m_boxes(boxes),
+    m_centroids(boxes.size()), m_order(boxes.size()), m_nodes_used(1)
+{
+    for (UINT i = 0; i < boxes.size(); ++i)
+    {
+        XMStoreFloat3(&m_centroids[i], (XMLoadFloat3(&boxes[i].min_corner) +
+            XMLoadFloat3(&boxes[i].max_corner)) * 0.5f);
+        m_order[i] = i;
+    }
+    // A tree with n leaves has 2n - 1 nodes, and there are at most as many leaves as boxes.
+    m_bvh.m_nodes.resize(2 * boxes.size() - 1);
+}
+
+template <typename Result, typename Function>
+vector<Result> Bvh::Builder::for_ranges(UINT first, UINT count, Function function)
+{
+    const size_t ranges = (count + boxes_per_binning_job - 1) / boxes_per_binning_job;
+    vector<Result> results(ranges);
+    auto run = [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; ++r)
+        {
+            const UINT range_first = first + static_cast<UINT>(r) * boxes_per_binning_job;
+            function(range_first, std::min(range_first + boxes_per_binning_job, first + count),
+                results[r]);
+        }
+    };
+    if (ranges == 1)
+        run(0, 1);
+    else
+        job_system().parallel_for(ranges, 1, run);
+    return results;
+}
+
+void Bvh::Builder::make_leaf(UINT node, UINT first, UINT count)
+{
+    m_bvh.m_nodes[node].first = first;
+    m_bvh.m_nodes[node].count = count;
+}
+
+void Bvh::Builder::build(UINT node, UINT first, UINT count)
+{
+    Node_bounds node_bounds;
+    for (auto& b : for_ranges<Node_bounds>(first, count,
+        [&](UINT begin, UINT end, Node_bounds& result) {
+            for (UINT i = begin; i < end; ++i)
+            {
+                const Aabb& box = m_boxes[m_order[i]];
+                result.boxes.add(XMLoadFloat3(&box.min_corner), XMLoadFloat3(&box.max_corner));
+                const XMVECTOR centroid = XMLoadFloat3(&m_centroids[m_order[i]]);
+                result.centroids.add(centroid, centroid);
+            }
+        }))
+    {
+        node_bounds.boxes.add(b.boxes);
+        node_bounds.centroids.add(b.centroids);
+    }
+    Node& n = m_bvh.m_nodes[node];
+    XMStoreFloat3(&n.min_corner, node_bounds.boxes.min_corner);
+    XMStoreFloat3(&n.max_corner, node_bounds.boxes.max_corner);
+    n.count = 0;
+    if (count == 1)
+    {
+        make_leaf(node, first, count);
+        return;
+    }
+
+    XMFLOAT3 centroid_min, centroid_extent;
+    XMStoreFloat3(&centroid_min, node_bounds.centroids.min_corner);
+    XMStoreFloat3(&centroid_extent, node_bounds.centroids.max_corner -
+        node_bounds.centroids.min_corner);
+    auto bin = [&](UINT box, int axis) {
+        const float extent = component(centroid_extent, axis);
+        const int b = static_cast<int>((component(m_centroids[box], axis) -
+            component(centroid_min, axis)) * (bins_count / extent));
+        return std::min(b, bins_count - 1);
+    };
+
+    Bins bins;
+    for (auto& b : for_ranges<Bins>(first, count, [&](UINT begin, UINT end, Bins& result) {
+            for (UINT i = begin; i < end; ++i)
+                for (int axis = 0; axis < 3; ++axis)
+                    if (component(centroid_extent, axis) > 0.0f)
+                    {
+                        const Aabb& box = m_boxes[m_order[i]];
+                        const int index = bin(m_order[i], axis);
+                        result.bounds[axis][index].add(XMLoadFloat3(&box.min_corner),
+                            XMLoadFloat3(&box.max_corner));
+                        ++result.counts[axis][index];
+                    }
+        }))
+        for (int axis = 0; axis < 3; ++axis)
+            for (int i = 0; i < bins_count; ++i)
+            {
+                bins.bounds[axis][i].add(b.bounds[axis][i]);
+                bins.counts[axis][i] += b.counts[axis][i];
+            }
+
+    // The cost of splitting after each bin is the area of each side times its boxes, which
+    // the sides are swept for, from the left and from the right.
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_split = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (component(centroid_extent, axis) <= 0.0f)
+            continue;
+        float left_costs[bins_count];
+        Bounds left;
+        UINT left_count = 0;
+        for (int i = 0; i < bins_count - 1; ++i)
+        {
+            left.add(bins.bounds[axis][i]);
+            left_count += bins.counts[axis][i];
+            left_costs[i] = left.half_area() * left_count;
+        }
+        Bounds right;
+        UINT right_count = 0;
+        for (int i = bins_count - 1; i > 0; --i)
+        {
+            right.add(bins.bounds[axis][i]);
+            right_count += bins.counts[axis][i];
+            const float cost = left_costs[i - 1] + right.half_area() * right_count;
+            if (cost < best_cost && right_count > 0 && right_count < count)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = i;
+            }
+        }
+    }
+
+    const float leaf_cost = static_cast<float>(count);
+    const float area = node_bounds.boxes.half_area();
+    const float split_cost = area > 0.0f ? traversal_cost + best_cost / area : FLT_MAX;
+    if (count <= max_leaf_boxes && (best_axis < 0 || split_cost >= leaf_cost))
+    {
+        make_leaf(node, first, count);
+        return;
+    }
+
+    // Boxes with the same centroids can't be binned apart, so they are split in the middle.
+    UINT left_count = count / 2;
+    if (best_axis >= 0)
+    {
+        auto middle = std::partition(m_order.begin() + first, m_order.begin() + first + count,
+            [&](UINT box) { return bin(box, best_axis) < best_split; });
+        left_count = static_cast<UINT>(middle - (m_order.begin() + first));
+    }
+
+    const UINT children = m_nodes_used.fetch_add(2);
+    m_bvh.m_nodes[node].first = children;
+    if (count < min_boxes_for_subtree_job)
+    {
+        build(children, first, left_count);
+        build(children + 1, first + left_count, count - left_count);
+        return;
+    }
+    Job_system::Job_counter counter;
+    job_system().run(counter, [&]() { build(children, first, left_count); });
+    build(children + 1, first + left_count, count - left_count);
+    job_system().wait(counter);
+}
+
+void Bvh::build(const vector<Aabb>& boxes, const vector<int>& ids)
+{
+    m_nodes.clear();
+    m_boxes.clear();
+    m_ids.clear();
+    if (boxes.empty())
+        return;
+
+    Builder builder(*this, boxes);
+    builder.build(0, 0, static_cast<UINT>(boxes.size()));
+    m_nodes.resize(builder.nodes_used());
+    m_nodes.shrink_to_fit();
+    for (UINT i : builder.order())
+    {
+        m_boxes.push_back(boxes[i]);
+        m_ids.push_back(ids[i]);
+    }
+}
+
+void Bvh::add_subtree(UINT node, vector<int>& ids) const
+{
+    // The boxes of a subtree follow each other, from the ones of its leftmost leaf to the
+    // ones of its rightmost.
+    UINT leftmost = node;
+    while (m_nodes[leftmost].count == 0)
+        leftmost = m_nodes[leftmost].first;
+    UINT rightmost = node;
+    while (m_nodes[rightmost].count == 0)
+        rightmost = m_nodes[rightmost].first + 1;
+    ids.insert(ids.end(), m_ids.begin() + m_nodes[leftmost].first,
+        m_ids.begin() + m_nodes[rightmost].first + m_nodes[rightmost].count);
+}
+
+void Bvh::query(const Frustum& frustum, vector<int>& ids) const
+{
+    if (m_nodes.empty())
+        return;
+    vector<UINT> stack = { 0 };
+    while (!stack.empty())
+    {
+        const UINT index = stack.back();
+        stack.pop_back();
+        const Node& node = m_nodes[index];
+        const Aabb box = bounds(node);
+        if (!frustum.intersects_box(box))
+            continue;
+        if (node.count > 0)
+        {
+            // The boxes of a leaf are next to each other, so they are tested in batches.
+            uint8_t visible[max_leaf_boxes];
+            frustum.cull_boxes(&m_boxes[node.first], node.count, visible);
+            for (UINT i = 0; i < node.count; ++i)
+                if (visible[i])
+                    ids.push_back(m_ids[node.first + i]);
+        }
+        else if (frustum.contains_box(box))
+            add_subtree(index, ids);
+        else
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+}
+
+void Bvh::query(FXMVECTOR center, float radius, vector<int>& ids) const
+{
+    if (m_nodes.empty())
+        return;
+    vector<UINT> stack = { 0 };
+    while (!stack.empty())
+    {
+        const Node& node = m_nodes[stack.back()];
+        stack.pop_back();
+        if (!intersects_sphere(bounds(node), center, radius))
+            continue;
+        if (node.count > 0)
+        {
+            for (UINT i = node.first; i < node.first + node.count; ++i)
+                if (intersects_sphere(m_boxes[i], center, radius))
+                    ids.push_back(m_ids[i]);
+        }
+        else
+        {
+            stack.push_back(node.first);
+            stack.push_back(node.first + 1);
+        }
+    }
+}
+
+int Bvh::first_hit(FXMVECTOR origin, FXMVECTOR direction, float& distance) const
+{
+    distance = FLT_MAX;
+    int hit = -1;
+    if (m_nodes.empty())
+        return hit;
+    XMFLOAT3 o, d;
+    XMStoreFloat3(&o, origin);
+    XMStoreFloat3(&d, direction);
+
+    // The nearer child is visited first, and the nodes that are entered further away than
+    // the nearest hit so far are skipped.
+    struct Entry
+    {
+        UINT node;
+        float distance;
+    };
+    vector<Entry> stack = { { 0, ray_distance(o, d, bounds(m_nodes[0])) } };
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        if (entry.distance >= distance)
+            continue;
+        const Node& node = m_nodes[entry.node];
+        if (node.count > 0)
+        {
+            for (UINT i = node.first; i < node.first + node.count; ++i)
+            {
+                const float t = ray_distance(o, d, m_boxes[i]);
+                if (t < distance)
+                {
+                    distance = t;
+                    hit = m_ids[i];
+                }
+            }
+            continue;
+        }
+        Entry nearer = { node.first, ray_distance(o, d, bounds(m_nodes[node.first])) };
+        Entry further = { node.first + 1, ray_distance(o, d, bounds(m_nodes[node.first + 1])) };
+        if (further.distance < nearer.distance)
+            std::swap(nearer, further);
+        if (further.distance < distance)
+            stack.push_back(further);
+        if (nearer.distance < distance)
+            stack.push_back(nearer);
+    }
+    return hit;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+#include "Aabb.h"
+
+
+class Frustum;
+
+// A bounding volume hierarchy of boxes that don't move, e.g. of the static objects of a scene,
+// which finds the boxes in a frustum, a sphere or along a ray without testing all of them.
+// It is built top down with the surface area heuristic, evaluated in bins as in "On fast
+// Construction of SAH-based Bounding Volume Hierarchies" by Ingo Wald, 2007.
+class Bvh
+{
+public:
+    // The ids are what the queries return, e.g. the object ids. The subtrees of the big nodes
+    // are built in parallel on the job system.
+    void build(const std::vector<Aabb>& boxes, const std::vector<int>& ids);
+
+    // These add the ids of the boxes that intersect the frustum or the sphere to ids, in no
+    // particular order.
+    void query(const Frustum& frustum, std::vector<int>& ids) const;
+    void query(DirectX::FXMVECTOR center, float radius, std::vector<int>& ids) const;
+    // Returns the id of the nearest box that the ray hits, or -1 if it hits none, and sets
+    // distance to how far along the direction it is. A ray that starts in a box hits it at 0.
+    int first_hit(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction,
+        float& distance) const;
+
+    size_t size() const { return m_ids.size(); }
+    size_t nodes_count() const { return m_nodes.size(); }
+
+private:
+    // Two nodes fit in a cache line, and the children of a node are next to each other.
+    struct alignas(32) Node
+    {
+        DirectX::XMFLOAT3 min_corner;
+        UINT first; // The first child, or the first box of a leaf.
+        DirectX::XMFLOAT3 max_corner;
+        UINT count; // The number of boxes of a leaf, 0 for the other nodes.
+    };
+    class Builder;
+
+    static Aabb bounds(const Node& node) { return { node.min_corner, node.max_corner }; }
+    void add_subtree(UINT node, std::vector<int>& ids) const;
+
+    std::vector<Node> m_nodes;
+    // In the order of the leaves, so the boxes of each subtree follow each other.
+    std::vector<Aabb> m_boxes;
+    std::vector<int> m_ids;
+};
@@ -0,0 +1,688 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Compressed_file.h"
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+
+
+using std::string;
+using std::vector;
+
+
+namespace
+{
+    // The decompressed data is handed over to the parser in blocks of this size, and at most
+    // max_queued_blocks of them are waiting to be read. Together with the window and the
+    // input buffer this is all the memory that the decompression needs, whatever the size
+    // of the file.
+    constexpr size_t output_block_size = 256 * 1024;
+    constexpr size_t max_queued_blocks = 4;
+    constexpr size_t input_buffer_size = 64 * 1024;
+
+    // The longest distance that a DEFLATE match can refer back.
+    constexpr size_t window_size = 32 * 1024;
+
+    bool ends_with(const string& file_name, const string& extension)
+    {
+        if (file_name.size() < extension.size())
+            return false;
+        return std::equal(extension.begin(), extension.end(),
+            file_name.end() - extension.size(), [](char a, char b)
+            { return a == std::tolower(static_cast<unsigned char>(b)); });
+    }
+
+    // Thrown on the decompression thread when the stream has been destroyed, to stop it.
+    struct Decompression_cancelled
+    {
+    };
+
+    // The decompressed blocks that have not been read yet. The decompression thread waits
+    // when it is full and the reader waits when it is empty, which lets them overlap while
+    // keeping the memory bounded.
+    class Block_queue
+    {
+    public:
+        void push(vector<char>&& block)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [&] { return m_blocks.size() < max_queued_blocks ||
+                m_cancelled; });
+            if (m_cancelled)
+                throw Decompression_cancelled();
+            m_blocks.push_back(std::move(block));
+            m_changed.notify_all();
+        }
+
+        // Returns an empty block at the end of the data, or throws the error of the
+        // decompression if it failed.
+        vector<char> pop()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [&] { return !m_blocks.empty() || m_finished; });
+            if (m_blocks.empty())
+            {
+                if (m_error)
+                    std::rethrow_exception(m_error);
+                return {};
+            }
+            vector<char> block = std::move(m_blocks.front());
+            m_blocks.pop_front();
+            m_changed.notify_all();
+            return block;
+        }
+
+        void finish(std::exception_ptr error = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+            m_error = error;
+            m_changed.notify_all();
+        }
+
+        void cancel()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cancelled = true;
+            m_changed.notify_all();
+        }
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::deque<vector<char>> m_blocks;
+        bool m_finished = false;
+        bool m_cancelled = false;
+        std::exception_ptr m_error;
+    };
+
+    // Reads the compressed stream in bits, least significant bit first, as DEFLATE packs them.
+    class Bit_reader
+    {
+    public:
+        Bit_reader(std::istream& input, const string& name) : m_input(input), m_name(name),
+            m_buffer(input_buffer_size), m_next(nullptr), m_end(nullptr), m_bits(0),
+            m_bit_count(0), m_padding_bits(0)
+        {
+        }
+
+        // Returns the next count bits without consuming them. count <= 32.
+        uint32_t peek(int count)
+        {
+            if (m_bit_count < count)
+                refill();
+            return static_cast<uint32_t>(m_bits & ((1ull << count) - 1));
+        }
+
+        void consume(int count)
+        {
+            m_bits >>= count;
+            m_bit_count -= count;
+            if (m_bit_count < m_padding_bits)
+                throw Decompression_error(m_name, "The compressed data ends unexpectedly.");
+        }
+
+        uint32_t bits(int count)
+        {
+            const uint32_t value = peek(count);
+            consume(count);
+            return value;
+        }
+
+        void align_to_byte()
+        {
+            consume(m_bit_count % 8);
+        }
+
+        // Whether all of the input has been read. Only valid at a byte boundary.
+        bool at_end()
+        {
+            return m_bit_count == m_padding_bits && m_next == m_end && !fill_buffer();
+        }
+    private:
+        void refill()
+        {
+            while (m_bit_count <= 56)
+            {
+                if (m_next == m_end && !fill_buffer())
+                {
+                    // Zeros are added after the end, which makes it possible to peek further
+                    // than there is data. Consuming them is an error.
+                    m_bit_count += 8;
+                    m_padding_bits += 8;
+                    continue;
+                }
+                m_bits |= static_cast<uint64_t>(static_cast<uint8_t>(*m_next++)) << m_bit_count;
+                m_bit_count += 8;
+            }
+        }
+
+        bool fill_buffer()
+        {
+            if (m_padding_bits != 0)
+                return false;
+            m_input.read(m_buffer.data(), m_buffer.size());
+            if (m_input.bad())
+                throw Decompression_error(m_name, "The file could not be read.");
+            m_next = m_buffer.data();
+            m_end = m_next + m_input.gcount();
+            return m_next != m_end;
+        }
+
+        std::istream& m_input;
+        const string& m_name;
+        vector<char> m_buffer;
+        const char* m_next;
+        const char* m_end;
+        uint64_t m_bits;
+        int m_bit_count;
+        int m_padding_bits;
+    };
+
+    uint32_t update_crc32(uint32_t crc, const char* data, size_t size)
+    {
+        static const auto table = [] {
+            std::array<uint32_t, 256> t;
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int bit = 0; bit < 8; ++bit)
+                    c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        crc = ~crc;
+        for (size_t i = 0; i < size; ++i)
+            crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+    // The decompressed data. The last window_size bytes are kept in front of the block that
+    // is being filled, for the matches to refer back to, when the block is handed over.
+    class Output_window
+    {
+    public:
+        Output_window(Block_queue& queue, const string& name) : m_queue(queue), m_name(name),
+            m_buffer(window_size + output_block_size), m_position(0), m_block_start(0),
+            m_crc_position(0), m_crc(0), m_size(0)
+        {
+        }
+
+        void put(char c)
+        {
+            if (m_position == m_buffer.size())
+                flush();
+            m_buffer[m_position++] = c;
+        }
+
+        void copy_match(size_t distance, size_t length)
+        {
+            if (distance > m_position)
+                throw Decompression_error(m_name, "A match refers to before the start.");
+            if (m_buffer.size() - m_position < length)
+                flush();
+            // The match can overlap what it writes, so it is copied one byte at a time.
+            char* destination = &m_buffer[m_position];
+            const char* source = destination - distance;
+            for (size_t i = 0; i < length; ++i)
+                destination[i] = source[i];
+            m_position += length;
+        }
+
+        // Hands over the decompressed data that has not been handed over yet.
+        void flush()
+        {
+            update_crc();
+            if (m_position != m_block_start)
+                m_queue.push(vector<char>(m_buffer.begin() + m_block_start,
+                    m_buffer.begin() + m_position));
+
+            const size_t kept = std::min(m_position, window_size);
+            if (kept != m_position)
+                std::copy(m_buffer.begin() + (m_position - kept), m_buffer.begin() + m_position,
+                    m_buffer.begin());
+            m_position = kept;
+            m_block_start = kept;
+            m_crc_position = kept;
+        }
+
+        // The CRC-32 and size modulo 2^32 of the data since the last call.
+        void end_member(uint32_t& crc, uint32_t& size)
+        {
+            update_crc();
+            crc = m_crc;
+            size = m_size;
+            m_crc = 0;
+            m_size = 0;
+        }
+    private:
+        void update_crc()
+        {
+            const size_t count = m_position - m_crc_position;
+            m_crc = update_crc32(m_crc, &m_buffer[m_crc_position], count);
+            m_size += static_cast<uint32_t>(count);
+            m_crc_position = m_position;
+        }
+
+        Block_queue& m_queue;
+        const string& m_name;
+        vector<char> m_buffer;
+        size_t m_position;
+        size_t m_block_start;
+        size_t m_crc_position;
+        uint32_t m_crc;
+        uint32_t m_size;
+    };
+
+    constexpr int max_code_bits = 15;
+    constexpr int literal_length_symbol_count = 288;
+    constexpr int distance_symbol_count = 32;
+    constexpr int code_length_symbol_count = 19;
+    constexpr int end_of_block = 256;
+
+    // A canonical Huffman code. The codes of up to fast_bits bits, which are the vast
+    // majority, are decoded with one table lookup, the longer ones bit by bit.
+    class Huffman_code
+    {
+    public:
+        // Incomplete codes are allowed, since a code with only one symbol is, but
+        // over-subscribed ones are not.
+        void build(const uint8_t* lengths, int symbol_count, const string& name)
+        {
+            m_count.fill(0);
+            for (int s = 0; s < symbol_count; ++s)
+                ++m_count[lengths[s]];
+            m_count[0] = 0;
+
+            std::array<uint16_t, max_code_bits + 1> offsets;
+            int left = 1;
+            offsets[1] = 0;
+            for (int length = 1; length <= max_code_bits; ++length)
+            {
+                left = (left << 1) - m_count[length];
+                if (left < 0)
+                    throw Decompression_error(name, "Invalid Huffman code.");
+                if (length < max_code_bits)
+                    offsets[length + 1] = offsets[length] + m_count[length];
+            }
+            for (int s = 0; s < symbol_count; ++s)
+                if (lengths[s] != 0)
+                    m_symbols[offsets[lengths[s]]++] = static_cast<uint16_t>(s);
+
+            // The codes are packed starting with their most significant bit, so the table is
+            // indexed with them reversed.
+            m_fast.fill(0);
+            uint32_t code = 0;
+            int symbol_index = 0;
+            for (int length = 1; length <= fast_bits; ++length)
+            {
+                for (int i = 0; i < m_count[length]; ++i, ++code, ++symbol_index)
+                {
+                    uint32_t reversed = 0;
+                    for (int bit = 0; bit < length; ++bit)
+                        reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+                    const uint16_t entry = static_cast<uint16_t>(m_symbols[symbol_index] << 4 |
+                        length);
+                    for (uint32_t j = reversed; j < m_fast.size(); j += 1 << length)
+                        m_fast[j] = entry;
+                }
+                code <<= 1;
+            }
+        }
+
+        int decode(Bit_reader& in, const string& name) const
+        {
+            const uint16_t entry = m_fast[in.peek(fast_bits)];
+            if (entry != 0)
+            {
+                in.consume(entry & 0xf);
+                return entry >> 4;
+            }
+
+            const uint32_t bits = in.peek(max_code_bits);
+            int code = 0;
+            int first = 0;
+            int index = 0;
+            for (int length = 1; length <= max_code_bits; ++length)
+            {
+                code |= (bits >> (length - 1)) & 1;
+                const int count = m_count[length];
+                if (code - first < count)
+                {
+                    in.consume(length);
+                    return m_symbols[index + code - first];
+                }
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+            throw Decompression_error(name, "Invalid Huffman code in the data.");
+        }
+    private:
+        static constexpr int fast_bits = 10;
+        std::array<uint16_t, 1 << fast_bits> m_fast; // symbol << 4 | length, or 0 if longer.
+        std::array<uint16_t, max_code_bits + 1> m_count; // The number of codes per length.
+        std::array<uint16_t, literal_length_symbol_count> m_symbols; // In code order.
+    };
+
+    constexpr uint16_t length_base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+        31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    constexpr uint8_t length_extra_bits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    constexpr uint16_t distance_base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97,
+        129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+        24577 };
+    constexpr uint8_t distance_extra_bits[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    constexpr int length_code_count = sizeof(length_base) / sizeof(length_base[0]);
+    constexpr int distance_code_count = sizeof(distance_base) / sizeof(distance_base[0]);
+
+    class Inflater
+    {
+    public:
+        Inflater(Bit_reader& in, Output_window& out, const string& name) : m_in(in),
+            m_out(out), m_name(name)
+        {
+            uint8_t lengths[literal_length_symbol_count];
+            std::fill(lengths, lengths + 144, uint8_t(8));
+            std::fill(lengths + 144, lengths + 256, uint8_t(9));
+            std::fill(lengths + 256, lengths + 280, uint8_t(7));
+            std::fill(lengths + 280, lengths + 288, uint8_t(8));
+            m_fixed_literal_lengths.build(lengths, literal_length_symbol_count, name);
+            std::fill(lengths, lengths + distance_symbol_count, uint8_t(5));
+            m_fixed_distances.build(lengths, distance_symbol_count, name);
+        }
+
+        // Decompresses one DEFLATE stream, i.e. until its last block.
+        void inflate()
+        {
+            bool last_block = false;
+            while (!last_block)
+            {
+                last_block = m_in.bits(1) != 0;
+                const uint32_t type = m_in.bits(2);
+                if (type == 0)
+                    read_stored_block();
+                else if (type == 1)
+                    read_block(m_fixed_literal_lengths, m_fixed_distances);
+                else if (type == 2)
+                {
+                    read_dynamic_codes();
+                    read_block(m_literal_lengths, m_distances);
+                }
+                else
+                    throw Decompression_error(m_name, "Invalid block type.");
+            }
+        }
+    private:
+        void read_stored_block()
+        {
+            m_in.align_to_byte();
+            const uint32_t length = m_in.bits(16);
+            if (m_in.bits(16) != (~length & 0xffff))
+                throw Decompression_error(m_name, "Invalid length of a stored block.");
+            for (uint32_t i = 0; i < length; ++i)
+                m_out.put(static_cast<char>(m_in.bits(8)));
+        }
+
+        void read_dynamic_codes()
+        {
+            const int literal_length_count = m_in.bits(5) + 257;
+            const int distance_count = m_in.bits(5) + 1;
+            const int code_length_count = m_in.bits(4) + 4;
+            if (literal_length_count > 286 || distance_count > distance_code_count)
+                throw Decompression_error(m_name, "Too many codes in a block.");
+
+            // The code lengths are themselves Huffman coded, with their lengths in this order.
+            constexpr uint8_t order[code_length_symbol_count] = { 16, 17, 18, 0, 8, 7, 9, 6,
+                10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+            uint8_t lengths[literal_length_symbol_count + distance_symbol_count] = {};
+            for (int i = 0; i < code_length_count; ++i)
+                lengths[order[i]] = static_cast<uint8_t>(m_in.bits(3));
+            Huffman_code code_lengths;
+            code_lengths.build(lengths, code_length_symbol_count, m_name);
+
+            const int count = literal_length_count + distance_count;
+            std::fill(lengths, lengths + code_length_symbol_count, uint8_t(0));
+            for (int i = 0; i < count;)
+            {
+                const int symbol = code_lengths.decode(m_in, m_name);
+                if (symbol < 16)
+                {
+                    lengths[i++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+                uint8_t length = 0;
+                int repeat;
+                if (symbol == 16)
+                {
+                    if (i == 0)
+                        throw Decompression_error(m_name, "A code length repeat has no "
+                            "previous length.");
+                    length = lengths[i - 1];
+                    repeat = 3 + m_in.bits(2);
+                }
+                else if (symbol == 17)
+                    repeat = 3 + m_in.bits(3);
+                else
+                    repeat = 11 + m_in.bits(7);
+                if (i + repeat > count)
+                    throw Decompression_error(m_name, "Too many code lengths.");
+                std::fill(lengths + i, lengths + i + repeat, length);
+                i += repeat;
+            }
+            if (lengths[end_of_block] == 0)
+                throw Decompression_error(m_name, "A block has no end of block code.");
+
+            m_literal_lengths.build(lengths, literal_length_count, m_name);
+            m_distances.build(lengths + literal_length_count, distance_count, m_name);
+        }
+
+        void read_block(const Huffman_code& literal_lengths, const Huffman_code& distances)
+        {
+            for (;;)
+            {
+                const int symbol = literal_lengths.decode(m_in, m_name);
+                if (symbol < end_of_block)
+                    m_out.put(static_cast<char>(symbol));
+                else if (symbol == end_of_block)
+                    return;
+                else
+                {
+                    const int length_code = symbol - end_of_block - 1;
+                    if (length_code >= length_code_count)
+                        throw Decompression_error(m_name, "Invalid length code.");
+                    const size_t length = length_base[length_code] +
+                        m_in.bits(length_extra_bits[length_code]);
+                    const int distance_code = distances.decode(m_in, m_name);
+                    if (distance_code >= distance_code_count)
+                        throw Decompression_error(m_name, "Invalid distance code.");
+                    const size_t distance = distance_base[distance_code] +
+                        m_in.bits(distance_extra_bits[distance_code]);
+                    m_out.copy_match(distance, length);
+                }
+            }
+        }
+
+        Bit_reader& m_in;
+        Output_window& m_out;
+        const string& m_name;
+        Huffman_code m_fixed_literal_lengths;
+        Huffman_code m_fixed_distances;
+        Huffman_code m_literal_lengths;
+        Huffman_code m_distances;
+    };
+
+    void skip_zero_terminated_string(Bit_reader& in)
+    {
+        while (in.bits(8) != 0)
+            ;
+    }
+
+    uint32_t read_uint32(Bit_reader& in)
+    {
+        const uint32_t low = in.bits(16);
+        return low | in.bits(16) << 16;
+    }
+
+    void read_gzip_member(Bit_reader& in, Output_window& out, Inflater& inflater,
+        const string& name)
+    {
+        constexpr uint32_t id1 = 0x1f;
+        constexpr uint32_t id2 = 0x8b;
+        constexpr uint32_t deflate_method = 8;
+        if (in.bits(8) != id1 || in.bits(8) != id2)
+            throw Decompression_error(name, "It is not a gzip file.");
+        if (in.bits(8) != deflate_method)
+            throw Decompression_error(name, "Unsupported compression method.");
+
+        constexpr uint32_t header_crc = 2;
+        constexpr uint32_t extra_field = 4;
+        constexpr uint32_t original_name = 8;
+        constexpr uint32_t comment = 16;
+        constexpr uint32_t reserved = 0xe0;
+        const uint32_t flags = in.bits(8);
+        if (flags & reserved)
+            throw Decompression_error(name, "Unknown gzip header flags.");
+        constexpr int time_and_os_bytes = 6;
+        for (int i = 0; i < time_and_os_bytes; ++i)
+            in.bits(8);
+        if (flags & extra_field)
+            for (uint32_t i = in.bits(16); i > 0; --i)
+                in.bits(8);
+        if (flags & original_name)
+            skip_zero_terminated_string(in);
+        if (flags & comment)
+            skip_zero_terminated_string(in);
+        if (flags & header_crc)
+            in.bits(16);
+
+        inflater.inflate();
+
+        in.align_to_byte();
+        uint32_t crc;
+        uint32_t size;
+        out.end_member(crc, size);
+        if (read_uint32(in) != crc)
+            throw Decompression_error(name, "The CRC of the decompressed data is wrong.");
+        if (read_uint32(in) != size)
+            throw Decompression_error(name, "The size of the decompressed data is wrong.");
+    }
+
+    // A file can consist of several gzip members, which are decompressed after each other.
+    void decompress_gzip(std::istream& compressed, const string& name, Block_queue& queue)
+    {
+        Bit_reader in(compressed, name);
+        Output_window out(queue, name);
+        Inflater inflater(in, out, name);
+        do
+        {
+            read_gzip_member(in, out, inflater, name);
+        } while (!in.at_end());
+        out.flush();
+    }
+
+    // Gives the parser the blocks that are decompressed on a separate thread.
+    class Decompressing_streambuf : public std::streambuf
+    {
+    public:
+        Decompressing_streambuf(std::unique_ptr<std::istream> compressed, const string& name) :
+            m_compressed(std::move(compressed)), m_name(name), m_thread([this] { decompress(); })
+        {
+        }
+
+        ~Decompressing_streambuf()
+        {
+            m_queue.cancel();
+            m_thread.join();
+        }
+    protected:
+        int_type underflow() override
+        {
+            m_block = m_queue.pop();
+            if (m_block.empty())
+                return traits_type::eof();
+            setg(m_block.data(), m_block.data(), m_block.data() + m_block.size());
+            return traits_type::to_int_type(m_block[0]);
+        }
+    private:
+        void decompress()
+        {
+            try
+            {
+                decompress_gzip(*m_compressed, m_name, m_queue);
+                m_queue.finish();
+            }
+            catch (Decompression_cancelled&)
+            {
+            }
+            catch (...)
+            {
+                m_queue.finish(std::current_exception());
+            }
+        }
+
+        std::unique_ptr<std::istream> m_compressed;
+        const string m_name;
+        Block_queue m_queue;
+        vector<char> m_block;
+        std::thread m_thread; // Last, so that the rest is initialized when it starts.
+    };
+
+    class Decompressing_stream : public std::istream
+    {
+    public:
+        Decompressing_stream(std::unique_ptr<std::istream> compressed, const string& name) :
+            std::istream(nullptr), m_buffer(std::move(compressed), name)
+        {
+            rdbuf(&m_buffer);
+            // This makes the stream rethrow the Decompression_error of a failed read, instead
+            // of only setting the bad bit, which could be mistaken for the end of the file.
+            exceptions(std::ios::badbit);
+        }
+    private:
+        Decompressing_streambuf m_buffer;
+    };
+}
+
+bool is_compressed_file(const string& file_name)
+{
+    return ends_with(file_name, ".gz") || ends_with(file_name, ".zst");
+}
+
+string uncompressed_file_name(const string& file_name)
+{
+    if (!is_compressed_file(file_name))
+        return file_name;
+    return file_name.substr(0, file_name.find_last_of('.'));
+}
+
+std::unique_ptr<std::istream> open_input_file(const string& file_name)
+{
+    if (ends_with(file_name, ".zst"))
+        throw Decompression_error(file_name, "Zstandard compressed files are not supported, "
+            "use gzip.");
+    if (!ends_with(file_name, ".gz"))
+        return std::make_unique<std::ifstream>(file_name);
+
+    auto file = std::make_unique<std::ifstream>(file_name, std::ios::binary);
+    if (!file->is_open())
+        return file;
+    return open_gzip_stream(std::move(file), file_name);
+}
+
+std::unique_ptr<std::istream> open_gzip_stream(std::unique_ptr<std::istream> compressed,
+    const string& name/* = ""*/)
+{
+    return std::make_unique<Decompressing_stream>(std::move(compressed), name);
+}
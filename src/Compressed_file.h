@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+// Reading of compressed input files. Model, mtl and scene files can be stored compressed with
+// gzip (.gz), and are then decompressed while they are parsed, without first decompressing
+// them to disk or into memory as a whole. The decompression runs on a thread of its own and
+// is at most a few blocks ahead of the parser, which reads the decompressed data through an
+// ordinary std::istream.
+// See https://www.rfc-editor.org/rfc/rfc1951 (DEFLATE) and
+// https://www.rfc-editor.org/rfc/rfc1952 (gzip)
+
+struct Decompression_error
+{
+    Decompression_error(const std::string& file_name_, const std::string& reason_) :
+        file_name(file_name_), reason(reason_) {}
+    std::string file_name;
+    std::string reason;
+};
+
+// Whether the file name ends with .gz or .zst.
+bool is_compressed_file(const std::string& file_name);
+
+// The file name without the compression extension, e.g. model.obj for model.obj.gz, which
+// tells the format of the content.
+std::string uncompressed_file_name(const std::string& file_name);
+
+// Opens the file for reading, with decompression if it ends with .gz. If the file could not
+// be opened, the stream is in a failed state, like an std::ifstream. Errors in the compressed
+// data are thrown as Decompression_error from the reads of the stream. Zstandard (.zst) is not
+// supported, those files throw Decompression_error directly.
+std::unique_ptr<std::istream> open_input_file(const std::string& file_name);
+
+// Decompresses the gzip data of the compressed stream, which is read on the decompression
+// thread. The name is only used in the errors.
+std::unique_ptr<std::istream> open_gzip_stream(std::unique_ptr<std::istream> compressed,
+    const std::string& name = "");
@@ -12,10 +12,13 @@
 #include "View.h"
 #include "Commands.h"
 #include "Root_signature.h"
+#include "Mesh.h"
 
 #ifndef _DEBUG
 #include "build/depths_vertex_shader_srv_instance_data.h"
 #include "build/depths_alpha_cut_out_vertex_shader_srv_instance_data.h"
+#include "build/depths_vertex_shader_srv_instance_data_compact.h"
+#include "build/depths_alpha_cut_out_vertex_shader_srv_instance_data_compact.h"
 #include "build/pixel_shader_depths_alpha_cut_out.h"
 #endif
 
@@ -34,6 +37,7 @@ void Depth_pass::create_pipeline_state(ComPtr<ID3D12Device> device,
 
     Input_layout input_layout = alpha_cut_out ? Input_layout::position_normal :
         Input_layout::position;
+    const bool compact = Mesh::default_vertex_format() == Vertex_format::compact;
 
 #ifndef _DEBUG
     if (!pipeline_state)
@@ -48,6 +52,13 @@ void Depth_pass::create_pipeline_state(ComPtr<ID3D12Device> device,
                 _countof(g_depths_alpha_cut_out_vertex_shader_srv_instance_data)) :
             CD3DX12_SHADER_BYTECODE(g_depths_vertex_shader_srv_instance_data,
                 _countof(g_depths_vertex_shader_srv_instance_data));
+        if (compact)
+            compiled_vertex_shader = alpha_cut_out ?
+                CD3DX12_SHADER_BYTECODE(
+                    g_depths_alpha_cut_out_vertex_shader_srv_instance_data_compact,
+                    _countof(g_depths_alpha_cut_out_vertex_shader_srv_instance_data_compact)) :
+                CD3DX12_SHADER_BYTECODE(g_depths_vertex_shader_srv_instance_data_compact,
+                    _countof(g_depths_vertex_shader_srv_instance_data_compact));
 
         ::create_pipeline_state(device, pipeline_state, m_root_signature->get(),
             compiled_vertex_shader, alpha_cut_out ? compiled_pixel_shader :
@@ -61,6 +72,10 @@ void Depth_pass::create_pipeline_state(ComPtr<ID3D12Device> device,
         const char* vertex_shader_entry = alpha_cut_out ?
             "depths_alpha_cut_out_vertex_shader_srv_instance_data" :
             "depths_vertex_shader_srv_instance_data";
+        if (compact)
+            vertex_shader_entry = alpha_cut_out ?
+                "depths_alpha_cut_out_vertex_shader_srv_instance_data_compact" :
+                "depths_vertex_shader_srv_instance_data_compact";
 
         const char* pixel_shader_entry = alpha_cut_out ? "pixel_shader_depths_alpha_cut_out"
                                                        : nullptr;
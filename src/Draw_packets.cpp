@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Draw_packets.h"
+#include "Render_queue.h"
+#include "Job_system.h"
+
+#include <climits>
+
+
+namespace
+{
+    constexpr size_t draws_per_part = 512;
+    constexpr UINT no_mesh = UINT_MAX;
+}
+
+void Draw_packet_stream::build(const Render_queue& queue, Frustum_culling frustum_culling,
+    Meshlet_culling meshlet_culling)
+{
+    build(queue, frustum_culling, meshlet_culling, job_system());
+}
+
+void Draw_packet_stream::build(const Render_queue& queue, Frustum_culling frustum_culling,
+    Meshlet_culling meshlet_culling, Job_system& jobs)
+{
+    auto& draws = queue.draws(frustum_culling);
+    auto& ranges = queue.ranges(meshlet_culling);
+    auto& mesh_ids = queue.mesh_ids();
+    m_part_count = (draws.size() + draws_per_part - 1) / draws_per_part;
+    if (m_part_packets.size() < m_part_count)
+        m_part_packets.resize(m_part_count);
+
+    jobs.parallel_for(m_part_count, 1, [&](size_t begin, size_t end) {
+        for (size_t part = begin; part < end; ++part)
+        {
+            auto& packets = m_part_packets[part];
+            packets.clear();
+            const size_t first_draw = part * draws_per_part;
+            const size_t end_draw = std::min(first_draw + draws_per_part, draws.size());
+            // Most draws have one range, so this is mostly all the memory that the part needs,
+            // and it is kept for the builds after this one.
+            packets.reserve(end_draw - first_draw);
+
+            // The changes are from the last draw with packets, which is left for the parts
+            // before this one to tell, see below. The meshlet culling can leave a draw
+            // without any ranges, and so without packets.
+            UINT previous_mesh = no_mesh;
+            const D3D12_INDEX_BUFFER_VIEW* previous_index_buffer = nullptr;
+            for (size_t d = first_draw; d < end_draw; ++d)
+            {
+                const Queued_draw& draw = draws[d];
+                const UINT i = draw.object;
+                const Draw_ranges& r = ranges[i];
+                if (r.range_count == 0)
+                    continue;
+
+                Draw_packet packet;
+                packet.object = i;
+                packet.object_id = queue.object_ids()[i] + draw.first_instance;
+                packet.dynamic_transform_ref = queue.dynamic_transform_refs()[i] < 0 ? -1 :
+                    queue.dynamic_transform_refs()[i] + draw.first_instance;
+                packet.material_id = queue.material_ids()[i];
+                packet.instances = draw.instances;
+                packet.changes = Draw_packet::object_changed |
+                    (mesh_ids[i] != previous_mesh ? Draw_packet::mesh_changed : 0) |
+                    (r.index_buffer != previous_index_buffer ?
+                        Draw_packet::index_buffer_changed : 0);
+                previous_mesh = mesh_ids[i];
+                previous_index_buffer = r.index_buffer;
+
+                // The ranges after the first draw the same object, with the same buffers.
+                for (UINT j = 0; j < r.range_count; ++j)
+                {
+                    packet.start_index = r.ranges[j].start_index;
+                    packet.index_count = r.ranges[j].index_count;
+                    packet.base_vertex = r.ranges[j].base_vertex;
+                    packets.push_back(packet);
+                    packet.changes = 0;
+                }
+            }
+        }
+    });
+
+    // The first packet of each part sets the mesh and the index buffer, which only has to be
+    // done where they differ from those of the last packet of the parts before it.
+    m_size = 0;
+    const Draw_packet* last = nullptr;
+    for (size_t part = 0; part < m_part_count; ++part)
+    {
+        auto& packets = m_part_packets[part];
+        if (packets.empty())
+            continue;
+        if (last)
+        {
+            Draw_packet& first = packets.front();
+            if (mesh_ids[first.object] == mesh_ids[last->object])
+                first.changes &= ~Draw_packet::mesh_changed;
+            if (ranges[first.object].index_buffer == ranges[last->object].index_buffer)
+                first.changes &= ~Draw_packet::index_buffer_changed;
+        }
+        last = &packets.back();
+        m_size += packets.size();
+    }
+
+    m_queue = &queue;
+    m_queue_version = queue.version();
+    m_frustum_culling = frustum_culling;
+    m_meshlet_culling = meshlet_culling;
+}
+
+void Draw_packet_stream::update(const Render_queue& queue, Frustum_culling frustum_culling,
+    Meshlet_culling meshlet_culling)
+{
+    if (m_queue != &queue || m_queue_version != queue.version() ||
+        m_frustum_culling != frustum_culling || m_meshlet_culling != meshlet_culling)
+        build(queue, frustum_culling, meshlet_culling);
+}
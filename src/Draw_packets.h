@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+class Render_queue;
+class Job_system;
+enum class Frustum_culling;
+enum class Meshlet_culling;
+
+// One draw call, of one index range of a queued draw, with all that recording it takes. The
+// changes tell what differs from the packet before it in the stream, so that a recorder only
+// sets that again. Nothing in it is of a graphics API, so the mesh and the index buffer are
+// those of the object at index object in the queue, see Render_queue::mesh and ranges.
+struct Draw_packet
+{
+    enum Change : uint32_t { object_changed = 1, mesh_changed = 2, index_buffer_changed = 4 };
+
+    uint32_t object;
+    // The range of the index buffer, as in Index_range.
+    uint32_t start_index;
+    uint32_t index_count;
+    int base_vertex;
+    // Of the first instance of the draw, see Render_queue.
+    int object_id;
+    int dynamic_transform_ref; // -1 for static objects.
+    int material_id;
+    int instances;
+    uint32_t changes;
+};
+
+// The draws of a render queue as packets, in the order of the queue, which a recorder for a
+// graphics API replays into its command list. The queue is split into parts that are turned
+// into packets in parallel, each into an array of its own, and the arrays are replayed one
+// after the other.
+class Draw_packet_stream
+{
+public:
+    void build(const Render_queue& queue, Frustum_culling frustum_culling,
+        Meshlet_culling meshlet_culling);
+    // Builds it on the given job system instead of on the shared one, e.g. to measure how
+    // the build scales with the number of workers.
+    void build(const Render_queue& queue, Frustum_culling frustum_culling,
+        Meshlet_culling meshlet_culling, Job_system& jobs);
+    // Builds the stream again unless it was built from the same version of the queue, with
+    // the same culling. The passes that draw a queue between two culls of it then share one
+    // build, e.g. the early z pass and the main pass.
+    void update(const Render_queue& queue, Frustum_culling frustum_culling,
+        Meshlet_culling meshlet_culling);
+
+    // Calls recorder.record(packet) for each packet, in order.
+    template <typename Recorder>
+    void replay(Recorder& recorder) const
+    {
+        for (size_t i = 0; i < m_part_count; ++i)
+            for (auto& packet : m_part_packets[i])
+                recorder.record(packet);
+    }
+    size_t size() const { return m_size; }
+
+private:
+    // The arrays of the parts are kept between builds, with their memory, and only the first
+    // m_part_count of them are used.
+    std::vector<std::vector<Draw_packet>> m_part_packets;
+    size_t m_part_count = 0;
+    size_t m_size = 0;
+
+    // What it was last built from.
+    const Render_queue* m_queue = nullptr;
+    unsigned int m_queue_version = 0;
+    Frustum_culling m_frustum_culling;
+    Meshlet_culling m_meshlet_culling;
+};
+
+// Records nothing, but counts what a recorder for a graphics API would set and draw, so that
+// the packet streams can be tested and benchmarked without one.
+struct Null_draw_recorder
+{
+    void record(const Draw_packet& packet)
+    {
+        ++draw_calls;
+        instances += packet.instances;
+        indices += static_cast<size_t>(packet.index_count) * packet.instances;
+        object_changes += (packet.changes & Draw_packet::object_changed) != 0;
+        mesh_changes += (packet.changes & Draw_packet::mesh_changed) != 0;
+        index_buffer_changes += (packet.changes & Draw_packet::index_buffer_changed) != 0;
+    }
+
+    size_t draw_calls = 0;
+    size_t instances = 0;
+    size_t indices = 0;
+    size_t object_changes = 0;
+    size_t mesh_changes = 0;
+    size_t index_buffer_changes = 0;
+};
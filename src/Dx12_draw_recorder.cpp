@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Dx12_draw_recorder.h"
+#include "Draw_packets.h"
+#include "Render_queue.h"
+#include "Scene.h"
+#include "util.h"
+
+
+Dx12_draw_recorder::Dx12_draw_recorder(ID3D12GraphicsCommandList& command_list,
+    const Render_queue& queue, Meshlet_culling meshlet_culling, int root_param_index_of_values,
+    Texture_mapping texture_mapping, Input_layout input_layout) :
+    m_command_list(command_list),
+    m_queue(queue),
+    m_meshlet_culling(meshlet_culling),
+    m_root_param_index_of_values(root_param_index_of_values),
+    m_texture_mapping(texture_mapping),
+    m_input_layout(input_layout)
+{
+    m_command_list.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void Dx12_draw_recorder::record(const Draw_packet& packet)
+{
+    if (packet.changes & Draw_packet::object_changed)
+    {
+        // The shaders find the transform of each instance from these.
+        constexpr UINT size_in_words_of_value = 1;
+        m_command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
+            size_in_words_of_value, &packet.object_id, value_offset_for_object_id());
+
+        m_command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
+            size_in_words_of_value, &packet.dynamic_transform_ref,
+            value_offset_for_dynamic_transform_ref());
+
+        if (m_texture_mapping == Texture_mapping::enabled)
+            m_command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
+                size_in_words_of_value, &packet.material_id, value_offset_for_material_id());
+    }
+
+    if (packet.changes & Draw_packet::mesh_changed)
+    {
+        const Mesh& mesh = m_queue.mesh(packet.object);
+        if (mesh.vertex_format() == Vertex_format::compact)
+        {
+            constexpr UINT size_in_words_of_position_dequantization =
+                sizeof(Position_dequantization) / bytes_per_word;
+            m_command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
+                size_in_words_of_position_dequantization, &mesh.position_dequantization(),
+                value_offset_for_position_dequantization());
+        }
+        mesh.set_vertex_buffers(m_command_list, m_input_layout);
+    }
+
+    if (packet.changes & Draw_packet::index_buffer_changed)
+        m_command_list.IASetIndexBuffer(
+            m_queue.ranges(m_meshlet_culling)[packet.object].index_buffer);
+
+    const Index_range range = { packet.start_index, packet.index_count, packet.base_vertex };
+    constexpr UINT range_count = 1;
+    Mesh::draw(m_command_list, packet.instances, &range, range_count);
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+struct Draw_packet;
+class Render_queue;
+enum class Meshlet_culling;
+enum class Texture_mapping;
+enum class Input_layout;
+
+// Records the draw packets of a Draw_packet_stream into a command list, with the values that
+// the shaders take per draw set as root constants, see Scene.h, and the buffers and the
+// position dequantization of a mesh only set when it changes. The meshes and index buffers
+// are looked up in the queue that the stream was built from, with the same meshlet culling.
+class Dx12_draw_recorder
+{
+public:
+    Dx12_draw_recorder(ID3D12GraphicsCommandList& command_list, const Render_queue& queue,
+        Meshlet_culling meshlet_culling, int root_param_index_of_values,
+        Texture_mapping texture_mapping, Input_layout input_layout);
+    void record(const Draw_packet& packet);
+private:
+    ID3D12GraphicsCommandList& m_command_list;
+    const Render_queue& m_queue;
+    Meshlet_culling m_meshlet_culling;
+    int m_root_param_index_of_values;
+    Texture_mapping m_texture_mapping;
+    Input_layout m_input_layout;
+};
@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Frustum.h"
+
+
+using namespace DirectX;
+
+
+Frustum::Frustum(FXMMATRIX view_projection)
+{
+    // DirectXMath uses row vectors, so the clip coordinates are dot products with the columns.
+    const XMMATRIX m = XMMatrixTranspose(view_projection);
+    const XMVECTOR planes[planes_count] =
+    {
+        m.r[3] + m.r[0], // Left
+        m.r[3] - m.r[0], // Right
+        m.r[3] + m.r[1], // Bottom
+        m.r[3] - m.r[1], // Top
+        m.r[2],          // Near, z is in [0, w] in Direct3D.
+        m.r[3] - m.r[2]  // Far
+    };
+    for (int i = 0; i < planes_count; ++i)
+        XMStoreFloat4(&m_planes[i], XMPlaneNormalize(planes[i]));
+}
+
+bool Frustum::intersects_sphere(FXMVECTOR center, float radius) const
+{
+    const XMVECTOR point = XMVectorSetW(center, 1.0f);
+    for (auto& plane : m_planes)
+        if (XMVectorGetX(XMVector4Dot(XMLoadFloat4(&plane), point)) < -radius)
+            return false;
+    return true;
+}
+
+namespace
+{
+    // The distance from the plane to the center of the box, and how far from the center the
+    // box reaches in the direction of the normal.
+    void distance_and_reach(const XMFLOAT4& plane, const Aabb& box, float& distance,
+        float& reach)
+    {
+        const XMVECTOR min_corner = XMLoadFloat3(&box.min_corner);
+        const XMVECTOR max_corner = XMLoadFloat3(&box.max_corner);
+        const XMVECTOR p = XMLoadFloat4(&plane);
+        distance = XMVectorGetX(XMVector4Dot(p, XMVectorSetW((min_corner + max_corner) * 0.5f,
+            1.0f)));
+        reach = XMVectorGetX(XMVector3Dot(XMVectorAbs(p), (max_corner - min_corner) * 0.5f));
+    }
+}
+
+bool Frustum::intersects_box(const Aabb& box) const
+{
+    for (auto& plane : m_planes)
+    {
+        float distance, reach;
+        distance_and_reach(plane, box, distance, reach);
+        if (distance < -reach)
+            return false;
+    }
+    return true;
+}
+
+bool Frustum::contains_box(const Aabb& box) const
+{
+    for (auto& plane : m_planes)
+    {
+        float distance, reach;
+        distance_and_reach(plane, box, distance, reach);
+        if (distance < reach)
+            return false;
+    }
+    return true;
+}
+
+namespace
+{
+    constexpr size_t boxes_per_batch = 4;
+
+    // Tests the boxes that box_at(i) returns, for i < count, boxes_per_batch at a time. The
+    // last batch is filled up with its last box.
+    template <int planes_count, typename Box_at>
+    void cull(const XMFLOAT4 (&planes)[planes_count], size_t count, Box_at box_at,
+        uint8_t* visible)
+    {
+        // The planes are splatted once, so that each of their components is in all the lanes,
+        // and so are the absolute values of the normals, which the reaches of the boxes need.
+        XMVECTOR splatted_planes[planes_count][4];
+        XMVECTOR splatted_abs_normals[planes_count][3];
+        for (int i = 0; i < planes_count; ++i)
+        {
+            const XMVECTOR plane = XMLoadFloat4(&planes[i]);
+            splatted_planes[i][0] = XMVectorSplatX(plane);
+            splatted_planes[i][1] = XMVectorSplatY(plane);
+            splatted_planes[i][2] = XMVectorSplatZ(plane);
+            splatted_planes[i][3] = XMVectorSplatW(plane);
+            for (int axis = 0; axis < 3; ++axis)
+                splatted_abs_normals[i][axis] = XMVectorAbs(splatted_planes[i][axis]);
+        }
+
+        for (size_t first = 0; first < count; first += boxes_per_batch)
+        {
+            // The centers and extents of the boxes are transposed into a vector of their x
+            // coordinates, one of the y ones and one of the z ones.
+            XMVECTOR centers[boxes_per_batch];
+            XMVECTOR extents[boxes_per_batch];
+            for (size_t lane = 0; lane < boxes_per_batch; ++lane)
+            {
+                const Aabb& box = box_at(std::min(first + lane, count - 1));
+                const XMVECTOR min_corner = XMLoadFloat3(&box.min_corner);
+                const XMVECTOR max_corner = XMLoadFloat3(&box.max_corner);
+                centers[lane] = (min_corner + max_corner) * 0.5f;
+                extents[lane] = (max_corner - min_corner) * 0.5f;
+            }
+            const XMMATRIX c = XMMatrixTranspose(XMMATRIX(centers[0], centers[1], centers[2],
+                centers[3]));
+            const XMMATRIX e = XMMatrixTranspose(XMMATRIX(extents[0], extents[1], extents[2],
+                extents[3]));
+            XMVECTOR outside = XMVectorFalseInt();
+            for (int i = 0; i < planes_count; ++i)
+            {
+                const XMVECTOR* p = splatted_planes[i];
+                const XMVECTOR* n = splatted_abs_normals[i];
+                const XMVECTOR distances = XMVectorMultiplyAdd(c.r[0], p[0],
+                    XMVectorMultiplyAdd(c.r[1], p[1], XMVectorMultiplyAdd(c.r[2], p[2], p[3])));
+                const XMVECTOR reaches = XMVectorMultiplyAdd(e.r[0], n[0],
+                    XMVectorMultiplyAdd(e.r[1], n[1], e.r[2] * n[2]));
+                outside = XMVectorOrInt(outside, XMVectorLess(distances,
+                    XMVectorNegate(reaches)));
+            }
+            XMUINT4 mask;
+            XMStoreUInt4(&mask, outside);
+            const uint32_t lanes[boxes_per_batch] = { mask.x, mask.y, mask.z, mask.w };
+            for (size_t lane = 0; lane < boxes_per_batch && first + lane < count; ++lane)
+                visible[first + lane] = lanes[lane] == 0;
+        }
+    }
+}
+
+void Frustum::cull_boxes(const Aabb* boxes, size_t count, uint8_t* visible) const
+{
+    cull(m_planes, count, [&](size_t i) -> const Aabb& { return boxes[i]; }, visible);
+}
+
+void Frustum::cull_boxes(const Aabb* boxes, const int* indices, size_t count,
+    uint8_t* visible) const
+{
+    cull(m_planes, count, [&](size_t i) -> const Aabb& { return boxes[indices[i]]; },
+        visible);
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+#include "Aabb.h"
+
+
+// The six planes of a view frustum, extracted from a (model) view projection matrix as in
+// "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix" by Gribb
+// and Hartmann, 2001. With a model view projection matrix the planes are in model space.
+class Frustum
+{
+public:
+    explicit Frustum(DirectX::FXMMATRIX view_projection);
+
+    bool intersects_sphere(DirectX::FXMVECTOR center, float radius) const;
+    bool intersects_box(const Aabb& box) const;
+    bool contains_box(const Aabb& box) const;
+    // Sets visible[i] to whether boxes[i] intersects the frustum, as intersects_box does. The
+    // boxes are tested four at a time, one per SIMD lane, which is what the leaves of a Bvh and
+    // the cells of a Loose_grid need.
+    void cull_boxes(const Aabb* boxes, size_t count, uint8_t* visible) const;
+    // The same for boxes[indices[i]].
+    void cull_boxes(const Aabb* boxes, const int* indices, size_t count,
+        uint8_t* visible) const;
+
+private:
+    static constexpr int planes_count = 6;
+    // Normalized, with the normals pointing into the frustum.
+    DirectX::XMFLOAT4 m_planes[planes_count];
+};
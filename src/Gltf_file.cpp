@@ -0,0 +1,844 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Gltf_file.h"
+#include "Compressed_file.h"
+#include "Memory_mapped_file.h"
+#include "Tangent_space.h"
+#include "util.h"
+
+#include <cctype>
+#include <charconv>
+#include <cstring>
+
+
+using namespace DirectX;
+using DirectX::PackedVector::XMConvertFloatToHalf;
+using DirectX::PackedVector::XMHALF4;
+using std::map;
+using std::string;
+using std::vector;
+
+
+namespace
+{
+    // A JSON value, with just enough of JSON for the glTF chunk. Members that are missing
+    // are null, so that optional properties can be looked up without checking every step.
+    struct Json
+    {
+        enum class Type { null, boolean, number, string, array, object };
+
+        const Json& operator[](const char* key) const
+        {
+            for (size_t i = 0; i < member_names.size(); ++i)
+                if (member_names[i] == key)
+                    return elements[i];
+            return null_value();
+        }
+
+        // Negative indices, like from int_or(-1) for a missing index, give null.
+        const Json& operator[](int i) const
+        {
+            return type == Type::array && i >= 0 && static_cast<size_t>(i) < elements.size() ?
+                elements[i] : null_value();
+        }
+
+        bool is_null() const { return type == Type::null; }
+        size_t size() const { return type == Type::array ? elements.size() : 0; }
+
+        double number_or(double default_value) const
+        {
+            return type == Type::number ? number : default_value;
+        }
+
+        int int_or(int default_value) const
+        {
+            return type == Type::number ? static_cast<int>(number) : default_value;
+        }
+
+        static const Json& null_value()
+        {
+            static const Json null;
+            return null;
+        }
+
+        Type type = Type::null;
+        bool boolean = false;
+        double number = 0.0;
+        string text;
+        vector<Json> elements; // The values of arrays and objects.
+        vector<string> member_names;
+    };
+
+    class Json_parser
+    {
+    public:
+        Json_parser(const char* begin, const char* end, const string& filename) :
+            m_position(begin), m_end(end), m_filename(filename) {}
+
+        Json parse()
+        {
+            Json value = parse_value(0);
+            skip_whitespace();
+            if (m_position != m_end)
+                error();
+            return value;
+        }
+
+    private:
+        // Deeper than this is not a sensible glTF file, and it keeps the stack bounded.
+        static constexpr int max_depth = 64;
+
+        [[noreturn]] void error() const
+        {
+            throw Gltf_read_error(m_filename, "invalid JSON");
+        }
+
+        void skip_whitespace()
+        {
+            while (m_position < m_end && (*m_position == ' ' || *m_position == '\t' ||
+                *m_position == '\n' || *m_position == '\r'))
+                ++m_position;
+        }
+
+        void expect(char c)
+        {
+            skip_whitespace();
+            if (m_position == m_end || *m_position != c)
+                error();
+            ++m_position;
+        }
+
+        bool next_is(char c)
+        {
+            skip_whitespace();
+            return m_position < m_end && *m_position == c;
+        }
+
+        bool skip_literal(const char* literal)
+        {
+            const size_t length = std::strlen(literal);
+            if (static_cast<size_t>(m_end - m_position) < length ||
+                std::memcmp(m_position, literal, length) != 0)
+                return false;
+            m_position += length;
+            return true;
+        }
+
+        Json parse_value(int depth)
+        {
+            if (depth > max_depth)
+                error();
+            skip_whitespace();
+            if (m_position == m_end)
+                error();
+
+            Json value;
+            switch (*m_position)
+            {
+                case '{':
+                    value.type = Json::Type::object;
+                    ++m_position;
+                    if (next_is('}'))
+                    {
+                        ++m_position;
+                        break;
+                    }
+                    for (;;)
+                    {
+                        skip_whitespace();
+                        value.member_names.push_back(parse_string());
+                        expect(':');
+                        value.elements.push_back(parse_value(depth + 1));
+                        if (!next_is(','))
+                            break;
+                        ++m_position;
+                    }
+                    expect('}');
+                    break;
+                case '[':
+                    value.type = Json::Type::array;
+                    ++m_position;
+                    if (next_is(']'))
+                    {
+                        ++m_position;
+                        break;
+                    }
+                    for (;;)
+                    {
+                        value.elements.push_back(parse_value(depth + 1));
+                        if (!next_is(','))
+                            break;
+                        ++m_position;
+                    }
+                    expect(']');
+                    break;
+                case '"':
+                    value.type = Json::Type::string;
+                    value.text = parse_string();
+                    break;
+                default:
+                    if (skip_literal("true"))
+                    {
+                        value.type = Json::Type::boolean;
+                        value.boolean = true;
+                    }
+                    else if (skip_literal("false"))
+                        value.type = Json::Type::boolean;
+                    else if (!skip_literal("null"))
+                    {
+                        value.type = Json::Type::number;
+                        auto result = std::from_chars(m_position, m_end, value.number);
+                        if (result.ec != std::errc())
+                            error();
+                        m_position = result.ptr;
+                    }
+            }
+            return value;
+        }
+
+        string parse_string()
+        {
+            if (m_position == m_end || *m_position != '"')
+                error();
+            ++m_position;
+            string text;
+            while (m_position < m_end && *m_position != '"')
+            {
+                char c = *m_position++;
+                if (c == '\\')
+                {
+                    if (m_position == m_end)
+                        error();
+                    c = *m_position++;
+                    switch (c)
+                    {
+                        case 'b': c = '\b'; break;
+                        case 'f': c = '\f'; break;
+                        case 'n': c = '\n'; break;
+                        case 'r': c = '\r'; break;
+                        case 't': c = '\t'; break;
+                        case 'u':
+                        {
+                            // Only used for names here, so anything outside of ASCII is
+                            // replaced.
+                            unsigned int code = 0;
+                            if (m_end - m_position < 4 || std::from_chars(m_position,
+                                m_position + 4, code, 16).ptr != m_position + 4)
+                                error();
+                            m_position += 4;
+                            c = code < 0x80 ? static_cast<char>(code) : '_';
+                            break;
+                        }
+                        default: break; // '"', '\\' and '/' are themselves.
+                    }
+                }
+                text += c;
+            }
+            if (m_position == m_end)
+                error();
+            ++m_position;
+            return text;
+        }
+
+        const char* m_position;
+        const char* m_end;
+        const string& m_filename;
+    };
+
+
+    constexpr uint32_t glb_magic = 0x46546C67;        // "glTF"
+    constexpr uint32_t glb_version = 2;
+    constexpr uint32_t json_chunk_type = 0x4E4F534A;  // "JSON"
+    constexpr uint32_t binary_chunk_type = 0x004E4942; // "BIN\0"
+    constexpr size_t glb_header_size = 12;
+    constexpr size_t chunk_header_size = 8;
+
+    namespace Component_type
+    {
+        constexpr int byte = 5120;
+        constexpr int unsigned_byte = 5121;
+        constexpr int short_ = 5122;
+        constexpr int unsigned_short = 5123;
+        constexpr int unsigned_int = 5125;
+        constexpr int float_ = 5126;
+    }
+
+    constexpr int triangles_mode = 4;
+
+    uint32_t read_uint32(const char* p)
+    {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    struct Gltf
+    {
+        Json json;
+        const char* binary;
+        size_t binary_size;
+        const string& filename;
+    };
+
+    [[noreturn]] void error(const Gltf& gltf, const string& reason)
+    {
+        throw Gltf_read_error(gltf.filename, reason);
+    }
+
+    // The elements of an accessor, read in place from the binary chunk.
+    struct Accessor_view
+    {
+        const char* data; // The first element.
+        size_t count;
+        size_t stride;
+        int component_type;
+        int component_count;
+        bool normalized;
+    };
+
+    size_t component_size(int component_type)
+    {
+        switch (component_type)
+        {
+            case Component_type::byte:
+            case Component_type::unsigned_byte:
+                return 1;
+            case Component_type::short_:
+            case Component_type::unsigned_short:
+                return 2;
+            case Component_type::unsigned_int:
+            case Component_type::float_:
+                return 4;
+            default:
+                return 0;
+        }
+    }
+
+    int component_count(const string& type)
+    {
+        if (type == "SCALAR")
+            return 1;
+        if (type == "VEC2")
+            return 2;
+        if (type == "VEC3")
+            return 3;
+        if (type == "VEC4")
+            return 4;
+        return 0;
+    }
+
+    Accessor_view accessor_view(const Gltf& gltf, int index)
+    {
+        const Json& accessor = gltf.json["accessors"][index];
+        if (accessor.is_null())
+            error(gltf, "accessor " + std::to_string(index) + " not defined");
+        if (!accessor["sparse"].is_null())
+            error(gltf, "sparse accessors are not supported");
+
+        Accessor_view view;
+        view.count = static_cast<size_t>(accessor["count"].number_or(0));
+        view.component_type = accessor["componentType"].int_or(0);
+        view.component_count = component_count(accessor["type"].text);
+        view.normalized = accessor["normalized"].boolean;
+        const size_t element_size = component_size(view.component_type) *
+            view.component_count;
+        if (element_size == 0)
+            error(gltf, "accessor " + std::to_string(index) + " has an unsupported type");
+
+        const Json& buffer_view = gltf.json["bufferViews"][accessor["bufferView"].int_or(-1)];
+        if (buffer_view.is_null())
+            error(gltf, "accessor " + std::to_string(index) + " has no buffer view");
+        if (buffer_view["buffer"].int_or(0) != 0)
+            error(gltf, "only the binary chunk of the glb file is supported as buffer");
+
+        const size_t view_offset = static_cast<size_t>(buffer_view["byteOffset"].number_or(0));
+        const size_t view_length = static_cast<size_t>(buffer_view["byteLength"].number_or(0));
+        const size_t offset = static_cast<size_t>(accessor["byteOffset"].number_or(0));
+        view.stride = static_cast<size_t>(buffer_view["byteStride"].number_or(0));
+        if (view.stride == 0)
+            view.stride = element_size; // Tightly packed.
+
+        // Both the view and the elements have to fit, so that nothing is read outside of the
+        // file, whatever it contains.
+        bool inside = view_offset <= gltf.binary_size &&
+            view_length <= gltf.binary_size - view_offset && view.stride >= element_size;
+        if (inside && view.count != 0)
+            inside = offset <= view_length && element_size <= view_length - offset &&
+                view.count - 1 <= (view_length - offset - element_size) / view.stride;
+        if (!inside)
+            error(gltf, "accessor " + std::to_string(index) + " is outside of its buffer");
+
+        view.data = gltf.binary + view_offset + offset;
+        return view;
+    }
+
+    float read_component(const char* p, int component_type, bool normalized)
+    {
+        switch (component_type)
+        {
+            case Component_type::float_:
+            {
+                float value;
+                std::memcpy(&value, p, sizeof(value));
+                return value;
+            }
+            case Component_type::unsigned_byte:
+            {
+                const float value = static_cast<uint8_t>(*p);
+                return normalized ? value / 255.0f : value;
+            }
+            case Component_type::byte:
+            {
+                const float value = static_cast<int8_t>(*p);
+                return normalized ? std::max(value / 127.0f, -1.0f) : value;
+            }
+            case Component_type::unsigned_short:
+            {
+                uint16_t value;
+                std::memcpy(&value, p, sizeof(value));
+                return normalized ? value / 65535.0f : value;
+            }
+            case Component_type::short_:
+            {
+                int16_t value;
+                std::memcpy(&value, p, sizeof(value));
+                return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+            }
+            default:
+                return static_cast<float>(read_uint32(p));
+        }
+    }
+
+    // Reads the components of element i into the first lanes of the vector, the rest keep
+    // the values that they have in defaults.
+    XMVECTOR read_element(const Accessor_view& view, size_t i, FXMVECTOR defaults)
+    {
+        XMFLOAT4 element;
+        XMStoreFloat4(&element, defaults);
+        float* components = &element.x;
+        const char* p = view.data + i * view.stride;
+        const size_t size = component_size(view.component_type);
+        for (int c = 0; c < view.component_count && c < 4; ++c)
+            components[c] = read_component(p + c * size, view.component_type,
+                view.normalized);
+        return XMLoadFloat4(&element);
+    }
+
+    uint32_t read_index(const Accessor_view& view, size_t i)
+    {
+        const char* p = view.data + i * view.stride;
+        switch (view.component_type)
+        {
+            case Component_type::unsigned_byte:
+                return static_cast<uint8_t>(*p);
+            case Component_type::unsigned_short:
+            {
+                uint16_t value;
+                std::memcpy(&value, p, sizeof(value));
+                return value;
+            }
+            default:
+                return read_uint32(p);
+        }
+    }
+
+    Accessor_view attribute(const Gltf& gltf, const Json& primitive, const char* name)
+    {
+        const Json& index = primitive["attributes"][name];
+        if (index.is_null())
+            return Accessor_view();
+        return accessor_view(gltf, index.int_or(-1));
+    }
+
+    // Decodes the percent encoding of URIs, e.g. %20 for space.
+    string decoded_uri(const string& uri)
+    {
+        string result;
+        for (size_t i = 0; i < uri.size(); ++i)
+        {
+            unsigned int code = 0;
+            if (uri[i] == '%' && i + 2 < uri.size() && std::from_chars(&uri[i + 1],
+                &uri[i + 3], code, 16).ptr == &uri[i + 3])
+            {
+                result += static_cast<char>(code);
+                i += 2;
+            }
+            else
+                result += uri[i];
+        }
+        return result;
+    }
+
+    // Returns the file of the image that the texture uses, or an empty string if there is
+    // none that is supported.
+    string texture_file(const Gltf& gltf, const Json& texture_info,
+        const string& texture_directory)
+    {
+        if (texture_info.is_null())
+            return "";
+        const Json& texture = gltf.json["textures"][texture_info["index"].int_or(-1)];
+        const Json& image = gltf.json["images"][texture["source"].int_or(-1)];
+        const string& uri = image["uri"].text;
+        if (uri.empty() || uri.compare(0, 5, "data:") == 0)
+        {
+            log(gltf.filename + ": only images in separate files are supported, a texture "
+                "is ignored");
+            return "";
+        }
+        return texture_directory + decoded_uri(uri);
+    }
+
+    // Returns the names that the materials got in materials, in the order of the file.
+    vector<string> read_materials(const Gltf& gltf, const string& texture_directory,
+        map<string, Material>& materials)
+    {
+        using namespace Material_settings;
+
+        vector<string> names;
+        const Json& gltf_materials = gltf.json["materials"];
+        for (size_t i = 0; i < gltf_materials.size(); ++i)
+        {
+            const Json& m = gltf_materials[i];
+            const Json& pbr = m["pbrMetallicRoughness"];
+            Material material = { "", "", "", 0, -1 };
+
+            material.diffuse_map = texture_file(gltf, pbr["baseColorTexture"],
+                texture_directory);
+            if (!material.diffuse_map.empty())
+                material.settings |= diffuse_map_exists;
+
+            material.normal_map = texture_file(gltf, m["normalTexture"], texture_directory);
+            if (!material.normal_map.empty())
+                material.settings |= normal_map_exists;
+
+            material.ao_roughness_metalness_map = texture_file(gltf,
+                pbr["metallicRoughnessTexture"], texture_directory);
+            if (!material.ao_roughness_metalness_map.empty())
+            {
+                material.settings |= aorm_map_exists;
+                if (texture_file(gltf, m["occlusionTexture"], texture_directory) ==
+                    material.ao_roughness_metalness_map)
+                    material.settings |= use_ao_in_aorm_map;
+            }
+
+            const string& alpha_mode = m["alphaMode"].text;
+            if (alpha_mode == "BLEND")
+                material.settings |= transparency;
+            else if (alpha_mode == "MASK")
+                material.settings |= alpha_cut_out;
+            if (m["doubleSided"].boolean)
+                material.settings |= two_sided;
+            const Json& emissive_factor = m["emissiveFactor"];
+            for (size_t c = 0; c < emissive_factor.size(); ++c)
+                if (emissive_factor[c].number_or(0) != 0.0)
+                    material.settings |= emissive;
+
+            // The names are optional and don't have to be unique in glTF.
+            string name = m["name"].text.empty() ? "material_" + std::to_string(i) :
+                m["name"].text;
+            if (materials.find(name) != materials.end())
+                name += "_" + std::to_string(i);
+            materials[name] = material;
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    // Area weighted normals, for primitives without them.
+    vector<XMVECTOR> calculate_normals(const Vertices& vertices, const vector<int>& indices)
+    {
+        vector<XMVECTOR> normals(vertices.positions.size(), XMVectorZero());
+        for (size_t i = 0; i + vertex_count_per_face <= indices.size();
+            i += vertex_count_per_face)
+        {
+            const XMVECTOR p0 = XMLoadFloat4(&vertices.positions[indices[i]]);
+            const XMVECTOR p1 = XMLoadFloat4(&vertices.positions[indices[i + 1]]);
+            const XMVECTOR p2 = XMLoadFloat4(&vertices.positions[indices[i + 2]]);
+            const XMVECTOR normal = XMVector3Cross(XMVectorSetW(p1 - p0, 0.0f),
+                XMVectorSetW(p2 - p0, 0.0f));
+            for (int c = 0; c < vertex_count_per_face; ++c)
+                normals[indices[i + c]] += normal;
+        }
+        for (auto& n : normals)
+            n = XMVector3Normalize(n);
+        return normals;
+    }
+
+    // Returns false if the primitive is not a triangle list, and is skipped.
+    bool read_primitive(const Gltf& gltf, const Json& primitive, FXMMATRIX transform,
+        const vector<string>& material_names, Obj_object& object)
+    {
+        if (primitive["mode"].int_or(triangles_mode) != triangles_mode)
+            return false;
+
+        const Accessor_view positions = attribute(gltf, primitive, "POSITION");
+        if (positions.count == 0)
+            return false;
+        const Accessor_view normals = attribute(gltf, primitive, "NORMAL");
+        const Accessor_view tangents = attribute(gltf, primitive, "TANGENT");
+        const Accessor_view texture_coords = attribute(gltf, primitive, "TEXCOORD_0");
+        const Accessor_view colors = attribute(gltf, primitive, "COLOR_0");
+        const size_t vertex_count = positions.count;
+        for (auto view : { &normals, &tangents, &texture_coords, &colors })
+            if (view->count != 0 && view->count != vertex_count)
+                error(gltf, "the attributes of a primitive have different counts");
+
+        // Mirroring transforms turn the triangles inside out, and the handedness of the
+        // tangent space with them.
+        XMVECTOR determinant;
+        const XMMATRIX normal_transform = XMMatrixTranspose(XMMatrixInverse(&determinant,
+            transform));
+        const bool mirrored = XMVectorGetX(determinant) < 0.0f;
+
+        vector<int>& indices = object.indices;
+        const Json& indices_accessor = primitive["indices"];
+        if (indices_accessor.is_null())
+        {
+            indices.resize(vertex_count);
+            for (size_t i = 0; i < vertex_count; ++i)
+                indices[i] = static_cast<int>(i);
+        }
+        else
+        {
+            const Accessor_view view = accessor_view(gltf, indices_accessor.int_or(-1));
+            if (view.component_count != 1 || view.component_type == Component_type::float_)
+                error(gltf, "invalid indices");
+            indices.resize(view.count);
+            for (size_t i = 0; i < view.count; ++i)
+            {
+                const uint32_t index = read_index(view, i);
+                if (index >= vertex_count)
+                    error(gltf, "index outside of the vertices");
+                indices[i] = static_cast<int>(index);
+            }
+        }
+        indices.resize(indices.size() / vertex_count_per_face * vertex_count_per_face);
+        if (mirrored)
+            for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+                std::swap(indices[i + 1], indices[i + 2]);
+
+        Vertices& vertices = object.vertices;
+        vertices.positions.resize(vertex_count);
+        vertices.normals.resize(vertex_count);
+        const XMVECTOR zero = XMVectorZero();
+        for (size_t i = 0; i < vertex_count; ++i)
+        {
+            const XMVECTOR position = XMVector3TransformCoord(read_element(positions, i, zero),
+                transform);
+            const XMVECTOR uv = texture_coords.count ? read_element(texture_coords, i, zero) :
+                zero;
+            XMStoreFloat4(&vertices.positions[i], XMVectorSetW(position, XMVectorGetX(uv)));
+            vertices.normals[i].w = XMConvertFloatToHalf(XMVectorGetY(uv));
+        }
+
+        vector<XMVECTOR> vertex_normals;
+        if (normals.count)
+        {
+            vertex_normals.resize(vertex_count);
+            for (size_t i = 0; i < vertex_count; ++i)
+                vertex_normals[i] = XMVector3Normalize(XMVector3TransformNormal(
+                    read_element(normals, i, zero), normal_transform));
+        }
+        else
+            vertex_normals = calculate_normals(vertices, indices);
+        for (size_t i = 0; i < vertex_count; ++i)
+        {
+            const XMHALF4 n = convert_vector_to_half4(vertex_normals[i]);
+            vertices.normals[i].x = n.x;
+            vertices.normals[i].y = n.y;
+            vertices.normals[i].z = n.z;
+        }
+
+        if (tangents.count && normals.count)
+        {
+            // The bitangent is defined by the handedness in w, see the specification.
+            vertices.tangents.resize(vertex_count);
+            vertices.bitangents.resize(vertex_count);
+            const XMVECTOR one = XMVectorSet(0, 0, 0, 1);
+            for (size_t i = 0; i < vertex_count; ++i)
+            {
+                const XMVECTOR t = read_element(tangents, i, one);
+                const XMVECTOR tangent = XMVector3Normalize(XMVector3TransformNormal(t,
+                    transform));
+                const float handedness = (XMVectorGetW(t) < 0.0f) != mirrored ? -1.0f : 1.0f;
+                const XMVECTOR bitangent = XMVector3Cross(vertex_normals[i], tangent) *
+                    handedness;
+                vertices.tangents[i] = convert_vector_to_half4(XMVectorSetW(tangent, 0.0f));
+                vertices.bitangents[i] = convert_vector_to_half4(XMVectorSetW(bitangent, 0.0f));
+            }
+        }
+        else
+        {
+            // The normal maps of glTF have y up in the texture, i.e. towards decreasing v,
+            // while the calculated bitangents follow increasing v, so they are flipped.
+            calculate_vertex_tangents(vertices, indices, 1);
+            for (auto& b : vertices.bitangents)
+                b = convert_vector_to_half4(-convert_half4_to_vector(b));
+        }
+
+        if (colors.count)
+        {
+            vertices.colors.resize(vertex_count);
+            const XMVECTOR opaque = XMVectorSet(0, 0, 0, 1);
+            for (size_t i = 0; i < vertex_count; ++i)
+                vertices.colors[i] = convert_vector_to_half4(read_element(colors, i, opaque));
+        }
+
+        const int material = primitive["material"].int_or(-1);
+        if (material >= 0 && static_cast<size_t>(material) < material_names.size())
+            object.material = material_names[material];
+        return true;
+    }
+
+    XMMATRIX local_transform(const Json& node)
+    {
+        const Json& matrix = node["matrix"];
+        if (matrix.size() == 16)
+        {
+            // glTF matrices are column major for column vectors, which is the same memory
+            // layout as the row major matrices for row vectors of DirectXMath.
+            XMFLOAT4X4 m;
+            for (int i = 0; i < 16; ++i)
+                m.m[i / 4][i % 4] = static_cast<float>(matrix[i].number_or(0));
+            return XMLoadFloat4x4(&m);
+        }
+
+        auto vector_or = [](const Json& v, XMFLOAT4 value)
+        {
+            float* components = &value.x;
+            for (size_t i = 0; i < v.size() && i < 4; ++i)
+                components[i] = static_cast<float>(v[i].number_or(0));
+            return XMLoadFloat4(&value);
+        };
+        const XMVECTOR scale = vector_or(node["scale"], { 1, 1, 1, 0 });
+        const XMVECTOR rotation = vector_or(node["rotation"], { 0, 0, 0, 1 });
+        const XMVECTOR translation = vector_or(node["translation"], { 0, 0, 0, 0 });
+        return XMMatrixScalingFromVector(scale) * XMMatrixRotationQuaternion(rotation) *
+            XMMatrixTranslationFromVector(translation);
+    }
+
+    void read_mesh(const Gltf& gltf, int mesh_index, FXMMATRIX transform,
+        const vector<string>& material_names, vector<Obj_object>& objects)
+    {
+        const Json& primitives = gltf.json["meshes"][mesh_index]["primitives"];
+        for (size_t i = 0; i < primitives.size(); ++i)
+        {
+            Obj_object object;
+            if (read_primitive(gltf, primitives[i], transform, material_names, object))
+                objects.push_back(std::move(object));
+        }
+    }
+
+    void read_node(const Gltf& gltf, int node_index, FXMMATRIX parent_transform,
+        const vector<string>& material_names, vector<Obj_object>& objects, size_t depth)
+    {
+        const Json& node = gltf.json["nodes"][node_index];
+        if (node.is_null() || depth > gltf.json["nodes"].size()) // Only possible with a cycle.
+            error(gltf, "invalid node hierarchy");
+
+        const XMMATRIX transform = local_transform(node) * parent_transform;
+        if (!node["mesh"].is_null())
+            read_mesh(gltf, node["mesh"].int_or(-1), transform, material_names, objects);
+        const Json& children = node["children"];
+        for (size_t i = 0; i < children.size(); ++i)
+            read_node(gltf, children[i].int_or(-1), transform, material_names, objects,
+                depth + 1);
+    }
+}
+
+vector<Obj_object> read_glb_objects(const char* begin, const char* end,
+    const string& texture_directory, map<string, Material>& materials,
+    const string& filename/* = ""*/)
+{
+    const size_t size = end - begin;
+    if (size < glb_header_size + chunk_header_size || read_uint32(begin) != glb_magic)
+        throw Gltf_read_error(filename, "not a glb file");
+    if (read_uint32(begin + 4) != glb_version)
+        throw Gltf_read_error(filename, "only glTF 2.0 is supported");
+
+    // The JSON chunk comes first, and then the optional binary chunk.
+    const char* json_chunk = begin + glb_header_size;
+    const size_t json_size = read_uint32(json_chunk);
+    if (read_uint32(json_chunk + 4) != json_chunk_type ||
+        json_size > size - glb_header_size - chunk_header_size)
+        throw Gltf_read_error(filename, "invalid JSON chunk");
+    const char* json_begin = json_chunk + chunk_header_size;
+    const char* json_end = json_begin + json_size;
+
+    Gltf gltf = { Json_parser(json_begin, json_end, filename).parse(), nullptr, 0, filename };
+    if (static_cast<size_t>(end - json_end) >= chunk_header_size &&
+        read_uint32(json_end + 4) == binary_chunk_type)
+    {
+        gltf.binary = json_end + chunk_header_size;
+        gltf.binary_size = std::min<size_t>(read_uint32(json_end),
+            end - json_end - chunk_header_size);
+    }
+    if (!gltf.json["buffers"][0]["uri"].is_null())
+        error(gltf, "only the binary chunk of the glb file is supported as buffer");
+
+    const vector<string> material_names = read_materials(gltf, texture_directory, materials);
+
+    vector<Obj_object> objects;
+    const Json& scenes = gltf.json["scenes"];
+    if (scenes.size() == 0)
+    {
+        // Without scenes, the meshes are not placed anywhere, so they are all used as they
+        // are.
+        for (size_t i = 0; i < gltf.json["meshes"].size(); ++i)
+            read_mesh(gltf, static_cast<int>(i), XMMatrixIdentity(), material_names, objects);
+    }
+    else
+    {
+        const Json& nodes = scenes[gltf.json["scene"].int_or(0)]["nodes"];
+        for (size_t i = 0; i < nodes.size(); ++i)
+            read_node(gltf, nodes[i].int_or(-1), XMMatrixIdentity(), material_names, objects,
+                0);
+    }
+    return objects;
+}
+
+vector<Obj_object> read_glb_objects(const string& filename, const string& texture_directory,
+    map<string, Material>& materials)
+{
+    vector<Obj_object> objects;
+    if (is_compressed_file(filename))
+    {
+        // The accessors can refer to anywhere in the binary chunk, so unlike the text formats
+        // a compressed file is decompressed into memory as a whole.
+        auto file = open_input_file(filename);
+        if (!*file)
+            throw Gltf_read_error(filename, "could not open the file");
+        const vector<char> data((std::istreambuf_iterator<char>(*file)),
+            std::istreambuf_iterator<char>());
+        objects = read_glb_objects(data.data(), data.data() + data.size(), texture_directory,
+            materials, filename);
+    }
+    else
+    {
+        Memory_mapped_file file(filename);
+        if (!file.is_open())
+            throw Gltf_read_error(filename, "could not open the file");
+        objects = read_glb_objects(file.begin(), file.end(), texture_directory, materials,
+            filename);
+    }
+
+    const int thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    prepare_objects_for_rendering(objects, materials, thread_count, filename);
+    return objects;
+}
+
+bool is_glb_file(const string& filename)
+{
+    const string extension = ".glb";
+    if (filename.size() < extension.size())
+        return false;
+    return std::equal(extension.begin(), extension.end(),
+        filename.end() - extension.size(), [](char a, char b)
+        { return a == std::tolower(static_cast<unsigned char>(b)); });
+}
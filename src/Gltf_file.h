@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Wavefront_obj_file.h"
+
+
+// Read binary glTF 2.0 files (.glb).
+// See https://www.khronos.org/registry/glTF/specs/2.0/glTF-2.0.html
+//
+// The file is memory mapped and the vertex data is read directly from the binary chunk, through
+// the accessors and buffer views, without any intermediate copies or text parsing. The result
+// is the same kind of objects as from Obj files, one per mesh primitive, so that they share the
+// rest of the pipeline, see create_model_collection.
+//
+// The meshes are placed as in the default scene, with the transforms of the nodes baked into
+// the vertices. Only triangle lists are read, and only the first texture coordinates and
+// colors. Skins, morph targets, animations and cameras are ignored. The texture coordinates
+// are used as they are, since glTF has the origin at the top left, like Direct3D.
+//
+// The materials are mapped to the Material settings:
+//   baseColorTexture                -> diffuse_map
+//   normalTexture                   -> normal_map
+//   metallicRoughnessTexture        -> ao_roughness_metalness_map, which has roughness in
+//                                      green and metalness in blue, like map_ORM. The ambient
+//                                      occlusion in red is used when occlusionTexture is the
+//                                      same image.
+//   alphaMode BLEND / MASK          -> transparency / alpha_cut_out
+//   doubleSided                     -> two_sided
+//   emissiveFactor                  -> emissive, if it is not black
+// Only images that refer to files are supported, and the texture names are those files,
+// relative to the glb file and prefixed with texture_directory.
+
+struct Gltf_read_error
+{
+    Gltf_read_error(const std::string& file_name_, const std::string& reason_) :
+        file_name(file_name_), reason(reason_) {}
+    std::string file_name;
+    std::string reason;
+};
+
+// Reads, optimizes and generates levels of detail for the objects of the file, like
+// read_obj_objects. The file can be compressed (.glb.gz), see Compressed_file.h. Throws
+// Gltf_read_error if the file is not valid or uses something that is not supported.
+std::vector<Obj_object> read_glb_objects(const std::string& filename,
+    const std::string& texture_directory, std::map<std::string, Material>& materials);
+
+// Reads the file in the memory range [begin, end), without optimizing the objects. The file
+// name is only used in the errors.
+std::vector<Obj_object> read_glb_objects(const char* begin, const char* end,
+    const std::string& texture_directory, std::map<std::string, Material>& materials,
+    const std::string& filename = "");
+
+// Whether the model file should be read with read_glb_objects, i.e. if it ends with .glb.
+bool is_glb_file(const std::string& filename);
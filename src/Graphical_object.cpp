@@ -8,6 +8,9 @@
 #include "pch.h"
 #include "Graphical_object.h"
 #include "Mesh.h"
+#include "Meshlets.h"
+#include "Mesh_simplifier.h"
+#include "Frustum.h"
 #include "Primitives.h"
 #include "util.h"
 
@@ -41,28 +44,64 @@ Graphical_object::Graphical_object(ID3D12Device& device,
     m_dynamic_transform_ref(dynamic_transform_ref),
     m_instances(instances),
     m_material_id(material_id),
-    m_triangle_index(0)
+    m_meshlets_culled(false),
+    m_lod(0),
+    m_sorted_index_buffer(0),
+    m_sorted_range()
 {
 }
 
 Graphical_object::Graphical_object(std::shared_ptr<Mesh> mesh, 
     const std::vector<std::shared_ptr<Texture>>& textures,
-    int id, int material_id, int dynamic_transform_ref, int instances/* = 1*/,
-    int triangle_index/* = 0*/) :
+    int id, int material_id, int dynamic_transform_ref, int instances/* = 1*/) :
     m_mesh(mesh),
     m_textures(textures),
     m_id(id),
     m_dynamic_transform_ref(dynamic_transform_ref),
     m_instances(instances),
     m_material_id(material_id),
-    m_triangle_index(triangle_index)
+    m_meshlets_culled(false),
+    m_lod(0),
+    m_sorted_index_buffer(0),
+    m_sorted_range()
 {
 }
 
 void Graphical_object::draw(ID3D12GraphicsCommandList& command_list,
-    Input_layout input_layout) const
+    Input_layout input_layout, Meshlet_culling meshlet_culling/* = Meshlet_culling::disabled*/)
+    const
 {
-    m_mesh->draw(command_list, m_instances, input_layout, m_triangle_index);
+    const Draw_ranges ranges = draw_ranges(meshlet_culling);
+    m_mesh->set_vertex_buffers(command_list, input_layout);
+    command_list.IASetIndexBuffer(ranges.index_buffer);
+    Mesh::draw(command_list, m_instances, ranges.ranges, ranges.range_count);
+}
+
+Draw_ranges Graphical_object::draw_ranges(Meshlet_culling meshlet_culling) const
+{
+    // The sorted triangles are indices of the vertex buffer as it is, i.e. without a base
+    // vertex. See Mesh::triangle_indices.
+    if (!m_sorted_index_buffers.empty())
+        return { &m_sorted_index_buffers[m_sorted_index_buffer]->view(), &m_sorted_range, 1 };
+
+    const bool culled = meshlet_culling == Meshlet_culling::enabled && m_meshlets_culled;
+    const std::vector<Index_range>& ranges = m_lod == 0 && culled ? m_visible_meshlet_ranges :
+        m_mesh->lod_ranges(m_lod);
+    return { &m_mesh->index_buffer_view(), ranges.data(), static_cast<UINT>(ranges.size()) };
+}
+
+void Graphical_object::cull_meshlets(DirectX::FXMMATRIX model_view_projection,
+    DirectX::FXMVECTOR eye, Backface_culling backface_culling)
+{
+    m_meshlets_culled = m_instances == 1 && m_lod == 0 && !m_mesh->meshlets().empty();
+    if (m_meshlets_culled)
+        ::cull_meshlets(m_mesh->meshlets(), Frustum(model_view_projection), eye,
+            backface_culling, m_visible_meshlet_ranges);
+}
+
+void Graphical_object::select_lod(float pixels_per_unit)
+{
+    m_lod = ::select_lod(m_mesh->lod_errors(), pixels_per_unit, m_lod);
 }
 
 void Graphical_object::release_temp_resources()
@@ -90,5 +129,60 @@ DirectX::XMVECTOR Graphical_object::center() const
 void Graphical_object::transform_center(DirectX::XMMATRIX model_view)
 {
     XMStoreFloat3(&m_transformed_center,
-        DirectX::XMVector3Transform(m_mesh->center(m_triangle_index), model_view));
+        DirectX::XMVector3Transform(m_mesh->center(), model_view));
+}
+
+void Graphical_object::create_sorted_index_buffers(ID3D12Device& device,
+    UINT swap_chain_buffer_count)
+{
+    const auto& indices = m_mesh->triangle_indices();
+    if (indices.empty()) // Not a transparent mesh.
+        return;
+
+    m_triangle_sorter = std::make_unique<Triangle_sorter>(m_mesh->triangle_centers());
+    const UINT index_count = static_cast<UINT>(indices.size());
+    const size_t vertex_count = m_mesh->vertices_count();
+    for (UINT i = 0; i < swap_chain_buffer_count; ++i)
+        m_sorted_index_buffers.push_back(std::make_unique<Dynamic_index_buffer>(device,
+            index_count, vertex_count));
+
+    m_sorted_range = { 0, index_count, 0 };
+    if (Dynamic_index_buffer::index_size(vertex_count) == sizeof(uint16_t))
+        m_sorted_indices_16.resize(index_count);
+    else
+        m_sorted_indices_32.resize(index_count);
+
+    // Until the first sort, the triangles are in the order of the mesh.
+    std::vector<UINT> order(m_triangle_sorter->triangle_count());
+    for (UINT i = 0; i < order.size(); ++i)
+        order[i] = i;
+    if (m_sorted_indices_16.empty())
+        write_triangles_in_order(order, indices, m_sorted_indices_32.data());
+    else
+        write_triangles_in_order(order, indices, m_sorted_indices_16.data());
+}
+
+void Graphical_object::sort_triangles_back_to_front(DirectX::FXMMATRIX model_view)
+{
+    if (!m_triangle_sorter)
+        return;
+
+    const auto& order = m_triangle_sorter->sort_back_to_front(model_view);
+    const auto& indices = m_mesh->triangle_indices();
+    if (m_sorted_indices_16.empty())
+        write_triangles_in_order(order, indices, m_sorted_indices_32.data());
+    else
+        write_triangles_in_order(order, indices, m_sorted_indices_16.data());
+}
+
+void Graphical_object::upload_sorted_triangles(ID3D12GraphicsCommandList& command_list,
+    UINT back_buf_index)
+{
+    if (m_sorted_index_buffers.empty())
+        return;
+
+    const void* indices = m_sorted_indices_16.empty() ?
+        static_cast<const void*>(m_sorted_indices_32.data()) : m_sorted_indices_16.data();
+    m_sorted_index_buffers[back_buf_index]->upload_new_data_to_gpu(command_list, indices);
+    m_sorted_index_buffer = back_buf_index;
 }
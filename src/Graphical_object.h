@@ -10,12 +10,17 @@
 
 #include "Mesh.h"
 #include "Texture.h"
+#include "Triangle_sorting.h"
 
 
 using Microsoft::WRL::ComPtr;
 
 enum class Primitive_type { Plane, Cube, Terrain };
 enum class Input_layout;
+enum class Backface_culling;
+
+// When enabled, only the meshlets that were visible at the last call to cull_meshlets are drawn.
+enum class Meshlet_culling { enabled, disabled };
 
 class Graphical_object
 {
@@ -31,19 +36,37 @@ public:
         const std::vector<std::shared_ptr<Texture>>& textures,
         int id, int material_id,
         int dynamic_transform_ref, // Set to negative number for static object.
-        int instances = 1,
-        int triangle_index = 0);
+        int instances = 1);
 
-    void draw(ID3D12GraphicsCommandList& command_list, Input_layout input_layout) const;
+    void draw(ID3D12GraphicsCommandList& command_list, Input_layout input_layout,
+        Meshlet_culling meshlet_culling = Meshlet_culling::disabled) const;
+    // What draw draws, which depends on the lod, the culled meshlets and the sorted triangles.
+    Draw_ranges draw_ranges(Meshlet_culling meshlet_culling) const;
+    // The eye is in model space. Objects with several instances are not culled, since the
+    // instances have different transforms.
+    void cull_meshlets(DirectX::FXMMATRIX model_view_projection, DirectX::FXMVECTOR eye,
+        Backface_culling backface_culling);
+    // pixels_per_unit is how many pixels one unit in model space covers on the screen, at the
+    // distance of the object. The meshlets are only culled when the full mesh is drawn.
+    void select_lod(float pixels_per_unit);
+    int lod() const { return m_lod; }
     void release_temp_resources();
     int triangles_count() const;
     size_t vertices_count() const;
+    const Mesh& mesh() const { return *m_mesh; }
     int instances() const { return m_instances; }
     int id() const { return m_id; }
     int dynamic_transform_ref() const { return m_dynamic_transform_ref; }
     int material_id() const { return m_material_id; }
     DirectX::XMVECTOR center() const;
     void transform_center(DirectX::XMMATRIX model_view);
+
+    // Objects with transparent meshes are drawn with their triangles in back to front order,
+    // from an index buffer per swap chain buffer that is sorted on the CPU every frame.
+    // The triangles are sorted with the transform of the first instance.
+    void create_sorted_index_buffers(ID3D12Device& device, UINT swap_chain_buffer_count);
+    void sort_triangles_back_to_front(DirectX::FXMMATRIX model_view);
+    void upload_sorted_triangles(ID3D12GraphicsCommandList& command_list, UINT back_buf_index);
 private:
 
     DirectX::XMFLOAT3 m_transformed_center;
@@ -54,5 +77,13 @@ private:
     int m_instances;
     int m_material_settings;
     int m_material_id;
-    int m_triangle_index;
+    std::vector<Index_range> m_visible_meshlet_ranges;
+    bool m_meshlets_culled;
+    int m_lod;
+    std::unique_ptr<Triangle_sorter> m_triangle_sorter;
+    std::vector<std::unique_ptr<Dynamic_index_buffer>> m_sorted_index_buffers;
+    std::vector<uint16_t> m_sorted_indices_16;
+    std::vector<uint32_t> m_sorted_indices_32;
+    UINT m_sorted_index_buffer; // The one that was uploaded last, and is drawn.
+    Index_range m_sorted_range; // All of the sorted triangles.
 };
@@ -13,6 +13,7 @@
 #include "Commands.h"
 #include "Mesh.h"
 #include "Scene.h"
+#include "Scene_file.h"
 #include "Depth_stencil.h"
 #include "Depth_pass.h"
 #include "Shadow_map.h"
@@ -28,6 +29,8 @@
 #include "build/pixel_shader_no_vertex_colors.h"
 #include "build/vertex_shader_srv_instance_data.h"
 #include "build/vertex_shader_srv_instance_data_vertex_colors.h"
+#include "build/vertex_shader_srv_instance_data_compact.h"
+#include "build/vertex_shader_srv_instance_data_vertex_colors_compact.h"
 #endif
 
 
@@ -99,11 +102,15 @@ private:
     std::atomic<bool> m_shaders_compiled;
     std::atomic<bool> m_scene_loaded;
     bool m_init_done;
+    bool m_first_frame_rendered;
 };
 
 
 Graphics::Graphics(HWND window, const Config& config, Input& input)
 {
+    // The pipeline states and the meshes are created for the same format.
+    Mesh::set_default_vertex_format(config.compact_vertex_format ? Vertex_format::compact :
+        Vertex_format::full);
     static Graphics_impl graphics(window, config, input);
     impl = &graphics;
 }
@@ -163,7 +170,8 @@ Graphics_impl::Graphics_impl(HWND window, const Config& config, Input& input) :
     m_height(config.height),
     m_shaders_compiled(false),
     m_scene_loaded(false),
-    m_init_done(false)
+    m_init_done(false),
+    m_first_frame_rendered(false)
 {
     create_main_command_list();
     for (UINT i = 1; i < m_dx12_display->swap_chain_buffer_count(); ++i)
@@ -184,7 +192,7 @@ Graphics_impl::Graphics_impl(HWND window, const Config& config, Input& input) :
         auto swap_chain_buffer_count = m_dx12_display->swap_chain_buffer_count();
         m_scene = std::make_unique<Scene>(*m_device.Get(), swap_chain_buffer_count,
         #ifndef NO_SCENE_FILE
-            data_path + config.scene_file, 
+            data_path + config.scene_file, config.cook_scene ? Cook_scene::yes : Cook_scene::no,
         #endif
             *m_texture_descriptor_heap.Get(),
             m_root_signature.m_root_param_index_of_values);
@@ -276,6 +284,14 @@ void Graphics_impl::render()
     }
 
     m_dx12_display->end_render();
+
+    if (m_init_done && !m_first_frame_rendered)
+    {
+        // The startup time, which is what the scene snapshots are for, see Scene_file.h.
+        log("First frame rendered " + std::to_string(seconds_since_process_start()) +
+            " s after the process started");
+        m_first_frame_rendered = true;
+    }
 }
 
 void Graphics_impl::render_loading_message()
@@ -303,8 +319,10 @@ void Graphics_impl::render_loading_message()
 void Graphics_impl::render_info_text()
 {
 #if !defined(NO_TEXT) && !defined(NO_UI)
-    m_user_interface.render_2d_text(m_scene->objects_count(), m_scene->triangles_count(),
-        m_scene->vertices_count(), m_scene->lights_count(), Mesh::draw_calls());
+    m_user_interface.render_2d_text(m_scene->objects_count(),
+        m_scene->visible_objects_count(), m_scene->culling_seconds(), m_scene->triangles_count(),
+        m_scene->vertices_count(), m_scene->index_buffer_size(), m_scene->lights_count(),
+        Mesh::draw_calls());
 #endif
     Mesh::reset_draw_calls();
 }
@@ -365,6 +383,7 @@ void Graphics_impl::create_pipeline_state(ComPtr<ID3D12PipelineState>& pipeline_
 
     Input_layout input_layout = m_use_vertex_colors ? Input_layout::position_normal_tangents_color
         : Input_layout::position_normal_tangents;
+    const bool compact = Mesh::default_vertex_format() == Vertex_format::compact;
 
     // Don't use pre-compiled shaders in debug mode to lower turn-around time
     // when the shaders have been changed. Also decreases time for full rebuild.
@@ -376,6 +395,12 @@ void Graphics_impl::create_pipeline_state(ComPtr<ID3D12PipelineState>& pipeline_
                 _countof(g_vertex_shader_srv_instance_data_vertex_colors)) :
             CD3DX12_SHADER_BYTECODE(g_vertex_shader_srv_instance_data,
                 _countof(g_vertex_shader_srv_instance_data));
+        if (compact)
+            compiled_vertex_shader = m_use_vertex_colors ?
+                CD3DX12_SHADER_BYTECODE(g_vertex_shader_srv_instance_data_vertex_colors_compact,
+                    _countof(g_vertex_shader_srv_instance_data_vertex_colors_compact)) :
+                CD3DX12_SHADER_BYTECODE(g_vertex_shader_srv_instance_data_compact,
+                    _countof(g_vertex_shader_srv_instance_data_compact));
 
         auto compiled_pixel_shader = m_use_vertex_colors ?
             CD3DX12_SHADER_BYTECODE(g_pixel_shader_vertex_colors,
@@ -395,6 +420,10 @@ void Graphics_impl::create_pipeline_state(ComPtr<ID3D12PipelineState>& pipeline_
         const char* vertex_shader = m_use_vertex_colors ?
             "vertex_shader_srv_instance_data_vertex_colors" :
             "vertex_shader_srv_instance_data";
+        if (compact)
+            vertex_shader = m_use_vertex_colors ?
+                "vertex_shader_srv_instance_data_vertex_colors_compact" :
+                "vertex_shader_srv_instance_data_compact";
         const char* pixel_shader = m_use_vertex_colors ? "pixel_shader_vertex_colors"
                                                        : "pixel_shader_no_vertex_colors";
 
@@ -485,10 +514,17 @@ bool Graphics_impl::early_z_pass_is_enabled()
 void Graphics_impl::record_frame_rendering_commands_in_command_list()
 {
     Commands c { commands() };
+    // The transparent triangles are sorted before the upload, since they are uploaded with
+    // the rest of the per frame data.
+    m_scene->sort_transparent_objects_back_to_front(m_view);
     c.upload_data_to_gpu();
     c.set_descriptor_heap(m_texture_descriptor_heap);
     c.set_root_signature();
     c.set_shader_constants();
+    m_scene->select_lods(m_view);
+    m_scene->cull_objects(m_view);
+    m_scene->cull_meshlets(m_view, m_config.backface_culling ? Backface_culling::enabled :
+        Backface_culling::disabled);
     if (shadow_mapping_is_enabled())
         c.generate_shadow_maps();
     if (early_z_pass_is_enabled())
@@ -498,7 +534,6 @@ void Graphics_impl::record_frame_rendering_commands_in_command_list()
     set_and_clear_render_target();
     c.set_view_for_shader();
     c.set_shadow_map_for_shader();
-    m_scene->sort_transparent_objects_back_to_front(m_view);
 
     if (early_z_pass_is_enabled())
     {
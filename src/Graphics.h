@@ -15,18 +15,24 @@ struct Config
 {
     Config() : width(800), height(600), monitor(1), swap_chain_buffer_count(2),
         borderless_windowed_fullscreen(false), vsync(false), use_vertex_colors(false),
-        backface_culling(true), early_z_pass(false), edit_mode(true),
-        invert_mouse(false), mouse_sensitivity(0.3f), max_speed(1.5), fov(70.0f) {}
+        compact_vertex_format(false), backface_culling(true), early_z_pass(false),
+        edit_mode(true), invert_mouse(false), mouse_sensitivity(0.3f), max_speed(1.5), fov(70.0f)
+#ifndef NO_SCENE_FILE
+        , cook_scene(false)
+#endif
+    {}
     int width;
     int height;
 #ifndef NO_SCENE_FILE
     std::string scene_file;
+    bool cook_scene; // Compiles the scene file into a snapshot that later runs start from.
 #endif
     int monitor;
     int swap_chain_buffer_count;
     bool borderless_windowed_fullscreen;
     bool vsync;
     bool use_vertex_colors;
+    bool compact_vertex_format;
     bool backface_culling;
     bool early_z_pass;
     bool edit_mode;
@@ -0,0 +1,245 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Job_system.h"
+
+
+namespace
+{
+    // Which job system the current thread is a worker of, and the index of its queue.
+    thread_local const Job_system* worker_of = nullptr;
+    thread_local size_t worker_queue = 0;
+
+    // How many times an idle worker looks for jobs before it goes to sleep. Waking it up is
+    // much more expensive than that, and jobs often come in bursts, e.g. from a parallel_for.
+    constexpr int spins_before_sleeping = 64;
+}
+
+Job_system::Job_system(int worker_count /* = default_worker_count()*/) :
+    m_queue_count(static_cast<size_t>(std::max(worker_count, 1)) + 1),
+    m_queues(std::make_unique<Job_queue[]>(m_queue_count)),
+    m_queued_jobs(0), m_sleeping_workers(0), m_stopping(false)
+{
+    for (size_t i = 1; i < m_queue_count; ++i)
+        m_workers.emplace_back([this, i] { work(i); });
+}
+
+Job_system::~Job_system()
+{
+    m_stopping = true;
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_job_added.notify_all();
+    }
+    for (auto& worker : m_workers)
+        worker.join();
+}
+
+int Job_system::default_worker_count()
+{
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+}
+
+void Job_system::run(Job_counter& counter, std::function<void()> job)
+{
+    ++counter.m_pending;
+    add({ std::move(job), &counter });
+}
+
+void Job_system::run_after(Job_counter& dependency, Job_counter& counter,
+    std::function<void()> job)
+{
+    ++counter.m_pending;
+    {
+        std::lock_guard<std::mutex> lock(dependency.m_mutex);
+        if (!dependency.done())
+        {
+            // It is added by the last job of the dependency, see finish.
+            dependency.m_continuations.push_back({ std::move(job), &counter });
+            return;
+        }
+    }
+    add({ std::move(job), &counter });
+}
+
+void Job_system::wait(Job_counter& counter)
+{
+    const size_t queue = own_queue();
+    while (!counter.done())
+        if (!run_one_job(queue))
+            std::this_thread::yield();
+
+    // The last job to finish may still hold the lock, and the counter may be destroyed as
+    // soon as this returns.
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+    if (counter.m_exception)
+    {
+        auto exception = counter.m_exception;
+        counter.m_exception = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+void Job_system::add(Job job)
+{
+    auto& queue = m_queues[own_queue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+        ++m_queued_jobs;
+    }
+    wake_worker();
+}
+
+void Job_system::add_background(Job job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_background_jobs.mutex);
+        m_background_jobs.jobs.push_back(std::move(job));
+        ++m_queued_jobs;
+    }
+    wake_worker();
+}
+
+void Job_system::wake_worker()
+{
+    // A worker increments the sleeping count before it checks the queued count for the last
+    // time, and this checks the sleeping count after the queued count has been incremented,
+    // so at least one of them sees the other.
+    if (m_sleeping_workers > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_job_added.notify_one();
+    }
+}
+
+bool Job_system::run_one_job(size_t own_queue)
+{
+    Job job;
+    bool found = false;
+    {
+        auto& queue = m_queues[own_queue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            found = true;
+        }
+    }
+    for (size_t i = 1; i < m_queue_count && !found; ++i)
+    {
+        // The oldest job of a queue is likely to be the biggest part of a parallel_for.
+        auto& queue = m_queues[(own_queue + i) % m_queue_count];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            found = true;
+        }
+    }
+    if (!found)
+        return false;
+    --m_queued_jobs;
+    execute(job);
+    return true;
+}
+
+bool Job_system::run_background_job()
+{
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(m_background_jobs.mutex);
+        if (m_background_jobs.jobs.empty())
+            return false;
+        job = std::move(m_background_jobs.jobs.front());
+        m_background_jobs.jobs.pop_front();
+    }
+    --m_queued_jobs;
+    execute(job);
+    return true;
+}
+
+void Job_system::execute(Job& job)
+{
+    std::exception_ptr exception;
+    try
+    {
+        job.function();
+    }
+    catch (...)
+    {
+        exception = std::current_exception();
+    }
+    if (!job.counter)
+        return; // The background jobs give their exceptions through their futures.
+
+    if (exception)
+    {
+        std::lock_guard<std::mutex> lock(job.counter->m_mutex);
+        if (!job.counter->m_exception)
+            job.counter->m_exception = exception;
+    }
+    finish(*job.counter);
+}
+
+void Job_system::finish(Job_counter& counter)
+{
+    // Only the last job takes the lock. Before that the counter cannot be destroyed, since
+    // whoever waits for it has not seen it reach zero.
+    int pending = counter.m_pending;
+    while (pending > 1)
+        if (counter.m_pending.compare_exchange_weak(pending, pending - 1))
+            return;
+
+    std::vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter.m_mutex);
+        if (--counter.m_pending == 0)
+            continuations.swap(counter.m_continuations);
+    }
+    for (auto& job : continuations)
+        add(std::move(job));
+}
+
+size_t Job_system::own_queue() const
+{
+    return worker_of == this ? worker_queue : 0;
+}
+
+void Job_system::work(size_t queue)
+{
+    worker_of = this;
+    worker_queue = queue;
+    int spins = 0;
+    while (!m_stopping)
+    {
+        if (run_one_job(queue) || run_background_job())
+        {
+            spins = 0;
+            continue;
+        }
+        if (++spins < spins_before_sleeping)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        ++m_sleeping_workers;
+        m_job_added.wait(lock, [this] { return m_queued_jobs > 0 || m_stopping; });
+        --m_sleeping_workers;
+        spins = 0;
+    }
+}
+
+Job_system& job_system()
+{
+    static Job_system system;
+    return system;
+}
@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// A work stealing job scheduler. Each worker thread has a queue of its own, which it takes
+// the jobs it adds from the back of, newest first, and the other threads steal from the
+// front of when they have run out of work. Threads that are not workers add their jobs to a
+// shared queue.
+//
+// Jobs are grouped by a Job_counter, which tells how many of them are left. A thread that
+// waits for a counter runs jobs meanwhile, so jobs can wait for other jobs, e.g. a nested
+// parallel_for, without blocking a worker. A job can also be added to run after all the jobs
+// of another counter have finished, which is how dependencies between jobs are expressed.
+//
+// When the job system is destroyed, the running jobs are finished and the ones that have not
+// started are discarded. Nothing should wait for them then.
+class Job_system
+{
+public:
+    class Job_counter;
+private:
+    struct Job
+    {
+        std::function<void()> function;
+        Job_counter* counter;
+    };
+public:
+    // The calling thread helps while it waits, so the default has one worker less than there
+    // are cores. There is at least one, which runs the background jobs.
+    explicit Job_system(int worker_count = default_worker_count());
+    ~Job_system();
+    Job_system(const Job_system&) = delete;
+    Job_system& operator=(const Job_system&) = delete;
+
+    class Job_counter
+    {
+    public:
+        Job_counter() : m_pending(0) {}
+        Job_counter(const Job_counter&) = delete;
+        Job_counter& operator=(const Job_counter&) = delete;
+        bool done() const { return m_pending.load() == 0; }
+    private:
+        friend class Job_system;
+        std::atomic<int> m_pending;
+        std::mutex m_mutex;
+        std::vector<Job> m_continuations;
+        std::exception_ptr m_exception;
+    };
+
+    // Adds a job that is counted by the counter.
+    void run(Job_counter& counter, std::function<void()> job);
+
+    // Adds a job, counted by the counter, that is started when all the jobs that have been
+    // added to the dependency have finished.
+    void run_after(Job_counter& dependency, Job_counter& counter, std::function<void()> job);
+
+    // Runs jobs until all the jobs of the counter have finished, and then rethrows the first
+    // exception that any of them threw.
+    void wait(Job_counter& counter);
+
+    // Calls function(begin, end) for ranges of at most grain_size indices that together cover
+    // [0, count), in parallel, and returns when all of them have returned. The range is split
+    // in halves, which are forked off as jobs, until they are small enough, so the number of
+    // jobs only depends on the grain size, and stealing spreads the halves over the workers.
+    template<typename Function>
+    void parallel_for(size_t count, size_t grain_size, Function function)
+    {
+        if (count == 0)
+            return;
+        Job_counter counter;
+        std::exception_ptr exception;
+        try
+        {
+            run_range(counter, 0, count, std::max<size_t>(grain_size, 1), function);
+        }
+        catch (...)
+        {
+            // The jobs that have been forked off refer to the counter, so they have to be
+            // waited for anyway.
+            exception = std::current_exception();
+        }
+        wait(counter);
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+
+    // Adds a background job, whose result or exception is given by the returned future. These
+    // are for longer work, like reading files. They are only run by the workers, when they
+    // have nothing else to do, so that a thread that waits for a counter, e.g. the main
+    // thread in a parallel_for, is never held up by one. The thread that calls get on the
+    // future only blocks, it does not run jobs.
+    template<typename Function>
+    auto submit(Function function) -> std::future<decltype(function())>
+    {
+        using Result = decltype(function());
+        // std::function needs a copyable function, which the packaged task is not.
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+        auto result = task->get_future();
+        add_background({ [task] { (*task)(); }, nullptr });
+        return result;
+    }
+
+    int worker_count() const { return static_cast<int>(m_workers.size()); }
+
+    static int default_worker_count();
+private:
+    template<typename Function>
+    void run_range(Job_counter& counter, size_t begin, size_t end, size_t grain_size,
+        const Function& function)
+    {
+        while (end - begin > grain_size)
+        {
+            const size_t middle = begin + (end - begin) / 2;
+            run(counter, [this, &counter, middle, end, grain_size, &function] {
+                run_range(counter, middle, end, grain_size, function);
+            });
+            end = middle;
+        }
+        function(begin, end);
+    }
+
+    void add(Job job);
+    void add_background(Job job);
+    void wake_worker();
+    bool run_one_job(size_t own_queue);
+    bool run_background_job();
+    void execute(Job& job);
+    void finish(Job_counter& counter);
+    size_t own_queue() const;
+    void work(size_t queue);
+
+    // Aligned so that the queues of different threads are not in the same cache line.
+    struct alignas(64) Job_queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    // The shared queue is first, followed by one for each worker.
+    size_t m_queue_count;
+    std::unique_ptr<Job_queue[]> m_queues;
+    Job_queue m_background_jobs;
+    std::atomic<int> m_queued_jobs;
+    std::atomic<int> m_sleeping_workers;
+    std::atomic<bool> m_stopping;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_job_added;
+    std::vector<std::thread> m_workers;
+};
+
+// The job system that the engine shares, created on first use.
+Job_system& job_system();
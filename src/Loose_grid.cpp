@@ -0,0 +1,270 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Loose_grid.h"
+#include "Frustum.h"
+
+#include <cfloat>
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    // The cells are tested before their boxes, so there is no point in them having only one
+    // box each, but a cell that intersects a frustum has all of its boxes tested.
+    constexpr float boxes_per_cell = 8.0f;
+
+    // The cell coordinates are packed into the keys of the cells with this many bits each, and
+    // the boxes further out than that are in the cells at the edge, which then reach them.
+    constexpr int coordinate_bits = 21;
+    constexpr int max_coordinate = (1 << (coordinate_bits - 1)) - 1;
+
+    XMVECTOR center(const Aabb& box)
+    {
+        return (XMLoadFloat3(&box.min_corner) + XMLoadFloat3(&box.max_corner)) * 0.5f;
+    }
+}
+
+Loose_grid::Loose_grid(float cell_size) : m_cell_size(cell_size)
+{
+}
+
+void Loose_grid::clear(float cell_size)
+{
+    m_cell_size = cell_size;
+    m_cells.clear();
+    m_cell_indices.clear();
+    m_boxes.clear();
+    m_box_cells.clear();
+    m_box_slots.clear();
+    m_size = 0;
+}
+
+void Loose_grid::set(int id, const Aabb& box)
+{
+    const size_t index = static_cast<size_t>(id);
+    if (index >= m_boxes.size())
+    {
+        m_boxes.resize(index + 1);
+        m_box_cells.resize(index + 1, no_cell);
+        m_box_slots.resize(index + 1);
+    }
+    m_boxes[index] = box;
+
+    // Most moves are small, so the box usually stays in its cell, which then only has to
+    // reach far enough for it.
+    const XMVECTOR c = coordinates(box);
+    UINT cell_index = m_box_cells[index];
+    if (cell_index == no_cell || m_cells[cell_index].key != key(c))
+    {
+        if (cell_index != no_cell)
+            remove_from_cell(id);
+        else
+            ++m_size;
+        cell_index = find_or_add_cell(c);
+        Cell& cell = m_cells[cell_index];
+        m_box_cells[index] = cell_index;
+        m_box_slots[index] = static_cast<UINT>(cell.ids.size());
+        cell.ids.push_back(id);
+    }
+
+    Cell& cell = m_cells[cell_index];
+    const XMVECTOR cell_min = XMLoadFloat3(&cell.min_corner);
+    const XMVECTOR cell_max = cell_min + XMVectorReplicate(m_cell_size);
+    const XMVECTOR reach = XMVectorMax(XMVectorMax(cell_min - XMLoadFloat3(&box.min_corner),
+        XMLoadFloat3(&box.max_corner) - cell_max), XMLoadFloat3(&cell.reach));
+    XMStoreFloat3(&cell.reach, reach);
+}
+
+void Loose_grid::remove(int id)
+{
+    const size_t index = static_cast<size_t>(id);
+    if (index >= m_box_cells.size() || m_box_cells[index] == no_cell)
+        return;
+    remove_from_cell(id);
+    m_box_cells[index] = no_cell;
+    --m_size;
+}
+
+void Loose_grid::query(const Frustum& frustum, vector<int>& ids) const
+{
+    vector<uint8_t> visible;
+    for (auto& cell : m_cells)
+    {
+        const Aabb cell_bounds = bounds(cell);
+        if (!frustum.intersects_box(cell_bounds))
+            continue;
+        if (frustum.contains_box(cell_bounds))
+        {
+            ids.insert(ids.end(), cell.ids.begin(), cell.ids.end());
+            continue;
+        }
+        // The boxes of the cell are tested in batches, through its ids.
+        visible.resize(cell.ids.size());
+        frustum.cull_boxes(m_boxes.data(), cell.ids.data(), cell.ids.size(), visible.data());
+        for (size_t i = 0; i < cell.ids.size(); ++i)
+            if (visible[i])
+                ids.push_back(cell.ids[i]);
+    }
+}
+
+void Loose_grid::query(FXMVECTOR center, float radius, vector<int>& ids) const
+{
+    for (auto& cell : m_cells)
+    {
+        if (!intersects_sphere(bounds(cell), center, radius))
+            continue;
+        for (int id : cell.ids)
+            if (intersects_sphere(m_boxes[id], center, radius))
+                ids.push_back(id);
+    }
+}
+
+int Loose_grid::first_hit(FXMVECTOR origin, FXMVECTOR direction, float& distance) const
+{
+    XMFLOAT3 o, d;
+    XMStoreFloat3(&o, origin);
+    XMStoreFloat3(&d, direction);
+
+    // The cells that the ray goes through are visited from the nearest, until the next one is
+    // further away than the nearest hit so far. The cells overlap, so that is not when the
+    // first box is hit.
+    struct Entry
+    {
+        float distance;
+        UINT cell;
+    };
+    vector<Entry> entries;
+    for (UINT i = 0; i < m_cells.size(); ++i)
+    {
+        const float t = ray_distance(o, d, bounds(m_cells[i]));
+        if (t < FLT_MAX)
+            entries.push_back({ t, i });
+    }
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry& e1, const Entry& e2) { return e1.distance < e2.distance; });
+
+    distance = FLT_MAX;
+    int hit = -1;
+    for (auto& entry : entries)
+    {
+        if (entry.distance >= distance)
+            break;
+        for (int id : m_cells[entry.cell].ids)
+        {
+            const float t = ray_distance(o, d, m_boxes[id]);
+            if (t < distance)
+            {
+                distance = t;
+                hit = id;
+            }
+        }
+    }
+    return hit;
+}
+
+float Loose_grid::cell_size_for(const vector<Aabb>& boxes)
+{
+    if (boxes.empty())
+        return 1.0f;
+    XMVECTOR min_center = XMVectorReplicate(FLT_MAX);
+    XMVECTOR max_center = XMVectorReplicate(-FLT_MAX);
+    float extents = 0.0f;
+    for (auto& box : boxes)
+    {
+        const XMVECTOR c = center(box);
+        min_center = XMVectorMin(min_center, c);
+        max_center = XMVectorMax(max_center, c);
+        const XMVECTOR extent = XMLoadFloat3(&box.max_corner) - XMLoadFloat3(&box.min_corner);
+        extents += std::max(XMVectorGetX(extent), std::max(XMVectorGetY(extent),
+            XMVectorGetZ(extent)));
+    }
+    // The boxes are assumed to be spread evenly, between their centers. The cells are at
+    // least as big as the average box, so that the loose bounds of a cell are at most about
+    // twice its size.
+    const XMVECTOR spread = max_center - min_center;
+    const float volume = XMVectorGetX(spread) * XMVectorGetY(spread) * XMVectorGetZ(spread);
+    const float size = std::max(extents / boxes.size(),
+        std::cbrt(volume * boxes_per_cell / boxes.size()));
+    return size > 0.0f ? size : 1.0f;
+}
+
+XMVECTOR Loose_grid::coordinates(const Aabb& box) const
+{
+    const XMVECTOR limit = XMVectorReplicate(static_cast<float>(max_coordinate));
+    return XMVectorMin(XMVectorMax(XMVectorFloor(center(box) / m_cell_size), -limit), limit);
+}
+
+uint64_t Loose_grid::key(FXMVECTOR coordinates)
+{
+    XMFLOAT3 c;
+    XMStoreFloat3(&c, coordinates);
+    uint64_t result = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const uint64_t coordinate = static_cast<uint64_t>(
+            static_cast<int64_t>(component(c, axis)) + max_coordinate);
+        result |= coordinate << (axis * coordinate_bits);
+    }
+    return result;
+}
+
+UINT Loose_grid::find_or_add_cell(FXMVECTOR coordinates)
+{
+    const uint64_t k = key(coordinates);
+    auto found = m_cell_indices.find(k);
+    if (found != m_cell_indices.end())
+        return found->second;
+
+    const UINT index = static_cast<UINT>(m_cells.size());
+    m_cell_indices[k] = index;
+    Cell cell;
+    XMStoreFloat3(&cell.min_corner, coordinates * m_cell_size);
+    cell.reach = { 0.0f, 0.0f, 0.0f };
+    cell.key = k;
+    m_cells.push_back(std::move(cell));
+    return index;
+}
+
+void Loose_grid::remove_from_cell(int id)
+{
+    const UINT cell_index = m_box_cells[id];
+    Cell& cell = m_cells[cell_index];
+    const int last = cell.ids.back();
+    cell.ids[m_box_slots[id]] = last;
+    m_box_slots[last] = m_box_slots[id];
+    cell.ids.pop_back();
+    if (!cell.ids.empty())
+        return;
+
+    // The empty cells are removed, so that only the cells with boxes are tested, with the last
+    // cell moved into the place of the empty one.
+    m_cell_indices.erase(cell.key);
+    const UINT last_cell = static_cast<UINT>(m_cells.size() - 1);
+    if (cell_index != last_cell)
+    {
+        m_cells[cell_index] = std::move(m_cells[last_cell]);
+        m_cell_indices[m_cells[cell_index].key] = cell_index;
+        for (int moved : m_cells[cell_index].ids)
+            m_box_cells[moved] = cell_index;
+    }
+    m_cells.pop_back();
+}
+
+Aabb Loose_grid::bounds(const Cell& cell) const
+{
+    const XMVECTOR cell_min = XMLoadFloat3(&cell.min_corner);
+    const XMVECTOR reach = XMLoadFloat3(&cell.reach);
+    Aabb result;
+    XMStoreFloat3(&result.min_corner, cell_min - reach);
+    XMStoreFloat3(&result.max_corner, cell_min + XMVectorReplicate(m_cell_size) + reach);
+    return result;
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+#include "Aabb.h"
+
+#include <climits>
+#include <unordered_map>
+
+
+class Frustum;
+
+// A grid of boxes that move, e.g. of the dynamic objects of a scene, which finds the boxes in a
+// frustum, a sphere or along a ray like a Bvh does, but where moving a box only touches that
+// box and its cells, instead of rebuilding everything. Each box is in the cell that its center
+// is in, and the cells are loose: their bounds reach as far out of them as the box that reaches
+// the furthest, so they contain their boxes whole. See "Loose Octrees" by Thatcher Ulrich, in
+// Game Programming Gems, 2000. Only the cells that have boxes are kept, so the grid is unbounded.
+class Loose_grid
+{
+public:
+    // The ids are what the queries return, and index the boxes, so they should be small, e.g.
+    // the dynamic transform refs of the objects.
+    explicit Loose_grid(float cell_size = 1.0f);
+    // Removes all the boxes.
+    void clear(float cell_size);
+    // Adds the box, or moves it if the id is already there.
+    void set(int id, const Aabb& box);
+    void remove(int id);
+
+    // These add the ids of the boxes that intersect the frustum or the sphere to ids, in no
+    // particular order.
+    void query(const Frustum& frustum, std::vector<int>& ids) const;
+    void query(DirectX::FXMVECTOR center, float radius, std::vector<int>& ids) const;
+    // Returns the id of the nearest box that the ray hits, or -1 if it hits none, and sets
+    // distance to how far along the direction it is. A ray that starts in a box hits it at 0.
+    int first_hit(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction,
+        float& distance) const;
+
+    const Aabb& box(int id) const { return m_boxes[id]; }
+    size_t size() const { return m_size; }
+    size_t cells_count() const { return m_cells.size(); }
+    float cell_size() const { return m_cell_size; }
+
+    // A cell size for the boxes, which is big enough for the cells to not reach much further
+    // than the grid would without them being loose, and to have a few boxes each.
+    static float cell_size_for(const std::vector<Aabb>& boxes);
+
+private:
+    struct Cell
+    {
+        DirectX::XMFLOAT3 min_corner;
+        DirectX::XMFLOAT3 reach; // How far out of the cell its boxes reach, at most.
+        uint64_t key;
+        std::vector<int> ids;
+    };
+    static constexpr UINT no_cell = UINT_MAX;
+
+    // Of the cell that the center of the box is in.
+    DirectX::XMVECTOR coordinates(const Aabb& box) const;
+    static uint64_t key(DirectX::FXMVECTOR coordinates);
+    UINT find_or_add_cell(DirectX::FXMVECTOR coordinates);
+    void remove_from_cell(int id);
+    Aabb bounds(const Cell& cell) const;
+
+    float m_cell_size;
+    std::vector<Cell> m_cells;
+    std::unordered_map<uint64_t, UINT> m_cell_indices;
+
+    // Per id.
+    std::vector<Aabb> m_boxes;
+    std::vector<UINT> m_box_cells;
+    std::vector<UINT> m_box_slots; // Where the id is in the ids of its cell.
+    size_t m_size = 0;
+};
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Memory_mapped_file.h"
+#include "util.h"
+
+#include <fileapi.h>
+#include <memoryapi.h>
+#include <handleapi.h>
+
+
+Memory_mapped_file::Memory_mapped_file(const std::string& file_name) :
+    m_file(INVALID_HANDLE_VALUE), m_file_mapping(nullptr), m_data(nullptr), m_size(0)
+{
+    constexpr LPSECURITY_ATTRIBUTES attributes = nullptr;
+    constexpr HANDLE template_file = nullptr;
+    m_file = CreateFileW(widen(file_name).c_str(), GENERIC_READ, FILE_SHARE_READ, attributes,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, template_file);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(m_file, &file_size) || file_size.QuadPart == 0 ||
+        static_cast<unsigned long long>(file_size.QuadPart) > SIZE_MAX)
+        return; // It is not possible to map an empty file, and we simply treat it as missing.
+
+    constexpr DWORD maximum_size_high = 0; // Zero for both of these means
+    constexpr DWORD maximum_size_low = 0;  // the current size of the file.
+    constexpr LPCWSTR name = nullptr;
+    m_file_mapping = CreateFileMappingW(m_file, attributes, PAGE_READONLY, maximum_size_high,
+        maximum_size_low, name);
+    if (!m_file_mapping)
+        return;
+
+    constexpr DWORD offset_high = 0;
+    constexpr DWORD offset_low = 0;
+    constexpr SIZE_T value_meaning_map_the_whole_file = 0;
+    m_data = static_cast<const char*>(MapViewOfFile(m_file_mapping, FILE_MAP_READ, offset_high,
+        offset_low, value_meaning_map_the_whole_file));
+    if (m_data)
+        m_size = static_cast<size_t>(file_size.QuadPart);
+}
+
+Memory_mapped_file::~Memory_mapped_file()
+{
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_file_mapping)
+        CloseHandle(m_file_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+}
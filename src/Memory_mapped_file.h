@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+// Maps a whole file, read only, into the address space of the process. This makes it
+// possible to parse the file in place, without first copying it into a buffer or reading
+// it through a stream. The operating system pages in the data as it is accessed.
+// If the file could not be opened, or is empty, is_open() returns false and
+// begin() == end().
+class Memory_mapped_file
+{
+public:
+    Memory_mapped_file(const std::string& file_name);
+    ~Memory_mapped_file();
+    Memory_mapped_file(const Memory_mapped_file&) = delete;
+    Memory_mapped_file& operator=(const Memory_mapped_file&) = delete;
+
+    bool is_open() const { return m_data != nullptr; }
+    const char* begin() const { return m_data; }
+    const char* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+private:
+    HANDLE m_file;
+    HANDLE m_file_mapping;
+    const char* m_data;
+    size_t m_size;
+};
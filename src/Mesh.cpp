@@ -7,29 +7,63 @@
 
 #include "pch.h"
 #include "Mesh.h"
+#include "Mesh_optimizer.h"
+#include "Meshlets.h"
+#include "Vertex_compression.h"
 #include "util.h"
 #include "Wavefront_obj_file.h"
 #include "Root_signature.h"
 #include "Dx12_util.h"
 
+#include <cfloat>
+
+
+namespace
+{
+    // The occluders are rasterized every frame, so only the meshes that hide a lot with few
+    // triangles are worth it, and that is mostly the simple ones.
+    constexpr size_t max_occluder_triangles = 256;
+}
 
 int Mesh::s_draw_calls = 0;
+Vertex_format Mesh::s_default_vertex_format = Vertex_format::full;
 
 
 Mesh::Mesh(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
-    const Vertices& vertices, const std::vector<int>& indices, bool transparent/* = false*/)
-    : m_transparent(transparent)
+    const Vertices& vertices, const std::vector<int>& indices, bool transparent/* = false*/) :
+    Mesh(device, command_list, vertices, indices, std::vector<Mesh_lod>(), std::string(),
+        transparent)
 {
-    create_and_fill_vertex_buffers(vertices, indices, device, command_list, transparent);
-    create_and_fill_index_buffer(indices, device, command_list);
 }
 
 Mesh::Mesh(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
     const Vertices& vertices, const std::vector<int>& indices, const std::string& name,
-    bool transparent/* = false*/) : m_transparent(transparent)
+    bool transparent/* = false*/) : Mesh(device, command_list, vertices, indices,
+        std::vector<Mesh_lod>(), name, transparent)
 {
-    create_and_fill_vertex_buffers(vertices, indices, device, command_list, transparent);
-    create_and_fill_index_buffer(indices, device, command_list);
+}
+
+Mesh::Mesh(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+    const Vertices& vertices, const std::vector<int>& indices,
+    const std::vector<Mesh_lod>& lods, const std::string& name,
+    bool transparent/* = false*/) : m_vertex_format(s_default_vertex_format),
+    m_position_dequantization(), m_transparent(transparent)
+{
+    std::vector<int> all_indices = indices;
+    for (auto& lod : lods)
+        all_indices.insert(all_indices.end(), lod.indices.begin(), lod.indices.end());
+    const Compact_indices compact = compact_indices(all_indices, vertices.positions.size());
+    create_and_fill_vertex_buffers(vertices, indices, compact.vertex_remap, device,
+        command_list, transparent);
+    create_and_fill_index_buffer(compact, device, command_list);
+    split_index_ranges_into_lods(static_cast<UINT>(indices.size()), lods);
+    if (transparent)
+        store_triangle_indices(compact);
+    else
+    {
+        m_meshlets = build_meshlets(indices, vertices.positions, m_index_ranges);
+        store_occluder(vertices, indices);
+    }
     #ifdef _DEBUG
     set_buffer_debug_names(name);
     #else
@@ -40,10 +74,22 @@ Mesh::Mesh(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
 void Mesh::set_buffer_debug_names(const std::string& name)
 {
     SET_DEBUG_NAME(m_vertex_positions_buffer, (L"Vertex Positions Buffer " + widen(name)).c_str());
-    SET_DEBUG_NAME(m_vertex_normals_buffer, (L"Vertex Normals Buffer " + widen(name)).c_str());
-    SET_DEBUG_NAME(m_vertex_tangents_buffer, (L"Vertex Tangents Buffer " + widen(name)).c_str());
-    SET_DEBUG_NAME(m_vertex_bitangents_buffer, (L"Vertex Bitangents Buffer " + widen(name)).c_str());
     SET_DEBUG_NAME(m_vertex_colors_buffer, (L"Vertex Colors Buffer " + widen(name)).c_str());
+    if (m_vertex_format == Vertex_format::compact)
+    {
+        SET_DEBUG_NAME(m_vertex_tangent_frames_buffer,
+            (L"Vertex Tangent Frames Buffer " + widen(name)).c_str());
+        SET_DEBUG_NAME(m_vertex_texture_coords_buffer,
+            (L"Vertex Texture Coordinates Buffer " + widen(name)).c_str());
+    }
+    else
+    {
+        SET_DEBUG_NAME(m_vertex_normals_buffer, (L"Vertex Normals Buffer " + widen(name)).c_str());
+        SET_DEBUG_NAME(m_vertex_tangents_buffer,
+            (L"Vertex Tangents Buffer " + widen(name)).c_str());
+        SET_DEBUG_NAME(m_vertex_bitangents_buffer,
+            (L"Vertex Bitangents Buffer " + widen(name)).c_str());
+    }
     SET_DEBUG_NAME(m_index_buffer, (L"Index Buffer " + widen(name)).c_str());
 }
 
@@ -54,13 +100,31 @@ void Mesh::release_temp_resources()
     m_temp_upload_resource_vb_tangents.Reset();
     m_temp_upload_resource_vb_bitangents.Reset();
     m_temp_upload_resource_vb_colors.Reset();
+    m_temp_upload_resource_vb_tangent_frames.Reset();
+    m_temp_upload_resource_vb_texture_coords.Reset();
     m_temp_upload_resource_ib.Reset();
 }
 
 
-void Mesh::draw(ID3D12GraphicsCommandList& command_list, int draw_instances_count,
-    Input_layout input_layout, int triangle_index) const
+void Mesh::set_vertex_buffers(ID3D12GraphicsCommandList& command_list,
+    Input_layout input_layout) const
 {
+    if (m_vertex_format == Vertex_format::compact)
+    {
+        // The texture coordinates are needed by all layouts except the one with only positions,
+        // since the alpha cut out passes use position_normal to get them.
+        D3D12_VERTEX_BUFFER_VIEW vertex_buffer_views[] = { m_vertex_positions_buffer_view,
+            m_vertex_tangent_frames_buffer_view, m_vertex_texture_coords_buffer_view,
+            m_vertex_colors_buffer_view };
+        UINT views_count = _countof(vertex_buffer_views);
+        if (input_layout == Input_layout::position)
+            views_count = 1;
+        else if (input_layout != Input_layout::position_normal_tangents_color)
+            views_count = 3;
+        command_list.IASetVertexBuffers(0, views_count, vertex_buffer_views);
+        return;
+    }
+
     switch (input_layout)
     {
         case Input_layout::position_normal_tangents_color:
@@ -93,27 +157,21 @@ void Mesh::draw(ID3D12GraphicsCommandList& command_list, int draw_instances_coun
             break;
         }
     }
-
-    command_list.IASetIndexBuffer(&m_index_buffer_view);
-    const int index_count = m_transparent ? vertex_count_per_face : m_index_count;
-    command_list.DrawIndexedInstanced(index_count, draw_instances_count,
-        triangle_index * vertex_count_per_face, 0, 0);
-    ++s_draw_calls;
-}
-
-int Mesh::triangles_count() const
-{
-    return m_transparent? 1 : m_index_count / 3;
 }
 
-size_t Mesh::vertices_count() const
+void Mesh::draw(ID3D12GraphicsCommandList& command_list, int draw_instances_count,
+    const Index_range* ranges, UINT range_count)
 {
-    return m_transparent? 3 : m_vertices_count;
+    constexpr UINT start_instance = 0;
+    for (UINT i = 0; i < range_count; ++i)
+        command_list.DrawIndexedInstanced(ranges[i].index_count, draw_instances_count,
+            ranges[i].start_index, ranges[i].base_vertex, start_instance);
+    s_draw_calls += static_cast<int>(range_count);
 }
 
-DirectX::XMVECTOR Mesh::center(int triangle_index) const
+DirectX::XMVECTOR Mesh::center() const
 {
-    return DirectX::XMLoadFloat3(&m_centers[triangle_index]);
+    return DirectX::XMLoadFloat3(&m_center);
 }
 
 namespace
@@ -144,6 +202,24 @@ DirectX::XMVECTOR calculate_center(const Vertices& vertices)
     return center;
 }
 
+void Mesh::calculate_bounds(const Vertices& vertices)
+{
+    using namespace DirectX;
+
+    // The w of the positions is a texture coordinate.
+    auto position = [&](size_t i)
+    { return XMVectorSetW(XMLoadFloat4(&vertices.positions[i]), 0.0f); };
+    XMVECTOR min_position = XMVectorReplicate(FLT_MAX);
+    XMVECTOR max_position = XMVectorReplicate(-FLT_MAX);
+    for (size_t i = 0; i < vertices.positions.size(); ++i)
+    {
+        min_position = XMVectorMin(min_position, position(i));
+        max_position = XMVectorMax(max_position, position(i));
+    }
+    XMStoreFloat3(&m_aabb_min, min_position);
+    XMStoreFloat3(&m_aabb_max, max_position);
+}
+
 DirectX::XMVECTOR calculate_center_of_triangle(const Vertices& vertices,
     const std::vector<int>& indices, int index)
 {
@@ -162,55 +238,156 @@ DirectX::XMVECTOR calculate_center_of_triangle(const Vertices& vertices,
 }
 
 void Mesh::create_and_fill_vertex_buffers(const Vertices& vertices,
-    const std::vector<int>& indices, ID3D12Device& device,
+    const std::vector<int>& indices, const std::vector<int>& vertex_remap, ID3D12Device& device,
     ID3D12GraphicsCommandList& command_list, bool transparent)
 {
-    m_vertices_count = vertices.positions.size();
+    DirectX::XMStoreFloat3(&m_center, calculate_center(vertices));
+    calculate_bounds(vertices);
     if (transparent)
-        for (UINT i = 0; i < indices.size() / vertex_count_per_face; ++i)
-        {
-            DirectX::XMFLOAT3 center;
-            DirectX::XMStoreFloat3(&center, calculate_center_of_triangle(vertices, indices, i));
-            m_centers.push_back(center);
-        }
-    else
     {
-        DirectX::XMFLOAT3 center;
-        DirectX::XMStoreFloat3(&center, calculate_center(vertices));
-        m_centers.push_back(center);
+        m_triangle_centers.resize(indices.size() / vertex_count_per_face);
+        for (int i = 0; i < static_cast<int>(m_triangle_centers.size()); ++i)
+            DirectX::XMStoreFloat3(&m_triangle_centers[i],
+                calculate_center_of_triangle(vertices, indices, i));
     }
 
+    // Big meshes can have some of their vertices duplicated, see compact_indices.
+    Vertices remapped;
+    if (!vertex_remap.empty())
+        remapped = remapped_vertices(vertices, vertex_remap);
+    const Vertices& uploaded = vertex_remap.empty() ? vertices : remapped;
+    m_vertices_count = uploaded.positions.size();
+
+    if (m_vertex_format == Vertex_format::compact)
+    {
+        create_and_fill_compact_vertex_buffers(uploaded, device, command_list);
+        return;
+    }
 
     create_and_fill_vertex_buffer(device, command_list, m_vertex_positions_buffer,
-        m_temp_upload_resource_vb_pos, vertices.positions, m_vertex_positions_buffer_view);
+        m_temp_upload_resource_vb_pos, uploaded.positions, m_vertex_positions_buffer_view);
 
     create_and_fill_vertex_buffer(device, command_list, m_vertex_normals_buffer,
-        m_temp_upload_resource_vb_normals, vertices.normals, m_vertex_normals_buffer_view);
+        m_temp_upload_resource_vb_normals, uploaded.normals, m_vertex_normals_buffer_view);
 
     create_and_fill_vertex_buffer(device, command_list, m_vertex_tangents_buffer,
-        m_temp_upload_resource_vb_tangents, vertices.tangents, m_vertex_tangents_buffer_view);
+        m_temp_upload_resource_vb_tangents, uploaded.tangents, m_vertex_tangents_buffer_view);
 
     create_and_fill_vertex_buffer(device, command_list, m_vertex_bitangents_buffer,
-        m_temp_upload_resource_vb_bitangents, vertices.bitangents, m_vertex_bitangents_buffer_view);
+        m_temp_upload_resource_vb_bitangents, uploaded.bitangents, m_vertex_bitangents_buffer_view);
 
     create_and_fill_vertex_buffer(device, command_list, m_vertex_colors_buffer,
-        m_temp_upload_resource_vb_colors, vertices.colors.empty()?
-        std::vector<Vertex_color>(vertices.positions.size()) // Create dummy colors to avoid errors
-        : vertices.colors, m_vertex_colors_buffer_view);
+        m_temp_upload_resource_vb_colors, uploaded.colors.empty()?
+        std::vector<Vertex_color>(uploaded.positions.size()) // Create dummy colors to avoid errors
+        : uploaded.colors, m_vertex_colors_buffer_view);
 }
 
-void Mesh::create_and_fill_index_buffer(const std::vector<int>& indices,
+void Mesh::create_and_fill_compact_vertex_buffers(const Vertices& vertices,
     ID3D12Device& device, ID3D12GraphicsCommandList& command_list)
 {
-    m_index_count = static_cast<UINT>(indices.size());
+    const Compact_vertices compact = compress_vertices(vertices);
+    m_position_dequantization = compact.position_dequantization;
+
+    create_and_fill_vertex_buffer(device, command_list, m_vertex_positions_buffer,
+        m_temp_upload_resource_vb_pos, compact.positions, m_vertex_positions_buffer_view);
+
+    create_and_fill_vertex_buffer(device, command_list, m_vertex_tangent_frames_buffer,
+        m_temp_upload_resource_vb_tangent_frames, compact.tangent_frames,
+        m_vertex_tangent_frames_buffer_view);
+
+    create_and_fill_vertex_buffer(device, command_list, m_vertex_texture_coords_buffer,
+        m_temp_upload_resource_vb_texture_coords, compact.texture_coords,
+        m_vertex_texture_coords_buffer_view);
 
-    const UINT index_buffer_size = static_cast<UINT>(indices.size() * sizeof(int));
+    create_and_fill_vertex_buffer(device, command_list, m_vertex_colors_buffer,
+        m_temp_upload_resource_vb_colors, compact.colors.empty()?
+        std::vector<Vertex_color>(compact.positions.size()) // Create dummy colors to avoid errors
+        : compact.colors, m_vertex_colors_buffer_view);
+}
+
+void Mesh::create_and_fill_index_buffer(const Compact_indices& indices,
+    ID3D12Device& device, ID3D12GraphicsCommandList& command_list)
+{
+    // Most meshes get 16 bit indices, which halves the memory and bandwidth used for them.
+    const bool use_32_bit = !indices.indices_32.empty();
+    m_index_count = static_cast<UINT>(use_32_bit ? indices.indices_32.size() :
+        indices.indices_16.size());
+    m_index_ranges = indices.ranges;
+    m_index_buffer_size = use_32_bit ? indices.indices_32.size() * sizeof(int) :
+        indices.indices_16.size() * sizeof(uint16_t);
+
+    const UINT index_buffer_size = static_cast<UINT>(m_index_buffer_size);
+    const void* index_data = use_32_bit ? static_cast<const void*>(indices.indices_32.data()) :
+        indices.indices_16.data();
 
     create_and_fill_buffer(device, command_list, m_index_buffer, 
-        m_temp_upload_resource_ib, indices.data(), index_buffer_size,
+        m_temp_upload_resource_ib, index_data, index_buffer_size,
         m_index_buffer_view, index_buffer_size);
 
-    m_index_buffer_view.Format = DXGI_FORMAT_R32_UINT;
+    m_index_buffer_view.Format = use_32_bit ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+}
+
+void Mesh::split_index_ranges_into_lods(UINT index_count, const std::vector<Mesh_lod>& lods)
+{
+    // The ranges from compact_indices can span several levels, so they are cut at the ends
+    // of the levels. Both are whole triangles, so the pieces are too.
+    const std::vector<Index_range> all_ranges = m_index_ranges;
+    auto ranges_of_level = [&](UINT start, UINT count)
+    {
+        std::vector<Index_range> ranges;
+        for (auto& r : all_ranges)
+        {
+            const UINT first = std::max(start, r.start_index);
+            const UINT end = std::min(start + count, r.start_index + r.index_count);
+            if (first < end)
+                ranges.push_back({ first, end - first, r.base_vertex });
+        }
+        return ranges;
+    };
+
+    m_index_count = index_count;
+    m_index_ranges = ranges_of_level(0, index_count);
+    m_lod_ranges = { m_index_ranges };
+    m_lod_errors = { 0.0f };
+    UINT start = index_count;
+    for (auto& lod : lods)
+    {
+        const UINT count = static_cast<UINT>(lod.indices.size());
+        m_lod_ranges.push_back(ranges_of_level(start, count));
+        m_lod_errors.push_back(lod.error);
+        start += count;
+    }
+}
+
+void Mesh::store_triangle_indices(const Compact_indices& indices)
+{
+    // The sorted triangles are drawn with one call, so the ranges and their base vertices
+    // can't be used, and the indices have to be those of the whole vertex buffer.
+    const bool use_32_bit = !indices.indices_32.empty();
+    m_triangle_indices.reserve(m_index_count);
+    for (auto& range : m_index_ranges)
+        for (UINT i = range.start_index; i < range.start_index + range.index_count; ++i)
+            m_triangle_indices.push_back(range.base_vertex +
+                (use_32_bit ? indices.indices_32[i] : indices.indices_16[i]));
+}
+
+void Mesh::store_occluder(const Vertices& vertices, const std::vector<int>& indices)
+{
+    if (indices.size() / vertex_count_per_face > max_occluder_triangles)
+        return;
+    // Only the vertices that the triangles use are kept.
+    std::vector<int> remap(vertices.positions.size(), -1);
+    m_occluder_indices.reserve(indices.size());
+    for (int index : indices)
+    {
+        if (remap[index] < 0)
+        {
+            remap[index] = static_cast<int>(m_occluder_vertices.size());
+            auto& p = vertices.positions[index];
+            m_occluder_vertices.push_back({ p.x, p.y, p.z });
+        }
+        m_occluder_indices.push_back(static_cast<UINT>(remap[index]));
+    }
 }
 
 void calculate_tangent_space_basis(DirectX::XMVECTOR v[vertex_count_per_face],
@@ -319,3 +496,30 @@ void Instance_data::upload_new_data_to_gpu(ID3D12GraphicsCommandList& command_li
     upload_new_data(command_list, instance_data.data(), m_instance_vertex_buffer, m_upload_resource,
         m_vertex_buffer_size, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
 }
+
+UINT Dynamic_index_buffer::index_size(size_t vertex_count)
+{
+    constexpr size_t max_vertex_count_of_16_bit = 1 << 16;
+    return vertex_count <= max_vertex_count_of_16_bit ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+Dynamic_index_buffer::Dynamic_index_buffer(ID3D12Device& device, UINT index_count,
+    size_t vertex_count)
+{
+    const UINT size = index_count * index_size(vertex_count);
+    create_upload_heap(device, size, m_upload_resource);
+    create_gpu_buffer(device, size, m_index_buffer, D3D12_RESOURCE_STATE_INDEX_BUFFER);
+    m_index_buffer_view.BufferLocation = m_index_buffer->GetGPUVirtualAddress();
+    m_index_buffer_view.SizeInBytes = size;
+    m_index_buffer_view.Format = index_size(vertex_count) == sizeof(uint16_t) ?
+        DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+
+    SET_DEBUG_NAME(m_index_buffer, L"Dynamic Index Buffer");
+}
+
+void Dynamic_index_buffer::upload_new_data_to_gpu(ID3D12GraphicsCommandList& command_list,
+    const void* indices)
+{
+    upload_new_data(command_list, indices, m_index_buffer, m_upload_resource,
+        m_index_buffer_view.SizeInBytes, D3D12_RESOURCE_STATE_INDEX_BUFFER);
+}
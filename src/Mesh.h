@@ -37,7 +37,60 @@ struct Vertices
     std::vector<Vertex_color> colors;
 };
 
+// The compact format uses half the memory, see Vertex_compression.h.
+enum class Vertex_format { full, compact };
+
+// The positions of the compact vertex format are relative to the bounding box of the mesh.
+// The vertex shaders get them as offset + quantized_position * scale.
+struct Position_dequantization
+{
+    DirectX::XMFLOAT4 offset;
+    DirectX::XMFLOAT4 scale;
+};
+
 enum class Input_layout;
+struct Compact_indices;
+
+// A part of an index buffer, with indices that are relative to base_vertex.
+struct Index_range
+{
+    UINT start_index;
+    UINT index_count;
+    int base_vertex;
+};
+
+// What is drawn of a mesh, e.g. the ranges of a level of detail or of the visible meshlets, in
+// the mesh's index buffer or in one of sorted triangles.
+struct Draw_ranges
+{
+    const D3D12_INDEX_BUFFER_VIEW* index_buffer;
+    const Index_range* ranges;
+    UINT range_count;
+};
+
+// A simplified version of a mesh, that uses the same vertices. See Mesh_simplifier.h.
+struct Mesh_lod
+{
+    std::vector<int> indices;
+    float error; // The biggest distance from the full mesh, in model space.
+};
+
+// A cluster of triangles with bounds for culling, see Meshlets.h. The bounds are in model space.
+struct Meshlet
+{
+    Index_range range;
+    DirectX::XMFLOAT4 bounding_sphere; // Center and radius.
+    DirectX::XMFLOAT3 aabb_min;
+    DirectX::XMFLOAT3 aabb_max;
+    // All the triangle normals are within a cone around axis, and cutoff is the sine of its
+    // half angle. The meshlet is backfacing when seen from anywhere in the opposite cone, with
+    // its tip at apex. A cutoff of 1 means that it can't be culled that way.
+    DirectX::XMFLOAT3 cone_apex;
+    DirectX::XMFLOAT3 cone_axis;
+    float cone_cutoff;
+};
+
+constexpr int vertex_count_per_face = 3;
 
 class Mesh
 {
@@ -47,27 +100,77 @@ public:
     Mesh(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
         const Vertices& vertices, const std::vector<int>& indices, const std::string& name,
         bool transparent = false);
+    // The levels of detail are stored after the full mesh, in the same index buffer.
+    Mesh(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+        const Vertices& vertices, const std::vector<int>& indices,
+        const std::vector<Mesh_lod>& lods, const std::string& name, bool transparent = false);
 
     void set_buffer_debug_names(const std::string& name);
 
     void release_temp_resources();
 
-    void draw(ID3D12GraphicsCommandList& command_list, int draw_instances_count,
-        Input_layout input_layout, int triangle_index) const;
-
-    int triangles_count() const;
-    size_t vertices_count() const;
-    DirectX::XMVECTOR center(int triangle_index) const;
+    // A mesh is drawn by setting its vertex buffers and an index buffer, and then drawing
+    // ranges of that. Draws of the same mesh that follow each other, e.g. of the objects of an
+    // array, then only set the buffers once, see Render_queue.
+    void set_vertex_buffers(ID3D12GraphicsCommandList& command_list,
+        Input_layout input_layout) const;
+    const D3D12_INDEX_BUFFER_VIEW& index_buffer_view() const { return m_index_buffer_view; }
+    static void draw(ID3D12GraphicsCommandList& command_list, int draw_instances_count,
+        const Index_range* ranges, UINT range_count);
+
+    int triangles_count() const { return m_index_count / vertex_count_per_face; }
+    size_t vertices_count() const { return m_vertices_count; }
+    size_t index_buffer_size() const { return m_index_buffer_size; }
+    DirectX::XMVECTOR center() const;
+    // The bounds of the vertices, in model space, which the objects are culled with, see
+    // Scene_impl::cull_render_queues.
+    const DirectX::XMFLOAT3& aabb_min() const { return m_aabb_min; }
+    const DirectX::XMFLOAT3& aabb_max() const { return m_aabb_max; }
+
+    // Only kept for transparent meshes, which have their triangles sorted back to front with
+    // these, see Triangle_sorting.h. The indices are those of the vertex buffer, i.e. with the
+    // base vertex of their range added.
+    const std::vector<DirectX::XMFLOAT3>& triangle_centers() const { return m_triangle_centers; }
+    const std::vector<UINT>& triangle_indices() const { return m_triangle_indices; }
+
+    // Only kept for the opaque meshes with few triangles, e.g. walls, which are rasterized on
+    // the CPU as occluders, see Occlusion_buffer.h. The indices are of these vertices, which
+    // are in model space.
+    const std::vector<DirectX::XMFLOAT3>& occluder_vertices() const
+    { return m_occluder_vertices; }
+    const std::vector<UINT>& occluder_indices() const { return m_occluder_indices; }
+
+    Vertex_format vertex_format() const { return m_vertex_format; }
+    const Position_dequantization& position_dequantization() const
+    { return m_position_dequantization; }
+    const std::vector<Meshlet>& meshlets() const { return m_meshlets; }
+    // Level 0 is the full mesh, with error 0.
+    int lod_count() const { return static_cast<int>(m_lod_errors.size()); }
+    const std::vector<float>& lod_errors() const { return m_lod_errors; }
+    const std::vector<Index_range>& lod_ranges(int lod) const { return m_lod_ranges[lod]; }
 
     static int draw_calls() { return s_draw_calls; }
     static void reset_draw_calls() { s_draw_calls = 0; }
 
+    // The format of the meshes that are created after this. It should be set before any
+    // meshes are created, since the pipeline states are created for one of the formats.
+    static void set_default_vertex_format(Vertex_format format)
+    { s_default_vertex_format = format; }
+    static Vertex_format default_vertex_format() { return s_default_vertex_format; }
+
 private:
 
     void create_and_fill_vertex_buffers(const Vertices& vertices, const std::vector<int>& indices,
-        ID3D12Device& device, ID3D12GraphicsCommandList& command_list, bool transparent);
-    void create_and_fill_index_buffer(const std::vector<int>& indices, ID3D12Device& device, 
+        const std::vector<int>& vertex_remap, ID3D12Device& device,
+        ID3D12GraphicsCommandList& command_list, bool transparent);
+    void calculate_bounds(const Vertices& vertices);
+    void create_and_fill_compact_vertex_buffers(const Vertices& vertices, ID3D12Device& device,
+        ID3D12GraphicsCommandList& command_list);
+    void create_and_fill_index_buffer(const Compact_indices& indices, ID3D12Device& device, 
         ID3D12GraphicsCommandList& command_list);
+    void split_index_ranges_into_lods(UINT index_count, const std::vector<Mesh_lod>& lods);
+    void store_triangle_indices(const Compact_indices& indices);
+    void store_occluder(const Vertices& vertices, const std::vector<int>& indices);
 
 
     ComPtr<ID3D12Resource> m_vertex_positions_buffer;
@@ -85,24 +188,48 @@ private:
     ComPtr<ID3D12Resource> m_vertex_colors_buffer;
     D3D12_VERTEX_BUFFER_VIEW m_vertex_colors_buffer_view;
 
+    // Only used by the compact vertex format, which also uses the positions and colors buffers.
+    ComPtr<ID3D12Resource> m_vertex_tangent_frames_buffer;
+    D3D12_VERTEX_BUFFER_VIEW m_vertex_tangent_frames_buffer_view;
+
+    ComPtr<ID3D12Resource> m_vertex_texture_coords_buffer;
+    D3D12_VERTEX_BUFFER_VIEW m_vertex_texture_coords_buffer_view;
+
     ComPtr<ID3D12Resource> m_index_buffer;
     D3D12_INDEX_BUFFER_VIEW m_index_buffer_view;
     UINT m_index_count;
+    size_t m_index_buffer_size;
+    std::vector<Index_range> m_index_ranges;
+    std::vector<Meshlet> m_meshlets;
+    std::vector<std::vector<Index_range>> m_lod_ranges;
+    std::vector<float> m_lod_errors;
     size_t m_vertices_count;
-    std::vector<DirectX::XMFLOAT3> m_centers;
+    DirectX::XMFLOAT3 m_center;
+    DirectX::XMFLOAT3 m_aabb_min;
+    DirectX::XMFLOAT3 m_aabb_max;
+    std::vector<DirectX::XMFLOAT3> m_triangle_centers;
+    std::vector<UINT> m_triangle_indices;
+    std::vector<DirectX::XMFLOAT3> m_occluder_vertices;
+    std::vector<UINT> m_occluder_indices;
+
+    Vertex_format m_vertex_format;
+    Position_dequantization m_position_dequantization;
 
     static int s_draw_calls;
+    static Vertex_format s_default_vertex_format;
 
     ComPtr<ID3D12Resource> m_temp_upload_resource_vb_pos;
     ComPtr<ID3D12Resource> m_temp_upload_resource_vb_normals;
     ComPtr<ID3D12Resource> m_temp_upload_resource_vb_tangents;
     ComPtr<ID3D12Resource> m_temp_upload_resource_vb_bitangents;
     ComPtr<ID3D12Resource> m_temp_upload_resource_vb_colors;
+    ComPtr<ID3D12Resource> m_temp_upload_resource_vb_tangent_frames;
+    ComPtr<ID3D12Resource> m_temp_upload_resource_vb_texture_coords;
     ComPtr<ID3D12Resource> m_temp_upload_resource_ib;
     bool m_transparent;
 };
 
-constexpr int vertex_count_per_face = 3;
+// Per face versions. See Tangent_space.h for whole meshes at a time, which is much faster.
 void calculate_tangent_space_basis(DirectX::XMVECTOR v[vertex_count_per_face],
     DirectX::XMVECTOR uv[vertex_count_per_face],
     DirectX::XMVECTOR& tangent, DirectX::XMVECTOR& bitangent);
@@ -172,3 +299,20 @@ private:
     D3D12_GPU_DESCRIPTOR_HANDLE m_structured_buffer_gpu_descriptor_handle;
     UINT m_vertex_buffer_size;
 };
+
+// An index buffer that is rewritten every frame, e.g. with the triangles of a transparent mesh
+// in back to front order. The GPU can still be reading the one of the previous frame, so there
+// should be one per swap chain buffer.
+class Dynamic_index_buffer
+{
+public:
+    // 16 bit indices are used when the vertices can be addressed with them, see index_size.
+    Dynamic_index_buffer(ID3D12Device& device, UINT index_count, size_t vertex_count);
+    void upload_new_data_to_gpu(ID3D12GraphicsCommandList& command_list, const void* indices);
+    const D3D12_INDEX_BUFFER_VIEW& view() const { return m_index_buffer_view; }
+    static UINT index_size(size_t vertex_count);
+private:
+    ComPtr<ID3D12Resource> m_index_buffer;
+    ComPtr<ID3D12Resource> m_upload_resource;
+    D3D12_INDEX_BUFFER_VIEW m_index_buffer_view;
+};
@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Mesh_cache.h"
+#include "Memory_mapped_file.h"
+
+#include <filesystem>
+
+
+using std::vector;
+using std::map;
+using std::string;
+
+
+namespace
+{
+    // Increase this when the format, or what the parser produces, changes.
+    constexpr uint32_t mesh_cache_version = 3;
+
+    struct Mesh_cache_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t flip_v;
+        // The sizes of the vertex elements, so that a changed vertex layout invalidates it.
+        uint32_t element_sizes[5];
+        uint32_t dependency_count;
+        uint64_t material_count;
+        uint64_t object_count;
+    };
+
+    constexpr char magic[8] = { 'J', 'M', 'E', 'S', 'H', 0, 0, 0 };
+
+    Mesh_cache_header header(Obj_flip_v flip_v, size_t dependency_count,
+        size_t material_count, size_t object_count)
+    {
+        Mesh_cache_header h = {};
+        memcpy(h.magic, magic, sizeof(magic));
+        h.version = mesh_cache_version;
+        h.flip_v = flip_v == Obj_flip_v::yes ? 1 : 0;
+        h.element_sizes[0] = sizeof(Vertex_position);
+        h.element_sizes[1] = sizeof(Vertex_normal);
+        h.element_sizes[2] = sizeof(Vertex_tangent);
+        h.element_sizes[3] = sizeof(Vertex_bitangent);
+        h.element_sizes[4] = sizeof(Vertex_color);
+        h.dependency_count = static_cast<uint32_t>(dependency_count);
+        h.material_count = material_count;
+        h.object_count = object_count;
+        return h;
+    }
+
+
+    class Writer
+    {
+    public:
+        Writer(const string& file_name) : m_file(file_name, std::ios::binary) {}
+        bool good() const { return m_file.good(); }
+
+        template<typename T>
+        void write(const T& value)
+        {
+            m_file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        void write(const string& text)
+        {
+            write(static_cast<uint32_t>(text.size()));
+            m_file.write(text.data(), text.size());
+        }
+
+        template<typename T>
+        void write(const vector<T>& elements)
+        {
+            write(static_cast<uint64_t>(elements.size()));
+            m_file.write(reinterpret_cast<const char*>(elements.data()),
+                elements.size() * sizeof(T));
+        }
+    private:
+        std::ofstream m_file;
+    };
+
+
+    // Reads from the memory mapped file, and fails instead of reading past the end.
+    class Reader
+    {
+    public:
+        Reader(const char* begin, const char* end) : m_position(begin), m_end(end),
+            m_good(begin != nullptr) {}
+        bool good() const { return m_good; }
+
+        template<typename T>
+        void read(T& value)
+        {
+            if (available(sizeof(T)))
+            {
+                memcpy(&value, m_position, sizeof(T));
+                m_position += sizeof(T);
+            }
+        }
+
+        void read(string& text)
+        {
+            uint32_t size = 0;
+            read(size);
+            if (available(size))
+            {
+                text.assign(m_position, size);
+                m_position += size;
+            }
+        }
+
+        template<typename T>
+        void read(vector<T>& elements)
+        {
+            uint64_t count = 0;
+            read(count);
+            if (available(0) && count <= static_cast<uint64_t>(m_end - m_position) / sizeof(T))
+            {
+                elements.resize(static_cast<size_t>(count));
+                memcpy(elements.data(), m_position, elements.size() * sizeof(T));
+                m_position += elements.size() * sizeof(T);
+            }
+            else
+                m_good = false;
+        }
+    private:
+        bool available(size_t size)
+        {
+            m_good = m_good && size <= static_cast<size_t>(m_end - m_position);
+            return m_good;
+        }
+
+        const char* m_position;
+        const char* m_end;
+        bool m_good;
+    };
+}
+
+
+bool operator==(const File_stamp& s1, const File_stamp& s2)
+{
+    return s1.size == s2.size && s1.modification_time == s2.modification_time;
+}
+
+bool file_stamp(const string& file_name, File_stamp& stamp)
+{
+    namespace fs = std::filesystem;
+    std::error_code error;
+    stamp.size = fs::file_size(file_name, error);
+    if (error)
+        return false;
+    auto time = fs::last_write_time(file_name, error);
+    stamp.modification_time = time.time_since_epoch().count();
+    return !error;
+}
+
+string mesh_cache_file_name(const string& model_file)
+{
+    return model_file + ".jmesh";
+}
+
+bool read_mesh_cache(const string& model_file, Obj_flip_v flip_v, vector<Obj_object>& objects,
+    map<string, Material>& materials, vector<string>* material_files/* = nullptr*/)
+{
+    Memory_mapped_file file(mesh_cache_file_name(model_file));
+    Reader reader(file.begin(), file.end());
+
+    Mesh_cache_header h = {};
+    reader.read(h);
+    const Mesh_cache_header expected = header(flip_v, h.dependency_count, h.material_count,
+        h.object_count);
+    if (!reader.good() || memcmp(&h, &expected, sizeof(h)) != 0)
+        return false;
+
+    // The first dependency is the model file, and the rest are its mtl files.
+    vector<string> dependencies;
+    for (uint32_t i = 0; i < h.dependency_count; ++i)
+    {
+        string dependency;
+        File_stamp cached;
+        File_stamp current;
+        reader.read(dependency);
+        reader.read(cached);
+        if (!reader.good() || !file_stamp(dependency, current) || !(current == cached))
+            return false;
+        dependencies.push_back(std::move(dependency));
+    }
+
+    map<string, Material> cached_materials;
+    for (uint64_t i = 0; i < h.material_count && reader.good(); ++i)
+    {
+        string name;
+        Material material = {};
+        reader.read(name);
+        reader.read(material.diffuse_map);
+        reader.read(material.normal_map);
+        reader.read(material.ao_roughness_metalness_map);
+        reader.read(material.settings);
+        material.id = -1;
+        cached_materials[name] = material;
+    }
+
+    vector<Obj_object> cached_objects;
+    for (uint64_t i = 0; i < h.object_count && reader.good(); ++i)
+    {
+        cached_objects.emplace_back();
+        Obj_object& object = cached_objects.back();
+        reader.read(object.material);
+        reader.read(object.vertices.positions);
+        reader.read(object.vertices.normals);
+        reader.read(object.vertices.tangents);
+        reader.read(object.vertices.bitangents);
+        reader.read(object.vertices.colors);
+        reader.read(object.indices);
+        uint64_t lod_count = 0;
+        reader.read(lod_count);
+        for (uint64_t j = 0; j < lod_count && reader.good(); ++j)
+        {
+            object.lods.emplace_back();
+            reader.read(object.lods.back().indices);
+            reader.read(object.lods.back().error);
+        }
+    }
+
+    if (!reader.good())
+        return false;
+
+    objects = std::move(cached_objects);
+    materials = std::move(cached_materials);
+    if (material_files && !dependencies.empty())
+        material_files->insert(material_files->end(), dependencies.begin() + 1,
+            dependencies.end());
+    return true;
+}
+
+bool write_mesh_cache(const string& model_file, Obj_flip_v flip_v,
+    const vector<Obj_object>& objects, const map<string, Material>& materials,
+    const vector<string>& material_files)
+{
+    vector<string> dependencies = { model_file };
+    dependencies.insert(dependencies.end(), material_files.begin(), material_files.end());
+    vector<File_stamp> stamps(dependencies.size());
+    for (size_t i = 0; i < dependencies.size(); ++i)
+        if (!file_stamp(dependencies[i], stamps[i]))
+            return false;
+
+    const string file_name = mesh_cache_file_name(model_file);
+    {
+        Writer writer(file_name);
+        writer.write(header(flip_v, dependencies.size(), materials.size(), objects.size()));
+
+        for (size_t i = 0; i < dependencies.size(); ++i)
+        {
+            writer.write(dependencies[i]);
+            writer.write(stamps[i]);
+        }
+
+        for (auto& m : materials)
+        {
+            writer.write(m.first);
+            writer.write(m.second.diffuse_map);
+            writer.write(m.second.normal_map);
+            writer.write(m.second.ao_roughness_metalness_map);
+            writer.write(m.second.settings);
+        }
+
+        for (auto& object : objects)
+        {
+            writer.write(object.material);
+            writer.write(object.vertices.positions);
+            writer.write(object.vertices.normals);
+            writer.write(object.vertices.tangents);
+            writer.write(object.vertices.bitangents);
+            writer.write(object.vertices.colors);
+            writer.write(object.indices);
+            writer.write(static_cast<uint64_t>(object.lods.size()));
+            for (auto& lod : object.lods)
+            {
+                writer.write(lod.indices);
+                writer.write(lod.error);
+            }
+        }
+
+        if (writer.good())
+            return true;
+    }
+
+    std::remove(file_name.c_str()); // Don't leave a partially written cache.
+    return false;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Wavefront_obj_file.h"
+
+
+// A binary cache of a parsed model file, with its materials. It is stored next to the model
+// file, see mesh_cache_file_name. The cache is only used if it has the same version and
+// vertex layout as this build, and if the model file and the mtl files that it depends on
+// have the same sizes and modification times as when the cache was written.
+
+std::string mesh_cache_file_name(const std::string& model_file);
+
+// Returns false if there is no valid cache for the model file, in which case objects and
+// materials are not changed. The mtl files that the cache depends on are added to
+// material_files, if given.
+bool read_mesh_cache(const std::string& model_file, Obj_flip_v flip_v,
+    std::vector<Obj_object>& objects, std::map<std::string, Material>& materials,
+    std::vector<std::string>* material_files = nullptr);
+
+// Returns false if the cache could not be written, for example because the directory of the
+// model file is read only.
+bool write_mesh_cache(const std::string& model_file, Obj_flip_v flip_v,
+    const std::vector<Obj_object>& objects, const std::map<std::string, Material>& materials,
+    const std::vector<std::string>& material_files);
+
+// The size and modification time of a file, which the caches are checked against.
+struct File_stamp
+{
+    uint64_t size;
+    int64_t modification_time;
+};
+
+bool operator==(const File_stamp& s1, const File_stamp& s2);
+
+// Returns false if the file does not exist.
+bool file_stamp(const std::string& file_name, File_stamp& stamp);
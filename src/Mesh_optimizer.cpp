@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Mesh_optimizer.h"
+
+
+using std::vector;
+
+
+namespace
+{
+    // A FIFO cache simulated with time stamps: a vertex is in the cache if fewer than
+    // cache_size vertices have been added after it. This makes it cheap to flush it.
+    class Fifo_cache
+    {
+    public:
+        Fifo_cache(size_t vertex_count, int cache_size) : m_times(vertex_count, 0),
+            m_time(cache_size + 1), m_cache_size(cache_size) {}
+
+        // Returns true if it was a miss.
+        bool add(int vertex)
+        {
+            if (contains(vertex))
+                return false;
+            m_times[vertex] = m_time++;
+            return true;
+        }
+
+        int add_triangle(const int* triangle)
+        {
+            return add(triangle[0]) + add(triangle[1]) + add(triangle[2]);
+        }
+
+        bool contains(int vertex) const { return age(vertex) <= m_cache_size; }
+        int age(int vertex) const { return static_cast<int>(m_time - m_times[vertex]); }
+        void flush() { m_time += m_cache_size + 1; }
+    private:
+        vector<unsigned int> m_times;
+        unsigned int m_time;
+        const int m_cache_size;
+    };
+
+    // The triangles that use each vertex, in one array.
+    struct Vertex_triangles
+    {
+        Vertex_triangles(const vector<int>& indices, size_t vertex_count) :
+            offsets(vertex_count + 1, 0), triangles(indices.size())
+        {
+            for (int index : indices)
+                ++offsets[index + 1];
+            for (size_t i = 0; i < vertex_count; ++i)
+                offsets[i + 1] += offsets[i];
+            vector<int> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); ++i)
+                triangles[fill[indices[i]]++] = static_cast<int>(i / vertex_count_per_face);
+        }
+
+        int count(int vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+
+        vector<int> offsets;
+        vector<int> triangles;
+    };
+}
+
+
+Vertex_cache_statistics simulate_vertex_cache(const vector<int>& indices, size_t vertex_count,
+    int cache_size/* = vertex_cache_size*/)
+{
+    Fifo_cache cache(vertex_count, cache_size);
+    vector<bool> used(vertex_count, false);
+    int misses = 0;
+    int used_count = 0;
+    for (int index : indices)
+    {
+        misses += cache.add(index);
+        if (!used[index])
+        {
+            used[index] = true;
+            ++used_count;
+        }
+    }
+
+    const size_t triangle_count = indices.size() / vertex_count_per_face;
+    Vertex_cache_statistics statistics = { 0.0f, 0.0f };
+    if (triangle_count != 0)
+        statistics.acmr = static_cast<float>(misses) / triangle_count;
+    if (used_count != 0)
+        statistics.atvr = static_cast<float>(misses) / used_count;
+    return statistics;
+}
+
+vector<int> optimize_vertex_cache(vector<int>& indices, size_t vertex_count,
+    int cache_size/* = vertex_cache_size*/)
+{
+    const Vertex_triangles adjacency(indices, vertex_count);
+    const int triangle_count = static_cast<int>(indices.size() / vertex_count_per_face);
+
+    vector<int> live_triangles(vertex_count);
+    for (size_t i = 0; i < vertex_count; ++i)
+        live_triangles[i] = adjacency.count(static_cast<int>(i));
+
+    Fifo_cache cache(vertex_count, cache_size);
+    vector<bool> emitted(triangle_count, false);
+    vector<int> dead_end_stack;
+    vector<int> candidates;
+    int scan_position = 0;
+
+    vector<int> output;
+    output.reserve(indices.size());
+    vector<int> hard_clusters;
+
+    auto next_dead_end_vertex = [&]() {
+        while (!dead_end_stack.empty())
+        {
+            const int vertex = dead_end_stack.back();
+            dead_end_stack.pop_back();
+            if (live_triangles[vertex] > 0)
+                return vertex;
+        }
+        for (; scan_position < static_cast<int>(vertex_count); ++scan_position)
+            if (live_triangles[scan_position] > 0)
+                return scan_position;
+        return -1;
+    };
+
+    int fanning_vertex = vertex_count != 0 ? next_dead_end_vertex() : -1;
+    while (fanning_vertex != -1)
+    {
+        if (candidates.empty())
+            hard_clusters.push_back(static_cast<int>(output.size()) / vertex_count_per_face);
+
+        candidates.clear();
+        const int* first = &adjacency.triangles[adjacency.offsets[fanning_vertex]];
+        const int* last = first + adjacency.count(fanning_vertex);
+        for (const int* triangle = first; triangle != last; ++triangle)
+        {
+            if (emitted[*triangle])
+                continue;
+            emitted[*triangle] = true;
+            for (int i = 0; i < vertex_count_per_face; ++i)
+            {
+                const int vertex = indices[*triangle * vertex_count_per_face + i];
+                output.push_back(vertex);
+                dead_end_stack.push_back(vertex);
+                candidates.push_back(vertex);
+                --live_triangles[vertex];
+                cache.add(vertex);
+            }
+        }
+
+        // Choose the candidate that will still be in the cache when all its remaining
+        // triangles have been emitted, and of those the one that has been in it the longest.
+        int next = -1;
+        int best_priority = -1;
+        for (int vertex : candidates)
+        {
+            if (live_triangles[vertex] <= 0)
+                continue;
+            int priority = 0;
+            if (cache.age(vertex) + 2 * live_triangles[vertex] <= cache_size)
+                priority = cache.age(vertex);
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                next = vertex;
+            }
+        }
+        if (next == -1)
+        {
+            candidates.clear(); // Marks that the next triangle starts a new cluster.
+            next = next_dead_end_vertex();
+        }
+        fanning_vertex = next;
+    }
+
+    indices = std::move(output);
+    return hard_clusters;
+}
+
+void optimize_overdraw(vector<int>& indices, const vector<Vertex_position>& positions,
+    const vector<int>& hard_clusters, float threshold/* = 1.05f*/,
+    int cache_size/* = vertex_cache_size*/)
+{
+    using namespace DirectX;
+
+    const int triangle_count = static_cast<int>(indices.size() / vertex_count_per_face);
+    if (hard_clusters.empty() || triangle_count == 0)
+        return;
+
+    // Splits the hard clusters as soon as the part so far has a cache miss ratio that is
+    // good enough compared to the whole of it.
+    vector<int> clusters;
+    Fifo_cache cache(positions.size(), cache_size);
+    for (size_t h = 0; h < hard_clusters.size(); ++h)
+    {
+        const int start = hard_clusters[h];
+        const int end = h + 1 < hard_clusters.size() ? hard_clusters[h + 1] : triangle_count;
+
+        cache.flush();
+        int misses = 0;
+        for (int t = start; t < end; ++t)
+            misses += cache.add_triangle(&indices[t * vertex_count_per_face]);
+        const float limit = threshold * misses / (end - start);
+
+        cache.flush();
+        clusters.push_back(start);
+        misses = 0;
+        for (int t = start; t < end - 1; ++t)
+        {
+            misses += cache.add_triangle(&indices[t * vertex_count_per_face]);
+            if (misses <= limit * (t + 1 - clusters.back()))
+            {
+                clusters.push_back(t + 1);
+                misses = 0;
+                cache.flush();
+            }
+        }
+    }
+    const int cluster_count = static_cast<int>(clusters.size());
+    clusters.push_back(triangle_count);
+
+    // The area weighted center and the normal of each cluster.
+    vector<XMFLOAT3> cluster_centers(cluster_count);
+    vector<XMFLOAT3> cluster_normals(cluster_count);
+    XMVECTOR mesh_center_sum = XMVectorZero();
+    float mesh_area = 0.0f;
+    for (int c = 0; c < cluster_count; ++c)
+    {
+        XMVECTOR center_sum = XMVectorZero();
+        XMVECTOR normal_sum = XMVectorZero();
+        float area = 0.0f;
+        for (int t = clusters[c]; t < clusters[c + 1]; ++t)
+        {
+            const int* triangle = &indices[t * vertex_count_per_face];
+            XMVECTOR p0 = XMLoadFloat4(&positions[triangle[0]]);
+            XMVECTOR p1 = XMLoadFloat4(&positions[triangle[1]]);
+            XMVECTOR p2 = XMLoadFloat4(&positions[triangle[2]]);
+            XMVECTOR normal = XMVector3Cross(p1 - p0, p2 - p0);
+            const float triangle_area = XMVectorGetX(XMVector3Length(normal)) * 0.5f;
+            center_sum += (p0 + p1 + p2) * (triangle_area / vertex_count_per_face);
+            normal_sum += normal;
+            area += triangle_area;
+        }
+        mesh_center_sum += center_sum;
+        mesh_area += area;
+        if (area > 0.0f)
+            center_sum = center_sum / area;
+        XMStoreFloat3(&cluster_centers[c], center_sum);
+        XMStoreFloat3(&cluster_normals[c], XMVector3Normalize(normal_sum));
+    }
+    if (mesh_area == 0.0f)
+        return;
+    const XMVECTOR mesh_center = mesh_center_sum / mesh_area;
+
+    vector<float> sort_keys(cluster_count);
+    for (int c = 0; c < cluster_count; ++c)
+        sort_keys[c] = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&cluster_centers[c]) -
+            mesh_center, XMLoadFloat3(&cluster_normals[c])));
+
+    vector<int> order(cluster_count);
+    for (int c = 0; c < cluster_count; ++c)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return sort_keys[a] > sort_keys[b];
+    });
+
+    vector<int> output;
+    output.reserve(indices.size());
+    for (int c : order)
+        output.insert(output.end(), indices.begin() + clusters[c] * vertex_count_per_face,
+            indices.begin() + clusters[c + 1] * vertex_count_per_face);
+    indices = std::move(output);
+}
+
+namespace
+{
+    template<typename T>
+    void reorder(vector<T>& elements, const vector<int>& new_positions, int new_count)
+    {
+        if (elements.empty())
+            return;
+        // The streams shorter than the positions, which can happen for the colors, are
+        // extended with zeros. That is the same as what the GPU reads outside of a buffer.
+        vector<T> reordered(new_count);
+        for (size_t i = 0; i < elements.size() && i < new_positions.size(); ++i)
+            if (new_positions[i] != -1)
+                reordered[new_positions[i]] = elements[i];
+        elements = std::move(reordered);
+    }
+}
+
+void optimize_vertex_fetch(Vertices& vertices, vector<int>& indices)
+{
+    vector<int> new_positions(vertices.positions.size(), -1);
+    int new_count = 0;
+    for (int& index : indices)
+    {
+        if (new_positions[index] == -1)
+            new_positions[index] = new_count++;
+        index = new_positions[index];
+    }
+
+    reorder(vertices.positions, new_positions, new_count);
+    reorder(vertices.normals, new_positions, new_count);
+    reorder(vertices.tangents, new_positions, new_count);
+    reorder(vertices.bitangents, new_positions, new_count);
+    reorder(vertices.colors, new_positions, new_count);
+}
+
+Mesh_optimization_result optimize_mesh(Vertices& vertices, vector<int>& indices)
+{
+    const size_t vertex_count = vertices.positions.size();
+    Mesh_optimization_result result = {};
+    if (indices.size() % vertex_count_per_face != 0 ||
+        std::any_of(indices.begin(), indices.end(), [&](int index) {
+            return index < 0 || static_cast<size_t>(index) >= vertex_count; }))
+        return result; // Malformed, leave it as it is.
+
+    result.before = simulate_vertex_cache(indices, vertex_count);
+
+    auto hard_clusters = optimize_vertex_cache(indices, vertex_count);
+    optimize_overdraw(indices, vertices.positions, hard_clusters);
+    optimize_vertex_fetch(vertices, indices);
+
+    result.after = simulate_vertex_cache(indices, vertices.positions.size());
+    return result;
+}
+
+Compact_indices compact_indices(const vector<int>& indices, size_t vertex_count)
+{
+    constexpr size_t max_16_bit_vertex_count = UINT16_MAX + 1;
+    const UINT index_count = static_cast<UINT>(indices.size());
+    Compact_indices result;
+
+    if (index_count % vertex_count_per_face != 0 ||
+        std::any_of(indices.begin(), indices.end(), [&](int index) {
+            return index < 0 || static_cast<size_t>(index) >= vertex_count; }))
+    {
+        result.indices_32 = indices; // Malformed, leave it as it is.
+        result.ranges = { { 0, index_count, 0 } };
+        return result;
+    }
+
+    result.indices_16.resize(indices.size());
+    if (vertex_count <= max_16_bit_vertex_count)
+    {
+        std::copy(indices.begin(), indices.end(), result.indices_16.begin());
+        if (index_count != 0)
+            result.ranges = { { 0, index_count, 0 } };
+        return result;
+    }
+
+    // Each range gets its own vertices, in the order that they are first used in it. The
+    // vertices that are used by more than one range are duplicated.
+    vector<int> range_of_vertex(vertex_count, -1);
+    vector<int> new_index(vertex_count);
+    int range = -1;
+    for (UINT i = 0; i < index_count; i += vertex_count_per_face)
+    {
+        const int* triangle = &indices[i];
+        int new_vertices = 0;
+        for (int j = 0; j < vertex_count_per_face; ++j)
+            if (range_of_vertex[triangle[j]] != range &&
+                std::find(triangle, triangle + j, triangle[j]) == triangle + j)
+                ++new_vertices;
+
+        if (range == -1 || result.vertex_remap.size() - result.ranges.back().base_vertex +
+            new_vertices > max_16_bit_vertex_count)
+        {
+            ++range;
+            result.ranges.push_back({ i, 0, static_cast<int>(result.vertex_remap.size()) });
+        }
+
+        Index_range& r = result.ranges.back();
+        for (int j = 0; j < vertex_count_per_face; ++j)
+        {
+            const int vertex = triangle[j];
+            if (range_of_vertex[vertex] != range)
+            {
+                range_of_vertex[vertex] = range;
+                new_index[vertex] = static_cast<int>(result.vertex_remap.size());
+                result.vertex_remap.push_back(vertex);
+            }
+            result.indices_16[i + j] = static_cast<uint16_t>(new_index[vertex] - r.base_vertex);
+        }
+        r.index_count += vertex_count_per_face;
+    }
+    return result;
+}
+
+Vertices remapped_vertices(const Vertices& vertices, const vector<int>& vertex_remap)
+{
+    Vertices result;
+    auto remap = [&](const auto& in, auto& out) {
+        if (in.empty())
+            return;
+        out.resize(vertex_remap.size()); // Zeros for any vertices after shorter color streams.
+        for (size_t i = 0; i < vertex_remap.size(); ++i)
+            if (static_cast<size_t>(vertex_remap[i]) < in.size())
+                out[i] = in[vertex_remap[i]];
+    };
+    remap(vertices.positions, result.positions);
+    remap(vertices.normals, result.normals);
+    remap(vertices.tangents, result.tangents);
+    remap(vertices.bitangents, result.bitangents);
+    remap(vertices.colors, result.colors);
+    return result;
+}
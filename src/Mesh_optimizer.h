@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Mesh.h"
+
+
+// Reorders the triangles and vertices of indexed triangle lists to make them faster to render.
+// This is done in three stages, which should be run in this order:
+// 1. optimize_vertex_cache, so that the post transform vertex cache is reused as much as
+//    possible. It uses the Tipsify algorithm from "Fast Triangle Reordering for Vertex Locality
+//    and Reduced Overdraw" by Sander, Nehab and Barczak, 2007.
+// 2. optimize_overdraw, which, from the same paper, reorders clusters of triangles so that
+//    the ones facing away from the center of the mesh are drawn first, since they are more
+//    likely to occlude the others. It keeps the order within the clusters.
+// 3. optimize_vertex_fetch, which reorders the vertices in the order that they are first used,
+//    so that the vertex fetches become close to sequential.
+// optimize_mesh runs all of them.
+
+// I use a FIFO cache for the simulation, like the paper, since the caches in actual hardware
+// are not well documented, and this size gives orders that are good on a range of caches.
+constexpr int vertex_cache_size = 16;
+
+struct Vertex_cache_statistics
+{
+    // Average cache miss ratio, i.e. transformed vertices per triangle.
+    // 3 is the worst and about 0.5 is the best for big regular meshes.
+    float acmr;
+    // Average transformed vertices per vertex. 1 is the best, when every vertex is
+    // transformed only once.
+    float atvr;
+};
+
+Vertex_cache_statistics simulate_vertex_cache(const std::vector<int>& indices,
+    size_t vertex_count, int cache_size = vertex_cache_size);
+
+// Returns the first triangle of each hard cluster, i.e. where the algorithm had to start over
+// somewhere not connected to the previous triangles. It is used by optimize_overdraw.
+std::vector<int> optimize_vertex_cache(std::vector<int>& indices, size_t vertex_count,
+    int cache_size = vertex_cache_size);
+
+// The clusters are split further, as long as the vertex cache miss ratio of each of
+// them does not become worse than threshold times what it was before.
+void optimize_overdraw(std::vector<int>& indices, const std::vector<Vertex_position>& positions,
+    const std::vector<int>& hard_clusters, float threshold = 1.05f,
+    int cache_size = vertex_cache_size);
+
+// Vertices that are not used by any triangle are removed.
+void optimize_vertex_fetch(Vertices& vertices, std::vector<int>& indices);
+
+struct Mesh_optimization_result
+{
+    Vertex_cache_statistics before;
+    Vertex_cache_statistics after;
+};
+
+Mesh_optimization_result optimize_mesh(Vertices& vertices, std::vector<int>& indices);
+
+
+// The indices in the smallest format that can address the vertices. That is 16 bit indices,
+// which is enough for most meshes. Bigger meshes are split in ranges of triangles that use at
+// most 2^16 vertices each. Then each range gets its own copy of the vertices it uses,
+// starting at its base vertex, and vertex_remap tells which vertex each of the new vertices
+// is a copy of. The order of the triangles is kept.
+struct Compact_indices
+{
+    std::vector<uint16_t> indices_16;
+    std::vector<int> indices_32; // Only used for indices outside of the vertices.
+    std::vector<Index_range> ranges;
+    std::vector<int> vertex_remap; // Empty when the vertices are used as they are.
+};
+
+Compact_indices compact_indices(const std::vector<int>& indices, size_t vertex_count);
+
+Vertices remapped_vertices(const Vertices& vertices, const std::vector<int>& vertex_remap);
@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Mesh_simplifier.h"
+#include "Mesh_optimizer.h"
+
+#include <cfloat>
+#include <cstring>
+#include <unordered_map>
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    // The sum of the squared distances to a set of planes, weighted by the areas of the
+    // triangles that they come from. The symmetric 4x4 matrix is stored as its upper triangle.
+    struct Quadric
+    {
+        double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+        double weight;
+    };
+
+    void add(Quadric& q, const Quadric& other)
+    {
+        double* d = &q.a2;
+        const double* s = &other.a2;
+        for (int i = 0; i < 11; ++i)
+            d[i] += s[i];
+    }
+
+    void add_plane(Quadric& q, XMVECTOR p0, XMVECTOR p1, XMVECTOR p2)
+    {
+        const XMVECTOR cross = XMVector3Cross(p1 - p0, p2 - p0);
+        const float length = XMVectorGetX(XMVector3Length(cross));
+        if (length == 0.0f)
+            return;
+        const double area = 0.5 * length;
+        const XMVECTOR n = cross / length;
+        const double a = XMVectorGetX(n);
+        const double b = XMVectorGetY(n);
+        const double c = XMVectorGetZ(n);
+        const double d = -XMVectorGetX(XMVector3Dot(n, p0));
+        const Quadric plane = { a * a * area, a * b * area, a * c * area, a * d * area,
+            b * b * area, b * c * area, b * d * area, c * c * area, c * d * area, d * d * area,
+            area };
+        add(q, plane);
+    }
+
+    // The weighted mean distance to the planes, which is an approximation of the distance
+    // from the original surface.
+    float error(const Quadric& q, const Vertex_position& p)
+    {
+        const double x = p.x;
+        const double y = p.y;
+        const double z = p.z;
+        const double squared = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z +
+            2 * q.ad * x + q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y + q.c2 * z * z +
+            2 * q.cd * z + q.d2;
+        return q.weight > 0.0 ? static_cast<float>(std::sqrt(std::fmax(squared, 0.0) /
+            q.weight)) : 0.0f;
+    }
+
+    XMVECTOR load_position(const vector<Vertex_position>& positions, int index)
+    {
+        return XMVectorSetW(XMLoadFloat4(&positions[index]), 0.0f);
+    }
+
+    struct Position_hash
+    {
+        size_t operator()(const Vertex_position& p) const
+        {
+            uint32_t bits[3];
+            memcpy(&bits[0], &p.x, sizeof(float));
+            memcpy(&bits[1], &p.y, sizeof(float));
+            memcpy(&bits[2], &p.z, sizeof(float));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+
+    struct Position_equal
+    {
+        bool operator()(const Vertex_position& a, const Vertex_position& b) const
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z;
+        }
+    };
+
+    // The vertices that must not be moved: those on the border, on seams and on edges that are
+    // shared by more than two triangles.
+    vector<bool> locked_vertices(const vector<Vertex_position>& positions,
+        const vector<int>& indices)
+    {
+        // Vertices at the same position get the same group, which is the first of them.
+        vector<int> group(positions.size(), -1);
+        vector<int> vertices_in_group(positions.size(), 0);
+        std::unordered_map<Vertex_position, int, Position_hash, Position_equal> first_vertex;
+        for (int index : indices)
+        {
+            if (group[index] != -1)
+                continue;
+            auto inserted = first_vertex.insert({ positions[index], index });
+            group[index] = inserted.first->second;
+            ++vertices_in_group[group[index]];
+        }
+
+        // The edges are sorted, which is faster than counting them in a hash map, so that
+        // the number of triangles of each edge is the length of its run.
+        vector<uint64_t> edges;
+        edges.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+            for (int j = 0; j < vertex_count_per_face; ++j)
+            {
+                uint64_t g0 = group[indices[i + j]];
+                uint64_t g1 = group[indices[i + (j + 1) % vertex_count_per_face]];
+                if (g0 > g1)
+                    std::swap(g0, g1);
+                edges.push_back(g0 << 32 | g1);
+            }
+        std::sort(edges.begin(), edges.end());
+
+        vector<bool> locked(positions.size(), false);
+        for (size_t i = 0; i < edges.size();)
+        {
+            size_t end = i + 1;
+            while (end < edges.size() && edges[end] == edges[i])
+                ++end;
+            if (end - i != 2)
+            {
+                locked[static_cast<size_t>(edges[i] >> 32)] = true;
+                locked[static_cast<size_t>(edges[i] & UINT32_MAX)] = true;
+            }
+            i = end;
+        }
+
+        for (int index : indices)
+            if (locked[group[index]] || vertices_in_group[group[index]] > 1)
+                locked[index] = true;
+        return locked;
+    }
+
+    // The triangles of each vertex, as offsets into one list.
+    struct Adjacency
+    {
+        vector<int> offsets;
+        vector<int> triangles;
+    };
+
+    void build_adjacency(const vector<int>& indices, size_t vertex_count, Adjacency& adjacency)
+    {
+        adjacency.offsets.assign(vertex_count + 1, 0);
+        for (int index : indices)
+            ++adjacency.offsets[index + 1];
+        for (size_t i = 0; i < vertex_count; ++i)
+            adjacency.offsets[i + 1] += adjacency.offsets[i];
+        adjacency.triangles.resize(indices.size());
+        vector<int> next(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            adjacency.triangles[next[indices[i]]++] = static_cast<int>(i / vertex_count_per_face);
+    }
+
+    // Whether moving vertex to the position of target flips or squashes any of the triangles
+    // that are not removed by the collapse.
+    bool collapse_flips_triangle(const vector<Vertex_position>& positions,
+        const vector<int>& indices, const Adjacency& adjacency, int vertex, int target)
+    {
+        for (int a = adjacency.offsets[vertex]; a < adjacency.offsets[vertex + 1]; ++a)
+        {
+            const int* triangle = &indices[adjacency.triangles[a] * vertex_count_per_face];
+            if (triangle[0] == target || triangle[1] == target || triangle[2] == target)
+                continue;
+            XMVECTOR before[vertex_count_per_face];
+            XMVECTOR after[vertex_count_per_face];
+            for (int j = 0; j < vertex_count_per_face; ++j)
+            {
+                before[j] = load_position(positions, triangle[j]);
+                after[j] = triangle[j] == vertex ? load_position(positions, target) : before[j];
+            }
+            const XMVECTOR n0 = XMVector3Cross(before[1] - before[0], before[2] - before[0]);
+            const XMVECTOR n1 = XMVector3Cross(after[1] - after[0], after[2] - after[0]);
+            // About 75 degrees.
+            constexpr float min_cosine = 0.25f;
+            if (XMVectorGetX(XMVector3Dot(n0, n1)) <= min_cosine *
+                XMVectorGetX(XMVector3Length(n0)) * XMVectorGetX(XMVector3Length(n1)))
+                return true;
+        }
+        return false;
+    }
+}
+
+vector<int> simplify_mesh(const vector<Vertex_position>& positions, const vector<int>& indices,
+    size_t target_index_count, float max_error, float& error)
+{
+    error = 0.0f;
+    for (int index : indices)
+        if (index < 0 || static_cast<size_t>(index) >= positions.size())
+            return indices;
+
+    const size_t vertex_count = positions.size();
+    const vector<bool> locked = locked_vertices(positions, indices);
+
+    vector<Quadric> quadrics(vertex_count, Quadric());
+    for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+    {
+        Quadric q = {};
+        add_plane(q, load_position(positions, indices[i]),
+            load_position(positions, indices[i + 1]), load_position(positions, indices[i + 2]));
+        for (int j = 0; j < vertex_count_per_face; ++j)
+            add(quadrics[indices[i + j]], q);
+    }
+
+    vector<int> result = indices;
+    Adjacency adjacency;
+    vector<int> collapse_target(vertex_count);
+    vector<float> collapse_error(vertex_count);
+    vector<int> candidates;
+    vector<bool> touched(vertex_count);
+
+    // Each pass collapses as many edges as it can, in the order of their errors, without
+    // collapsing more than one edge around each vertex, since that would make the errors
+    // and the adjacency of the pass outdated.
+    while (result.size() > target_index_count)
+    {
+        build_adjacency(result, vertex_count, adjacency);
+
+        std::fill(collapse_target.begin(), collapse_target.end(), -1);
+        std::fill(collapse_error.begin(), collapse_error.end(), FLT_MAX);
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            const int vertex = result[i];
+            if (locked[vertex])
+                continue;
+            const size_t first = i - i % vertex_count_per_face;
+            for (size_t j = first; j < first + vertex_count_per_face; ++j)
+            {
+                const int target = result[j];
+                if (target == vertex)
+                    continue;
+                Quadric q = quadrics[vertex];
+                add(q, quadrics[target]);
+                const float e = ::error(q, positions[target]);
+                if (e < collapse_error[vertex])
+                {
+                    collapse_error[vertex] = e;
+                    collapse_target[vertex] = target;
+                }
+            }
+        }
+
+        candidates.clear();
+        for (size_t v = 0; v < vertex_count; ++v)
+            if (collapse_target[v] != -1 && collapse_error[v] <= max_error)
+                candidates.push_back(static_cast<int>(v));
+        std::sort(candidates.begin(), candidates.end(),
+            [&](int a, int b) { return collapse_error[a] < collapse_error[b]; });
+
+        std::fill(touched.begin(), touched.end(), false);
+        size_t index_count = result.size();
+        int collapses = 0;
+        for (int vertex : candidates)
+        {
+            const int target = collapse_target[vertex];
+            if (touched[vertex] || touched[target] ||
+                collapse_flips_triangle(positions, result, adjacency, vertex, target))
+                continue;
+
+            for (int a = adjacency.offsets[vertex]; a < adjacency.offsets[vertex + 1]; ++a)
+            {
+                const int* triangle = &result[adjacency.triangles[a] * vertex_count_per_face];
+                for (int j = 0; j < vertex_count_per_face; ++j)
+                    touched[triangle[j]] = true;
+                if (triangle[0] == target || triangle[1] == target || triangle[2] == target)
+                    index_count -= vertex_count_per_face;
+            }
+            add(quadrics[target], quadrics[vertex]);
+            error = std::max(error, collapse_error[vertex]);
+            collapse_target[vertex] = -target - 2; // Marks it as collapsed.
+            ++collapses;
+            if (index_count <= target_index_count)
+                break;
+        }
+        if (collapses == 0)
+            break;
+
+        size_t kept = 0;
+        for (size_t i = 0; i < result.size(); i += vertex_count_per_face)
+        {
+            int triangle[vertex_count_per_face];
+            for (int j = 0; j < vertex_count_per_face; ++j)
+            {
+                const int index = result[i + j];
+                triangle[j] = collapse_target[index] < -1 ? -collapse_target[index] - 2 : index;
+            }
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] ||
+                triangle[0] == triangle[2])
+                continue;
+            for (int j = 0; j < vertex_count_per_face; ++j)
+                result[kept++] = triangle[j];
+        }
+        result.resize(kept);
+    }
+    return result;
+}
+
+vector<Mesh_lod> generate_lods(const vector<Vertex_position>& positions,
+    const vector<int>& indices, int lod_count/* = max_lod_count*/)
+{
+    vector<Mesh_lod> lods;
+    // Each level is simplified from the previous one, which is much faster than from the full
+    // mesh. The errors are then added, which overestimates them a bit.
+    const vector<int>* previous = &indices;
+    float previous_error = 0.0f;
+    for (int lod = 1; lod < lod_count; ++lod)
+    {
+        const size_t previous_triangles = previous->size() / vertex_count_per_face;
+        const size_t target_index_count = previous_triangles / 2 * vertex_count_per_face;
+        float error;
+        Mesh_lod level;
+        level.indices = simplify_mesh(positions, *previous, target_index_count, FLT_MAX, error);
+
+        // A level that is not much smaller is not worth the memory.
+        constexpr double min_reduction = 0.75;
+        if (level.indices.empty() || level.indices.size() > previous->size() * min_reduction)
+            break;
+
+        optimize_vertex_cache(level.indices, positions.size());
+        level.error = previous_error + error;
+        previous_error = level.error;
+        lods.push_back(std::move(level));
+        previous = &lods.back().indices;
+    }
+    return lods;
+}
+
+int select_lod(const vector<float>& lod_errors, float pixels_per_unit, int current_lod,
+    float max_pixel_error/* = default_max_lod_pixel_error*/,
+    float hysteresis/* = default_lod_hysteresis*/)
+{
+    if (lod_errors.empty())
+        return 0;
+    int lod = std::min(std::max(current_lod, 0), static_cast<int>(lod_errors.size()) - 1);
+    while (lod > 0 && lod_errors[lod] * pixels_per_unit > max_pixel_error)
+        --lod;
+    while (lod + 1 < static_cast<int>(lod_errors.size()) &&
+        lod_errors[lod + 1] * pixels_per_unit <= max_pixel_error * (1.0f - hysteresis))
+        ++lod;
+    return lod;
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Mesh.h"
+
+
+// Simplifies meshes by collapsing edges, in the order of the error that each collapse causes.
+// The error is measured with the quadric error metric from "Surface Simplification Using
+// Quadric Error Metrics" by Garland and Heckbert, 1997. A vertex is always collapsed into one
+// of its neighbours, so no new vertices are created and the simplified mesh can use the same
+// vertex buffer as the original.
+// Vertices on the border of the mesh, and on UV or normal seams, i.e. where there are several
+// vertices at the same position, are never moved. This keeps the outline and the texture
+// mapping intact, but it also means that meshes with many seams can't be simplified much.
+
+// Returns the simplified indices, with at most target_index_count indices if that is possible
+// without making the error bigger than max_error. The error is a distance in model space, and
+// the biggest error of the collapses that were made is returned in error.
+std::vector<int> simplify_mesh(const std::vector<Vertex_position>& positions,
+    const std::vector<int>& indices, size_t target_index_count, float max_error, float& error);
+
+// The levels of detail after the full mesh, each with about half of the triangles of the
+// previous one. It stops early when a level can't be made much smaller than the previous one.
+constexpr int max_lod_count = 5; // Including the full mesh.
+std::vector<Mesh_lod> generate_lods(const std::vector<Vertex_position>& positions,
+    const std::vector<int>& indices, int lod_count = max_lod_count);
+
+
+// Selects the coarsest level whose error, when projected to the screen, is at most
+// max_pixel_error. pixels_per_unit is how many pixels one unit in model space covers at the
+// distance of the object. To not switch back and forth between two levels every frame when
+// the distance is close to where they switch, a coarser level than the current one is only
+// selected if its error is also smaller by the hysteresis fraction.
+constexpr float default_max_lod_pixel_error = 1.0f;
+constexpr float default_lod_hysteresis = 0.25f;
+int select_lod(const std::vector<float>& lod_errors, float pixels_per_unit, int current_lod,
+    float max_pixel_error = default_max_lod_pixel_error,
+    float hysteresis = default_lod_hysteresis);
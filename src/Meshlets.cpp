@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Meshlets.h"
+#include "Frustum.h"
+
+#include <cfloat>
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    XMVECTOR load_position(const vector<Vertex_position>& positions, int index)
+    {
+        return XMVectorSetW(XMLoadFloat4(&positions[index]), 0.0f);
+    }
+
+    void calculate_bounds(Meshlet& meshlet, const vector<int>& indices,
+        const vector<Vertex_position>& positions)
+    {
+        const UINT start = meshlet.range.start_index;
+        const UINT end = start + meshlet.range.index_count;
+
+        XMVECTOR min_position = XMVectorReplicate(FLT_MAX);
+        XMVECTOR max_position = XMVectorReplicate(-FLT_MAX);
+        for (UINT i = start; i < end; ++i)
+        {
+            const XMVECTOR p = load_position(positions, indices[i]);
+            min_position = XMVectorMin(min_position, p);
+            max_position = XMVectorMax(max_position, p);
+        }
+        XMStoreFloat3(&meshlet.aabb_min, min_position);
+        XMStoreFloat3(&meshlet.aabb_max, max_position);
+
+        // The sphere around the center of the box is not the smallest one, but it is close
+        // enough for culling.
+        const XMVECTOR center = (min_position + max_position) * 0.5f;
+        float radius_squared = 0.0f;
+        for (UINT i = start; i < end; ++i)
+            radius_squared = std::max(radius_squared, XMVectorGetX(XMVector3LengthSq(
+                load_position(positions, indices[i]) - center)));
+        XMStoreFloat4(&meshlet.bounding_sphere, XMVectorSetW(center, std::sqrt(radius_squared)));
+
+        // The normal cone is calculated as in meshoptimizer by Arseny Kapoulkine.
+        struct Face
+        {
+            XMVECTOR point;
+            XMVECTOR normal;
+        };
+        vector<Face> faces;
+        XMVECTOR normal_sum = XMVectorZero();
+        for (UINT i = start; i < end; i += vertex_count_per_face)
+        {
+            const XMVECTOR p0 = load_position(positions, indices[i]);
+            const XMVECTOR p1 = load_position(positions, indices[i + 1]);
+            const XMVECTOR p2 = load_position(positions, indices[i + 2]);
+            const XMVECTOR cross = XMVector3Cross(p1 - p0, p2 - p0);
+            constexpr float min_length_squared = 1e-20f;
+            if (XMVectorGetX(XMVector3LengthSq(cross)) < min_length_squared)
+                continue; // Degenerate triangles are never visible.
+            faces.push_back({ p0, XMVector3Normalize(cross) });
+            normal_sum += faces.back().normal;
+        }
+
+        meshlet.cone_apex = { 0.0f, 0.0f, 0.0f };
+        meshlet.cone_axis = { 0.0f, 0.0f, 1.0f };
+        meshlet.cone_cutoff = 1.0f;
+        if (faces.empty() || XMVectorGetX(XMVector3LengthSq(normal_sum)) == 0.0f)
+            return;
+
+        const XMVECTOR axis = XMVector3Normalize(normal_sum);
+        float min_dot = 1.0f;
+        for (auto& f : faces)
+            min_dot = std::min(min_dot, XMVectorGetX(XMVector3Dot(f.normal, axis)));
+
+        // Wide cones are not worth it, and the apex would be far away.
+        constexpr float min_usable_dot = 0.1f;
+        if (min_dot <= min_usable_dot)
+            return;
+
+        // The apex is placed along the axis, behind all the triangle planes.
+        float max_t = 0.0f;
+        for (auto& f : faces)
+            max_t = std::max(max_t, XMVectorGetX(XMVector3Dot(center - f.point, f.normal)) /
+                XMVectorGetX(XMVector3Dot(axis, f.normal)));
+        XMStoreFloat3(&meshlet.cone_apex, center - axis * max_t);
+        XMStoreFloat3(&meshlet.cone_axis, axis);
+        meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+    }
+
+    void build_meshlets_in_range(const vector<int>& indices,
+        const vector<Vertex_position>& positions, const Index_range& range,
+        vector<int>& last_use, vector<Meshlet>& meshlets)
+    {
+        const UINT end = range.start_index + range.index_count;
+        Meshlet meshlet = {};
+        meshlet.range = { range.start_index, 0, range.base_vertex };
+        int meshlet_vertices = 0;
+        // The vertices that are in the current meshlet are marked with its number in last_use.
+        int meshlet_number = static_cast<int>(meshlets.size());
+
+        for (UINT i = range.start_index; i < end; i += vertex_count_per_face)
+        {
+            int new_vertices = 0;
+            for (int j = 0; j < vertex_count_per_face; ++j)
+                if (last_use[indices[i + j]] != meshlet_number)
+                    ++new_vertices;
+
+            const bool full = meshlet.range.index_count ==
+                max_meshlet_triangles * vertex_count_per_face ||
+                meshlet_vertices + new_vertices > max_meshlet_vertices;
+            if (full)
+            {
+                calculate_bounds(meshlet, indices, positions);
+                meshlets.push_back(meshlet);
+                meshlet.range = { i, 0, range.base_vertex };
+                meshlet_vertices = 0;
+                ++meshlet_number;
+            }
+
+            for (int j = 0; j < vertex_count_per_face; ++j)
+            {
+                int& last = last_use[indices[i + j]];
+                if (last != meshlet_number)
+                {
+                    last = meshlet_number;
+                    ++meshlet_vertices;
+                }
+            }
+            meshlet.range.index_count += vertex_count_per_face;
+        }
+
+        if (meshlet.range.index_count)
+        {
+            calculate_bounds(meshlet, indices, positions);
+            meshlets.push_back(meshlet);
+        }
+    }
+}
+
+vector<Meshlet> build_meshlets(const vector<int>& indices,
+    const vector<Vertex_position>& positions, const vector<Index_range>& ranges)
+{
+    vector<Meshlet> meshlets;
+    for (int index : indices)
+        if (index < 0 || static_cast<size_t>(index) >= positions.size())
+            return meshlets; // Such meshes can not be drawn in parts, see compact_indices.
+
+    const vector<Index_range> all_indices = { { 0, static_cast<UINT>(indices.size()), 0 } };
+    vector<int> last_use(positions.size(), -1);
+    for (auto& range : ranges.empty() ? all_indices : ranges)
+        build_meshlets_in_range(indices, positions, range, last_use, meshlets);
+    return meshlets;
+}
+
+bool meshlet_is_backfacing(const Meshlet& meshlet, FXMVECTOR eye)
+{
+    const XMVECTOR apex = XMLoadFloat3(&meshlet.cone_apex);
+    const XMVECTOR axis = XMLoadFloat3(&meshlet.cone_axis);
+    return XMVectorGetX(XMVector3Dot(XMVector3Normalize(apex - eye), axis)) >=
+        meshlet.cone_cutoff;
+}
+
+void cull_meshlets(const vector<Meshlet>& meshlets, const Frustum& frustum, FXMVECTOR eye,
+    Backface_culling backface_culling, vector<Index_range>& visible)
+{
+    visible.clear();
+    for (auto& meshlet : meshlets)
+    {
+        const XMVECTOR sphere = XMLoadFloat4(&meshlet.bounding_sphere);
+        if (!frustum.intersects_sphere(sphere, XMVectorGetW(sphere)))
+            continue;
+        if (backface_culling == Backface_culling::enabled && meshlet_is_backfacing(meshlet, eye))
+            continue;
+
+        auto& r = meshlet.range;
+        if (!visible.empty() && visible.back().base_vertex == r.base_vertex &&
+            visible.back().start_index + visible.back().index_count == r.start_index)
+            visible.back().index_count += r.index_count;
+        else
+            visible.push_back(r);
+    }
+}
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Mesh.h"
+#include "util.h"
+
+
+// Meshlets are small clusters of triangles that can be culled on their own. Each is a run of
+// consecutive triangles in the index buffer, so a visible meshlet is drawn with
+// DrawIndexedInstanced with an offset into the same index buffer as the whole mesh. The runs
+// follow the triangle order from optimize_mesh, which keeps neighbouring triangles together.
+// The limits are the ones recommended for mesh shaders, so the meshlets could be reused by
+// those.
+constexpr int max_meshlet_vertices = 64;
+constexpr int max_meshlet_triangles = 124;
+
+// The meshlets never cross the index ranges, since the ranges have different base vertices.
+// An empty ranges means one range with all the indices.
+std::vector<Meshlet> build_meshlets(const std::vector<int>& indices,
+    const std::vector<Vertex_position>& positions, const std::vector<Index_range>& ranges);
+
+// True when the whole meshlet faces away from the eye. The eye is in the same space as the
+// meshlet, i.e. model space.
+bool meshlet_is_backfacing(const Meshlet& meshlet, DirectX::FXMVECTOR eye);
+
+class Frustum;
+
+// Replaces visible with the index ranges of the meshlets that are inside the frustum and,
+// when backface culling, not backfacing. Consecutive visible meshlets are merged into one range,
+// to keep the number of draw calls down. The frustum and the eye are in model space.
+void cull_meshlets(const std::vector<Meshlet>& meshlets, const Frustum& frustum,
+    DirectX::FXMVECTOR eye, Backface_culling backface_culling,
+    std::vector<Index_range>& visible);
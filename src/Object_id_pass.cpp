@@ -13,10 +13,13 @@
 #include "Commands.h"
 #include "Dx12_util.h"
 #include "Root_signature.h"
+#include "Mesh.h"
 
 #ifndef _DEBUG
 #include "build/object_ids_vertex_shader_srv_instance_data.h"
 #include "build/object_ids_alpha_cut_out_vertex_shader_srv_instance_data.h"
+#include "build/object_ids_vertex_shader_srv_instance_data_compact.h"
+#include "build/object_ids_alpha_cut_out_vertex_shader_srv_instance_data_compact.h"
 #include "build/pixel_shader_object_ids_alpha_cut_out.h"
 #include "build/pixel_shader_object_ids.h"
 #endif
@@ -46,6 +49,7 @@ void Object_id_pass::create_pipeline_state(ComPtr<ID3D12Device> device,
     const wchar_t* debug_name, Backface_culling backface_culling)
 {
     UINT render_targets_count = 1;
+    const bool compact = Mesh::default_vertex_format() == Vertex_format::compact;
 
 #ifndef _DEBUG
     if (!pipeline_state)
@@ -55,6 +59,13 @@ void Object_id_pass::create_pipeline_state(ComPtr<ID3D12Device> device,
                 _countof(g_object_ids_alpha_cut_out_vertex_shader_srv_instance_data)) :
             CD3DX12_SHADER_BYTECODE(g_object_ids_vertex_shader_srv_instance_data,
                 _countof(g_object_ids_vertex_shader_srv_instance_data));
+        if (compact)
+            compiled_vertex_shader = alpha_cut_out ?
+                CD3DX12_SHADER_BYTECODE(
+                    g_object_ids_alpha_cut_out_vertex_shader_srv_instance_data_compact,
+                    _countof(g_object_ids_alpha_cut_out_vertex_shader_srv_instance_data_compact)) :
+                CD3DX12_SHADER_BYTECODE(g_object_ids_vertex_shader_srv_instance_data_compact,
+                    _countof(g_object_ids_vertex_shader_srv_instance_data_compact));
 
         auto compiled_pixel_shader = alpha_cut_out ?
             CD3DX12_SHADER_BYTECODE(g_pixel_shader_object_ids_alpha_cut_out,
@@ -73,6 +84,10 @@ void Object_id_pass::create_pipeline_state(ComPtr<ID3D12Device> device,
         const char* vertex_shader_entry = alpha_cut_out ?
             "object_ids_alpha_cut_out_vertex_shader_srv_instance_data" :
             "object_ids_vertex_shader_srv_instance_data";
+        if (compact)
+            vertex_shader_entry = alpha_cut_out ?
+                "object_ids_alpha_cut_out_vertex_shader_srv_instance_data_compact" :
+                "object_ids_vertex_shader_srv_instance_data_compact";
 
         const char* pixel_shader_entry = alpha_cut_out ? "pixel_shader_object_ids_alpha_cut_out"
             : "pixel_shader_object_ids";
@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Occlusion_buffer.h"
+#include "Job_system.h"
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    // The tiles are rasterized in parallel, so there have to be a few of them for each worker
+    // even at the small size of the buffer. They are whole blocks, and their rows are whole
+    // groups of four pixels, which are rasterized together.
+    constexpr int tile_width = 32;
+    constexpr int tile_height = 16;
+    constexpr int block_size = 8;
+    constexpr int pixels_per_group = 4;
+
+    int round_up(int value, int multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    // The part of the triangle in front of the near plane, where z >= 0 in clip space, as one
+    // or two triangles, with the vertices in clip space. Returns the number of vertices of the
+    // fan of triangles that it is, 0, 3 or 4.
+    int clip_to_near_plane(const XMVECTOR triangle[3], XMVECTOR polygon[4])
+    {
+        int count = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const XMVECTOR current = triangle[i];
+            const XMVECTOR next = triangle[(i + 1) % 3];
+            const float current_z = XMVectorGetZ(current);
+            const float next_z = XMVectorGetZ(next);
+            if (current_z >= 0.0f)
+                polygon[count++] = current;
+            if ((current_z >= 0.0f) != (next_z >= 0.0f))
+                polygon[count++] = XMVectorLerp(current, next,
+                    current_z / (current_z - next_z));
+        }
+        return count;
+    }
+}
+
+Occlusion_buffer::Occlusion_buffer(int width, int height) :
+    m_width(round_up(width, tile_width)),
+    m_height(round_up(height, tile_height)),
+    m_tiles_x(m_width / tile_width),
+    m_tiles_y(m_height / tile_height),
+    m_view_projection(),
+    m_depths(static_cast<size_t>(m_width) * m_height, 1.0f),
+    m_block_max_depths(static_cast<size_t>(m_width / block_size) * (m_height / block_size),
+        1.0f),
+    m_tile_triangles(static_cast<size_t>(m_tiles_x) * m_tiles_y)
+{
+}
+
+void Occlusion_buffer::rasterize(const vector<Occluder>& occluders, FXMMATRIX view_projection)
+{
+    XMStoreFloat4x4(&m_view_projection, view_projection);
+
+    m_occluder_triangles.resize(occluders.size());
+    job_system().parallel_for(occluders.size(), 1,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                m_occluder_triangles[i].clear();
+                set_up_triangles(occluders[i], m_occluder_triangles[i]);
+            }
+        });
+
+    // The triangles are binned into the tiles that their bounds overlap.
+    m_triangles.clear();
+    for (auto& triangles : m_occluder_triangles)
+        m_triangles.insert(m_triangles.end(), triangles.begin(), triangles.end());
+    for (auto& tile : m_tile_triangles)
+        tile.clear();
+    for (UINT i = 0; i < m_triangles.size(); ++i)
+    {
+        const Triangle& t = m_triangles[i];
+        for (int y = t.min_y / tile_height; y <= t.max_y / tile_height; ++y)
+            for (int x = t.min_x / tile_width; x <= t.max_x / tile_width; ++x)
+                m_tile_triangles[y * m_tiles_x + x].push_back(i);
+    }
+
+    job_system().parallel_for(m_tile_triangles.size(), 1,
+        [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; ++tile)
+                rasterize_tile(static_cast<int>(tile));
+        });
+}
+
+bool Occlusion_buffer::occluded(const Aabb& box) const
+{
+    const XMMATRIX view_projection = XMLoadFloat4x4(&m_view_projection);
+    float min_x = FLT_MAX;
+    float min_y = FLT_MAX;
+    float max_x = -FLT_MAX;
+    float max_y = -FLT_MAX;
+    float min_depth = FLT_MAX;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const XMVECTOR position = XMVectorSet(
+            corner & 1 ? box.max_corner.x : box.min_corner.x,
+            corner & 2 ? box.max_corner.y : box.min_corner.y,
+            corner & 4 ? box.max_corner.z : box.min_corner.z, 1.0f);
+        const XMVECTOR clip = XMVector4Transform(position, view_projection);
+        const float w = XMVectorGetW(clip);
+        if (XMVectorGetZ(clip) < 0.0f || w <= 0.0f)
+            return false;
+        const float x = (XMVectorGetX(clip) / w * 0.5f + 0.5f) * m_width;
+        const float y = (0.5f - XMVectorGetY(clip) / w * 0.5f) * m_height;
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+        min_depth = std::min(min_depth, XMVectorGetZ(clip) / w);
+    }
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= m_width || min_y >= m_height)
+        return false;
+
+    // The pixels that the bounds of the projected box touch, where it is only hidden if all of
+    // them have nearer depths. The blocks where all of the pixels do are not tested per pixel.
+    const int first_x = std::max(0, static_cast<int>(min_x));
+    const int first_y = std::max(0, static_cast<int>(min_y));
+    const int last_x = std::min(m_width - 1, static_cast<int>(max_x));
+    const int last_y = std::min(m_height - 1, static_cast<int>(max_y));
+    const int blocks_x = m_width / block_size;
+    for (int block_y = first_y / block_size; block_y <= last_y / block_size; ++block_y)
+        for (int block_x = first_x / block_size; block_x <= last_x / block_size; ++block_x)
+        {
+            if (m_block_max_depths[block_y * blocks_x + block_x] < min_depth)
+                continue;
+            const int end_y = std::min(last_y, block_y * block_size + block_size - 1);
+            const int end_x = std::min(last_x, block_x * block_size + block_size - 1);
+            for (int y = std::max(first_y, block_y * block_size); y <= end_y; ++y)
+                for (int x = std::max(first_x, block_x * block_size); x <= end_x; ++x)
+                    if (depth(x, y) >= min_depth)
+                        return false;
+        }
+    return true;
+}
+
+void Occlusion_buffer::set_up_triangles(const Occluder& occluder,
+    vector<Triangle>& triangles) const
+{
+    const XMMATRIX transform = XMLoadFloat4x4(&occluder.model) *
+        XMLoadFloat4x4(&m_view_projection);
+    auto& vertices = *occluder.vertices;
+    auto& indices = *occluder.indices;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        XMVECTOR triangle[3];
+        for (int v = 0; v < 3; ++v)
+            triangle[v] = XMVector4Transform(XMVectorSetW(
+                XMLoadFloat3(&vertices[indices[i + v]]), 1.0f), transform);
+        XMVECTOR polygon[4];
+        const int count = clip_to_near_plane(triangle, polygon);
+        for (int fan = 1; fan + 1 < count; ++fan)
+        {
+            // To pixels, with y down, and the depth as in the depth buffer.
+            float x[3], y[3], z[3];
+            const XMVECTOR corners[3] = { polygon[0], polygon[fan], polygon[fan + 1] };
+            for (int v = 0; v < 3; ++v)
+            {
+                const float w = XMVectorGetW(corners[v]);
+                x[v] = (XMVectorGetX(corners[v]) / w * 0.5f + 0.5f) * m_width;
+                y[v] = (0.5f - XMVectorGetY(corners[v]) / w * 0.5f) * m_height;
+                z[v] = XMVectorGetZ(corners[v]) / w;
+            }
+            float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+            if (area == 0.0f || std::min(z[0], std::min(z[1], z[2])) > 1.0f)
+                continue;
+            // Both sides are rasterized, with the vertices in the order that makes the inside
+            // positive.
+            if (area < 0.0f)
+            {
+                std::swap(x[1], x[2]);
+                std::swap(y[1], y[2]);
+                std::swap(z[1], z[2]);
+                area = -area;
+            }
+
+            // The pixels with centers within the bounds of the triangle, on the screen.
+            Triangle t;
+            t.min_x = std::max(0, static_cast<int>(std::ceil(
+                std::min(x[0], std::min(x[1], x[2])) - 0.5f)));
+            t.min_y = std::max(0, static_cast<int>(std::ceil(
+                std::min(y[0], std::min(y[1], y[2])) - 0.5f)));
+            t.max_x = std::min(m_width - 1, static_cast<int>(std::floor(
+                std::max(x[0], std::max(x[1], x[2])) - 0.5f)));
+            t.max_y = std::min(m_height - 1, static_cast<int>(std::floor(
+                std::max(y[0], std::max(y[1], y[2])) - 0.5f)));
+            if (t.min_x > t.max_x || t.min_y > t.max_y)
+                continue;
+
+            for (int e = 0; e < 3; ++e)
+            {
+                const int next = (e + 1) % 3;
+                const float a = y[e] - y[next];
+                const float b = x[next] - x[e];
+                t.edges[e] = { a, b, -(a * x[e] + b * y[e]) };
+            }
+
+            // The depth is linear on the screen. It is moved to the farthest that the plane of
+            // the triangle is within a pixel, but not further than the triangle goes.
+            const float dz_dx = ((z[1] - z[0]) * (y[2] - y[0]) -
+                (z[2] - z[0]) * (y[1] - y[0])) / area;
+            const float dz_dy = ((z[2] - z[0]) * (x[1] - x[0]) -
+                (z[1] - z[0]) * (x[2] - x[0])) / area;
+            t.depth = { dz_dx, dz_dy, z[0] - dz_dx * x[0] - dz_dy * y[0] +
+                0.5f * (std::abs(dz_dx) + std::abs(dz_dy)) };
+            t.max_depth = std::max(z[0], std::max(z[1], z[2]));
+            triangles.push_back(t);
+        }
+    }
+}
+
+void Occlusion_buffer::rasterize_tile(int tile)
+{
+    const int tile_x = (tile % m_tiles_x) * tile_width;
+    const int tile_y = (tile / m_tiles_x) * tile_height;
+    for (int y = tile_y; y < tile_y + tile_height; ++y)
+        std::fill_n(&m_depths[y * m_width + tile_x], tile_width, 1.0f);
+
+    const XMVECTOR pixel_offsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+    for (UINT index : m_tile_triangles[tile])
+    {
+        const Triangle& t = m_triangles[index];
+        const int first_x = std::max(t.min_x, tile_x) / pixels_per_group * pixels_per_group;
+        const int last_x = std::min(t.max_x, tile_x + tile_width - 1);
+        const int first_y = std::max(t.min_y, tile_y);
+        const int last_y = std::min(t.max_y, tile_y + tile_height - 1);
+        XMVECTOR a[3];
+        for (int e = 0; e < 3; ++e)
+            a[e] = XMVectorReplicate(t.edges[e].x);
+        const XMVECTOR depth_a = XMVectorReplicate(t.depth.x);
+        const XMVECTOR max_depth = XMVectorReplicate(t.max_depth);
+
+        for (int y = first_y; y <= last_y; ++y)
+        {
+            const float pixel_y = y + 0.5f;
+            XMVECTOR row[3];
+            for (int e = 0; e < 3; ++e)
+                row[e] = XMVectorReplicate(t.edges[e].y * pixel_y + t.edges[e].z);
+            const XMVECTOR depth_row = XMVectorReplicate(t.depth.y * pixel_y + t.depth.z);
+            for (int x = first_x; x <= last_x; x += pixels_per_group)
+            {
+                const XMVECTOR pixel_x = XMVectorReplicate(static_cast<float>(x)) +
+                    pixel_offsets;
+                const XMVECTOR zero = XMVectorZero();
+                const XMVECTOR outside = XMVectorOrInt(XMVectorOrInt(
+                    XMVectorLess(XMVectorMultiplyAdd(a[0], pixel_x, row[0]), zero),
+                    XMVectorLess(XMVectorMultiplyAdd(a[1], pixel_x, row[1]), zero)),
+                    XMVectorLess(XMVectorMultiplyAdd(a[2], pixel_x, row[2]), zero));
+                const XMVECTOR depth = XMVectorMin(XMVectorMultiplyAdd(depth_a, pixel_x,
+                    depth_row), max_depth);
+                XMFLOAT4* pixels = reinterpret_cast<XMFLOAT4*>(&m_depths[y * m_width + x]);
+                const XMVECTOR old_depth = XMLoadFloat4(pixels);
+                XMStoreFloat4(pixels, XMVectorSelect(XMVectorMin(old_depth, depth), old_depth,
+                    outside));
+            }
+        }
+    }
+
+    const int blocks_x = m_width / block_size;
+    for (int block_y = tile_y; block_y < tile_y + tile_height; block_y += block_size)
+        for (int block_x = tile_x; block_x < tile_x + tile_width; block_x += block_size)
+        {
+            float max_depth = 0.0f;
+            for (int y = block_y; y < block_y + block_size; ++y)
+                for (int x = block_x; x < block_x + block_size; ++x)
+                    max_depth = std::max(max_depth, depth(x, y));
+            m_block_max_depths[block_y / block_size * blocks_x + block_x / block_size] =
+                max_depth;
+        }
+}
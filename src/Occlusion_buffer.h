@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+#include "Aabb.h"
+
+
+enum class Occlusion_culling { enabled, disabled };
+
+// A mesh that hides what is behind it, e.g. a wall, with its vertices and indices in the
+// memory of the CPU, see Mesh::occluder_vertices.
+struct Occluder
+{
+    const std::vector<DirectX::XMFLOAT3>* vertices;
+    const std::vector<UINT>* indices; // Three per triangle.
+    DirectX::XMFLOAT4X4 model;
+};
+
+// A small depth buffer that the occluders in the view are rasterized into on the CPU, so that
+// the objects with bounds behind them can be left out before anything is drawn, by the early z
+// pass as well as by the main pass. The triangles are binned into tiles of the screen, which
+// are rasterized in parallel, four pixels at a time, and the farthest depth of each block of
+// 8x8 pixels is kept, so that a box behind a block doesn't have to be tested per pixel. See
+// "Software Occlusion Culling" by Jeff Andrews, Intel, 2013.
+class Occlusion_buffer
+{
+public:
+    // The size is rounded up to whole tiles.
+    Occlusion_buffer(int width = 256, int height = 144);
+
+    // Clears the buffer and rasterizes the triangles of the occluders, from both sides, with
+    // the depth that view_projection gives them, where 0 is the near plane.
+    void rasterize(const std::vector<Occluder>& occluders, DirectX::FXMMATRIX view_projection);
+    // True if the box is behind the occluders everywhere that it covers on the screen. The
+    // boxes that reach behind the near plane, or that are outside of the screen, are not.
+    bool occluded(const Aabb& box) const;
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    // Of the nearest occluder at the center of the pixel, or 1 where there is none. It is the
+    // farthest depth of the plane of its triangle within the pixel, so that it is never nearer
+    // than what the occluder hides there.
+    float depth(int x, int y) const { return m_depths[y * m_width + x]; }
+    // Those rasterized by the last rasterize, after the clipping to the near plane.
+    size_t triangles_count() const { return m_triangles.size(); }
+
+private:
+    // In pixels, with the edges and the depth as planes, a * x + b * y + c, with the pixel
+    // centers at half pixels. The inside is where all edges are at least 0.
+    struct Triangle
+    {
+        DirectX::XMFLOAT3 edges[3];
+        DirectX::XMFLOAT3 depth;
+        float max_depth;
+        int min_x, min_y, max_x, max_y; // Of the pixels, inclusive.
+    };
+
+    void set_up_triangles(const Occluder& occluder, std::vector<Triangle>& triangles) const;
+    void rasterize_tile(int tile);
+
+    int m_width;
+    int m_height;
+    int m_tiles_x;
+    int m_tiles_y;
+    DirectX::XMFLOAT4X4 m_view_projection;
+    std::vector<float> m_depths;
+    std::vector<float> m_block_max_depths; // Per block of 8x8 pixels.
+    std::vector<std::vector<Triangle>> m_occluder_triangles;
+    std::vector<Triangle> m_triangles;
+    std::vector<std::vector<UINT>> m_tile_triangles;
+};
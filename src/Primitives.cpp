@@ -7,6 +7,7 @@
 
 #include "pch.h"
 #include "Primitives.h"
+#include "Tangent_space.h"
 #include "util.h"
 
 
@@ -65,22 +66,11 @@ namespace {
 }
 
 
-DirectX::XMVECTOR load_half2(DirectX::PackedVector::XMHALF2 h)
-{
-    using DirectX::PackedVector::XMConvertHalfToFloat;
-    DirectX::XMVECTOR v = DirectX::XMVectorSet(XMConvertHalfToFloat(h.x),
-        XMConvertHalfToFloat(h.y), 0.0f, 0.0f);
-    return v;
-}
-
-
 Vertices convert_to_packed_vertices(const std::vector<Float_vertex>& input_vertices,
     std::vector<int>& indices)
 {
     using DirectX::PackedVector::XMConvertFloatToHalf;
     using DirectX::PackedVector::XMConvertHalfToFloat;
-    using DirectX::XMLoadFloat3;
-    using DirectX::XMVECTOR;
     Vertices vertices;
     for (const auto& i_v : input_vertices)
     {
@@ -93,24 +83,9 @@ Vertices convert_to_packed_vertices(const std::vector<Float_vertex>& input_verti
         vertices.normals.push_back(normal);
     }
 
-    for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
-    {
-        XMVECTOR v[vertex_count_per_face];
-        XMVECTOR uv[vertex_count_per_face];
-
-        int index = indices[i];
-
-        v[0] = XMLoadFloat3(&input_vertices[index].position);
-        uv[0] = load_half2(input_vertices[index].uv);
-        index = indices[i + 1];
-        v[1] = XMLoadFloat3(&input_vertices[index].position);
-        uv[1] = load_half2(input_vertices[index].uv);
-        index = indices[i + 2];
-        v[2] = XMLoadFloat3(&input_vertices[index].position);
-        uv[2] = load_half2(input_vertices[index].uv);
-
-        calculate_and_add_tangent_and_bitangent(v, uv, vertices);
-    }
+    // The faces share vertices, so the tangents are averaged per vertex.
+    const int thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    calculate_vertex_tangents(vertices, indices, thread_count);
     return vertices;
 }
 
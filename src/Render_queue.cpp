@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Render_queue.h"
+#include "Job_system.h"
+
+#include <unordered_map>
+
+
+namespace
+{
+    // Each object only takes a few loads and stores, so the jobs have to be big.
+    constexpr size_t objects_per_update_job = 4096;
+    constexpr size_t instances_per_culling_job = 1024;
+
+    // A draw call costs more than drawing a few instances that are outside of the view, at
+    // least of small meshes, so the visible instances of an array that are only this many
+    // culled ones apart are drawn together.
+    constexpr int max_culled_instances_within_draw = 4;
+}
+
+void Render_queue::build(const std::vector<std::shared_ptr<Graphical_object>>& objects)
+{
+    clear();
+    std::unordered_map<const Mesh*, UINT> mesh_ids;
+    for (size_t i = 0; i < objects.size(); i += objects[i]->instances())
+    {
+        auto& object = *objects[i];
+        auto mesh = mesh_ids.insert({ &object.mesh(), static_cast<UINT>(m_meshes.size()) });
+        if (mesh.second)
+            m_meshes.push_back(&object.mesh());
+        // The ranges are set by update_ranges.
+        add({ object.id(), object.dynamic_transform_ref(), object.material_id(),
+            mesh.first->second, object.instances(), Draw_ranges(), Draw_ranges() });
+        m_objects.push_back(&object);
+    }
+    update_ranges();
+    finish_build();
+}
+
+void Render_queue::build(const std::vector<Queued_object>& objects)
+{
+    clear();
+    for (auto& object : objects)
+        add(object);
+    finish_build();
+}
+
+void Render_queue::clear()
+{
+    m_object_ids.clear();
+    m_dynamic_transform_refs.clear();
+    m_material_ids.clear();
+    m_mesh_ids.clear();
+    m_meshes.clear();
+    m_instances.clear();
+    m_ranges.clear();
+    m_culled_ranges.clear();
+    m_objects.clear();
+    m_first_instances.clear();
+    m_instance_objects.clear();
+    m_draws.clear();
+    ++m_version;
+}
+
+void Render_queue::add(const Queued_object& object)
+{
+    const UINT index = static_cast<UINT>(m_object_ids.size());
+    m_object_ids.push_back(object.object_id);
+    m_dynamic_transform_refs.push_back(object.dynamic_transform_ref);
+    m_material_ids.push_back(object.material_id);
+    m_mesh_ids.push_back(object.mesh_id);
+    m_instances.push_back(object.instances);
+    m_ranges.push_back(object.ranges);
+    m_culled_ranges.push_back(object.culled_ranges);
+    m_first_instances.push_back(static_cast<UINT>(m_instance_objects.size()));
+    m_instance_objects.insert(m_instance_objects.end(), object.instances, index);
+    m_draws.push_back({ index, 0, object.instances });
+}
+
+void Render_queue::finish_build()
+{
+    // Everything is drawn until the queue is culled.
+    m_visible.assign(m_instance_objects.size(), 1);
+    m_visible_draws = m_draws;
+    m_visible_instances_count = m_instance_objects.size();
+}
+
+void Render_queue::update_ranges()
+{
+    ++m_version;
+    job_system().parallel_for(m_objects.size(), objects_per_update_job,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                m_ranges[i] = m_objects[i]->draw_ranges(Meshlet_culling::disabled);
+                m_culled_ranges[i] = m_objects[i]->draw_ranges(Meshlet_culling::enabled);
+            }
+        });
+}
+
+void Render_queue::cull(const std::vector<uint8_t>& static_visible,
+    const std::vector<uint8_t>& dynamic_visible)
+{
+    ++m_version;
+    job_system().parallel_for(m_instance_objects.size(), instances_per_culling_job,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const UINT object = m_instance_objects[i];
+                const int instance = static_cast<int>(i - m_first_instances[object]);
+                const int dynamic_ref = m_dynamic_transform_refs[object];
+                m_visible[i] = dynamic_ref >= 0 ? dynamic_visible[dynamic_ref + instance] :
+                    static_visible[m_object_ids[object] + instance];
+            }
+        });
+    update_visible_draws();
+}
+
+void Render_queue::update_visible_draws()
+{
+    // The visible instances of an object are drawn with as few draws as possible, see
+    // max_culled_instances_within_draw.
+    m_visible_draws.clear();
+    m_visible_instances_count = 0;
+    for (UINT object = 0; object < m_first_instances.size(); ++object)
+    {
+        const uint8_t* visible = &m_visible[m_first_instances[object]];
+        Queued_draw draw = { object, 0, 0 };
+        for (int i = 0; i < m_instances[object]; ++i)
+        {
+            if (!visible[i])
+                continue;
+            ++m_visible_instances_count;
+            const int draw_end = draw.first_instance + draw.instances;
+            if (draw.instances > 0 && i - draw_end <= max_culled_instances_within_draw)
+            {
+                draw.instances = i + 1 - draw.first_instance;
+                continue;
+            }
+            if (draw.instances > 0)
+                m_visible_draws.push_back(draw);
+            draw.first_instance = i;
+            draw.instances = 1;
+        }
+        if (draw.instances > 0)
+            m_visible_draws.push_back(draw);
+    }
+}
@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+#include "Graphical_object.h"
+
+
+enum class Frustum_culling { enabled, disabled };
+
+// A draw of some of the instances of one of the objects of a render queue. Its instance i is
+// instance first_instance + i of the object, which is at index object in the queue.
+struct Queued_draw
+{
+    UINT object;
+    int first_instance;
+    int instances;
+};
+
+// What a render queue keeps of an object, as plain values. A queue can be built from these
+// instead of from Graphical_objects, e.g. to test and benchmark the draw packets without
+// meshes, and so without a device. The meshes are only told apart by their ids then, and the
+// index buffers by the views that the ranges point to.
+struct Queued_object
+{
+    int object_id;
+    int dynamic_transform_ref;
+    int material_id;
+    UINT mesh_id;
+    int instances;
+    Draw_ranges ranges;
+    Draw_ranges culled_ranges; // With meshlet culling.
+};
+
+// The objects of one of the object lists of a scene, e.g. the regular objects, as arrays of
+// what drawing them takes, in the order that they are drawn. Drawing them then reads the
+// arrays from start to end, instead of following a shared_ptr to each object, and from that to
+// its mesh. The objects that are drawn as instances of the object before them are left out,
+// see Graphical_object::instances.
+class Render_queue
+{
+public:
+    void build(const std::vector<std::shared_ptr<Graphical_object>>& objects);
+    // The objects are drawn as they are, with their instances, and keep their ranges.
+    void build(const std::vector<Queued_object>& objects);
+    // What is drawn of the objects changes when their lods are selected, their meshlets are
+    // culled and their triangles are sorted, so this is needed after that, once per frame.
+    // Only the queues that are built from Graphical_objects are changed by it.
+    void update_ranges();
+    // Until the next call, or the next build, the draws with frustum culling are only of the
+    // visible instances. The static ones are visible where static_visible is nonzero, at their
+    // object ids, e.g. from a query of a Bvh of them, and the dynamic ones where
+    // dynamic_visible is nonzero, at their dynamic transform refs, e.g. from a query of a
+    // Loose_grid of them.
+    void cull(const std::vector<uint8_t>& static_visible,
+        const std::vector<uint8_t>& dynamic_visible);
+
+    size_t size() const { return m_object_ids.size(); }
+    const std::vector<int>& object_ids() const { return m_object_ids; }
+    const std::vector<int>& dynamic_transform_refs() const { return m_dynamic_transform_refs; }
+    const std::vector<int>& material_ids() const { return m_material_ids; }
+    // The objects with the same mesh have the same mesh id.
+    const std::vector<UINT>& mesh_ids() const { return m_mesh_ids; }
+    // Only for the queues that are built from Graphical_objects.
+    const Mesh& mesh(UINT object) const { return *m_meshes[m_mesh_ids[object]]; }
+    const std::vector<int>& instances() const { return m_instances; }
+    const std::vector<Draw_ranges>& ranges(Meshlet_culling meshlet_culling) const
+    { return meshlet_culling == Meshlet_culling::enabled ? m_culled_ranges : m_ranges; }
+    const std::vector<Queued_draw>& draws(Frustum_culling frustum_culling) const
+    { return frustum_culling == Frustum_culling::enabled ? m_visible_draws : m_draws; }
+    size_t instances_count() const { return m_instance_objects.size(); }
+    size_t visible_instances_count() const { return m_visible_instances_count; }
+    // Changed by each build, update_ranges and cull, so that what is made from the arrays can
+    // tell when it is out of date, see Draw_packet_stream::update.
+    unsigned int version() const { return m_version; }
+private:
+    void clear();
+    void add(const Queued_object& object);
+    void finish_build();
+    void update_visible_draws();
+
+    std::vector<int> m_object_ids;
+    std::vector<int> m_dynamic_transform_refs;
+    std::vector<int> m_material_ids;
+    std::vector<UINT> m_mesh_ids;
+    std::vector<const Mesh*> m_meshes; // By mesh id. The objects own them.
+    std::vector<int> m_instances;
+    std::vector<Draw_ranges> m_ranges;
+    std::vector<Draw_ranges> m_culled_ranges;
+    std::vector<const Graphical_object*> m_objects; // Only used by update_ranges.
+
+    // The instances of all the objects are culled together, so that big arrays are split over
+    // the jobs like the rest. The instances of each object follow each other, from its first.
+    std::vector<UINT> m_first_instances;
+    std::vector<UINT> m_instance_objects;
+    std::vector<uint8_t> m_visible;
+    std::vector<Queued_draw> m_draws;
+    std::vector<Queued_draw> m_visible_draws;
+    size_t m_visible_instances_count = 0;
+    unsigned int m_version = 0;
+};
@@ -11,6 +11,7 @@
 #include "Scene.h"
 #include "View.h"
 #include "Shadow_map.h"
+#include "Mesh.h"
 
 #include <D3DCompiler.h>
 
@@ -41,8 +42,8 @@ Root_signature::Root_signature(ComPtr<ID3D12Device> device, UINT* render_setting
     constexpr int root_parameters_count = 9;
     CD3DX12_ROOT_PARAMETER1 root_parameters[root_parameters_count]{};
 
-    constexpr int values_count = 4; // Needs to be a multiple of 4, because constant buffers are
-                                    // viewed as sets of 4x32-bit values, see:
+    constexpr int values_count = 12; // Needs to be a multiple of 4, because constant buffers are
+                                     // viewed as sets of 4x32-bit values, see:
 // https://docs.microsoft.com/en-us/windows/win32/direct3d12/using-constants-directly-in-the-root-signature
 
     UINT shader_register = 0;
@@ -297,14 +298,58 @@ void create_pipeline_state(ComPtr<ID3D12Device> device,
         { "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
     };
 
+    // The compact vertex format, see Vertex_compression.h. The positions and the QTangents
+    // are 16 bit snorm, so the input assembler converts them to floats in [-1, 1].
+    D3D12_INPUT_ELEMENT_DESC input_element_desc_compact_position_tangent_frame_color[] =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "QTANGENT", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 1, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 2, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "COLOR", 0, DXGI_FORMAT_R16G16B16A16_FLOAT, 3, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
+    D3D12_INPUT_ELEMENT_DESC input_element_desc_compact_position_tangent_frame[] =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "QTANGENT", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 1, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 2, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
+    // Used instead of position_normal, which is only used to get the texture coordinates.
+    D3D12_INPUT_ELEMENT_DESC input_element_desc_compact_position_texture_coords[] =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 2, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
+    D3D12_INPUT_ELEMENT_DESC input_element_desc_compact_position[] =
+    {
+        { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+    };
+
     D3D12_GRAPHICS_PIPELINE_STATE_DESC s {};
-    if (input_layout == Input_layout::position_normal_tangents_color)
+    if (Mesh::default_vertex_format() == Vertex_format::compact)
+    {
+        if (input_layout == Input_layout::position_normal_tangents_color)
+            s.InputLayout = { input_element_desc_compact_position_tangent_frame_color,
+            _countof(input_element_desc_compact_position_tangent_frame_color) };
+        else if (input_layout == Input_layout::position_normal_tangents)
+            s.InputLayout = { input_element_desc_compact_position_tangent_frame,
+            _countof(input_element_desc_compact_position_tangent_frame) };
+        else if (input_layout == Input_layout::position_normal)
+            s.InputLayout = { input_element_desc_compact_position_texture_coords,
+            _countof(input_element_desc_compact_position_texture_coords) };
+        else if (input_layout == Input_layout::position)
+            s.InputLayout = { input_element_desc_compact_position,
+            _countof(input_element_desc_compact_position) };
+    }
+    else if (input_layout == Input_layout::position_normal_tangents_color)
         s.InputLayout = { input_element_desc_position_normal_tangents_color,
         _countof(input_element_desc_position_normal_tangents_color) };
     else if (input_layout == Input_layout::position_normal_tangents)
         s.InputLayout = { input_element_desc_position_normal_tangents,
         _countof(input_element_desc_position_normal_tangents) };
-    if (input_layout == Input_layout::position_normal)
+    else if (input_layout == Input_layout::position_normal)
         s.InputLayout = { input_element_desc_position_normal,
         _countof(input_element_desc_position_normal) };
     else if (input_layout == Input_layout::position)
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Scatter.h"
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    // SplitMix64. Unlike the distributions of <random>, it gives the same numbers with every
+    // standard library.
+    class Random
+    {
+    public:
+        explicit Random(uint64_t seed) : m_state(seed) {}
+
+        uint64_t next()
+        {
+            uint64_t z = (m_state += 0x9e3779b97f4a7c15);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+        // In [0, 1).
+        float uniform()
+        {
+            constexpr float one_over_2_to_24 = 1.0f / 16777216.0f;
+            return static_cast<float>(next() >> 40) * one_over_2_to_24;
+        }
+
+        float uniform(float min, float max)
+        {
+            return min + (max - min) * uniform();
+        }
+    private:
+        uint64_t m_state;
+    };
+
+    // So that the positions and the rest of the objects don't use the same numbers.
+    constexpr uint64_t positions_stream = 0;
+    constexpr uint64_t objects_stream = 1;
+
+    Random random_stream(uint32_t seed, uint64_t stream)
+    {
+        return Random((static_cast<uint64_t>(seed) << 32) ^ stream);
+    }
+
+    struct Region
+    {
+        float min[3];
+        float extent[3];
+        int dimensions; // The ones where it is not flat.
+        double measure; // The length, area or volume in those dimensions.
+    };
+
+    Region region(const Scatter_settings& settings)
+    {
+        Region r = { { settings.region_min.x, settings.region_min.y, settings.region_min.z },
+            { settings.region_max.x - settings.region_min.x,
+              settings.region_max.y - settings.region_min.y,
+              settings.region_max.z - settings.region_min.z }, 0, 1.0 };
+        for (int axis = 0; axis < 3; ++axis)
+            if (r.extent[axis] > 0.0f)
+            {
+                ++r.dimensions;
+                r.measure *= r.extent[axis];
+            }
+            else
+                r.extent[axis] = 0.0f;
+        return r;
+    }
+
+    vector<XMFLOAT3> jittered_grid(const Region& r, size_t count, Random& random)
+    {
+        // Cells of about the same size in all the dimensions, at least as many as the objects.
+        const double cell_size = std::pow(r.measure / count, 1.0 / r.dimensions);
+        int64_t cells[3];
+        for (int axis = 0; axis < 3; ++axis)
+            cells[axis] = r.extent[axis] > 0.0f ? std::max(int64_t(1),
+                static_cast<int64_t>(std::ceil(r.extent[axis] / cell_size))) : 1;
+        // The rounding can make the product a bit too small.
+        while (static_cast<uint64_t>(cells[0] * cells[1] * cells[2]) < count)
+        {
+            int axis = 0;
+            for (int a = 1; a < 3; ++a)
+                if (r.extent[a] / cells[a] > r.extent[axis] / cells[axis])
+                    axis = a;
+            ++cells[axis];
+        }
+
+        // If there are more cells than objects, the objects are spread evenly over them.
+        const uint64_t cell_count = cells[0] * cells[1] * cells[2];
+        vector<XMFLOAT3> positions;
+        positions.reserve(count);
+        for (uint64_t cell = 0; cell < cell_count; ++cell)
+        {
+            if ((cell + 1) * count / cell_count == cell * count / cell_count)
+                continue;
+            const int64_t index[3] = { static_cast<int64_t>(cell / (cells[1] * cells[2])),
+                static_cast<int64_t>(cell / cells[2] % cells[1]),
+                static_cast<int64_t>(cell % cells[2]) };
+            float p[3];
+            for (int axis = 0; axis < 3; ++axis)
+                p[axis] = r.min[axis] + r.extent[axis] * static_cast<float>(std::min(
+                    (index[axis] + random.uniform()) / static_cast<double>(cells[axis]), 1.0));
+            positions.push_back(XMFLOAT3(p[0], p[1], p[2]));
+        }
+        return positions;
+    }
+
+    // Bridson, "Fast Poisson Disk Sampling in Arbitrary Dimensions", 2007. Gives as many
+    // samples as fit with no two of them closer than radius.
+    vector<XMFLOAT3> poisson_disk(const Region& r, float radius, Random& random)
+    {
+        // With this cell size there can be at most one sample in each cell, and the cells with
+        // samples that can be closer than the radius are at most two cells away.
+        constexpr int samples_per_active_sample = 30;
+        constexpr int neighbourhood = 2;
+        constexpr uint32_t empty = UINT32_MAX;
+        const float cell_size = radius / std::sqrt(static_cast<float>(r.dimensions));
+        int64_t cells[3];
+        for (int axis = 0; axis < 3; ++axis)
+            cells[axis] = r.extent[axis] > 0.0f ?
+                static_cast<int64_t>(r.extent[axis] / cell_size) + 1 : 1;
+        vector<uint32_t> grid(static_cast<size_t>(cells[0] * cells[1] * cells[2]), empty);
+
+        vector<XMFLOAT3> samples;
+        vector<uint32_t> active;
+        auto cell_of = [&](const float p[3], int64_t c[3])
+        {
+            for (int axis = 0; axis < 3; ++axis)
+                c[axis] = std::min(cells[axis] - 1, static_cast<int64_t>(
+                    (p[axis] - r.min[axis]) / cell_size));
+        };
+        auto is_free = [&](const float p[3])
+        {
+            int64_t c[3];
+            cell_of(p, c);
+            int64_t first[3], last[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                first[axis] = std::max(int64_t(0), c[axis] - neighbourhood);
+                last[axis] = std::min(cells[axis] - 1, c[axis] + neighbourhood);
+            }
+            for (int64_t x = first[0]; x <= last[0]; ++x)
+                for (int64_t y = first[1]; y <= last[1]; ++y)
+                    for (int64_t z = first[2]; z <= last[2]; ++z)
+                    {
+                        const uint32_t sample = grid[(x * cells[1] + y) * cells[2] + z];
+                        if (sample == empty)
+                            continue;
+                        const XMFLOAT3& s = samples[sample];
+                        const float d[3] = { s.x - p[0], s.y - p[1], s.z - p[2] };
+                        if (d[0] * d[0] + d[1] * d[1] + d[2] * d[2] < radius * radius)
+                            return false;
+                    }
+            return true;
+        };
+        auto add = [&](const float p[3])
+        {
+            int64_t c[3];
+            cell_of(p, c);
+            grid[(c[0] * cells[1] + c[1]) * cells[2] + c[2]] =
+                static_cast<uint32_t>(samples.size());
+            active.push_back(static_cast<uint32_t>(samples.size()));
+            samples.push_back(XMFLOAT3(p[0], p[1], p[2]));
+        };
+
+        float first[3];
+        for (int axis = 0; axis < 3; ++axis)
+            first[axis] = r.min[axis] + r.extent[axis] * random.uniform();
+        add(first);
+
+        while (!active.empty())
+        {
+            const size_t a = static_cast<size_t>(random.next() % active.size());
+            const XMFLOAT3 s = samples[active[a]];
+            const float center[3] = { s.x, s.y, s.z };
+            bool added = false;
+            for (int i = 0; i < samples_per_active_sample && !added; ++i)
+            {
+                // A random direction in the dimensions of the region, at a distance between the
+                // radius and twice the radius.
+                float direction[3];
+                float length_squared;
+                do
+                {
+                    length_squared = 0.0f;
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        direction[axis] = r.extent[axis] > 0.0f ? random.uniform(-1.0f, 1.0f) :
+                            0.0f;
+                        length_squared += direction[axis] * direction[axis];
+                    }
+                } while (length_squared > 1.0f || length_squared < 1e-6f);
+                const float distance = radius * random.uniform(1.0f, 2.0f) /
+                    std::sqrt(length_squared);
+
+                float p[3];
+                bool inside = true;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    p[axis] = center[axis] + direction[axis] * distance;
+                    inside = inside && p[axis] >= r.min[axis] &&
+                        p[axis] <= r.min[axis] + r.extent[axis];
+                }
+                if (inside && is_free(p))
+                {
+                    add(p);
+                    added = true;
+                }
+            }
+            if (!added)
+            {
+                active[a] = active.back();
+                active.pop_back();
+            }
+        }
+        return samples;
+    }
+
+    vector<XMFLOAT3> poisson_disk(const Region& r, size_t count, Random& random)
+    {
+        // A maximal Poisson disk sampling has about 0.7 / radius^2 samples per area unit in
+        // two dimensions, and 0.7 / radius^3 per volume unit in three. With this the sampling
+        // has some more samples than needed, and if not, it is done again with a smaller
+        // radius.
+        constexpr double samples_per_radius_measure = 0.5;
+        float radius = static_cast<float>(std::pow(samples_per_radius_measure * r.measure /
+            count, 1.0 / r.dimensions));
+        vector<XMFLOAT3> samples;
+        while ((samples = poisson_disk(r, radius, random)).size() < count)
+            radius *= 0.9f;
+
+        // The objects are a random subset of the samples, so that they cover the whole region.
+        for (size_t i = 0; i < count; ++i)
+            std::swap(samples[i], samples[i + random.next() % (samples.size() - i)]);
+        samples.resize(count);
+        return samples;
+    }
+
+    // A random rotation, with all of them equally likely. Shoemake, "Uniform random
+    // rotations", Graphics Gems III, 1992.
+    XMFLOAT4 random_rotation(Random& random)
+    {
+        const float u1 = random.uniform();
+        const float angle1 = XM_2PI * random.uniform();
+        const float angle2 = XM_2PI * random.uniform();
+        const float a = std::sqrt(1.0f - u1);
+        const float b = std::sqrt(u1);
+        return XMFLOAT4(a * std::sin(angle1), a * std::cos(angle1), b * std::sin(angle2),
+            b * std::cos(angle2));
+    }
+
+    XMVECTOR random_direction(Random& random)
+    {
+        // Rejection sampling of the unit ball, which has no bias towards the corners.
+        while (true)
+        {
+            const XMVECTOR v = XMVectorSet(random.uniform(-1.0f, 1.0f),
+                random.uniform(-1.0f, 1.0f), random.uniform(-1.0f, 1.0f), 0.0f);
+            const float length_squared = XMVectorGetX(XMVector3LengthSq(v));
+            if (length_squared <= 1.0f && length_squared > 1e-6f)
+                return XMVector3Normalize(v);
+        }
+    }
+}
+
+
+vector<XMFLOAT3> scatter_positions(const Scatter_settings& settings)
+{
+    const size_t count = static_cast<size_t>(std::max(settings.count, 0));
+    const Region r = region(settings);
+    if (count == 0 || r.dimensions == 0)
+        return vector<XMFLOAT3>(count, settings.region_min);
+
+    Random random = random_stream(settings.seed, positions_stream);
+    return settings.sampling == Scatter_sampling::poisson_disk ?
+        poisson_disk(r, count, random) : jittered_grid(r, count, random);
+}
+
+void scatter(const Scatter_settings& settings,
+    const std::function<void(const Scattered_object&)>& add)
+{
+    // The flying objects circle at a distance of a few times their scale, with speeds in
+    // degrees per second.
+    constexpr float min_flying_radius = 2.0f;
+    constexpr float max_flying_radius = 5.0f;
+    constexpr float min_flying_speed = 20.0f;
+    constexpr float max_flying_speed = 100.0f;
+
+    Random random = random_stream(settings.seed, objects_stream);
+    for (auto& p : scatter_positions(settings))
+    {
+        // All the random numbers are drawn for every object, so that e.g. changing a fraction
+        // doesn't change anything else.
+        Scattered_object o;
+        const float scale = random.uniform(settings.min_scale, settings.max_scale);
+        o.position = XMFLOAT4(p.x, p.y, p.z, scale);
+        const XMFLOAT4 rotation = random_rotation(random);
+        o.rotation = settings.random_rotation ? rotation : XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
+
+        const float motion = random.uniform();
+        float fraction = settings.flying_fraction;
+        o.motion = motion < fraction ? Object_motion::flying :
+            motion < (fraction += settings.rotating_fraction) ? Object_motion::rotating :
+            motion < (fraction += settings.dynamic_fraction) ? Object_motion::dynamic :
+            Object_motion::none;
+
+        const XMVECTOR axis = random_direction(random);
+        const XMVECTOR radius = XMVectorScale(XMVector3Normalize(XMVector3Cross(axis,
+            XMVector3Orthogonal(axis))), scale *
+            random.uniform(min_flying_radius, max_flying_radius));
+        XMStoreFloat3(&o.rotation_axis, axis);
+        XMStoreFloat3(&o.point_on_radius, XMVector3Rotate(radius,
+            XMQuaternionRotationNormal(axis, XM_2PI * random.uniform())));
+        o.speed = random.uniform(min_flying_speed, max_flying_speed);
+
+        add(o);
+    }
+}
+
+void write_scatter_scene(std::ostream& scene, const std::string& model_file,
+    const std::string& texture_file, const Scatter_settings& settings)
+{
+    // The view and the light are above one end of the region, looking at its center, at a
+    // distance that shows most of it.
+    const XMVECTOR min = XMLoadFloat3(&settings.region_min);
+    const XMVECTOR max = XMLoadFloat3(&settings.region_max);
+    const XMVECTOR center = XMVectorScale(XMVectorAdd(min, max), 0.5f);
+    const float size = std::max(XMVectorGetX(XMVector3Length(XMVectorSubtract(max, min))),
+        1.0f);
+    XMFLOAT3 c, view, light;
+    XMStoreFloat3(&c, center);
+    XMStoreFloat3(&view, XMVectorAdd(center,
+        XMVectorScale(XMVectorSet(0.0f, 0.3f, -0.7f, 0.0f), size)));
+    XMStoreFloat3(&light, XMVectorAdd(center,
+        XMVectorScale(XMVectorSet(0.2f, 1.0f, -0.3f, 0.0f), size)));
+
+    scene << "# " << settings.count << " scattered objects, written by generate_scene.\n"
+        "model scattered " << model_file << "\n";
+    std::string texture = texture_file;
+    if (texture != "none" && texture != "procedural")
+    {
+        scene << "texture scattered_texture " << texture_file << "\n";
+        texture = "scattered_texture";
+    }
+    scene << "view " << view.x << " " << view.y << " " << view.z << " " <<
+        c.x << " " << c.y << " " << c.z << "\n"
+        "light " << light.x << " " << light.y << " " << light.z << " " <<
+        c.x << " " << c.y << " " << c.z << " 4 " << 2.0f * size << " 3 " << 2.0f * size <<
+        " 1 1 1 1\n"
+        "ambient 0.2 0.2 0.2\n";
+
+    int i = 0;
+    scatter(settings, [&](const Scattered_object& o)
+    {
+        scene << "object o" << i << (o.motion == Object_motion::none ? " static" : " dynamic") <<
+            " scattered " << texture << " " << o.position.x << " " << o.position.y << " " <<
+            o.position.z << " " << o.position.w << "\n";
+        if (o.motion == Object_motion::rotating)
+            scene << "rotate o" << i << "\n";
+        else if (o.motion == Object_motion::flying)
+            scene << "fly o" << i << " " << o.point_on_radius.x << " " <<
+                o.point_on_radius.y << " " << o.point_on_radius.z << " " <<
+                o.rotation_axis.x << " " << o.rotation_axis.y << " " << o.rotation_axis.z <<
+                " " << o.speed << "\n";
+        ++i;
+    });
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include <functional>
+
+
+// Places objects randomly over a region, which gives scenes with any number of objects, e.g.
+// to measure how the culling, sorting and instancing scale. It is deterministic: the same
+// settings, including the seed, give the same objects.
+
+enum class Scatter_sampling
+{
+    jittered_grid, // One object in a random place in each cell of a grid over the region.
+    // No two objects closer than a distance given by the density. It looks more natural, but
+    // is much slower, some 15 s for a million objects instead of a quarter of a second.
+    poisson_disk
+};
+
+struct Scatter_settings
+{
+    int count;
+    DirectX::XMFLOAT3 region_min;
+    DirectX::XMFLOAT3 region_max;
+    float min_scale;
+    float max_scale;
+    bool random_rotation;
+    // Of all the objects, about these fractions are dynamic, rotating and flying, and the rest
+    // are static. The rotating and flying objects are dynamic too, but not counted as dynamic.
+    float dynamic_fraction;
+    float rotating_fraction;
+    float flying_fraction;
+    Scatter_sampling sampling;
+    uint32_t seed;
+};
+
+enum class Object_motion { none, dynamic, rotating, flying };
+
+struct Scattered_object
+{
+    DirectX::XMFLOAT4 position; // The w component is the scale, as in the scene file.
+    DirectX::XMFLOAT4 rotation; // A quaternion.
+    Object_motion motion;
+    // How a flying object flies, as by the fly statement of the scene file.
+    DirectX::XMFLOAT3 point_on_radius;
+    DirectX::XMFLOAT3 rotation_axis;
+    float speed;
+};
+
+// Calls add for each object, in the order that the positions are sampled in.
+void scatter(const Scatter_settings& settings,
+    const std::function<void(const Scattered_object&)>& add);
+
+// The positions that scatter gives the objects. There are always settings.count of them, and
+// dimensions in which the region is flat are left out of the sampling.
+std::vector<DirectX::XMFLOAT3> scatter_positions(const Scatter_settings& settings);
+
+// Writes a scene file with the objects of scatter, for when a file of that size is wanted, e.g.
+// to measure how long it takes to read. The model and texture files are relative to the data
+// directory, and the texture can also be none or procedural. The objects are not rotated,
+// since the object statement has no rotation.
+void write_scatter_scene(std::ostream& scene, const std::string& model_file,
+    const std::string& texture_file, const Scatter_settings& settings);
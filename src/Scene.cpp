@@ -9,13 +9,25 @@
 #include "Scene.h"
 #include "Scene_components.h"
 #include "Scene_file.h"
+#include "Gltf_file.h"
+#include "Compressed_file.h"
 #include "Graphical_object.h"
+#include "Render_queue.h"
+#include "Draw_packets.h"
+#include "Dx12_draw_recorder.h"
+#include "Frustum.h"
+#include "Bvh.h"
+#include "Loose_grid.h"
+#include "Occlusion_buffer.h"
+#include "Job_system.h"
 #include "Shadow_map.h"
 #include "util.h"
 #include "View.h"
 #include "Dx12_util.h"
 
 #include <locale.h>
+#include <optional>
+#include <unordered_set>
 
 using namespace DirectX;
 using namespace DirectX::PackedVector;
@@ -54,6 +66,19 @@ namespace
     {
         return descriptor_start_index_of_materials(swap_chain_buffer_count) + 1;
     }
+
+    // How many objects each job handles in the per frame work that is split over the job
+    // system. The work per object is small, so the jobs have to be big enough to be worth it.
+    constexpr size_t objects_per_animation_job = 1024;
+    constexpr size_t objects_per_lod_selection_job = 256;
+    constexpr size_t objects_per_occlusion_job = 1024;
+
+    // The occluders are the biggest static objects in the view, as seen from the eye, i.e.
+    // those with bounds that have a radius of at least this much of the distance to them. The
+    // distance is at least the other value, for those that the eye is in or close to.
+    constexpr size_t max_occluders = 64;
+    constexpr float min_occluder_size = 0.1f;
+    constexpr float min_occluder_distance = 0.1f;
 }
 
 void convert_vector_to_half4(XMHALF4& half4, XMVECTOR vec)
@@ -84,7 +109,7 @@ class Scene_impl
 {
 public:
     Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
-        const std::string& scene_file, ID3D12DescriptorHeap& descriptor_heap,
+        const std::string& scene_file, Cook_scene cook, ID3D12DescriptorHeap& descriptor_heap,
         int root_param_index_of_values);
     Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
         ID3D12DescriptorHeap& descriptor_heap, int root_param_index_of_values);
@@ -96,6 +121,9 @@ public:
     void draw_regular_objects(ID3D12GraphicsCommandList& command_list,
         Texture_mapping texture_mapping, Input_layout input_layout) const;
     void sort_transparent_objects_back_to_front(const View& view);
+    void select_lods(const View& view);
+    void cull_objects(const View& view);
+    void cull_meshlets(const View& view, Backface_culling backface_culling);
     void draw_transparent_objects(ID3D12GraphicsCommandList& command_list,
         Texture_mapping texture_mapping, Input_layout input_layout) const;
     void draw_alpha_cut_out_objects(ID3D12GraphicsCommandList& command_list,
@@ -107,7 +135,10 @@ public:
         Depth_pass& depth_pass, ID3D12GraphicsCommandList& command_list, Scene& scene);
     int triangles_count() const { return m_triangles_count; }
     size_t vertices_count() const { return m_vertices_count; }
+    size_t index_buffer_size() const { return m_index_buffer_size; }
     size_t objects_count() const { return m.graphical_objects.size(); }
+    size_t visible_objects_count() const;
+    double culling_seconds() const { return m_culling_seconds; }
     size_t lights_count() const { return m.lights.size(); }
     void set_static_instance_data_shader_constant(ID3D12GraphicsCommandList& command_list,
         int root_param_index_of_instance_data) const;
@@ -133,12 +164,66 @@ private:
     void upload_resources_to_gpu(ID3D12Device& device,
         ID3D12GraphicsCommandList& command_list);
     void upload_static_instance_data(ID3D12GraphicsCommandList& command_list);
-    void draw_objects(ID3D12GraphicsCommandList& command_list,
-        const std::vector<std::shared_ptr<Graphical_object> >& objects,
-        Texture_mapping texture_mapping, Input_layout input_layout) const;
+    void draw_objects(ID3D12GraphicsCommandList& command_list, const Render_queue& queue,
+        Draw_packet_stream& draw_packets, Texture_mapping texture_mapping,
+        Input_layout input_layout) const;
+    void update_render_queue_ranges();
+    void build_static_bvh();
+    void build_dynamic_grid();
+    void update_dynamic_grid(const std::vector<int>& moved_transform_refs);
+    Aabb dynamic_box(int dynamic_transform_ref) const;
+    void select_occluder_candidates();
+    void rasterize_occluders(const View& view, const std::vector<int>& visible_static_ids);
+    void cull_render_queues(const Frustum& frustum, Occlusion_culling occlusion_culling);
+    void cull_render_queues(const Frustum& frustum, const std::vector<int>& visible_static_ids,
+        Occlusion_culling occlusion_culling);
+    void cull_meshlets(const std::vector<std::shared_ptr<Graphical_object> >& objects,
+        const View& view, Backface_culling backface_culling);
+    const Per_instance_transform& model_transform(const Graphical_object& object) const;
 
     Scene_components m;
 
+    // The object lists of m, as they are drawn.
+    Render_queue m_regular_queue;
+    Render_queue m_transparent_queue;
+    Render_queue m_alpha_cut_out_queue;
+    Render_queue m_two_sided_queue;
+    // The queues as draw packets, built when a queue is drawn after it has changed, e.g. by a
+    // cull, and replayed by the passes that draw it after that. They are only kept so that
+    // those passes share them, so they are mutable.
+    mutable Draw_packet_stream m_regular_packets;
+    mutable Draw_packet_stream m_transparent_packets;
+    mutable Draw_packet_stream m_alpha_cut_out_packets;
+    mutable Draw_packet_stream m_two_sided_packets;
+
+    // The static objects never move, so they are culled with a hierarchy of their bounds,
+    // which gives the visible ones without testing all of them. The visibility is per object
+    // id, for the render queues. The ids in the view are queried once per cull_objects, and
+    // used both for the occluders and for the render queues.
+    Bvh m_static_bvh;
+    std::vector<int> m_view_static_ids;
+    std::vector<int> m_visible_static_ids;
+    std::vector<uint8_t> m_static_visible;
+
+    // The dynamic objects move, e.g. every frame, so they are culled with a grid that is kept
+    // up to date by only moving the objects that moved in it. The visibility is per dynamic
+    // transform ref.
+    Loose_grid m_dynamic_grid;
+    std::vector<Aabb> m_dynamic_mesh_boxes; // In model space.
+    std::vector<int> m_animated_transform_refs;
+    std::vector<Aabb> m_moved_boxes;
+    std::vector<int> m_visible_dynamic_ids;
+    std::vector<uint8_t> m_dynamic_visible;
+
+    // The big static objects in the view, that are opaque and simple enough, are rasterized
+    // on the CPU each frame, and the objects behind them are culled for the view as well. The
+    // boxes are per object id, of the static objects, and the candidates too, but they are
+    // null for the objects that can't be occluders.
+    Occlusion_buffer m_occlusion_buffer;
+    std::vector<Aabb> m_static_boxes;
+    std::vector<const Graphical_object*> m_occluder_candidates;
+    std::vector<Occluder> m_occluders;
+
     std::vector<std::shared_ptr<Texture>> m_textures;
     CD3DX12_GPU_DESCRIPTOR_HANDLE m_texture_gpu_descriptor_handle;
 
@@ -152,15 +237,21 @@ private:
 
     int m_triangles_count;
     size_t m_vertices_count;
+    size_t m_index_buffer_size;
 
     int m_selected_object_id;
     bool m_object_selected;
+    Meshlet_culling m_meshlet_culling;
+    Frustum_culling m_frustum_culling;
+    std::optional<Frustum> m_view_frustum; // Of the last cull_objects.
+    Time m_culling_time;
+    double m_culling_seconds; // For the view and the shadow maps, in the last frame.
 };
 
 
 Scene::Scene(ID3D12Device& device, UINT swap_chain_buffer_count, const std::string& scene_file,
-    ID3D12DescriptorHeap& descriptor_heap, int root_param_index_of_values) :
-    impl(new Scene_impl(device, swap_chain_buffer_count, scene_file, descriptor_heap,
+    Cook_scene cook, ID3D12DescriptorHeap& descriptor_heap, int root_param_index_of_values) :
+    impl(new Scene_impl(device, swap_chain_buffer_count, scene_file, cook, descriptor_heap,
         root_param_index_of_values))
 {
 }
@@ -193,6 +284,21 @@ void Scene::sort_transparent_objects_back_to_front(const View& view)
     impl->sort_transparent_objects_back_to_front(view);
 }
 
+void Scene::select_lods(const View& view)
+{
+    impl->select_lods(view);
+}
+
+void Scene::cull_objects(const View& view)
+{
+    impl->cull_objects(view);
+}
+
+void Scene::cull_meshlets(const View& view, Backface_culling backface_culling)
+{
+    impl->cull_meshlets(view, backface_culling);
+}
+
 void Scene::draw_transparent_objects(ID3D12GraphicsCommandList& command_list,
     Texture_mapping texture_mapping, Input_layout input_layout) const
 {
@@ -233,11 +339,26 @@ size_t Scene::vertices_count() const
     return impl->vertices_count();
 }
 
+size_t Scene::index_buffer_size() const
+{
+    return impl->index_buffer_size();
+}
+
 size_t Scene::objects_count() const
 {
     return impl->objects_count();
 }
 
+size_t Scene::visible_objects_count() const
+{
+    return impl->visible_objects_count();
+}
+
+double Scene::culling_seconds() const
+{
+    return impl->culling_seconds();
+}
+
 size_t Scene::lights_count() const
 {
     return impl->lights_count();
@@ -350,10 +471,12 @@ void create_texture_null_descriptors(ID3D12Device& device, UINT max_textures,
 }
 
 Scene_impl::Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
-    const std::string& scene_file, ID3D12DescriptorHeap& descriptor_heap,
+    const std::string& scene_file, Cook_scene cook, ID3D12DescriptorHeap& descriptor_heap,
     int root_param_index_of_values) :
     m_root_param_index_of_values(root_param_index_of_values),
-    m_triangles_count(0), m_vertices_count(0), m_selected_object_id(-1), m_object_selected(false)
+    m_triangles_count(0), m_vertices_count(0), m_index_buffer_size(0), m_selected_object_id(-1), m_object_selected(false),
+    m_meshlet_culling(Meshlet_culling::disabled), m_frustum_culling(Frustum_culling::disabled),
+    m_culling_seconds(0.0)
 {
 #ifndef NO_SCENE_FILE
     set_default_scene_components_parameters(m);
@@ -390,7 +513,8 @@ Scene_impl::Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
 
     try
     {
-        read_scene_file(scene_file, m, device, command_list, texture_index, descriptor_heap);
+        read_scene_file(scene_file, m, device, command_list, texture_index, descriptor_heap,
+            cook);
         scene_error = false;
     }
 
@@ -438,6 +562,16 @@ Scene_impl::Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
         print("Error reading file: " + scene_file + "\nMaterial " +
             e.material + " referenced by " + e.object + " not defined", "Error");
     }
+    catch (Gltf_read_error& e)
+    {
+        print("When reading file: " + scene_file + "\nError when trying to read model " +
+            e.file_name + ": " + e.reason, "Error");
+    }
+    catch (Decompression_error& e)
+    {
+        print("When reading file: " + scene_file + "\nError when trying to decompress " +
+            e.file_name + ": " + e.reason, "Error");
+    }
 
     create_texture_null_descriptors(device, max_textures, descriptor_heap, texture_index,
         texture_start_index);
@@ -464,6 +598,7 @@ Scene_impl::Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
     ignore_unused_variable(descriptor_heap);
     ignore_unused_variable(device);
     ignore_unused_variable(scene_file);
+    ignore_unused_variable(cook);
     ignore_unused_variable(swap_chain_buffer_count);
 #endif
 }
@@ -513,12 +648,26 @@ void Scene_impl::init(ID3D12Device& device, ID3D12GraphicsCommandList& command_l
         static_cast<UINT>(m.static_model_transforms.size()), descriptor_heap,
         descriptor_index_of_static_instance_data());
 
+    for (auto& g : m.transparent_objects)
+        g->create_sorted_index_buffers(device, swap_chain_buffer_count);
+
+    m_regular_queue.build(m.regular_objects);
+    m_transparent_queue.build(m.transparent_objects);
+    m_alpha_cut_out_queue.build(m.alpha_cut_out_objects);
+    m_two_sided_queue.build(m.two_sided_objects);
+    build_static_bvh();
+    build_dynamic_grid();
+    select_occluder_candidates();
+
     upload_resources_to_gpu(device, command_list);
+    std::unordered_set<const Mesh*> counted_meshes; // The meshes can be shared between objects.
     for (auto& g : m.graphical_objects)
     {
         g->release_temp_resources();
         m_triangles_count += g->triangles_count();
         m_vertices_count += g->vertices_count();
+        if (counted_meshes.insert(&g->mesh()).second)
+            m_index_buffer_size += g->mesh().index_buffer_size();
     }
 
     int texture_start_index = texture_index_of_textures(swap_chain_buffer_count);
@@ -570,7 +719,9 @@ void create_tiny_scene(Scene_components& sc, ID3D12Device& device,
 Scene_impl::Scene_impl(ID3D12Device& device, UINT swap_chain_buffer_count,
     ID3D12DescriptorHeap& descriptor_heap, int root_param_index_of_values) :
     m_root_param_index_of_values(root_param_index_of_values),
-    m_triangles_count(0), m_vertices_count(0), m_selected_object_id(-1), m_object_selected(false)
+    m_triangles_count(0), m_vertices_count(0), m_index_buffer_size(0), m_selected_object_id(-1), m_object_selected(false),
+    m_meshlet_culling(Meshlet_culling::disabled), m_frustum_culling(Frustum_culling::disabled),
+    m_culling_seconds(0.0)
 {
     set_default_scene_components_parameters(m);
 
@@ -643,56 +794,49 @@ void Scene_impl::update()
         m.dynamic_model_transforms[object.transform_ref].rotation = quaternion_half;
     }
 
-    for (auto& ufo : m.flying_objects) // :-)
-    {
-        XMMATRIX new_model_matrix = fly_around_in_circle(ufo, m.static_model_transforms);
-        XMVECTOR rotation = XMQuaternionRotationMatrix(new_model_matrix);
-        XMVECTOR translation = new_model_matrix.r[3];
-        XMHALF4 translation_half4;
-        convert_vector_to_half4(translation_half4, translation);
-        set_instance_data(m.dynamic_model_transforms[ufo.transform_ref], translation_half4, rotation);
-    }
+    job_system().parallel_for(m.flying_objects.size(), objects_per_animation_job,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto& ufo = m.flying_objects[i]; // :-)
+                XMMATRIX new_model_matrix = fly_around_in_circle(ufo, m.static_model_transforms);
+                XMVECTOR rotation = XMQuaternionRotationMatrix(new_model_matrix);
+                XMVECTOR translation = new_model_matrix.r[3];
+                XMHALF4 translation_half4;
+                convert_vector_to_half4(translation_half4, translation);
+                set_instance_data(m.dynamic_model_transforms[ufo.transform_ref],
+                    translation_half4, rotation);
+            }
+        });
+    update_dynamic_grid(m_animated_transform_refs);
 }
 
 void Scene_impl::draw_objects(ID3D12GraphicsCommandList& command_list,
-    const std::vector<std::shared_ptr<Graphical_object> >& objects,
+    const Render_queue& queue, Draw_packet_stream& draw_packets,
     Texture_mapping texture_mapping, Input_layout input_layout) const
 {
-    command_list.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-    for (size_t i = 0; i < objects.size();)
-    {
-        auto& graphical_object = objects[i];
-
-        constexpr UINT size_in_words_of_value = 1;
-        int object_id = graphical_object->id();
-        command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
-            size_in_words_of_value, &object_id, value_offset_for_object_id());
-        
-        auto dynamic_transform_ref = graphical_object->dynamic_transform_ref();
-        command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
-            size_in_words_of_value, &dynamic_transform_ref,
-            value_offset_for_dynamic_transform_ref());
-         
-        if (texture_mapping == Texture_mapping::enabled)
-        {
-            auto material_id = graphical_object->material_id();
-            command_list.SetGraphicsRoot32BitConstants(m_root_param_index_of_values,
-                size_in_words_of_value, &material_id, value_offset_for_material_id());
-        }
-
-        graphical_object->draw(command_list, input_layout);
+    // The queues are culled again for each shadow map, and then for the view, so the packets
+    // are built once for each of those, and not for each pass.
+    draw_packets.update(queue, m_frustum_culling, m_meshlet_culling);
+    Dx12_draw_recorder recorder(command_list, queue, m_meshlet_culling,
+        m_root_param_index_of_values, texture_mapping, input_layout);
+    draw_packets.replay(recorder);
+}
 
-        // If instances() returns more than 1, those additional instances were already drawn
-        // by the last draw call and the corresponding graphical objects should hence be skipped.
-        i += graphical_object->instances();
-    }
+void Scene_impl::update_render_queue_ranges()
+{
+    // The transparent objects are drawn with their sorted triangles, whatever the lod and the
+    // meshlets, and their queue is built again when they have been sorted.
+    m_regular_queue.update_ranges();
+    m_alpha_cut_out_queue.update_ranges();
+    m_two_sided_queue.update_ranges();
 }
 
 void Scene_impl::draw_regular_objects(ID3D12GraphicsCommandList& command_list,
     Texture_mapping texture_mapping, Input_layout input_layout) const
 {
-    draw_objects(command_list, m.regular_objects, texture_mapping, input_layout);
+    draw_objects(command_list, m_regular_queue, m_regular_packets, texture_mapping,
+        input_layout);
 }
 
 struct Graphical_object_z_of_center_less
@@ -703,54 +847,324 @@ struct Graphical_object_z_of_center_less
     }
 };
 
-XMMATRIX calculate_model_view(Per_instance_transform model, const View& view)
+XMMATRIX calculate_model_matrix(Per_instance_transform model)
 {
     XMVECTOR translation = convert_half4_to_vector(model.translation);
     XMVECTOR rotation = convert_half4_to_vector(model.rotation);
-    XMMATRIX model_matrix = XMMatrixAffineTransformation(XMVectorSet(1.0f, 1.0f, 1.0f, 1.0f),
-        XMVectorZero(), rotation, translation);
-    XMMATRIX model_view = XMMatrixMultiply(model_matrix, view.view_matrix());
-    return model_view;
+    // The w component of the translation is the scale, like in the shaders.
+    XMVECTOR scale = XMVectorReplicate(XMVectorGetW(translation));
+    return XMMatrixAffineTransformation(scale, XMVectorZero(), rotation,
+        XMVectorSetW(translation, 1.0f));
+}
+
+const Per_instance_transform& Scene_impl::model_transform(const Graphical_object& object) const
+{
+    auto ref = object.dynamic_transform_ref();
+    return ref >= 0 ? m.dynamic_model_transforms[ref] : m.static_model_transforms[object.id()];
 }
 
 void Scene_impl::sort_transparent_objects_back_to_front(const View& view)
 {
     // We only sort the transparent objects, not the alpha cut out objects. For better visual
-    // results they should also be sorted, but we get decent results without sorting. And for 
-    // scenes with many alpha cut out objects we save quite a bit of performance, mainly by
-    // not needing to have one Graphical_object per triangle. The sort seems to actually be
-    // quite cheap.
+    // results they should also be sorted, but we get decent results without sorting.
     //
-    // Splitting the objects in their composing triangles and sorting those doesn't give
-    // perfect results in all cases either. The order has to be determined per pixel for that.
+    // The objects are sorted by their centers, and the triangles of each object by their
+    // centers. That doesn't give perfect results in all cases either, e.g. for intersecting
+    // objects. The order has to be determined per pixel for that.
+
+    // Each object has a sorted index buffer of its own, so they are sorted in parallel.
+    job_system().parallel_for(m.transparent_objects.size(), 1,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto& g = m.transparent_objects[i];
+                auto model_view = XMMatrixMultiply(calculate_model_matrix(model_transform(*g)),
+                    view.view_matrix());
+                g->transform_center(model_view);
+                g->sort_triangles_back_to_front(model_view);
+            }
+        });
 
-    for (auto& g : m.transparent_objects)
+    std::sort(m.transparent_objects.begin(), m.transparent_objects.end(),
+        Graphical_object_z_of_center_less());
+}
+
+void Scene_impl::select_lods(const View& view)
+{
+    // How many pixels one unit covers at the distance 1, from the vertical field of view.
+    const float pixels_per_unit_at_unit_distance = 0.5f * view.height() *
+        XMVectorGetY(view.projection_matrix().r[1]);
+    constexpr float min_distance = 0.01f;
+    job_system().parallel_for(m.graphical_objects.size(), objects_per_lod_selection_job,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto& g = m.graphical_objects[i];
+                if (g->instances() != 1 || g->mesh().lod_count() == 1)
+                    continue;
+                auto& model = model_transform(*g);
+                XMVECTOR center = XMVector3Transform(g->mesh().center(),
+                    calculate_model_matrix(model));
+                float distance = XMVectorGetX(XMVector3Length(center - view.eye_position()));
+                float scale = XMVectorGetW(convert_half4_to_vector(model.translation));
+                g->select_lod(pixels_per_unit_at_unit_distance * scale /
+                    std::max(distance, min_distance));
+            }
+        });
+    update_render_queue_ranges();
+}
+
+void Scene_impl::build_static_bvh()
+{
+    std::vector<Aabb> boxes(m.graphical_objects.size());
+    job_system().parallel_for(boxes.size(), objects_per_animation_job,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto& g = m.graphical_objects[i];
+                const Aabb box = { g->mesh().aabb_min(), g->mesh().aabb_max() };
+                boxes[i] = transformed_aabb(box,
+                    calculate_model_matrix(m.static_model_transforms[g->id()]));
+            }
+        });
+
+    std::vector<Aabb> static_boxes;
+    std::vector<int> ids;
+    m_static_boxes.resize(m.static_model_transforms.size());
+    for (size_t i = 0; i < boxes.size(); ++i)
+        if (m.graphical_objects[i]->dynamic_transform_ref() < 0)
+        {
+            static_boxes.push_back(boxes[i]);
+            ids.push_back(m.graphical_objects[i]->id());
+            m_static_boxes[ids.back()] = boxes[i];
+        }
+    m_static_bvh.build(static_boxes, ids);
+    m_static_visible.resize(m.static_model_transforms.size());
+}
+
+void Scene_impl::build_dynamic_grid()
+{
+    m_dynamic_mesh_boxes.resize(m.dynamic_model_transforms.size());
+    std::vector<int> refs;
+    for (auto& g : m.graphical_objects)
     {
-        auto model = m.static_model_transforms[g->id()];
-        auto model_view = calculate_model_view(model, view);
-        g->transform_center(model_view);
+        const int ref = g->dynamic_transform_ref();
+        if (ref < 0)
+            continue;
+        m_dynamic_mesh_boxes[ref] = { g->mesh().aabb_min(), g->mesh().aabb_max() };
+        refs.push_back(ref);
     }
+    std::vector<Aabb> boxes(refs.size());
+    for (size_t i = 0; i < refs.size(); ++i)
+        boxes[i] = dynamic_box(refs[i]);
+    m_dynamic_grid.clear(Loose_grid::cell_size_for(boxes));
+    for (size_t i = 0; i < refs.size(); ++i)
+        m_dynamic_grid.set(refs[i], boxes[i]);
+    m_dynamic_visible.resize(m.dynamic_model_transforms.size());
+
+    m_animated_transform_refs.clear();
+    for (auto& object : m.rotating_objects)
+        m_animated_transform_refs.push_back(object.transform_ref);
+    for (auto& ufo : m.flying_objects)
+        m_animated_transform_refs.push_back(ufo.transform_ref);
+}
 
-    std::sort(m.transparent_objects.begin(), m.transparent_objects.end(),
-        Graphical_object_z_of_center_less());
+void Scene_impl::update_dynamic_grid(const std::vector<int>& moved_transform_refs)
+{
+    // The boxes are transformed in parallel, but the grid is updated by one thread, which is
+    // cheap when the objects stay in their cells, as they do for most of the frames.
+    m_moved_boxes.resize(moved_transform_refs.size());
+    job_system().parallel_for(m_moved_boxes.size(), objects_per_animation_job,
+        [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                m_moved_boxes[i] = dynamic_box(moved_transform_refs[i]);
+        });
+    for (size_t i = 0; i < m_moved_boxes.size(); ++i)
+        m_dynamic_grid.set(moved_transform_refs[i], m_moved_boxes[i]);
+}
+
+Aabb Scene_impl::dynamic_box(int dynamic_transform_ref) const
+{
+    return transformed_aabb(m_dynamic_mesh_boxes[dynamic_transform_ref],
+        calculate_model_matrix(m.dynamic_model_transforms[dynamic_transform_ref]));
+}
+
+void Scene_impl::select_occluder_candidates()
+{
+    // The transparent and the alpha cut out objects can be seen through.
+    m_occluder_candidates.assign(m.static_model_transforms.size(), nullptr);
+    for (auto objects : { &m.regular_objects, &m.two_sided_objects })
+        for (auto& g : *objects)
+            if (g->dynamic_transform_ref() < 0 && !g->mesh().occluder_indices().empty())
+                m_occluder_candidates[g->id()] = g.get();
+}
+
+void Scene_impl::rasterize_occluders(const View& view,
+    const std::vector<int>& visible_static_ids)
+{
+    m_culling_time.seconds_since_last_call();
+
+    // The candidates in the view that cover the most of it, as estimated by the size of their
+    // bounds compared to the distance to them, are the occluders.
+    struct Candidate
+    {
+        float size;
+        int id;
+    };
+    std::vector<Candidate> candidates;
+    const XMVECTOR eye = view.eye_position();
+    for (int id : visible_static_ids)
+    {
+        if (!m_occluder_candidates[id])
+            continue;
+        const Aabb& box = m_static_boxes[id];
+        const XMVECTOR min_corner = XMLoadFloat3(&box.min_corner);
+        const XMVECTOR max_corner = XMLoadFloat3(&box.max_corner);
+        const float radius = XMVectorGetX(XMVector3Length(max_corner - min_corner)) * 0.5f;
+        const float distance = XMVectorGetX(XMVector3Length(
+            (min_corner + max_corner) * 0.5f - eye));
+        const float size = radius / std::max(distance, min_occluder_distance);
+        if (size >= min_occluder_size)
+            candidates.push_back({ size, id });
+    }
+    const size_t count = std::min(candidates.size(), max_occluders);
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const Candidate& c1, const Candidate& c2) { return c1.size > c2.size; });
+
+    m_occluders.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int id = candidates[i].id;
+        const Mesh& mesh = m_occluder_candidates[id]->mesh();
+        Occluder occluder = { &mesh.occluder_vertices(), &mesh.occluder_indices(), {} };
+        XMStoreFloat4x4(&occluder.model, calculate_model_matrix(m.static_model_transforms[id]));
+        m_occluders.push_back(occluder);
+    }
+    m_occlusion_buffer.rasterize(m_occluders, view.view_projection_matrix());
+    m_culling_seconds += m_culling_time.seconds_since_last_call();
+}
+
+void Scene_impl::cull_render_queues(const Frustum& frustum,
+    Occlusion_culling occlusion_culling)
+{
+    // For the frusta other than the view, i.e. the ones of the shadow maps.
+    m_culling_time.seconds_since_last_call();
+    m_visible_static_ids.clear();
+    m_static_bvh.query(frustum, m_visible_static_ids);
+    m_culling_seconds += m_culling_time.seconds_since_last_call();
+    cull_render_queues(frustum, m_visible_static_ids, occlusion_culling);
+}
+
+void Scene_impl::cull_render_queues(const Frustum& frustum,
+    const std::vector<int>& visible_static_ids, Occlusion_culling occlusion_culling)
+{
+    m_culling_time.seconds_since_last_call();
+    std::fill(m_static_visible.begin(), m_static_visible.end(), uint8_t(0));
+    for (int id : visible_static_ids)
+        m_static_visible[id] = 1;
+    m_visible_dynamic_ids.clear();
+    m_dynamic_grid.query(frustum, m_visible_dynamic_ids);
+    std::fill(m_dynamic_visible.begin(), m_dynamic_visible.end(), uint8_t(0));
+    for (int ref : m_visible_dynamic_ids)
+        m_dynamic_visible[ref] = 1;
+
+    if (occlusion_culling == Occlusion_culling::enabled)
+    {
+        job_system().parallel_for(visible_static_ids.size(), objects_per_occlusion_job,
+            [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const int id = visible_static_ids[i];
+                    if (m_occlusion_buffer.occluded(m_static_boxes[id]))
+                        m_static_visible[id] = 0;
+                }
+            });
+        job_system().parallel_for(m_visible_dynamic_ids.size(), objects_per_occlusion_job,
+            [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const int ref = m_visible_dynamic_ids[i];
+                    if (m_occlusion_buffer.occluded(m_dynamic_grid.box(ref)))
+                        m_dynamic_visible[ref] = 0;
+                }
+            });
+    }
+
+    for (auto queue : { &m_regular_queue, &m_transparent_queue, &m_alpha_cut_out_queue,
+        &m_two_sided_queue })
+        queue->cull(m_static_visible, m_dynamic_visible);
+    m_culling_seconds += m_culling_time.seconds_since_last_call();
+}
+
+void Scene_impl::cull_objects(const View& view)
+{
+    m_culling_seconds = 0.0;
+    m_view_frustum = Frustum(view.view_projection_matrix());
+    m_culling_time.seconds_since_last_call();
+    m_view_static_ids.clear();
+    m_static_bvh.query(*m_view_frustum, m_view_static_ids);
+    m_culling_seconds += m_culling_time.seconds_since_last_call();
+    rasterize_occluders(view, m_view_static_ids);
+    cull_render_queues(*m_view_frustum, m_view_static_ids, Occlusion_culling::enabled);
+    m_frustum_culling = Frustum_culling::enabled;
+}
+
+size_t Scene_impl::visible_objects_count() const
+{
+    return m_regular_queue.visible_instances_count() +
+        m_transparent_queue.visible_instances_count() +
+        m_alpha_cut_out_queue.visible_instances_count() +
+        m_two_sided_queue.visible_instances_count();
+}
+
+void Scene_impl::cull_meshlets(const View& view, Backface_culling backface_culling)
+{
+    // The two sided and alpha cut out objects are drawn without backface culling.
+    cull_meshlets(m.regular_objects, view, backface_culling);
+    cull_meshlets(m.two_sided_objects, view, Backface_culling::disabled);
+    cull_meshlets(m.alpha_cut_out_objects, view, Backface_culling::disabled);
+    m_meshlet_culling = Meshlet_culling::enabled;
+    update_render_queue_ranges();
+}
+
+void Scene_impl::cull_meshlets(const std::vector<std::shared_ptr<Graphical_object> >& objects,
+    const View& view, Backface_culling backface_culling)
+{
+    // The meshlets of an object are many, so each object is a job.
+    job_system().parallel_for(objects.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto& g = objects[i];
+            if (g->instances() != 1 || g->mesh().meshlets().empty())
+                continue;
+            XMMATRIX model_matrix = calculate_model_matrix(model_transform(*g));
+            XMVECTOR eye = XMVector3Transform(view.eye_position(),
+                XMMatrixInverse(nullptr, model_matrix));
+            g->cull_meshlets(model_matrix * view.view_projection_matrix(), eye,
+                backface_culling);
+        }
+    });
 }
 
 void Scene_impl::draw_transparent_objects(ID3D12GraphicsCommandList& command_list,
     Texture_mapping texture_mapping, Input_layout input_layout) const
 {
-    draw_objects(command_list, m.transparent_objects, texture_mapping, input_layout);
+    draw_objects(command_list, m_transparent_queue, m_transparent_packets, texture_mapping,
+        input_layout);
 }
 
 void Scene_impl::draw_alpha_cut_out_objects(ID3D12GraphicsCommandList& command_list,
     Texture_mapping texture_mapping, Input_layout input_layout) const
 {
-    draw_objects(command_list, m.alpha_cut_out_objects, texture_mapping, input_layout);
+    draw_objects(command_list, m_alpha_cut_out_queue, m_alpha_cut_out_packets,
+        texture_mapping, input_layout);
 }
 
 void Scene_impl::draw_two_sided_objects(ID3D12GraphicsCommandList& command_list,
     Texture_mapping texture_mapping, Input_layout input_layout) const
 {
-    draw_objects(command_list, m.two_sided_objects, texture_mapping, input_layout);
+    draw_objects(command_list, m_two_sided_queue, m_two_sided_packets, texture_mapping,
+        input_layout);
 }
 
 void Scene_impl::upload_data_to_gpu(ID3D12GraphicsCommandList& command_list,
@@ -767,13 +1181,31 @@ void Scene_impl::upload_data_to_gpu(ID3D12GraphicsCommandList& command_list,
     if (!m.dynamic_model_transforms.empty())
         m_dynamic_instance_data[back_buf_index]->upload_new_data_to_gpu(command_list,
             m.dynamic_model_transforms);
+
+    // They were sorted for this frame before this, see sort_transparent_objects_back_to_front.
+    for (auto& g : m.transparent_objects)
+        g->upload_sorted_triangles(command_list, back_buf_index);
+    m_transparent_queue.build(m.transparent_objects);
 }
 
 void Scene_impl::generate_shadow_maps(UINT back_buf_index,
     Depth_pass& depth_pass, ID3D12GraphicsCommandList& command_list, Scene& scene)
 {
+    // The shadow maps are rendered from the lights, and with the backfaces, so the meshlets
+    // that were culled for the view can be needed there. The objects are culled for each
+    // light instead, which selects the shadow casters, and then for the view again.
+    auto meshlet_culling = m_meshlet_culling;
+    m_meshlet_culling = Meshlet_culling::disabled;
     for (auto& s : m_shadow_maps)
+    {
+        if (m_frustum_culling == Frustum_culling::enabled)
+            cull_render_queues(Frustum(s.view().view_projection_matrix()),
+                Occlusion_culling::disabled);
         s.generate(back_buf_index, scene, depth_pass, command_list);
+    }
+    m_meshlet_culling = meshlet_culling;
+    if (m_frustum_culling == Frustum_culling::enabled && !m_shadow_maps.empty())
+        cull_render_queues(*m_view_frustum, m_view_static_ids, Occlusion_culling::enabled);
 }
 
 void Scene_impl::upload_static_instance_data(ID3D12GraphicsCommandList& command_list)
@@ -853,6 +1285,7 @@ void Scene_impl::manipulate_object(DirectX::XMFLOAT3& delta_pos, DirectX::XMFLOA
         XMVECTOR rotation = convert_half4_to_vector(selected_object_rotation);
         convert_vector_to_half4(selected_object_rotation,
             XMQuaternionMultiply(rotation, XMLoadFloat4(&delta_rotation)));
+        m_dynamic_grid.set(dynamic_transform_ref, dynamic_box(dynamic_transform_ref));
     }
 }
 
@@ -13,6 +13,8 @@ using Microsoft::WRL::ComPtr;
 
 enum class Texture_mapping;
 enum class Input_layout;
+enum class Backface_culling;
+enum class Cook_scene;
 
 
 constexpr UINT value_offset_for_object_id() { return 0; }
@@ -27,6 +29,13 @@ constexpr UINT value_offset_for_material_id()
     return value_offset_for_dynamic_transform_ref() + 1;
 }
 
+// After the render settings, which are set by Root_signature. It is two float4, see
+// Position_dequantization, so it starts at the second float4 of the values.
+constexpr UINT value_offset_for_position_dequantization()
+{
+    return value_offset_for_material_id() + 2;
+}
+
 constexpr UINT texture_index_of_depth_buffer() { return 0; }
 
 class View;
@@ -47,7 +56,8 @@ class Scene
 {
 public:
     Scene(ID3D12Device& device, UINT swap_chain_buffer_count, const std::string& scene_file,
-        ID3D12DescriptorHeap& texture_descriptor_heap, int root_param_index_of_values);
+        Cook_scene cook, ID3D12DescriptorHeap& texture_descriptor_heap,
+        int root_param_index_of_values);
     Scene(ID3D12Device& device, UINT swap_chain_buffer_count,
         ID3D12DescriptorHeap& texture_descriptor_heap, int root_param_index_of_values);
     ~Scene();
@@ -55,7 +65,21 @@ public:
 
     void draw_regular_objects(ID3D12GraphicsCommandList& command_list,
         Texture_mapping texture_mapping, Input_layout input_layout) const;
+    // Also sorts the triangles of each transparent object. They are uploaded by
+    // upload_data_to_gpu, so this should be called before that.
     void sort_transparent_objects_back_to_front(const View& view);
+    // Selects the level of detail of each object from how big it is in the view.
+    void select_lods(const View& view);
+    // Until the next call, only the objects and the instances that are in the view are drawn,
+    // and to the shadow maps only the ones in the frustums of their lights. The static objects
+    // are culled with a Bvh of their bounds, the dynamic ones with a Loose_grid of theirs,
+    // which update keeps up to date as they move, like manipulate_object does. For the view,
+    // the objects behind the biggest simple static objects are culled too, with an
+    // Occlusion_buffer, so they are left out of the early z pass as well as the main pass.
+    void cull_objects(const View& view);
+    // Until the next call, only the meshlets that are visible from the view are drawn,
+    // except for the shadow maps.
+    void cull_meshlets(const View& view, Backface_culling backface_culling);
     void draw_transparent_objects(ID3D12GraphicsCommandList& command_list,
         Texture_mapping texture_mapping, Input_layout input_layout) const;
     void draw_alpha_cut_out_objects(ID3D12GraphicsCommandList& command_list,
@@ -67,7 +91,10 @@ public:
         Depth_pass& depth_pass, ID3D12GraphicsCommandList& command_list);
     int triangles_count() const;
     size_t vertices_count() const;
+    size_t index_buffer_size() const;
     size_t objects_count() const;
+    size_t visible_objects_count() const; // By the last cull_objects, of all the instances.
+    double culling_seconds() const; // For the view and the shadow maps, in the last frame.
     size_t lights_count() const;
     void set_static_instance_data_shader_constant(ID3D12GraphicsCommandList& command_list,
         int root_param_index_of_instance_data) const;
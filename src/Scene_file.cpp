@@ -9,9 +9,21 @@
 #include "Scene_file.h"
 #include "Scene_components.h"
 #include "Wavefront_obj_file.h"
+#include "Gltf_file.h"
+#include "Compressed_file.h"
+#include "Mesh_cache.h"
+#include "Job_system.h"
+#include "Scene_snapshot.h"
+#include "Scatter.h"
 #include "util.h"
 #include "Primitives.h"
 
+#include <charconv>
+#include <deque>
+#include <iterator>
+#include <string_view>
+#include <unordered_map>
+
 
 using namespace DirectX;
 using namespace DirectX::PackedVector;
@@ -19,6 +31,7 @@ using std::map;
 using std::vector;
 using std::shared_ptr;
 using std::string;
+using std::string_view;
 
 
 void throw_if_file_not_openable(const std::string& file_name)
@@ -29,40 +42,378 @@ void throw_if_file_not_openable(const std::string& file_name)
 }
 
 
-void read_scene_file(const std::string& file_name, Scene_components& sc, ID3D12Device& device,
-    ID3D12GraphicsCommandList& command_list, int& texture_index,
-    ID3D12DescriptorHeap& texture_descriptor_heap)
+namespace
 {
-    using std::ifstream;
-    ifstream file(file_name);
-    if (!file.is_open())
-        throw Scene_file_open_error();
+    // The part of a model that is read from its file, before any GPU resources are created.
+    struct Model_data
+    {
+        vector<Obj_object> objects;
+        map<string, Material> materials;
+        vector<string> material_files; // The mtl files that were read.
+    };
+
+    Model_data read_model_data(const string& model, const string& model_file,
+        Obj_flip_v flip_v)
+    {
+        throw_if_file_not_openable(model_file);
+
+        Model_data m;
+        if (!read_mesh_cache(model_file, flip_v, m.objects, m.materials, &m.material_files))
+        {
+            if (is_glb_file(uncompressed_file_name(model_file)))
+            {
+                // The images are relative to the model file, while the textures are
+                // relative to the data directory.
+                const string model_directory = model.substr(0,
+                    model.find_last_of("/\\") + 1);
+                m.objects = read_glb_objects(model_file, model_directory, m.materials);
+            }
+            else
+                m.objects = read_obj_objects(model_file, m.materials, flip_v,
+                    &m.material_files);
+            write_mesh_cache(model_file, flip_v, m.objects, m.materials, m.material_files);
+        }
+        return m;
+    }
+
+    // WIC, which decodes most of the textures, needs COM on the thread that uses it.
+    class Com_initialization
+    {
+    public:
+        Com_initialization() : m_result(CoInitializeEx(nullptr,
+            COINITBASE_MULTITHREADED | COINIT_DISABLE_OLE1DDE)) {}
+        ~Com_initialization()
+        {
+            if (SUCCEEDED(m_result))
+                CoUninitialize();
+        }
+    private:
+        HRESULT m_result;
+    };
+
+    inline bool is_space(char c)
+    {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Reads the words and numbers of a scene file like an istream, but in place. The words are
+    // views of the text, so reading them creates no strings.
+    class Scene_tokens
+    {
+    public:
+        explicit Scene_tokens(string_view text) : m_position(text.data()),
+            m_end(text.data() + text.size()) {}
+
+        // Gives an empty word at the end of the text.
+        Scene_tokens& operator>>(string_view& word)
+        {
+            while (m_position < m_end && is_space(*m_position))
+                ++m_position;
+            const char* begin = m_position;
+            while (m_position < m_end && !is_space(*m_position))
+                ++m_position;
+            word = string_view(begin, m_position - begin);
+            return *this;
+        }
+
+        Scene_tokens& operator>>(float& number) { read_number(number); return *this; }
+        Scene_tokens& operator>>(int& number) { read_number(number); return *this; }
+
+        void skip_line()
+        {
+            m_position = static_cast<const char*>(memchr(m_position, '\n',
+                m_end - m_position));
+            m_position = m_position ? m_position + 1 : m_end;
+        }
+    private:
+        // Throws Read_error if the next word is not a number.
+        template<typename T>
+        void read_number(T& number)
+        {
+            string_view word;
+            *this >> word;
+            const char* begin = word.data();
+            const char* end = word.data() + word.size();
+            if (begin < end && *begin == '+') // Not accepted by from_chars.
+                ++begin;
+            auto result = std::from_chars(begin, end, number);
+            if (word.empty() || result.ec != std::errc() || result.ptr != end)
+                throw Read_error(string(word));
+        }
+
+        const char* m_position;
+        const char* m_end;
+    };
+
+    // Names that are looked up by string_view, e.g. straight from the scene text, without
+    // creating a string for each lookup. A name is only copied when it is added.
+    template<typename T>
+    class Symbol_table
+    {
+    public:
+        T* find(string_view name)
+        {
+            auto symbol = m_symbols.find(name);
+            return symbol == m_symbols.end() ? nullptr : &symbol->second;
+        }
+
+        T& operator[](string_view name)
+        {
+            if (T* value = find(name))
+                return *value;
+            m_names.emplace_back(name);
+            return m_symbols[m_names.back()];
+        }
+    private:
+        std::unordered_map<string_view, T> m_symbols;
+        std::deque<string> m_names; // The keys refer to these, which a deque doesn't move.
+    };
+
+    // Allocates the objects in blocks instead of one at a time, since a scene can have millions
+    // of them. The objects of a block share its reference count, so it is freed when none of
+    // them are used anymore.
+    class Graphical_object_allocator
+    {
+    public:
+        Graphical_object_allocator() : m_next_block_size(first_block_size) {}
+
+        template<typename... Args>
+        shared_ptr<Graphical_object> create(Args&&... args)
+        {
+            if (!m_block || m_block->size() == m_block->capacity())
+            {
+                m_block = std::make_shared<vector<Graphical_object>>();
+                m_block->reserve(m_next_block_size);
+                m_next_block_size = std::min(m_next_block_size * 2, max_block_size);
+            }
+            m_block->emplace_back(std::forward<Args>(args)...);
+            return shared_ptr<Graphical_object>(m_block, &m_block->back());
+        }
+    private:
+        // Small scenes don't need big blocks.
+        static constexpr size_t first_block_size = 16;
+        static constexpr size_t max_block_size = 4096;
+
+        shared_ptr<vector<Graphical_object>> m_block;
+        size_t m_next_block_size;
+    };
+
+    // Reserves room for count more elements. Reserving the exact size for each of many small
+    // additions would give up the geometric growth, and make them quadratic.
+    template<typename T>
+    void reserve_more(vector<T>& v, size_t count)
+    {
+        if (v.size() + count > v.capacity())
+            v.reserve(std::max(v.size() + count, v.capacity() * 2));
+    }
+}
+
+// Reads the model files and decodes the texture files of a scene as background jobs, ahead of
+// the pass over the scene file that uses them. It finds them by looking ahead in the file, see
+// prefetch_scene, and when a model has been read, the textures of its materials are decoded
+// too. What the scene pass asks for that has not been prefetched is loaded when it is asked
+// for. The jobs are run by the job system it is given, normally the shared one.
+// The scene pass still creates the meshes and textures, which records the command list and
+// gives the textures their descriptor indices, in the order of the file. That keeps the
+// result the same as when everything was done on one thread.
+class Scene_prefetcher
+{
+public:
+    Scene_prefetcher(ID3D12Device& device, Job_system& jobs);
+    ~Scene_prefetcher();
+
+    void prefetch_scene(string_view scene_text);
+    void prefetch_model(const string& model, const string& model_file, Obj_flip_v flip_v);
+    void prefetch_texture(const string& texture_file);
+
+    const Model_data& model(const string& model, const string& model_file, Obj_flip_v flip_v);
+    Decoded_texture texture(const string& texture_file);
+private:
+    void prefetch_textures(const Model_data& model);
+
+    ID3D12Device& m_device;
+    Job_system& m_jobs;
+    std::mutex m_mutex;
+    map<string, std::shared_future<Model_data>> m_models;
+    map<string, std::future<Decoded_texture>> m_textures;
+    std::atomic<bool> m_cancelled;
+};
+
+Scene_prefetcher::Scene_prefetcher(ID3D12Device& device, Job_system& jobs) :
+    m_device(device), m_jobs(jobs), m_cancelled(false)
+{
+}
+
+void Scene_prefetcher::prefetch_scene(string_view scene_text)
+{
+    // This only looks at the lines by their first words. A texture is only decoded if its name
+    // is used on a later line, since it is not loaded otherwise.
+    std::unordered_map<string_view, string_view> texture_files;
+    for (size_t begin = 0; begin < scene_text.size();)
+    {
+        const size_t end = std::min(scene_text.find('\n', begin), scene_text.size());
+        Scene_tokens words(scene_text.substr(begin, end - begin));
+        begin = end + 1;
+        string_view statement, name, file;
+        words >> statement;
+        if (statement.empty() || statement[0] == '#')
+            continue;
+        if (statement == "model" || statement == "model_dont_flip_v")
+        {
+            words >> name >> file;
+            if (!file.empty() && file != "cube" && file != "plane")
+                prefetch_model(string(file), data_path + string(file),
+                    statement == "model_dont_flip_v" ? Obj_flip_v::no : Obj_flip_v::yes);
+        }
+        else if (statement == "texture")
+        {
+            words >> name >> file;
+            if (!file.empty())
+                texture_files[name] = file;
+        }
+        else
+            for (words >> name; !name.empty(); words >> name)
+            {
+                auto texture = texture_files.find(name);
+                if (texture != texture_files.end() && !texture->second.empty())
+                {
+                    prefetch_texture(data_path + string(texture->second));
+                    texture->second = string_view(); // So that it is only prefetched once.
+                }
+            }
+    }
+}
+
+Scene_prefetcher::~Scene_prefetcher()
+{
+    // The jobs refer to this, so the ones that are left, e.g. when the scene file has an
+    // error, have to be waited for. Those that have not started do nothing. The model jobs
+    // are waited for first, since they add texture jobs.
+    m_cancelled = true;
+    vector<std::shared_future<Model_data>> models;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& m : m_models)
+            models.push_back(m.second);
+    }
+    for (auto& m : models)
+        m.wait();
+    for (auto& t : m_textures)
+        t.second.wait();
+}
+
+void Scene_prefetcher::prefetch_model(const string& model, const string& model_file,
+    Obj_flip_v flip_v)
+{
+    const string key = model_file + (flip_v == Obj_flip_v::yes ? "" : " dont_flip_v");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_models.count(key))
+        return;
+    m_models[key] = m_jobs.submit([=] {
+        if (m_cancelled)
+            return Model_data();
+        Model_data m = read_model_data(model, model_file, flip_v);
+        prefetch_textures(m);
+        return m;
+    }).share();
+}
+
+void Scene_prefetcher::prefetch_texture(const string& texture_file)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_textures.count(texture_file))
+        return;
+    m_textures[texture_file] = m_jobs.submit([=] {
+        if (m_cancelled)
+            return Decoded_texture();
+        Com_initialization com;
+        return decode_texture_file(m_device, texture_file);
+    });
+}
+
+void Scene_prefetcher::prefetch_textures(const Model_data& model)
+{
+    for (auto& material : model.materials)
+        for (auto texture : { &Material::diffuse_map, &Material::normal_map,
+            &Material::ao_roughness_metalness_map })
+            if (!(material.second.*texture).empty())
+                prefetch_texture(data_path + material.second.*texture);
+}
+
+const Model_data& Scene_prefetcher::model(const string& model, const string& model_file,
+    Obj_flip_v flip_v)
+{
+    const string key = model_file + (flip_v == Obj_flip_v::yes ? "" : " dont_flip_v");
+    prefetch_model(model, model_file, flip_v);
+    std::shared_future<Model_data> result;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        result = m_models[key];
+    }
+    // The future is kept in the map, so the result lives as long as this object.
+    return result.get();
+}
 
-    read_scene_file_stream(file, sc, device, command_list, texture_index, texture_descriptor_heap);
+Decoded_texture Scene_prefetcher::texture(const string& texture_file)
+{
+    std::future<Decoded_texture> result;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto prefetched = m_textures.find(texture_file);
+        if (prefetched != m_textures.end())
+        {
+            result = std::move(prefetched->second);
+            m_textures.erase(prefetched);
+        }
+    }
+    // A texture file is only used once, unless it has several names.
+    if (!result.valid())
+        return decode_texture_file(m_device, texture_file);
+    return result.get();
 }
 
 struct Parse_state
 {
     Parse_state(Scene_components& sc, ID3D12Device& device,
         ID3D12GraphicsCommandList& command_list, int& texture_index,
-        ID3D12DescriptorHeap& texture_descriptor_heap);
-    shared_ptr<Texture> get_texture(const string& name);
-    void add_texture(const string& texture_name, vector<shared_ptr<Texture>>& used_textures,
+        ID3D12DescriptorHeap& texture_descriptor_heap, Scene_prefetcher& prefetcher);
+    shared_ptr<Texture> get_texture(string_view name);
+    void add_texture(string_view texture_name, vector<shared_ptr<Texture>>& used_textures,
         UINT& texture_index);
     int add_material(UINT diff_tex_index, UINT normal_map_index, UINT aorm_map_index,
         UINT material_settings);
-    void add_diffuse_and_normal_map(const string& diffuse_map, const string& normal_map,
+    void add_diffuse_and_normal_map(string_view diffuse_map, string_view normal_map,
         vector<shared_ptr<Texture>>& used_textures, int& current_material, UINT& material_settings);
-    void create_object(const string& name, shared_ptr<Mesh> mesh,
+    shared_ptr<Graphical_object> create_object(string_view name, const shared_ptr<Mesh>& mesh,
         const std::vector<shared_ptr<Texture>>& used_textures, bool dynamic, XMFLOAT4 position,
         UINT material_id, int instances = 1, UINT material_settings = 0,
-        int triangle_start_index = 0, bool rotating = false);
+        bool rotating = false, XMFLOAT4 rotation = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+    shared_ptr<Mesh> first_mesh(string_view model);
+    Dynamic_object dynamic_object(string_view name);
+
+    Symbol_table<shared_ptr<Mesh>> meshes;
+    Symbol_table<shared_ptr<Model_collection>> model_collections;
+    Symbol_table<shared_ptr<Texture>> textures;
+    Symbol_table<string> texture_files;
+    Symbol_table<Dynamic_object> objects;
+
+    // The objects of a dynamic array have consecutive ids and transform refs, and are referred
+    // to as arrayobject<id>. They are found from these instead of by names of their own.
+    struct Dynamic_array
+    {
+        int first_object_id;
+        int first_transform_ref;
+        size_t first_object; // In sc.graphical_objects.
+        int count;
+    };
+    vector<Dynamic_array> dynamic_arrays;
 
-    map<string, shared_ptr<Mesh>> meshes;
-    map<string, shared_ptr<Model_collection>> model_collections;
-    map<string, shared_ptr<Texture>> textures;
-    map<string, string> texture_files;
-    map<string, Dynamic_object> objects;
+    Graphical_object_allocator object_allocator;
+
+    // What the scene is created from, see Scene_snapshot.
+    Scene_snapshot snapshot;
+    std::unordered_map<const Mesh*, uint32_t> mesh_refs;
+    std::unordered_map<const Texture*, uint32_t> texture_refs;
 
     int object_id;
     int transform_ref;
@@ -74,118 +425,309 @@ struct Parse_state
     ID3D12GraphicsCommandList& command_list;
     int& m_texture_index;
     ID3D12DescriptorHeap& texture_descriptor_heap;
+    Scene_prefetcher& prefetcher;
 };
 
 namespace
 {
-    void read_object(std::istream& file, const std::string& input, Parse_state& s);
-    void read_array(std::istream& file, const std::string& input, Parse_state& s);
-    void read_model(std::istream& file, const std::string& input, Parse_state& s);
-    void read_texture(std::istream& file, map<string, string>& texture_files);
-    void read_fly(std::istream& file, Scene_components& sc, map<string, Dynamic_object>& objects);
-    void read_rotate(std::istream& file, Scene_components& sc, map<string, Dynamic_object>& objects);
-    void read_rotate(std::istream& file, Scene_components& sc, map<string, Dynamic_object>& objects);
-    void read_light(std::istream& file, Scene_components& sc);
-    void read_ambient(std::istream& file, Scene_components& sc);
-    void read_view(std::istream& file, Scene_components& sc);
+    void read_object(Scene_tokens& file, string_view input, Parse_state& s);
+    void read_array(Scene_tokens& file, string_view input, Parse_state& s);
+    void read_scatter(Scene_tokens& file, string_view input, Parse_state& s);
+    void read_model(Scene_tokens& file, string_view input, Parse_state& s);
+    void read_texture(Scene_tokens& file, Symbol_table<string>& texture_files);
+    void read_fly(Scene_tokens& file, Parse_state& s);
+    void read_rotate(Scene_tokens& file, Parse_state& s);
+    void read_light(Scene_tokens& file, Scene_components& sc);
+    void read_ambient(Scene_tokens& file, Scene_components& sc);
+    void read_view(Scene_tokens& file, Scene_components& sc);
+    void add_to_object_lists(Scene_components& sc, const shared_ptr<Graphical_object>& object,
+        UINT material_settings);
+}
+
+namespace
+{
+    Scene_snapshot read_scene(std::istream& scene_file, Scene_components& sc,
+        ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+        int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap, Job_system& jobs);
+    bool create_scene_from_snapshot(const Scene_snapshot& snapshot, Scene_components& sc,
+        ID3D12Device& device, ID3D12GraphicsCommandList& command_list, int& texture_index,
+        ID3D12DescriptorHeap& texture_descriptor_heap);
+}
+
+void read_scene_file(const std::string& file_name, Scene_components& sc, ID3D12Device& device,
+    ID3D12GraphicsCommandList& command_list, int& texture_index,
+    ID3D12DescriptorHeap& texture_descriptor_heap, Cook_scene cook/* = Cook_scene::no*/)
+{
+    Time time;
+    time.seconds_since_last_call();
+    const string snapshot_file = scene_snapshot_file_name(file_name);
+    Scene_snapshot snapshot;
+    if (cook == Cook_scene::no && read_scene_snapshot(snapshot_file, snapshot))
+    {
+        if (create_scene_from_snapshot(snapshot, sc, device, command_list, texture_index,
+            texture_descriptor_heap))
+        {
+            log("Created the scene from " + snapshot_file + " in " +
+                std::to_string(time.seconds_since_last_call()) + " s");
+            return;
+        }
+        log("The scene snapshot " + snapshot_file + " is out of date, so " + file_name +
+            " is read instead");
+    }
+
+    auto file = open_input_file(file_name);
+    if (!*file)
+        throw Scene_file_open_error();
+
+    snapshot = read_scene(*file, sc, device, command_list, texture_index,
+        texture_descriptor_heap, job_system());
+    log("Read the scene file " + file_name + " in " +
+        std::to_string(time.seconds_since_last_call()) + " s");
+
+    if (cook == Cook_scene::yes)
+    {
+        snapshot.dependencies.insert(snapshot.dependencies.begin(), file_name);
+        for (auto& t : snapshot.texture_files)
+            if (!t.empty())
+                snapshot.dependencies.push_back(t);
+        if (!write_scene_snapshot(snapshot_file, snapshot))
+            log("Could not write the scene snapshot " + snapshot_file);
+    }
 }
 
-// Only performs basic error checking for the moment. Not very robust.
-// You should ensure that the scene file is valid.
 void read_scene_file_stream(std::istream& file, Scene_components& sc,
     ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
     int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap)
 {
-    using namespace Material_settings;
+    read_scene(file, sc, device, command_list, texture_index, texture_descriptor_heap,
+        job_system());
+}
 
-    Parse_state s(sc, device, command_list, texture_index, texture_descriptor_heap);
+void read_scene_file_stream(std::istream& file, Scene_components& sc,
+    ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+    int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap, Job_system& jobs)
+{
+    read_scene(file, sc, device, command_list, texture_index, texture_descriptor_heap, jobs);
+}
 
-    while (file)
+namespace
+{
+    // Only performs basic error checking for the moment. Not very robust.
+    // You should ensure that the scene file is valid.
+    Scene_snapshot read_scene(std::istream& scene_file, Scene_components& sc,
+        ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+        int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap, Job_system& jobs)
     {
-        string input;
-        file >> input;
-
-        if (input == "object" || input == "normal_mapped_object")
-        {
-            read_object(file, input, s);
-        }
-        else if (input == "array" || input == "rotating_array" ||
-            input == "normal_mapped_array" || input == "normal_mapped_rotating_array")
-        {
-            read_array(file, input, s);
-        }
-        else if (input == "texture")
-        {
-            read_texture(file, s.texture_files);
-        }
-        else if (input == "model" || input == "model_dont_flip_v")
-        {
-            read_model(file, input, s);
-        }
-        else if (input == "fly")
-        {
-            read_fly(file, sc, s.objects);
-        }
-        else if (input == "rotate")
-        {
-            read_rotate(file, sc, s.objects);
-        }
-        else if (input == "light")
-        {
-            read_light(file, sc);
-        }
-        else if (input == "ambient")
+        using namespace Material_settings;
+
+        // The whole scene file is read first, so that the prefetcher can look ahead in it, and
+        // so that the names can be looked up as views of it. It is read through iterators,
+        // which let the errors of a compressed file through, see Compressed_file.h, where
+        // inserting the stream buffer into a stream would catch them and only fail.
+        const string scene_text((std::istreambuf_iterator<char>(scene_file)),
+            std::istreambuf_iterator<char>());
+        Scene_prefetcher prefetcher(device, jobs);
+        prefetcher.prefetch_scene(scene_text);
+        Scene_tokens file(scene_text);
+
+        Parse_state s(sc, device, command_list, texture_index, texture_descriptor_heap,
+            prefetcher);
+
+        while (true)
         {
-            read_ambient(file, sc);
-        }
-        else if (input == "view")
-        {
-            read_view(file, sc);
+            string_view input;
+            file >> input;
+
+            if (input.empty())
+            {
+                break;
+            }
+            else if (input == "object" || input == "normal_mapped_object")
+            {
+                read_object(file, input, s);
+            }
+            else if (input == "array" || input == "rotating_array" ||
+                input == "normal_mapped_array" || input == "normal_mapped_rotating_array")
+            {
+                read_array(file, input, s);
+            }
+            else if (input == "scatter" || input == "normal_mapped_scatter")
+            {
+                read_scatter(file, input, s);
+            }
+            else if (input == "texture")
+            {
+                read_texture(file, s.texture_files);
+            }
+            else if (input == "model" || input == "model_dont_flip_v")
+            {
+                read_model(file, input, s);
+            }
+            else if (input == "fly")
+            {
+                read_fly(file, s);
+            }
+            else if (input == "rotate")
+            {
+                read_rotate(file, s);
+            }
+            else if (input == "light")
+            {
+                read_light(file, sc);
+            }
+            else if (input == "ambient")
+            {
+                read_ambient(file, sc);
+            }
+            else if (input == "view")
+            {
+                read_view(file, sc);
+            }
+            else if (input[0] == '#')
+            {
+                file.skip_line();
+            }
+            else
+                throw Read_error(string(input));
         }
-        else if (!input.empty() && input[0] == '#')
+
+        s.snapshot.flying_objects.reserve(sc.flying_objects.size());
+        for (auto& f : sc.flying_objects)
+            s.snapshot.flying_objects.push_back({ static_cast<uint32_t>(f.object->id()),
+                f.point_on_radius, f.rotation_axis, f.speed, f.transform_ref });
+        s.snapshot.rotating_objects.reserve(sc.rotating_objects.size());
+        for (auto& r : sc.rotating_objects)
+            s.snapshot.rotating_objects.push_back({ static_cast<uint32_t>(r.object->id()),
+                r.transform_ref });
+        s.snapshot.dynamic_model_transforms = sc.dynamic_model_transforms;
+        s.snapshot.static_model_transforms = sc.static_model_transforms;
+        s.snapshot.materials = sc.materials;
+        s.snapshot.lights = sc.lights;
+        s.snapshot.ambient_light = sc.ambient_light;
+        s.snapshot.shadow_casting_lights_count = sc.shadow_casting_lights_count;
+        s.snapshot.initial_view_position = sc.initial_view_position;
+        s.snapshot.initial_view_focus_point = sc.initial_view_focus_point;
+        return std::move(s.snapshot);
+    }
+
+    // The meshes and textures are created in the same order as by read_scene, so the textures
+    // get the same descriptor indices, which the materials refer to. Returns false, before
+    // anything is created, if the models don't have the meshes that the snapshot refers to.
+    bool create_scene_from_snapshot(const Scene_snapshot& snapshot, Scene_components& sc,
+        ID3D12Device& device, ID3D12GraphicsCommandList& command_list, int& texture_index,
+        ID3D12DescriptorHeap& texture_descriptor_heap)
+    {
+        Scene_prefetcher prefetcher(device, job_system());
+        for (auto& m : snapshot.models)
+            prefetcher.prefetch_model(m.file, data_path + m.file,
+                m.flip_v ? Obj_flip_v::yes : Obj_flip_v::no);
+        for (auto& t : snapshot.texture_files)
+            if (!t.empty())
+                prefetcher.prefetch_texture(t);
+
+        // The model files and their mtl files are checked by read_scene_snapshot, so this only
+        // fails if they have changed since then.
+        vector<const Model_data*> models;
+        for (auto& m : snapshot.models)
+            models.push_back(&prefetcher.model(m.file, data_path + m.file,
+                m.flip_v ? Obj_flip_v::yes : Obj_flip_v::no));
+        for (auto& m : snapshot.meshes)
+            if (m.model >= 0 && m.index >= model_collection_size(models[m.model]->objects))
+                return false;
+
+        vector<shared_ptr<Model_collection>> collections;
+        for (size_t i = 0; i < models.size(); ++i)
+            collections.push_back(create_model_collection(models[i]->objects,
+                models[i]->materials, device, command_list, data_path + snapshot.models[i].file));
+
+        vector<shared_ptr<Mesh>> meshes;
+        for (auto& m : snapshot.meshes)
         {
-            std::getline(file, input);
+            if (m.model == Scene_snapshot::cube)
+                meshes.push_back(std::make_shared<Cube>(device, command_list));
+            else if (m.model == Scene_snapshot::plane)
+                meshes.push_back(std::make_shared<Plane>(device, command_list));
+            else
+                meshes.push_back(collections[m.model]->models[m.index].mesh);
         }
-        else if (input == "")
+
+        vector<shared_ptr<Texture>> textures;
+        for (auto& t : snapshot.texture_files)
+            if (t.empty())
+                textures.push_back(std::make_shared<Texture>(device, command_list,
+                    texture_descriptor_heap, texture_index++, 512, 512));
+            else
+                textures.push_back(std::make_shared<Texture>(device, command_list,
+                    texture_descriptor_heap, prefetcher.texture(t), texture_index++));
+
+        Graphical_object_allocator object_allocator;
+        reserve_more(sc.graphical_objects, snapshot.objects.size());
+        vector<shared_ptr<Texture>> used_textures;
+        for (auto& o : snapshot.objects)
         {
+            used_textures.clear();
+            for (uint32_t i = 0; i < o.texture_count; ++i)
+                used_textures.push_back(textures[snapshot.object_textures[o.first_texture + i]]);
+            auto object = object_allocator.create(meshes[o.mesh], used_textures,
+                static_cast<int>(sc.graphical_objects.size()), o.material_id,
+                o.dynamic_transform_ref, o.instances);
+            sc.graphical_objects.push_back(object);
+            add_to_object_lists(sc, object, o.material_settings);
         }
-        else
-            throw Read_error(input);
+
+        for (auto& f : snapshot.flying_objects)
+            sc.flying_objects.push_back({ sc.graphical_objects[f.object], f.point_on_radius,
+                f.rotation_axis, f.speed, f.transform_ref });
+        for (auto& r : snapshot.rotating_objects)
+            sc.rotating_objects.push_back({ sc.graphical_objects[r.object], r.transform_ref });
+
+        sc.dynamic_model_transforms = snapshot.dynamic_model_transforms;
+        sc.static_model_transforms = snapshot.static_model_transforms;
+        sc.materials = snapshot.materials;
+        sc.lights = snapshot.lights;
+        sc.ambient_light = snapshot.ambient_light;
+        sc.shadow_casting_lights_count = snapshot.shadow_casting_lights_count;
+        sc.initial_view_position = snapshot.initial_view_position;
+        sc.initial_view_focus_point = snapshot.initial_view_focus_point;
+        return true;
     }
 }
 
 Parse_state::Parse_state(Scene_components& sc, ID3D12Device& device,
     ID3D12GraphicsCommandList& command_list, int& texture_index,
-    ID3D12DescriptorHeap& texture_descriptor_heap) :
+    ID3D12DescriptorHeap& texture_descriptor_heap, Scene_prefetcher& prefetcher) :
     object_id(0), transform_ref(0), material_id(0), texture_start_index(texture_index),
     sc(sc), device(device), command_list(command_list), m_texture_index(texture_index),
-    texture_descriptor_heap(texture_descriptor_heap)
+    texture_descriptor_heap(texture_descriptor_heap), prefetcher(prefetcher)
 {
 }
 
-shared_ptr<Texture> Parse_state::get_texture(const string& name)
+shared_ptr<Texture> Parse_state::get_texture(string_view name)
 {
+    if (auto texture = textures.find(name))
+        return *texture;
+
     shared_ptr<Texture> texture;
-    bool texture_not_already_created = textures.find(name) == textures.end();
-    if (texture_not_already_created)
-    {
-        if (name == "procedural")
-            texture = std::make_shared<Texture>(device, command_list,
-                texture_descriptor_heap, m_texture_index++, 512, 512);
-        else if (texture_files.find(name) == texture_files.end())
-            throw Texture_not_defined(name);
-        else
-            texture = std::make_shared<Texture>(device, command_list,
-                texture_descriptor_heap, texture_files[name], m_texture_index++);
-        textures[name] = texture;
+    string file;
+    if (name == "procedural")
+        texture = std::make_shared<Texture>(device, command_list,
+            texture_descriptor_heap, m_texture_index++, 512, 512);
+    else if (auto texture_file = texture_files.find(name))
+    {
+        file = *texture_file;
+        texture = std::make_shared<Texture>(device, command_list,
+            texture_descriptor_heap, prefetcher.texture(file), m_texture_index++);
     }
     else
-        texture = textures[name];
+        throw Texture_not_defined(string(name));
 
+    textures[name] = texture;
+    texture_refs[texture.get()] = static_cast<uint32_t>(snapshot.texture_files.size());
+    snapshot.texture_files.push_back(file);
     return texture;
 };
 
-void Parse_state::add_texture(const string& texture_name,
+void Parse_state::add_texture(string_view texture_name,
     vector<shared_ptr<Texture>>& used_textures, UINT& texture_index)
 {
     shared_ptr<Texture> texture = get_texture(texture_name);
@@ -205,7 +747,7 @@ int Parse_state::add_material(UINT diff_tex_index, UINT normal_map_index, UINT a
     return current_material_id;
 };
 
-void Parse_state::add_diffuse_and_normal_map(const string& diffuse_map, const string& normal_map,
+void Parse_state::add_diffuse_and_normal_map(string_view diffuse_map, string_view normal_map,
     vector<shared_ptr<Texture>>& used_textures, int& current_material, UINT& material_settings)
 {
     using namespace Material_settings;
@@ -229,30 +771,30 @@ void Parse_state::add_diffuse_and_normal_map(const string& diffuse_map, const st
         aorm_map_index, material_settings);
 };
 
-void Parse_state::create_object(const string& name, shared_ptr<Mesh> mesh,
-    const std::vector<shared_ptr<Texture>>& used_textures, bool dynamic, XMFLOAT4 position,
-    UINT object_material_id, int instances/* = 1*/, UINT material_settings/* = 0*/,
-    int triangle_start_index/* = 0*/, bool rotating/* = false*/)
+shared_ptr<Graphical_object> Parse_state::create_object(string_view name,
+    const shared_ptr<Mesh>& mesh, const std::vector<shared_ptr<Texture>>& used_textures,
+    bool dynamic, XMFLOAT4 position, UINT object_material_id, int instances/* = 1*/,
+    UINT material_settings/* = 0*/, bool rotating/* = false*/,
+    XMFLOAT4 rotation/* = XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f)*/)
 {
     using namespace Material_settings;
 
     Per_instance_transform transform = { convert_float4_to_half4(position),
-    convert_vector_to_half4(DirectX::XMQuaternionIdentity()) };
+    convert_float4_to_half4(rotation) };
     sc.static_model_transforms.push_back(transform);
     int dynamic_transform_ref = dynamic ? transform_ref : -1;
-    auto object = std::make_shared<Graphical_object>(mesh, used_textures, object_id++,
-        object_material_id, dynamic_transform_ref, instances, triangle_start_index);
+    auto object = object_allocator.create(mesh, used_textures, object_id++,
+        object_material_id, dynamic_transform_ref, instances);
 
     sc.graphical_objects.push_back(object);
+    add_to_object_lists(sc, object, material_settings);
 
-    if (material_settings & transparency)
-        sc.transparent_objects.push_back(object);
-    else if (material_settings & alpha_cut_out)
-        sc.alpha_cut_out_objects.push_back(object);
-    else if (material_settings & two_sided)
-        sc.two_sided_objects.push_back(object);
-    else
-        sc.regular_objects.push_back(object);
+    snapshot.objects.push_back({ mesh_refs[mesh.get()],
+        static_cast<uint32_t>(snapshot.object_textures.size()),
+        static_cast<uint32_t>(used_textures.size()), static_cast<int32_t>(object_material_id),
+        dynamic_transform_ref, instances, material_settings });
+    for (auto& t : used_textures)
+        snapshot.object_textures.push_back(texture_refs[t.get()]);
 
     if (dynamic)
     {
@@ -265,32 +807,92 @@ void Parse_state::create_object(const string& name, shared_ptr<Mesh> mesh,
 
         ++transform_ref;
     }
+    return object;
 };
 
+// Arrays and scatters of a model use its first mesh.
+shared_ptr<Mesh> Parse_state::first_mesh(string_view model)
+{
+    if (auto primitive = meshes.find(model))
+        return *primitive;
+    if (auto collection = model_collections.find(model))
+        return (*collection)->models.front().mesh;
+    throw Model_not_defined(string(model));
+}
+
+Dynamic_object Parse_state::dynamic_object(string_view name)
+{
+    if (auto object = objects.find(name))
+        return *object;
+
+    constexpr string_view array_object = "arrayobject";
+    int id = -1;
+    if (name.substr(0, array_object.size()) == array_object)
+    {
+        const char* end = name.data() + name.size();
+        auto result = std::from_chars(name.data() + array_object.size(), end, id);
+        if (result.ec != std::errc() || result.ptr != end)
+            id = -1;
+    }
+    // The arrays are in the order of their ids.
+    auto array = std::upper_bound(dynamic_arrays.begin(), dynamic_arrays.end(), id,
+        [](int value, const Dynamic_array& a) { return value < a.first_object_id; });
+    if (id < 0 || array == dynamic_arrays.begin() ||
+        id >= (array - 1)->first_object_id + (array - 1)->count)
+        throw Object_not_defined(string(name));
+
+    --array;
+    const int index = id - array->first_object_id;
+    return { sc.graphical_objects[array->first_object + index],
+        array->first_transform_ref + index };
+}
+
 namespace
 {
-    void read_model(std::istream& file, const std::string& input, Parse_state& s)
+    void read_model(Scene_tokens& file, string_view input, Parse_state& s)
     {
-        string name, model;
+        string_view name, model;
         file >> name >> model;
 
-        if (s.meshes.find(name) != s.meshes.end() ||
-            s.model_collections.find(name) != s.model_collections.end())
-            throw Model_already_defined(name);
+        if (s.meshes.find(name) || s.model_collections.find(name))
+            throw Model_already_defined(string(name));
+
+        auto add_primitive = [&](shared_ptr<Mesh> mesh, int32_t primitive)
+        {
+            s.mesh_refs[mesh.get()] = static_cast<uint32_t>(s.snapshot.meshes.size());
+            s.snapshot.meshes.push_back({ primitive, 0 });
+            s.meshes[name] = mesh;
+        };
 
         if (model == "cube")
-            s.meshes[name] = std::make_shared<Cube>(s.device, s.command_list);
+            add_primitive(std::make_shared<Cube>(s.device, s.command_list),
+                Scene_snapshot::cube);
         else if (model == "plane")
-            s.meshes[name] = std::make_shared<Plane>(s.device, s.command_list);
+            add_primitive(std::make_shared<Plane>(s.device, s.command_list),
+                Scene_snapshot::plane);
         else
         {
-            string model_file = data_path + model;
+            string model_file = data_path + string(model);
             throw_if_file_not_openable(model_file);
 
             Obj_flip_v flip_v = input == "model_dont_flip_v" ? Obj_flip_v::no : Obj_flip_v::yes;
-            auto collection = read_obj_file(model_file, s.device, s.command_list, flip_v);
+            const Model_data& data = s.prefetcher.model(string(model), model_file, flip_v);
+            auto collection = create_model_collection(data.objects, data.materials, s.device,
+                s.command_list, model_file);
             s.model_collections[name] = collection;
 
+            const int32_t model_ref = static_cast<int32_t>(s.snapshot.models.size());
+            s.snapshot.models.push_back({ string(model), flip_v == Obj_flip_v::yes });
+            s.snapshot.dependencies.push_back(model_file);
+            s.snapshot.dependencies.insert(s.snapshot.dependencies.end(),
+                data.material_files.begin(), data.material_files.end());
+            for (size_t i = 0; i < collection->models.size(); ++i)
+            {
+                s.mesh_refs[collection->models[i].mesh.get()] =
+                    static_cast<uint32_t>(s.snapshot.meshes.size());
+                s.snapshot.meshes.push_back({ model_ref, static_cast<uint32_t>(i) });
+            }
+
             auto add_texture = [&](const string& file_name)
             {
                 if (!file_name.empty())
@@ -301,7 +903,7 @@ namespace
                 }
             };
 
-            for (auto m : collection->materials)
+            for (auto& m : collection->materials)
             {
                 add_texture(m.second.diffuse_map);
                 add_texture(m.second.normal_map);
@@ -310,50 +912,49 @@ namespace
         }
     }
 
-    void read_texture(std::istream& file, map<string, string>& texture_files)
+    void read_texture(Scene_tokens& file, Symbol_table<string>& texture_files)
     {
-        string name, texture_file;
+        string_view name, texture_file;
         file >> name >> texture_file;
-        string texture_file_path = data_path + texture_file;
+        string texture_file_path = data_path + string(texture_file);
         throw_if_file_not_openable(texture_file_path);
         texture_files[name] = texture_file_path;
     }
 
-    void read_object(std::istream& file, const std::string& input, Parse_state& s)
+    void read_object(Scene_tokens& file, string_view input, Parse_state& s)
     {
-        string name, static_dynamic;
+        string_view name, static_dynamic;
         file >> name >> static_dynamic;
         if (static_dynamic != "static" && static_dynamic != "dynamic")
-            throw Read_error(static_dynamic);
-        string model, diffuse_map;
+            throw Read_error(string(static_dynamic));
+        string_view model, diffuse_map;
         XMFLOAT4 position;
         file >> model >> diffuse_map >> position.x >> position.y >> position.z
             >> position.w; // This is used as scale.
 
         bool dynamic = static_dynamic == "dynamic" ? true : false;
 
-        string normal_map = "";
+        string_view normal_map;
         if (input == "normal_mapped_object")
             file >> normal_map;
 
-        if (s.meshes.find(model) != s.meshes.end())
+        if (auto mesh = s.meshes.find(model))
         {
-            auto mesh = s.meshes[model];
-
             vector<shared_ptr<Texture>> used_textures;
             UINT material_settings = 0;
             int current_material = 0;
             s.add_diffuse_and_normal_map(diffuse_map, normal_map, used_textures,
                 current_material, material_settings);
 
-            s.create_object(name, mesh, used_textures, dynamic, position,
+            s.create_object(name, *mesh, used_textures, dynamic, position,
                 current_material, 1, material_settings);
         }
         else
         {
-            if (s.model_collections.find(model) == s.model_collections.end())
-                throw Model_not_defined(model);
-            auto& model_collection = s.model_collections[model];
+            auto collection = s.model_collections.find(model);
+            if (!collection)
+                throw Model_not_defined(string(model));
+            auto& model_collection = *collection;
 
             for (auto& m : model_collection->models)
             {
@@ -368,7 +969,7 @@ namespace
                 {
                     auto material_iter = model_collection->materials.find(m.material);
                     if (material_iter == model_collection->materials.end())
-                        throw Material_not_defined(m.material, model);
+                        throw Material_not_defined(m.material, string(model));
                     auto& material = material_iter->second;
                     aorm_map = material.ao_roughness_metalness_map;
                     material_settings = material.settings;
@@ -400,42 +1001,34 @@ namespace
 
                 constexpr int instances = 1;
                 s.create_object(name, m.mesh, used_textures, dynamic, position,
-                    current_material_id, instances, material_settings,
-                    m.triangle_start_index);
+                    current_material_id, instances, material_settings);
             }
         }
     }
 
-    void read_array(std::istream& file, const std::string& input, Parse_state& s)
+    void read_array(Scene_tokens& file, string_view input, Parse_state& s)
     {
-        string static_dynamic;
+        string_view static_dynamic;
         file >> static_dynamic;
         if (static_dynamic != "static" && static_dynamic != "dynamic")
-            throw Read_error(static_dynamic);
+            throw Read_error(string(static_dynamic));
 
-        string model, diffuse_map;
+        string_view model, diffuse_map;
         XMFLOAT3 pos, offset;
         XMINT3 count;
         float scale;
         file >> model >> diffuse_map >> pos.x >> pos.y >> pos.z
             >> count.x >> count.y >> count.z >> offset.x >> offset.y >> offset.z >> scale;
 
-        string normal_map = "";
+        string_view normal_map;
         if (input == "normal_mapped_array" || input == "normal_mapped_rotating_array")
             file >> normal_map;
 
-        int instances = count.x * count.y * count.z;
+        int instances = std::max(count.x, 0) * std::max(count.y, 0) * std::max(count.z, 0);
         bool dynamic = static_dynamic == "dynamic" ? true : false;
-        s.sc.graphical_objects.reserve(s.sc.graphical_objects.size() + instances);
-        s.sc.regular_objects.reserve(s.sc.regular_objects.size() + instances);
-
-        shared_ptr<Mesh> mesh;
-        if (s.meshes.find(model) != s.meshes.end())
-            mesh = s.meshes[model];
-        else if (s.model_collections.find(model) != s.model_collections.end())
-            mesh = s.model_collections[model]->models.front().mesh;
-        else
-            throw Model_not_defined(model);
+        bool rotating = input == "rotating_array" || input == "normal_mapped_rotating_array";
+
+        shared_ptr<Mesh> mesh = s.first_mesh(model);
 
         vector<shared_ptr<Texture>> used_textures;
         UINT material_settings = 0;
@@ -443,7 +1036,20 @@ namespace
         s.add_diffuse_and_normal_map(diffuse_map, normal_map, used_textures,
             current_material, material_settings);
 
-        constexpr int triangle_start_index = 0;
+        reserve_more(s.sc.graphical_objects, instances);
+        reserve_more(s.sc.regular_objects, instances);
+        reserve_more(s.sc.static_model_transforms, instances);
+        reserve_more(s.snapshot.objects, instances);
+        reserve_more(s.snapshot.object_textures, instances * used_textures.size());
+        if (dynamic)
+        {
+            reserve_more(s.sc.dynamic_model_transforms, instances);
+            if (rotating)
+                reserve_more(s.sc.rotating_objects, instances);
+            if (instances > 0)
+                s.dynamic_arrays.push_back({ s.object_id, s.transform_ref,
+                    s.sc.graphical_objects.size(), instances });
+        }
 
         for (int x = 0; x < count.x; ++x)
             for (int y = 0; y < count.y; ++y)
@@ -451,38 +1057,106 @@ namespace
                 {
                     XMFLOAT4 position = XMFLOAT4(pos.x + offset.x * x, pos.y + offset.y * y,
                         pos.z + offset.z * z, scale);
-                    s.create_object(dynamic ? "arrayobject" + std::to_string(s.object_id) : "",
-                        mesh, used_textures, dynamic, position, current_material, instances,
-                        material_settings, triangle_start_index,
-                        (input == "rotating_array" || input == "normal_mapped_rotating_array") ?
-                        true : false);
+                    s.create_object(string_view(), mesh, used_textures, dynamic, position,
+                        current_material, instances, material_settings, rotating);
                 }
     }
 
-    void read_fly(std::istream& file, Scene_components& sc, map<string, Dynamic_object>& objects)
+    void read_scatter(Scene_tokens& file, string_view input, Parse_state& s)
     {
-        string object;
-        file >> object;
-        if (!objects.count(object))
-            throw Object_not_defined(object);
+        string_view separate_instanced;
+        file >> separate_instanced;
+        if (separate_instanced != "separate" && separate_instanced != "instanced")
+            throw Read_error(string(separate_instanced));
+
+        string_view model, diffuse_map, sampling;
+        Scatter_settings settings;
+        int random_rotation, seed;
+        file >> model >> diffuse_map >> settings.count
+            >> settings.region_min.x >> settings.region_min.y >> settings.region_min.z
+            >> settings.region_max.x >> settings.region_max.y >> settings.region_max.z
+            >> settings.min_scale >> settings.max_scale >> random_rotation
+            >> settings.dynamic_fraction >> settings.rotating_fraction
+            >> settings.flying_fraction >> sampling >> seed;
+        if (sampling == "jittered_grid")
+            settings.sampling = Scatter_sampling::jittered_grid;
+        else if (sampling == "poisson_disk")
+            settings.sampling = Scatter_sampling::poisson_disk;
+        else
+            throw Read_error(string(sampling));
+        settings.random_rotation = random_rotation != 0;
+        settings.seed = static_cast<uint32_t>(seed);
+
+        string_view normal_map;
+        if (input == "normal_mapped_scatter")
+            file >> normal_map;
+
+        shared_ptr<Mesh> mesh = s.first_mesh(model);
+
+        vector<shared_ptr<Texture>> used_textures;
+        UINT material_settings = 0;
+        int current_material = 0;
+        s.add_diffuse_and_normal_map(diffuse_map, normal_map, used_textures,
+            current_material, material_settings);
+
+        const size_t count = std::max(settings.count, 0);
+        reserve_more(s.sc.graphical_objects, count);
+        reserve_more(s.sc.regular_objects, count);
+        reserve_more(s.sc.static_model_transforms, count);
+        reserve_more(s.snapshot.objects, count);
+        reserve_more(s.snapshot.object_textures, count * used_textures.size());
+
+        auto create = [&](const Scattered_object& o, int instances)
+        {
+            auto object = s.create_object(string_view(), mesh, used_textures,
+                o.motion != Object_motion::none, o.position, current_material, instances,
+                material_settings, o.motion == Object_motion::rotating, o.rotation);
+            if (o.motion == Object_motion::flying)
+                s.sc.flying_objects.push_back({ object, o.point_on_radius, o.rotation_axis,
+                    o.speed, object->dynamic_transform_ref() });
+        };
+
+        if (separate_instanced == "separate")
+        {
+            scatter(settings, [&](const Scattered_object& o) { create(o, 1); });
+            return;
+        }
+
+        // The objects that move in the same way are drawn with one call, like an array, so
+        // they need consecutive ids and transform refs.
+        constexpr int motions = static_cast<int>(Object_motion::flying) + 1;
+        vector<Scattered_object> objects[motions];
+        scatter(settings, [&](const Scattered_object& o)
+            { objects[static_cast<int>(o.motion)].push_back(o); });
+        for (auto& same_motion : objects)
+        {
+            int instances = static_cast<int>(same_motion.size());
+            for (auto& o : same_motion)
+                create(o, instances--);
+        }
+    }
+
+    void read_fly(Scene_tokens& file, Parse_state& s)
+    {
+        string_view name;
+        file >> name;
+        const Dynamic_object object = s.dynamic_object(name);
         XMFLOAT3 point_on_radius, rot;
         float speed;
         file >> point_on_radius.x >> point_on_radius.y >> point_on_radius.z
              >> rot.x >> rot.y >> rot.z >> speed;
-        sc.flying_objects.push_back({ objects[object].object, point_on_radius,
-            rot, speed, objects[object].transform_ref });
+        s.sc.flying_objects.push_back({ object.object, point_on_radius,
+            rot, speed, object.transform_ref });
     }
 
-    void read_rotate(std::istream& file, Scene_components& sc, map<string, Dynamic_object>& objects)
+    void read_rotate(Scene_tokens& file, Parse_state& s)
     {
-        string object;
-        file >> object;
-        if (!objects.count(object))
-            throw Object_not_defined(object);
-        sc.rotating_objects.push_back(objects[object]);
+        string_view name;
+        file >> name;
+        s.sc.rotating_objects.push_back(s.dynamic_object(name));
     }
 
-    void read_light(std::istream& file, Scene_components& sc)
+    void read_light(Scene_tokens& file, Scene_components& sc)
     {
         XMFLOAT3 pos, focus_point;
         file >> pos.x >> pos.y >> pos.z >> focus_point.x >> focus_point.y >> focus_point.z;
@@ -501,17 +1175,32 @@ namespace
             ++sc.shadow_casting_lights_count;
     }
 
-    void read_ambient(std::istream& file, Scene_components& sc)
+    void read_ambient(Scene_tokens& file, Scene_components& sc)
     {
         float r, g, b;
         file >> r >> g >> b;
         sc.ambient_light = { r, g, b, 1.0f };
     }
 
-    void read_view(std::istream& file, Scene_components& sc)
+    void read_view(Scene_tokens& file, Scene_components& sc)
     {
         file >> sc.initial_view_position.x    >> sc.initial_view_position.y
              >> sc.initial_view_position.z    >> sc.initial_view_focus_point.x
              >> sc.initial_view_focus_point.y >> sc.initial_view_focus_point.z;
     }
+
+    void add_to_object_lists(Scene_components& sc, const shared_ptr<Graphical_object>& object,
+        UINT material_settings)
+    {
+        using namespace Material_settings;
+
+        if (material_settings & transparency)
+            sc.transparent_objects.push_back(object);
+        else if (material_settings & alpha_cut_out)
+            sc.alpha_cut_out_objects.push_back(object);
+        else if (material_settings & two_sided)
+            sc.two_sided_objects.push_back(object);
+        else
+            sc.regular_objects.push_back(object);
+    }
 }
@@ -11,20 +11,34 @@
 using Microsoft::WRL::ComPtr;
 
 struct Scene_components;
+class Job_system;
 
 
+// Whether to compile the scene file into a snapshot, see Scene_snapshot.h.
+enum class Cook_scene { no, yes };
+
 // Reads a scene file, resulting in a filled Scene_components argument
 // and also a populated command list, used to upload the data to the GPU.
+// If there is an up to date snapshot of the scene file, the scene is created from that
+// instead, unless it is cooked, in which case the scene file is read and a new snapshot is
+// written.
 // Might throw any of the exceptions defined further down.
 void read_scene_file(const std::string& file_name, Scene_components& sc,
     ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
-    int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap);
+    int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap,
+    Cook_scene cook = Cook_scene::no);
 
 // Exposed for unit tests
 void read_scene_file_stream(std::istream& file, Scene_components& sc,
     ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
     int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap);
 
+// As above, but the models and textures are loaded by the given job system instead of the
+// shared one, e.g. to benchmark it with different numbers of workers.
+void read_scene_file_stream(std::istream& file, Scene_components& sc,
+    ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+    int& texture_index, ID3D12DescriptorHeap& texture_descriptor_heap, Job_system& jobs);
+
 
 struct Read_error
 {
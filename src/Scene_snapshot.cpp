@@ -0,0 +1,357 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Scene_snapshot.h"
+#include "Memory_mapped_file.h"
+#include "Mesh_cache.h"
+
+
+using std::vector;
+using std::string;
+
+
+namespace
+{
+    // Increase this when the format, or what the scene parser produces, changes.
+    constexpr uint32_t scene_snapshot_version = 1;
+
+    constexpr char magic[8] = { 'J', 'S', 'C', 'E', 'N', 'E', 0, 0 };
+
+    // The sections start at multiples of this, which is enough for any of the records.
+    constexpr size_t section_alignment = 16;
+
+    enum Section
+    {
+        settings_section,
+        dependencies_section,
+        models_section,
+        meshes_section,
+        texture_files_section,
+        objects_section,
+        object_textures_section,
+        flying_objects_section,
+        rotating_objects_section,
+        dynamic_model_transforms_section,
+        static_model_transforms_section,
+        materials_section,
+        lights_section,
+        characters_section,
+        section_count
+    };
+
+    struct Section_entry
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct String_ref
+    {
+        uint64_t offset; // In the characters section.
+        uint64_t size;
+    };
+
+    struct Dependency_record
+    {
+        String_ref file;
+        File_stamp stamp;
+    };
+
+    struct Model_record
+    {
+        String_ref file;
+        uint32_t flip_v;
+        uint32_t padding;
+    };
+
+    struct Settings_record
+    {
+        DirectX::XMFLOAT4 ambient_light;
+        DirectX::XMFLOAT3 initial_view_position;
+        DirectX::XMFLOAT3 initial_view_focus_point;
+        uint32_t shadow_casting_lights_count;
+        uint32_t padding;
+    };
+
+    // Only made of 32 bit values, so that it has no padding and can be compared with memcmp.
+    struct Scene_snapshot_header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t section_count;
+        // The sizes of the records, so that a changed layout of any of them invalidates it.
+        uint32_t record_sizes[12];
+    };
+
+    Scene_snapshot_header header()
+    {
+        Scene_snapshot_header h = {};
+        memcpy(h.magic, magic, sizeof(magic));
+        h.version = scene_snapshot_version;
+        h.section_count = section_count;
+        const uint32_t record_sizes[] = { sizeof(Section_entry), sizeof(String_ref),
+            sizeof(Dependency_record), sizeof(Model_record), sizeof(Settings_record),
+            sizeof(Scene_snapshot::Mesh), sizeof(Scene_snapshot::Object),
+            sizeof(Scene_snapshot::Flying_object), sizeof(Scene_snapshot::Dynamic_object),
+            sizeof(Per_instance_transform), sizeof(Shader_material), sizeof(Light) };
+        static_assert(sizeof(record_sizes) == sizeof(h.record_sizes), "One size per record");
+        memcpy(h.record_sizes, record_sizes, sizeof(record_sizes));
+        return h;
+    }
+
+    constexpr size_t section_table_offset = sizeof(Scene_snapshot_header);
+    constexpr size_t first_section_offset = section_table_offset +
+        section_count * sizeof(Section_entry);
+
+
+    // Builds the whole file in memory, since it is small compared to the meshes and textures.
+    class Writer
+    {
+    public:
+        Writer() : m_data(first_section_offset), m_sections{}
+        {
+            const auto h = header();
+            memcpy(m_data.data(), &h, sizeof(h));
+        }
+
+        template<typename T>
+        void write(Section section, const T* records, size_t count)
+        {
+            m_data.resize((m_data.size() + section_alignment - 1) / section_alignment *
+                section_alignment);
+            m_sections[section] = { m_data.size(), count };
+            const char* bytes = reinterpret_cast<const char*>(records);
+            m_data.insert(m_data.end(), bytes, bytes + count * sizeof(T));
+        }
+
+        template<typename T>
+        void write(Section section, const vector<T>& records)
+        {
+            write(section, records.data(), records.size());
+        }
+
+        String_ref add_string(const string& text)
+        {
+            String_ref ref = { m_characters.size(), text.size() };
+            m_characters.insert(m_characters.end(), text.begin(), text.end());
+            return ref;
+        }
+
+        // Writes the characters and the section table, and then the file.
+        bool save(const string& file_name)
+        {
+            write(characters_section, m_characters);
+            memcpy(m_data.data() + section_table_offset, m_sections, sizeof(m_sections));
+            std::ofstream file(file_name, std::ios::binary);
+            file.write(m_data.data(), m_data.size());
+            return file.good();
+        }
+    private:
+        vector<char> m_data;
+        vector<char> m_characters;
+        Section_entry m_sections[section_count];
+    };
+
+
+    // Gives the sections of the memory mapped file in place, and fails instead of giving
+    // anything outside of the file.
+    class Reader
+    {
+    public:
+        Reader(const char* begin, const char* end) : m_begin(begin), m_size(end - begin),
+            m_good(begin != nullptr && m_size >= first_section_offset), m_sections{}
+        {
+            const auto expected = header();
+            m_good = m_good && memcmp(m_begin, &expected, sizeof(expected)) == 0;
+            if (m_good)
+                memcpy(m_sections, m_begin + section_table_offset, sizeof(m_sections));
+            auto characters = section<char>(characters_section);
+            m_characters = characters.first;
+            m_character_count = characters.second;
+        }
+
+        bool good() const { return m_good; }
+
+        template<typename T>
+        std::pair<const T*, size_t> section(Section section)
+        {
+            const auto& s = m_sections[section];
+            m_good = m_good && s.offset % alignof(T) == 0 && s.offset <= m_size &&
+                s.count <= (m_size - s.offset) / sizeof(T);
+            if (!m_good)
+                return { nullptr, 0 };
+            return { reinterpret_cast<const T*>(m_begin + s.offset),
+                static_cast<size_t>(s.count) };
+        }
+
+        template<typename T>
+        void read(Section section, vector<T>& records)
+        {
+            auto s = this->section<T>(section);
+            records.assign(s.first, s.first + s.second);
+        }
+
+        string text(const String_ref& ref)
+        {
+            m_good = m_good && ref.offset <= m_character_count &&
+                ref.size <= m_character_count - ref.offset;
+            if (!m_good)
+                return string();
+            return string(m_characters + ref.offset, static_cast<size_t>(ref.size));
+        }
+    private:
+        const char* m_begin;
+        size_t m_size;
+        bool m_good;
+        Section_entry m_sections[section_count];
+        const char* m_characters;
+        size_t m_character_count;
+    };
+}
+
+
+string scene_snapshot_file_name(const string& scene_file)
+{
+    return scene_file + ".jscene";
+}
+
+bool read_scene_snapshot(const string& file_name, Scene_snapshot& snapshot)
+{
+    Memory_mapped_file file(file_name);
+    Reader reader(file.begin(), file.end());
+
+    // The dependencies are checked first, since an outdated snapshot is the common case.
+    Scene_snapshot s;
+    auto dependencies = reader.section<Dependency_record>(dependencies_section);
+    for (size_t i = 0; i < dependencies.second && reader.good(); ++i)
+    {
+        const auto& d = dependencies.first[i];
+        s.dependencies.push_back(reader.text(d.file));
+        File_stamp current;
+        if (!reader.good() || !file_stamp(s.dependencies.back(), current) ||
+            !(current == d.stamp))
+            return false;
+    }
+
+    auto settings = reader.section<Settings_record>(settings_section);
+    if (!reader.good() || settings.second != 1)
+        return false;
+    s.ambient_light = settings.first->ambient_light;
+    s.initial_view_position = settings.first->initial_view_position;
+    s.initial_view_focus_point = settings.first->initial_view_focus_point;
+    s.shadow_casting_lights_count = settings.first->shadow_casting_lights_count;
+
+    auto models = reader.section<Model_record>(models_section);
+    for (size_t i = 0; i < models.second && reader.good(); ++i)
+        s.models.push_back({ reader.text(models.first[i].file), models.first[i].flip_v != 0 });
+
+    auto texture_files = reader.section<String_ref>(texture_files_section);
+    for (size_t i = 0; i < texture_files.second && reader.good(); ++i)
+        s.texture_files.push_back(reader.text(texture_files.first[i]));
+
+    reader.read(meshes_section, s.meshes);
+    reader.read(objects_section, s.objects);
+    reader.read(object_textures_section, s.object_textures);
+    reader.read(flying_objects_section, s.flying_objects);
+    reader.read(rotating_objects_section, s.rotating_objects);
+    reader.read(dynamic_model_transforms_section, s.dynamic_model_transforms);
+    reader.read(static_model_transforms_section, s.static_model_transforms);
+    reader.read(materials_section, s.materials);
+    reader.read(lights_section, s.lights);
+    if (!reader.good())
+        return false;
+
+    // The references are checked here, so that they can be used without checks. The objects
+    // of an array use the transforms from their own to that of their last instance, and the
+    // objects without a material have -1 as material id.
+    const size_t object_count = s.objects.size();
+    const size_t dynamic_transform_count = s.dynamic_model_transforms.size();
+    auto valid_transform_ref = [&](int32_t ref, int32_t instances) {
+        return ref >= 0 && instances >= 1 && static_cast<size_t>(ref) < dynamic_transform_count &&
+            static_cast<size_t>(instances) <= dynamic_transform_count - ref;
+    };
+    for (auto& m : s.meshes)
+        if (m.model != Scene_snapshot::cube && m.model != Scene_snapshot::plane &&
+            (m.model < 0 || static_cast<size_t>(m.model) >= s.models.size()))
+            return false;
+    for (size_t i = 0; i < object_count; ++i)
+    {
+        auto& o = s.objects[i];
+        if (o.mesh >= s.meshes.size() || o.first_texture > s.object_textures.size() ||
+            o.texture_count > s.object_textures.size() - o.first_texture ||
+            o.instances < 1 || static_cast<size_t>(o.instances) > object_count - i ||
+            o.material_id < -1 || (o.material_id >= 0 &&
+                static_cast<size_t>(o.material_id) >= s.materials.size()) ||
+            (o.dynamic_transform_ref != -1 &&
+                !valid_transform_ref(o.dynamic_transform_ref, o.instances)))
+            return false;
+    }
+    if (s.static_model_transforms.size() < object_count ||
+        s.shadow_casting_lights_count > s.lights.size())
+        return false;
+    for (auto t : s.object_textures)
+        if (t >= s.texture_files.size())
+            return false;
+    for (auto& f : s.flying_objects)
+        if (f.object >= object_count || !valid_transform_ref(f.transform_ref, 1))
+            return false;
+    for (auto& r : s.rotating_objects)
+        if (r.object >= object_count || !valid_transform_ref(r.transform_ref, 1))
+            return false;
+
+    snapshot = std::move(s);
+    return true;
+}
+
+bool write_scene_snapshot(const string& file_name, const Scene_snapshot& snapshot)
+{
+    Writer writer;
+
+    vector<Dependency_record> dependencies;
+    for (auto& d : snapshot.dependencies)
+    {
+        Dependency_record record = { writer.add_string(d), {} };
+        if (!file_stamp(d, record.stamp))
+            return false;
+        dependencies.push_back(record);
+    }
+    writer.write(dependencies_section, dependencies);
+
+    Settings_record settings = {};
+    settings.ambient_light = snapshot.ambient_light;
+    settings.initial_view_position = snapshot.initial_view_position;
+    settings.initial_view_focus_point = snapshot.initial_view_focus_point;
+    settings.shadow_casting_lights_count = snapshot.shadow_casting_lights_count;
+    writer.write(settings_section, &settings, 1);
+
+    vector<Model_record> models;
+    for (auto& m : snapshot.models)
+        models.push_back({ writer.add_string(m.file), m.flip_v ? 1u : 0u, 0 });
+    writer.write(models_section, models);
+
+    vector<String_ref> texture_files;
+    for (auto& t : snapshot.texture_files)
+        texture_files.push_back(writer.add_string(t));
+    writer.write(texture_files_section, texture_files);
+
+    writer.write(meshes_section, snapshot.meshes);
+    writer.write(objects_section, snapshot.objects);
+    writer.write(object_textures_section, snapshot.object_textures);
+    writer.write(flying_objects_section, snapshot.flying_objects);
+    writer.write(rotating_objects_section, snapshot.rotating_objects);
+    writer.write(dynamic_model_transforms_section, snapshot.dynamic_model_transforms);
+    writer.write(static_model_transforms_section, snapshot.static_model_transforms);
+    writer.write(materials_section, snapshot.materials);
+    writer.write(lights_section, snapshot.lights);
+
+    if (writer.save(file_name))
+        return true;
+
+    std::remove(file_name.c_str()); // Don't leave a partially written snapshot.
+    return false;
+}
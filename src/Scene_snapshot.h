@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Scene_components.h"
+
+
+// A compiled scene: the Scene_components that a scene file results in, with all the names
+// resolved. The meshes and textures are referred to by the files that they are created from,
+// and the objects by their indices. Reading it back only creates those, and copies the rest,
+// without any parsing or lookups by name.
+//
+// The file is flat and relocatable: a header, a table of sections, and the sections, which
+// are arrays of fixed size records at aligned offsets, and refer to each other by indices and
+// to a table of characters by offsets. So the arrays can be used in place in the memory
+// mapped file.
+//
+// The snapshot is only used if it has the same version and record sizes as this build, and
+// if the scene file, the model files, their mtl files and the texture files have the same
+// sizes and modification times as when it was written.
+
+struct Scene_snapshot
+{
+    // The model files, which are read as by the model statement in the scene file.
+    struct Model
+    {
+        std::string file;
+        bool flip_v;
+    };
+
+    static constexpr int32_t cube = -1;
+    static constexpr int32_t plane = -2;
+
+    // A mesh is a primitive, or one of the meshes of a model, i.e. of its Model_collection.
+    struct Mesh
+    {
+        int32_t model; // An index in models, or cube or plane.
+        uint32_t index;
+    };
+
+    struct Object
+    {
+        uint32_t mesh;
+        uint32_t first_texture; // In object_textures.
+        uint32_t texture_count;
+        int32_t material_id;
+        int32_t dynamic_transform_ref;
+        int32_t instances;
+        uint32_t material_settings;
+    };
+
+    struct Flying_object
+    {
+        uint32_t object;
+        DirectX::XMFLOAT3 point_on_radius;
+        DirectX::XMFLOAT3 rotation_axis;
+        float speed;
+        int32_t transform_ref;
+    };
+
+    struct Dynamic_object
+    {
+        uint32_t object;
+        int32_t transform_ref;
+    };
+
+    // The scene file, the model files and their mtl files, and the texture files, which it is
+    // checked against.
+    std::vector<std::string> dependencies;
+
+    std::vector<Model> models;
+    std::vector<Mesh> meshes;
+    // In the order that they are created, which gives them their descriptor indices. An empty
+    // file is a procedural texture.
+    std::vector<std::string> texture_files;
+    std::vector<Object> objects;
+    std::vector<uint32_t> object_textures; // Indices in texture_files.
+    std::vector<Flying_object> flying_objects;
+    std::vector<Dynamic_object> rotating_objects;
+
+    std::vector<Per_instance_transform> dynamic_model_transforms;
+    std::vector<Per_instance_transform> static_model_transforms;
+    std::vector<Shader_material> materials;
+    std::vector<Light> lights;
+    DirectX::XMFLOAT4 ambient_light;
+    uint32_t shadow_casting_lights_count;
+    DirectX::XMFLOAT3 initial_view_position;
+    DirectX::XMFLOAT3 initial_view_focus_point;
+};
+
+std::string scene_snapshot_file_name(const std::string& scene_file);
+
+// Returns false if there is no valid snapshot, in which case the snapshot is not changed.
+bool read_scene_snapshot(const std::string& file_name, Scene_snapshot& snapshot);
+
+// Returns false if the snapshot could not be written, or if a dependency does not exist.
+bool write_scene_snapshot(const std::string& file_name, const Scene_snapshot& snapshot);
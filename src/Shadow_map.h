@@ -41,6 +41,8 @@ public:
         Depth_pass& depth_pass, ID3D12GraphicsCommandList& command_list);
     void set_shadow_map_for_shader(ID3D12GraphicsCommandList& command_list,
         UINT back_buf_index, int root_param_index_of_shadow_map) const;
+    // From the light, which only the objects in its frustum can cast shadows in.
+    const View& view() const { return m_view; }
     static D3D12_STATIC_SAMPLER_DESC shadow_map_sampler(UINT sampler_shader_register);
     static constexpr UINT max_shadow_maps_count = 16;
     static constexpr Bit_depth default_bit_depth = Bit_depth::bpp16;
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Tangent_space.h"
+#include "util.h"
+
+#include <cmath>
+
+
+using namespace DirectX;
+using DirectX::PackedVector::XMConvertFloatToHalf;
+using DirectX::PackedVector::XMConvertHalfToFloat;
+using DirectX::PackedVector::XMHALF4;
+using std::vector;
+
+
+namespace
+{
+    // The number of faces that are calculated together, one per lane of an XMVECTOR.
+    constexpr size_t lanes = 4;
+
+    // Below this, starting a thread costs more than it saves.
+    constexpr size_t min_faces_per_thread = 16 * 1024;
+
+    size_t padded_to_lanes(size_t count)
+    {
+        return (count + lanes - 1) / lanes * lanes;
+    }
+
+    void resize(Vector_components& v, size_t size)
+    {
+        v.x.resize(size);
+        v.y.resize(size);
+        v.z.resize(size);
+    }
+
+    // The value of the corner of each face, where the corner indices are given per lane.
+    XMVECTOR gather(const vector<float>& values, const int (&corner_indices)[lanes])
+    {
+        return XMVectorSet(values[corner_indices[0]], values[corner_indices[1]],
+            values[corner_indices[2]], values[corner_indices[3]]);
+    }
+
+    void store(FXMVECTOR v, vector<float>& destination, size_t first)
+    {
+        XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&destination[first]), v);
+    }
+
+    struct Vector_lanes
+    {
+        XMVECTOR x;
+        XMVECTOR y;
+        XMVECTOR z;
+    };
+
+    // Normalizes four vectors at a time. The lanes that are not set in valid, or that have
+    // zero length, become zero vectors.
+    Vector_lanes normalized(const Vector_lanes& v, FXMVECTOR valid)
+    {
+        const XMVECTOR zero = XMVectorZero();
+        const XMVECTOR length_squared = v.x * v.x + v.y * v.y + v.z * v.z;
+        const XMVECTOR use = XMVectorAndInt(valid, XMVectorGreater(length_squared, zero));
+        const XMVECTOR length = XMVectorSqrt(length_squared);
+        return { XMVectorSelect(zero, XMVectorDivide(v.x, length), use),
+                 XMVectorSelect(zero, XMVectorDivide(v.y, length), use),
+                 XMVectorSelect(zero, XMVectorDivide(v.z, length), use) };
+    }
+
+    // Calculates the faces [first, last), where first is a multiple of lanes. The frames have
+    // to be padded to a multiple of lanes.
+    void calculate_face_tangent_frames(const Tangent_space_input& input,
+        const vector<int>& indices, size_t first, size_t last, Face_tangent_frames& frames)
+    {
+        const size_t face_count = indices.size() / vertex_count_per_face;
+        for (size_t face = first; face < last; face += lanes)
+        {
+            // The lanes after the last face repeat it, their results are never used.
+            int corners[vertex_count_per_face][lanes];
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                const size_t f = std::min(face + lane, face_count - 1);
+                for (int c = 0; c < vertex_count_per_face; ++c)
+                    corners[c][lane] = indices[f * vertex_count_per_face + c];
+            }
+
+            const Vector_components& p = input.positions;
+            const XMVECTOR x0 = gather(p.x, corners[0]);
+            const XMVECTOR y0 = gather(p.y, corners[0]);
+            const XMVECTOR z0 = gather(p.z, corners[0]);
+            const XMVECTOR u0 = gather(input.u, corners[0]);
+            const XMVECTOR v0 = gather(input.v, corners[0]);
+            const Vector_lanes edge_1 = { gather(p.x, corners[1]) - x0,
+                gather(p.y, corners[1]) - y0, gather(p.z, corners[1]) - z0 };
+            const Vector_lanes edge_2 = { gather(p.x, corners[2]) - x0,
+                gather(p.y, corners[2]) - y0, gather(p.z, corners[2]) - z0 };
+            const XMVECTOR delta_u_1 = gather(input.u, corners[1]) - u0;
+            const XMVECTOR delta_v_1 = gather(input.v, corners[1]) - v0;
+            const XMVECTOR delta_u_2 = gather(input.u, corners[2]) - u0;
+            const XMVECTOR delta_v_2 = gather(input.v, corners[2]) - v0;
+
+            // calculate_tangent_space_basis multiplies with the reciprocal of the
+            // determinant before normalizing, so only its sign matters. Using the sign
+            // avoids the division and the NaN for faces without a texture mapping.
+            const XMVECTOR zero = XMVectorZero();
+            const XMVECTOR determinant = delta_u_1 * delta_v_2 - delta_v_1 * delta_u_2;
+            const XMVECTOR sign = XMVectorSelect(XMVectorReplicate(1.0f),
+                XMVectorReplicate(-1.0f), XMVectorLess(determinant, zero));
+            const XMVECTOR has_texture_mapping = XMVectorNotEqual(determinant, zero);
+
+            const XMVECTOR t_1 = delta_v_2 * sign;
+            const XMVECTOR t_2 = delta_v_1 * sign;
+            const Vector_lanes tangent = normalized({ edge_1.x * t_1 - edge_2.x * t_2,
+                edge_1.y * t_1 - edge_2.y * t_2, edge_1.z * t_1 - edge_2.z * t_2 },
+                has_texture_mapping);
+
+            const XMVECTOR b_1 = delta_u_2 * sign;
+            const XMVECTOR b_2 = delta_u_1 * sign;
+            const Vector_lanes bitangent = normalized({ edge_2.x * b_2 - edge_1.x * b_1,
+                edge_2.y * b_2 - edge_1.y * b_1, edge_2.z * b_2 - edge_1.z * b_1 },
+                has_texture_mapping);
+
+            store(tangent.x, frames.tangents.x, face);
+            store(tangent.y, frames.tangents.y, face);
+            store(tangent.z, frames.tangents.z, face);
+            store(bitangent.x, frames.bitangents.x, face);
+            store(bitangent.y, frames.bitangents.y, face);
+            store(bitangent.z, frames.bitangents.z, face);
+        }
+    }
+
+    XMHALF4 half4(const Vector_components& v, size_t i)
+    {
+        return XMHALF4(XMConvertFloatToHalf(v.x[i]), XMConvertFloatToHalf(v.y[i]),
+            XMConvertFloatToHalf(v.z[i]), XMConvertFloatToHalf(0.0f));
+    }
+
+    XMVECTOR load(const Vector_components& v, size_t i)
+    {
+        return XMVectorSet(v.x[i], v.y[i], v.z[i], 0.0f);
+    }
+
+    void resize_tangents(Vertices& vertices)
+    {
+        const size_t count = vertices.positions.size();
+        if (vertices.tangents.size() < count)
+            vertices.tangents.resize(count);
+        if (vertices.bitangents.size() < count)
+            vertices.bitangents.resize(count);
+    }
+}
+
+Tangent_space_input tangent_space_input(const Vertices& vertices)
+{
+    const size_t count = vertices.positions.size();
+    Tangent_space_input input;
+    resize(input.positions, count);
+    input.u.resize(count);
+    input.v.resize(count, 0.0f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Vertex_position& p = vertices.positions[i];
+        input.positions.x[i] = p.x;
+        input.positions.y[i] = p.y;
+        input.positions.z[i] = p.z;
+        input.u[i] = p.w;
+    }
+    for (size_t i = 0; i < std::min(count, vertices.normals.size()); ++i)
+        input.v[i] = XMConvertHalfToFloat(vertices.normals[i].w);
+    return input;
+}
+
+Face_tangent_frames calculate_face_tangent_frames(const Tangent_space_input& input,
+    const vector<int>& indices, int max_thread_count)
+{
+    const size_t face_count = indices.size() / vertex_count_per_face;
+    Face_tangent_frames frames;
+    resize(frames.tangents, padded_to_lanes(face_count));
+    resize(frames.bitangents, padded_to_lanes(face_count));
+
+    const size_t block_count = padded_to_lanes(face_count) / lanes;
+    const int thread_count = static_cast<int>(std::max<size_t>(1,
+        std::min<size_t>(max_thread_count, face_count / min_faces_per_thread)));
+    run_in_parallel(thread_count, [&](int i) {
+        const size_t first = block_count * i / thread_count * lanes;
+        const size_t last = std::min(face_count, block_count * (i + 1) / thread_count * lanes);
+        calculate_face_tangent_frames(input, indices, first, last, frames);
+    });
+
+    resize(frames.tangents, face_count);
+    resize(frames.bitangents, face_count);
+    return frames;
+}
+
+void set_face_tangents(Vertices& vertices, const vector<int>& indices, int max_thread_count)
+{
+    if (indices.empty())
+        return;
+    const auto frames = calculate_face_tangent_frames(tangent_space_input(vertices), indices,
+        max_thread_count);
+
+    resize_tangents(vertices);
+    const size_t face_count = indices.size() / vertex_count_per_face;
+    for (size_t face = 0; face < face_count; ++face)
+    {
+        const XMHALF4 tangent = half4(frames.tangents, face);
+        const XMHALF4 bitangent = half4(frames.bitangents, face);
+        for (int c = 0; c < vertex_count_per_face; ++c)
+        {
+            const int index = indices[face * vertex_count_per_face + c];
+            vertices.tangents[index] = tangent;
+            vertices.bitangents[index] = bitangent;
+        }
+    }
+}
+
+void calculate_vertex_tangents(Vertices& vertices, const vector<int>& indices,
+    int max_thread_count)
+{
+    const size_t vertex_count = vertices.positions.size();
+    const Tangent_space_input input = tangent_space_input(vertices);
+    const auto frames = calculate_face_tangent_frames(input, indices, max_thread_count);
+
+    vector<XMVECTOR> normals(vertex_count, XMVectorZero());
+    for (size_t i = 0; i < std::min(vertex_count, vertices.normals.size()); ++i)
+        normals[i] = XMVector3Normalize(XMVectorSetW(
+            convert_half4_to_vector(vertices.normals[i]), 0.0f));
+
+    vector<XMVECTOR> tangent_sums(vertex_count, XMVectorZero());
+    vector<XMVECTOR> bitangent_sums(vertex_count, XMVectorZero());
+    const size_t face_count = indices.size() / vertex_count_per_face;
+    for (size_t face = 0; face < face_count; ++face)
+    {
+        const int* corners = &indices[face * vertex_count_per_face];
+        XMVECTOR p[vertex_count_per_face];
+        for (int c = 0; c < vertex_count_per_face; ++c)
+            p[c] = load(input.positions, corners[c]);
+        const XMVECTOR face_tangent = load(frames.tangents, face);
+        const XMVECTOR face_bitangent = load(frames.bitangents, face);
+
+        for (int c = 0; c < vertex_count_per_face; ++c)
+        {
+            const XMVECTOR edge_1 = XMVector3Normalize(p[(c + 1) % vertex_count_per_face] - p[c]);
+            const XMVECTOR edge_2 = XMVector3Normalize(p[(c + 2) % vertex_count_per_face] - p[c]);
+            const float cosine = XMVectorGetX(XMVector3Dot(edge_1, edge_2));
+            const float angle = std::acos(std::fmin(std::fmax(cosine, -1.0f), 1.0f));
+
+            const int vertex = corners[c];
+            const XMVECTOR n = normals[vertex];
+            const XMVECTOR tangent = XMVector3Normalize(face_tangent -
+                n * XMVector3Dot(n, face_tangent));
+            tangent_sums[vertex] += tangent * angle;
+            bitangent_sums[vertex] += face_bitangent * angle;
+        }
+    }
+
+    resize_tangents(vertices);
+    for (size_t i = 0; i < vertex_count; ++i)
+    {
+        const XMVECTOR tangent = XMVector3Normalize(tangent_sums[i]);
+        const XMVECTOR bitangent_sum = bitangent_sums[i];
+        XMVECTOR bitangent = XMVector3Cross(normals[i], tangent);
+        if (XMVectorGetX(XMVector3LengthSq(bitangent)) == 0.0f) // No normal.
+            bitangent = XMVector3Normalize(bitangent_sum);
+        else if (XMVectorGetX(XMVector3Dot(bitangent, bitangent_sum)) < 0.0f)
+            bitangent = -bitangent;
+        vertices.tangents[i] = convert_vector_to_half4(tangent);
+        vertices.bitangents[i] = convert_vector_to_half4(bitangent);
+    }
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Mesh.h"
+
+
+// Batch versions of calculate_tangent_space_basis, which calculate the tangent space of a whole
+// mesh at a time. The data is laid out with one array per component, so that four faces can be
+// calculated at once, one in each lane of an XMVECTOR. Big meshes are also split over threads.
+
+// Three dimensional vectors, one array per component.
+struct Vector_components
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+};
+
+// The positions and texture coordinates of the vertices of a mesh.
+struct Tangent_space_input
+{
+    Vector_components positions;
+    std::vector<float> u;
+    std::vector<float> v;
+};
+
+// Gets them from where the vertices keep them, u is in the w component of the position and
+// v is in the w component of the normal.
+Tangent_space_input tangent_space_input(const Vertices& vertices);
+
+// The normalized tangent and bitangent of each face.
+struct Face_tangent_frames
+{
+    Vector_components tangents;
+    Vector_components bitangents;
+};
+
+// The same as calculate_tangent_space_basis for every face in indices, except that faces
+// without a texture mapping, i.e. with a zero UV area, get zero vectors instead of NaN.
+// The faces are split over at most max_thread_count threads, if there are enough of them.
+Face_tangent_frames calculate_face_tangent_frames(const Tangent_space_input& input,
+    const std::vector<int>& indices, int max_thread_count);
+
+// Calculates the tangent space of the faces in indices and stores it in all of their
+// vertices. This is for faces that do not share vertices, like the unwelded faces of the Obj
+// parser, other vertices are left as they are. The tangents and bitangents are resized to the
+// number of vertices, if they are fewer.
+void set_face_tangents(Vertices& vertices, const std::vector<int>& indices,
+    int max_thread_count);
+
+// Calculates a smooth tangent space per vertex for an indexed mesh, in the spirit of
+// MikkTSpace: the face tangents are projected on the plane of the vertex normal and weighted
+// by the angle of the face at the vertex, and the bitangent is the cross product of normal and
+// tangent, with the same handedness as the texture mapping. Unlike MikkTSpace, vertices are
+// never split, which only matters where the handedness changes without a UV seam.
+void calculate_vertex_tangents(Vertices& vertices, const std::vector<int>& indices,
+    int max_thread_count);
@@ -30,34 +30,49 @@ namespace
     }
 }
 
-Texture::Texture(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
-    ID3D12DescriptorHeap& texture_descriptor_heap, const std::string& texture_filename,
-    UINT texture_index) : m_texture_index(texture_index)
+Decoded_texture decode_texture_file(ID3D12Device& device, const std::string& texture_filename)
 {
-    std::unique_ptr<uint8_t[]> decoded_data;
-    std::vector<D3D12_SUBRESOURCE_DATA> subresource;
+    Decoded_texture decoded;
 
     #ifndef NO_SCENE_FILE // If we're not using a scene file we're not using any
                           // texture files either.
     if (last_part_equals(texture_filename, "dds"))
     {
         if (FAILED(LoadDDSTextureFromFile(&device, widen(texture_filename).c_str(),
-            m_texture.ReleaseAndGetAddressOf(), decoded_data, subresource)))
+            decoded.texture.ReleaseAndGetAddressOf(), decoded.data, decoded.subresources)))
             throw Texture_read_error(texture_filename);
     }
     else
     {
         D3D12_SUBRESOURCE_DATA data;
         if (FAILED(LoadWICTextureFromFile(&device, widen(texture_filename).c_str(),
-            m_texture.ReleaseAndGetAddressOf(), decoded_data, data)))
+            decoded.texture.ReleaseAndGetAddressOf(), decoded.data, data)))
             throw Texture_read_error(texture_filename);
-        subresource.push_back(data);
+        decoded.subresources.push_back(data);
     }
     #else
+    ignore_unused_variable(device);
     ignore_unused_variable(texture_filename);
     #endif
 
-    init(device, command_list, texture_descriptor_heap, texture_index, subresource);
+    return decoded;
+}
+
+Texture::Texture(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+    ID3D12DescriptorHeap& texture_descriptor_heap, const std::string& texture_filename,
+    UINT texture_index) : Texture(device, command_list, texture_descriptor_heap,
+        decode_texture_file(device, texture_filename), texture_index)
+{
+}
+
+Texture::Texture(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+    ID3D12DescriptorHeap& texture_descriptor_heap, Decoded_texture&& decoded_texture,
+    UINT texture_index) : m_texture(std::move(decoded_texture.texture)),
+    m_texture_index(texture_index)
+{
+    // The decoded data is copied to the upload resource here, so it is not needed after this.
+    init(device, command_list, texture_descriptor_heap, texture_index,
+        decoded_texture.subresources);
 }
 
 void Texture::init(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
@@ -10,12 +10,28 @@
 
 using Microsoft::WRL::ComPtr;
 
+// A decoded texture file and the resource for it, which has not been filled yet. This is the
+// part of loading a texture that does not need a command list, so it can be done on any
+// thread, see Scene_file.cpp.
+struct Decoded_texture
+{
+    ComPtr<ID3D12Resource> texture;
+    std::unique_ptr<uint8_t[]> data;
+    std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+};
+
+// Throws Texture_read_error if the file could not be decoded.
+Decoded_texture decode_texture_file(ID3D12Device& device, const std::string& texture_filename);
+
 class Texture
 {
 public:
     Texture(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
         ID3D12DescriptorHeap& texture_descriptor_heap,
         const std::string& texture_filename, UINT texture_index);
+    Texture(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
+        ID3D12DescriptorHeap& texture_descriptor_heap, Decoded_texture&& decoded_texture,
+        UINT texture_index);
     Texture(ID3D12Device& device, ID3D12GraphicsCommandList& command_list,
         ID3D12DescriptorHeap& texture_descriptor_heap, UINT texture_index,
         UINT width, UINT height);
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Triangle_sorting.h"
+#include "Mesh.h"
+
+#include <cstring>
+
+
+using namespace DirectX;
+using std::vector;
+
+
+namespace
+{
+    // The number of depths that are calculated together, one per lane of an XMVECTOR.
+    constexpr size_t lanes = 4;
+
+    // The 32 bit keys are sorted 11 bits at a time, which gives three passes with histograms
+    // that are small enough to stay in the L1 cache.
+    constexpr int bits_per_digit = 11;
+    constexpr int digit_count = 3;
+    constexpr uint32_t bucket_count = 1 << bits_per_digit;
+    constexpr uint32_t digit_mask = bucket_count - 1;
+
+    size_t padded_to_lanes(size_t count)
+    {
+        return (count + lanes - 1) / lanes * lanes;
+    }
+
+    // A key that sorts in the same order as the float, when compared as an unsigned integer.
+    // The sign bit is flipped for positive numbers, which puts them after the negative ones,
+    // and all bits are flipped for negative numbers, since their magnitude sorts the other way.
+    uint32_t sortable_key(float f)
+    {
+        constexpr uint32_t sign_bit = 0x80000000;
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return (bits & sign_bit) ? ~bits : bits | sign_bit;
+    }
+
+    uint32_t digit(uint32_t key, int d)
+    {
+        return (key >> (d * bits_per_digit)) & digit_mask;
+    }
+
+    template <typename T>
+    void write_triangles(const vector<UINT>& order, const vector<UINT>& indices, T* destination)
+    {
+        for (UINT triangle : order)
+        {
+            const UINT* corners = &indices[triangle * vertex_count_per_face];
+            for (int c = 0; c < vertex_count_per_face; ++c)
+                *destination++ = static_cast<T>(corners[c]);
+        }
+    }
+}
+
+Triangle_sorter::Triangle_sorter(const vector<XMFLOAT3>& triangle_centers)
+{
+    const size_t count = triangle_centers.size();
+    m_center_x.resize(padded_to_lanes(count));
+    m_center_y.resize(padded_to_lanes(count));
+    m_center_z.resize(padded_to_lanes(count));
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_center_x[i] = triangle_centers[i].x;
+        m_center_y[i] = triangle_centers[i].y;
+        m_center_z[i] = triangle_centers[i].z;
+    }
+    m_keys.resize(padded_to_lanes(count));
+    m_temp_keys.resize(count);
+    m_order.resize(count);
+    m_temp_order.resize(count);
+}
+
+void Triangle_sorter::calculate_keys(FXMMATRIX model_view)
+{
+    // Only the z component of the transformed centers is needed, which is the dot product
+    // with the third column of the matrix.
+    const XMVECTOR m0 = XMVectorSplatZ(model_view.r[0]);
+    const XMVECTOR m1 = XMVectorSplatZ(model_view.r[1]);
+    const XMVECTOR m2 = XMVectorSplatZ(model_view.r[2]);
+    const XMVECTOR m3 = XMVectorSplatZ(model_view.r[3]);
+    for (size_t i = 0; i < m_keys.size(); i += lanes)
+    {
+        const XMVECTOR x = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_center_x[i]));
+        const XMVECTOR y = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_center_y[i]));
+        const XMVECTOR z = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_center_z[i]));
+        XMFLOAT4 depth;
+        XMStoreFloat4(&depth, x * m0 + y * m1 + z * m2 + m3);
+        m_keys[i] = sortable_key(depth.x);
+        m_keys[i + 1] = sortable_key(depth.y);
+        m_keys[i + 2] = sortable_key(depth.z);
+        m_keys[i + 3] = sortable_key(depth.w);
+    }
+}
+
+const vector<UINT>& Triangle_sorter::sort_back_to_front(FXMMATRIX model_view)
+{
+    // The view space is right handed with the eye looking along negative z, so the farthest
+    // triangle has the lowest z, and back to front is ascending z.
+    calculate_keys(model_view);
+
+    const size_t count = m_order.size();
+    UINT histograms[digit_count][bucket_count] = {};
+    for (size_t i = 0; i < count; ++i)
+    {
+        m_order[i] = static_cast<UINT>(i);
+        for (int d = 0; d < digit_count; ++d)
+            ++histograms[d][digit(m_keys[i], d)];
+    }
+
+    uint32_t* keys = m_keys.data();
+    uint32_t* temp_keys = m_temp_keys.data();
+    UINT* order = m_order.data();
+    UINT* temp_order = m_temp_order.data();
+    for (int d = 0; d < digit_count; ++d)
+    {
+        // Nothing moves if all the keys have the same digit, which is common for the highest
+        // one, since the depths of a mesh are usually close to each other.
+        auto& histogram = histograms[d];
+        if (count == 0 || histogram[digit(keys[0], d)] == count)
+            continue;
+
+        UINT offset = 0;
+        for (auto& bucket : histogram)
+        {
+            const UINT bucket_size = bucket;
+            bucket = offset;
+            offset += bucket_size;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            const UINT position = histogram[digit(keys[i], d)]++;
+            temp_keys[position] = keys[i];
+            temp_order[position] = order[i];
+        }
+        std::swap(keys, temp_keys);
+        std::swap(order, temp_order);
+    }
+
+    // After an odd number of passes the result is in the temporary buffer. The keys are
+    // calculated again at the next call, so they don't need to be moved back.
+    if (order != m_order.data())
+        m_order.swap(m_temp_order);
+    return m_order;
+}
+
+void write_triangles_in_order(const vector<UINT>& order, const vector<UINT>& indices,
+    uint16_t* destination)
+{
+    write_triangles(order, indices, destination);
+}
+
+void write_triangles_in_order(const vector<UINT>& order, const vector<UINT>& indices,
+    uint32_t* destination)
+{
+    write_triangles(order, indices, destination);
+}
@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+// Sorts the triangles of a transparent mesh back to front, so that they can be alpha blended
+// in that order. The depth of a triangle is the view space depth of its center.
+//
+// It is a radix sort on the depths, which is linear in the number of triangles, instead of
+// the n log n of a comparison sort. The buffers are kept between the calls, so nothing is
+// allocated after the first frame.
+class Triangle_sorter
+{
+public:
+    // One center per triangle, in model space.
+    explicit Triangle_sorter(const std::vector<DirectX::XMFLOAT3>& triangle_centers);
+
+    // Returns the triangle indices with the triangle farthest from the eye first. The order of
+    // triangles at the same depth is kept.
+    const std::vector<UINT>& sort_back_to_front(DirectX::FXMMATRIX model_view);
+
+    // Without the padding of the centers, see below.
+    size_t triangle_count() const { return m_order.size(); }
+private:
+    void calculate_keys(DirectX::FXMMATRIX model_view);
+
+    // The centers are stored one array per component, padded to a multiple of four, so that
+    // four depths can be calculated at a time.
+    std::vector<float> m_center_x;
+    std::vector<float> m_center_y;
+    std::vector<float> m_center_z;
+    std::vector<uint32_t> m_keys;
+    std::vector<uint32_t> m_temp_keys;
+    std::vector<UINT> m_order;
+    std::vector<UINT> m_temp_order;
+};
+
+// Writes the three indices of each triangle in order to destination, which has to have
+// room for all of them. The indices are the ones in the vertex buffer, i.e. with the base
+// vertex already added.
+void write_triangles_in_order(const std::vector<UINT>& order, const std::vector<UINT>& indices,
+    uint16_t* destination);
+void write_triangles_in_order(const std::vector<UINT>& order, const std::vector<UINT>& indices,
+    uint32_t* destination);
@@ -316,12 +316,14 @@ void record_frame_time(double& frame_time, double& fps)
     }
 }
 
-void User_interface::render_2d_text(size_t objects_count, int triangles_count,
-    size_t vertices_count, size_t lights_count, int draw_calls)
+void User_interface::render_2d_text(size_t objects_count, size_t visible_objects_count,
+    double culling_seconds, int triangles_count, size_t vertices_count,
+    size_t index_buffer_size, size_t lights_count, int draw_calls)
 {
     static double frame_time = 0.0;
     static double fps = 0.0;
     record_frame_time(frame_time, fps);
+    constexpr size_t bytes_per_kilobyte = 1024;
 
     using namespace std;
     wstringstream ss;
@@ -329,8 +331,11 @@ void User_interface::render_2d_text(size_t objects_count, int triangles_count,
     ss.unsetf(ios::ios_base::floatfield); // To get default floating point format
     ss << "Frame time: " << setprecision(4) << frame_time << " ms" << endl
         << "Number of objects: " << objects_count << endl
+        << "Visible objects: " << visible_objects_count << endl
+        << "Culling time: " << culling_seconds * 1000.0 << " ms" << endl
         << "Number of triangles: " << triangles_count << endl
         << "Number of vertices: " << vertices_count << endl
+        << "Index buffer memory: " << index_buffer_size / bytes_per_kilobyte << " KB" << endl
         << "Number of lights: " << lights_count << endl
         << "Number of draw calls: " << draw_calls << endl
         << "Early Z pass " << (m_early_z_pass? "enabled": "disabled") << "\n\n";
@@ -31,8 +31,9 @@ public:
         ID3D12DescriptorHeap& texture_descriptor_heap, UINT texture_index,
         Input& input, HWND window, const Config& config);
     void update(UINT back_buf_index, Scene& scene, View& view);
-    void render_2d_text(size_t objects_count, int triangles_count, size_t vertices_count, 
-        size_t lights_count, int draw_calls);
+    void render_2d_text(size_t objects_count, size_t visible_objects_count,
+        double culling_seconds, int triangles_count, size_t vertices_count,
+        size_t index_buffer_size, size_t lights_count, int draw_calls);
     void render_2d_text(const std::wstring& message);
     void scaling_changed(float dpi);
     bool early_z_pass() const { return m_early_z_pass; }
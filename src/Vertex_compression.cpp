@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch.h"
+#include "Vertex_compression.h"
+
+#include <cfloat>
+#include <cmath>
+
+
+using namespace DirectX;
+using DirectX::PackedVector::XMConvertFloatToHalf;
+using DirectX::PackedVector::XMConvertHalfToFloat;
+
+
+namespace
+{
+    constexpr float snorm16_max = 32767.0f;
+
+    int16_t to_snorm16(float value)
+    {
+        const float clamped = std::fmin(std::fmax(value, -1.0f), 1.0f);
+        return static_cast<int16_t>(std::lround(clamped * snorm16_max));
+    }
+
+    // The same conversion as the input assembler does for DXGI_FORMAT_R16G16B16A16_SNORM.
+    float from_snorm16(int16_t value)
+    {
+        return std::fmax(value / snorm16_max, -1.0f);
+    }
+
+    Compact_vertex_position to_snorm16(XMVECTOR v)
+    {
+        Compact_vertex_position result;
+        result.x = to_snorm16(XMVectorGetX(v));
+        result.y = to_snorm16(XMVectorGetY(v));
+        result.z = to_snorm16(XMVectorGetZ(v));
+        result.w = to_snorm16(XMVectorGetW(v));
+        return result;
+    }
+
+    XMVECTOR from_snorm16(const DirectX::PackedVector::XMSHORTN4& v)
+    {
+        return XMVectorSet(from_snorm16(v.x), from_snorm16(v.y), from_snorm16(v.z),
+            from_snorm16(v.w));
+    }
+
+    XMVECTOR any_perpendicular(XMVECTOR normal)
+    {
+        XMVECTOR axis = std::fabs(XMVectorGetX(normal)) < 0.9f ? XMVectorSet(1, 0, 0, 0) :
+            XMVectorSet(0, 1, 0, 0);
+        return XMVector3Normalize(XMVector3Cross(normal, axis));
+    }
+
+    // The quaternion of the rotation matrix that has tangent, bitangent and normal as columns.
+    // The matrix has to be orthonormal and right handed.
+    XMVECTOR quaternion_from_basis(XMVECTOR tangent, XMVECTOR bitangent, XMVECTOR normal)
+    {
+        XMFLOAT3 t, b, n;
+        XMStoreFloat3(&t, tangent);
+        XMStoreFloat3(&b, bitangent);
+        XMStoreFloat3(&n, normal);
+        const float trace = t.x + b.y + n.z;
+        if (trace > 0.0f)
+        {
+            const float s = 0.5f / std::sqrt(trace + 1.0f);
+            return XMVectorSet((b.z - n.y) * s, (n.x - t.z) * s, (t.y - b.x) * s, 0.25f / s);
+        }
+        if (t.x > b.y && t.x > n.z)
+        {
+            const float s = 2.0f * std::sqrt(1.0f + t.x - b.y - n.z);
+            return XMVectorSet(0.25f * s, (b.x + t.y) / s, (n.x + t.z) / s, (b.z - n.y) / s);
+        }
+        if (b.y > n.z)
+        {
+            const float s = 2.0f * std::sqrt(1.0f + b.y - t.x - n.z);
+            return XMVectorSet((b.x + t.y) / s, 0.25f * s, (n.y + b.z) / s, (n.x - t.z) / s);
+        }
+        const float s = 2.0f * std::sqrt(1.0f + n.z - t.x - b.y);
+        return XMVectorSet((n.x + t.z) / s, (n.y + b.z) / s, 0.25f * s, (t.y - b.x) / s);
+    }
+
+    Compact_vertex_tangent_frame encode_tangent_frame(XMVECTOR normal, XMVECTOR tangent,
+        XMVECTOR bitangent)
+    {
+        constexpr float min_length_squared = 1e-12f;
+        if (XMVectorGetX(XMVector3LengthSq(normal)) < min_length_squared)
+            normal = XMVectorSet(0, 0, 1, 0);
+        normal = XMVector3Normalize(normal);
+
+        // Gram-Schmidt, to make the basis orthonormal.
+        tangent = tangent - normal * XMVector3Dot(normal, tangent);
+        tangent = XMVectorGetX(XMVector3LengthSq(tangent)) < min_length_squared ?
+            any_perpendicular(normal) : XMVector3Normalize(tangent);
+        const XMVECTOR right_handed_bitangent = XMVector3Cross(normal, tangent);
+        const bool mirrored = XMVectorGetX(XMVector3Dot(right_handed_bitangent, bitangent)) < 0;
+
+        XMVECTOR q = XMVector4Normalize(quaternion_from_basis(tangent, right_handed_bitangent,
+            normal));
+        if (XMVectorGetW(q) < 0.0f)
+            q = XMVectorNegate(q);
+
+        // w has to stay non-zero after quantization, otherwise it can not carry the sign.
+        constexpr float min_w = 1.0f / snorm16_max;
+        if (XMVectorGetW(q) < min_w)
+        {
+            const float xyz_scale = std::sqrt(1.0f - min_w * min_w) /
+                XMVectorGetX(XMVector3Length(q));
+            q = XMVectorSetW(q * xyz_scale, min_w);
+        }
+        if (mirrored)
+            q = XMVectorNegate(q);
+        return to_snorm16(q);
+    }
+}
+
+Compact_vertices compress_vertices(const Vertices& vertices)
+{
+    Compact_vertices result;
+    result.colors = vertices.colors;
+
+    XMVECTOR min_position = XMVectorReplicate(FLT_MAX);
+    XMVECTOR max_position = XMVectorReplicate(-FLT_MAX);
+    for (auto& p : vertices.positions)
+    {
+        const XMVECTOR position = XMLoadFloat4(&p);
+        min_position = XMVectorMin(min_position, position);
+        max_position = XMVectorMax(max_position, position);
+    }
+    const XMVECTOR center = vertices.positions.empty() ? XMVectorZero() :
+        (min_position + max_position) * 0.5f;
+    XMFLOAT4 half_extent;
+    XMStoreFloat4(&half_extent, (max_position - min_position) * 0.5f);
+    // Flat meshes would otherwise divide by zero.
+    for (float* e : { &half_extent.x, &half_extent.y, &half_extent.z })
+        if (!(*e > 0.0f))
+            *e = 1.0f;
+    auto& dequantization = result.position_dequantization;
+    XMStoreFloat4(&dequantization.offset, XMVectorSetW(center, 0.0f));
+    dequantization.scale = { half_extent.x, half_extent.y, half_extent.z, 0.0f };
+    const XMVECTOR scale = XMLoadFloat4(&dequantization.scale);
+
+    const size_t count = vertices.positions.size();
+    result.positions.resize(count);
+    result.tangent_frames.resize(count);
+    result.texture_coords.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& p = vertices.positions[i];
+        const XMVECTOR position = XMVectorSet(p.x, p.y, p.z, 0.0f);
+        result.positions[i] = to_snorm16(XMVectorSetW(XMVectorDivide(position - center,
+            XMVectorSetW(scale, 1.0f)), 1.0f));
+
+        const XMVECTOR normal = i < vertices.normals.size() ?
+            convert_half4_to_vector(vertices.normals[i]) : XMVectorZero();
+        const XMVECTOR tangent = i < vertices.tangents.size() ?
+            convert_half4_to_vector(vertices.tangents[i]) : XMVectorZero();
+        const XMVECTOR bitangent = i < vertices.bitangents.size() ?
+            convert_half4_to_vector(vertices.bitangents[i]) : XMVectorZero();
+        result.tangent_frames[i] = encode_tangent_frame(XMVectorSetW(normal, 0.0f),
+            XMVectorSetW(tangent, 0.0f), XMVectorSetW(bitangent, 0.0f));
+
+        // The texture coordinates are stored in the w components of position and normal.
+        const float v = i < vertices.normals.size() ?
+            XMConvertHalfToFloat(vertices.normals[i].w) : 0.0f;
+        result.texture_coords[i] = Compact_vertex_texture_coords(XMConvertFloatToHalf(p.w),
+            XMConvertFloatToHalf(v));
+    }
+    return result;
+}
+
+Decompressed_vertex decompress_vertex(const Compact_vertices& vertices, size_t index)
+{
+    Decompressed_vertex result;
+
+    auto& dequantization = vertices.position_dequantization;
+    const XMVECTOR position = XMLoadFloat4(&dequantization.offset) +
+        from_snorm16(vertices.positions[index]) * XMLoadFloat4(&dequantization.scale);
+    XMStoreFloat3(&result.position, position);
+
+    const XMVECTOR q = XMVector4Normalize(from_snorm16(vertices.tangent_frames[index]));
+    XMFLOAT4 f;
+    XMStoreFloat4(&f, q);
+    result.tangent = { 1 - 2 * (f.y * f.y + f.z * f.z), 2 * (f.x * f.y + f.w * f.z),
+        2 * (f.x * f.z - f.w * f.y) };
+    result.bitangent = { 2 * (f.x * f.y - f.w * f.z), 1 - 2 * (f.x * f.x + f.z * f.z),
+        2 * (f.y * f.z + f.w * f.x) };
+    result.normal = { 2 * (f.x * f.z + f.w * f.y), 2 * (f.y * f.z - f.w * f.x),
+        1 - 2 * (f.x * f.x + f.y * f.y) };
+    if (f.w < 0.0f)
+        result.bitangent = { -result.bitangent.x, -result.bitangent.y, -result.bitangent.z };
+
+    auto& uv = vertices.texture_coords[index];
+    result.texture_coords = { XMConvertHalfToFloat(uv.x), XMConvertHalfToFloat(uv.y) };
+    return result;
+}
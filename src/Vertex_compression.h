@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+#include "Mesh.h"
+
+
+// The compact vertex format uses half the memory and bandwidth of the full one:
+// - The positions are 16 bit snorm, relative to the bounding box of the mesh. The vertex
+//   shader dequantizes them, see Position_dequantization.
+// - The normal, tangent and bitangent are stored together as a QTangent, i.e. a quaternion
+//   that rotates the tangent space basis to model space, in 16 bit snorm. The sign of w tells
+//   if the bitangent is mirrored. This is from "Spherical Skinning with Dual-Quaternions and
+//   QTangents" by Ivo Zoltan Frey, 2011.
+// - The texture coordinates are 16 bit floats.
+// The vertex colors, if any, are kept as they are.
+
+typedef DirectX::PackedVector::XMSHORTN4 Compact_vertex_position;
+
+typedef DirectX::PackedVector::XMSHORTN4 Compact_vertex_tangent_frame;
+
+typedef DirectX::PackedVector::XMHALF2 Compact_vertex_texture_coords;
+
+constexpr size_t full_vertex_size = sizeof(Vertex_position) + sizeof(Vertex_normal) +
+    sizeof(Vertex_tangent) + sizeof(Vertex_bitangent);
+
+constexpr size_t compact_vertex_size = sizeof(Compact_vertex_position) +
+    sizeof(Compact_vertex_tangent_frame) + sizeof(Compact_vertex_texture_coords);
+
+struct Compact_vertices
+{
+    std::vector<Compact_vertex_position> positions;
+    std::vector<Compact_vertex_tangent_frame> tangent_frames;
+    std::vector<Compact_vertex_texture_coords> texture_coords;
+    std::vector<Vertex_color> colors;
+    Position_dequantization position_dequantization;
+};
+
+// Vertices without a usable tangent get an arbitrary one, perpendicular to the normal.
+Compact_vertices compress_vertices(const Vertices& vertices);
+
+
+// Decompresses a vertex the same way as the vertex shaders do it.
+struct Decompressed_vertex
+{
+    DirectX::XMFLOAT3 position;
+    DirectX::XMFLOAT3 normal;
+    DirectX::XMFLOAT3 tangent;
+    DirectX::XMFLOAT3 bitangent;
+    DirectX::XMFLOAT2 texture_coords;
+};
+
+Decompressed_vertex decompress_vertex(const Compact_vertices& vertices, size_t index);
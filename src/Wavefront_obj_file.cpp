@@ -7,19 +7,29 @@
 
 #include "pch.h"
 #include "Wavefront_obj_file.h"
+#include "Compressed_file.h"
+#include "Memory_mapped_file.h"
+#include "Mesh_optimizer.h"
+#include "Mesh_simplifier.h"
+#include "Tangent_space.h"
 #include "util.h"
 
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
 
 using DirectX::PackedVector::XMHALF4;
 using DirectX::PackedVector::XMHALF2;
 using DirectX::XMFLOAT4;
-using DirectX::XMVECTOR;
 using DirectX::PackedVector::XMConvertHalfToFloat;
 using std::vector;
 using std::map;
 using std::string;
-using std::ifstream;
 using std::istringstream;
+using std::string_view;
 
 
 void read_mtl_file(const string file_name, map<string, Material>& materials);
@@ -52,10 +62,11 @@ bool read_obj_file(std::istream& file, Vertices& vertices, vector<int>& indices,
     vector<float> vf(max_vertex_components);
     vf[max_vertex_components - 1] = 1.0f; // Alpha value for 3 component vertex color.
 
-    while (file)
-    {
-        file >> input;
+    // The faces without tangents in the file, they are calculated together at the end.
+    vector<int> faces_without_tangents;
 
+    while (file >> input)
+    {
         if (input == "v")
         {
             std::getline(file, input);
@@ -141,8 +152,7 @@ bool read_obj_file(std::istream& file, Vertices& vertices, vector<int>& indices,
         }
         else if (input == "f")
         {
-            XMVECTOR v[vertex_count_per_face];
-            XMVECTOR uv[vertex_count_per_face];
+            const int first_corner = static_cast<int>(vertices.positions.size());
             bool tangents_in_file = false;
             for (int i = 0; i < vertex_count_per_face; ++i)
             {
@@ -198,14 +208,10 @@ bool read_obj_file(std::istream& file, Vertices& vertices, vector<int>& indices,
                 XMFLOAT4 position_plus_u = input_vertices[vertex_index - 1];
                 XMHALF4 normal_plus_v = input_normals[normal_index - 1];
 
-                v[i] = XMLoadFloat4(&position_plus_u);
-
                 if (uvs)
                 {
                     position_plus_u.w = XMConvertHalfToFloat(input_texture_coords[uv_index - 1].x);
                     normal_plus_v.w = input_texture_coords[uv_index - 1].y;
-                    uv[i].m128_f32[0] = position_plus_u.w;
-                    uv[i].m128_f32[1] = XMConvertHalfToFloat(normal_plus_v.w);
                 }
 
                 vertices.positions.push_back({ position_plus_u });
@@ -219,7 +225,17 @@ bool read_obj_file(std::istream& file, Vertices& vertices, vector<int>& indices,
             }
 
             if (!tangents_in_file)
-                calculate_and_add_tangent_and_bitangent(v, uv, vertices);
+            {
+                const bool whole_face = vertices.positions.size() ==
+                    static_cast<size_t>(first_corner) + vertex_count_per_face;
+                for (int i = 0; i < vertex_count_per_face; ++i)
+                {
+                    if (whole_face)
+                        faces_without_tangents.push_back(first_corner + i);
+                    vertices.tangents.push_back({});
+                    vertices.bitangents.push_back({});
+                }
+            }
         }
         else if (input == "mtllib")
         {
@@ -242,9 +258,807 @@ bool read_obj_file(std::istream& file, Vertices& vertices, vector<int>& indices,
         }
     }
 
+    constexpr int single_thread = 1;
+    set_face_tangents(vertices, faces_without_tangents, single_thread);
+
     return more_objects;
 }
 
+namespace
+{
+    // Helpers for the pointer based parsers below. They never read past end and they never
+    // allocate, which is what makes those parsers so much faster than the stream based one.
+
+    inline bool is_blank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline void skip_blanks(const char*& p, const char* end)
+    {
+        while (p < end && is_blank(*p))
+            ++p;
+    }
+
+    inline void skip_blanks_and_newlines(const char*& p, const char* end)
+    {
+        while (p < end && (is_blank(*p) || *p == '\n'))
+            ++p;
+    }
+
+    inline void skip_line(const char*& p, const char* end)
+    {
+        p = static_cast<const char*>(memchr(p, '\n', end - p));
+        p = p ? p + 1 : end;
+    }
+
+    inline string_view read_token(const char*& p, const char* end)
+    {
+        skip_blanks(p, end);
+        const char* token_start = p;
+        while (p < end && !is_blank(*p) && *p != '\n')
+            ++p;
+        return string_view(token_start, p - token_start);
+    }
+
+    inline bool read_float(const char*& p, const char* end, float& value)
+    {
+        skip_blanks(p, end);
+        if (p < end && *p == '+') // Not accepted by from_chars.
+            ++p;
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc())
+            return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // Every v record defines a vertex, even if it is malformed, so that the records can be
+    // counted without parsing them. See read_obj_objects. Returns true if it has a color.
+    inline bool read_vertex(const char*& p, const char* end, XMFLOAT4& position,
+        XMHALF4& color)
+    {
+        using DirectX::PackedVector::XMConvertFloatToHalf;
+
+        constexpr int max_vertex_components = 7;
+        float vf[max_vertex_components] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+                                            1.0f }; // Alpha value for 3 component color.
+        int i = 0;
+        while (i < max_vertex_components && read_float(p, end, vf[i]))
+            ++i;
+
+        position = XMFLOAT4(vf[0], vf[1], vf[2], 1.0f);
+        color = XMHALF4(XMConvertFloatToHalf(vf[3]), XMConvertFloatToHalf(vf[4]),
+            XMConvertFloatToHalf(vf[5]), XMConvertFloatToHalf(vf[6]));
+        constexpr int components_of_vertex_with_color = 6;
+        return i >= components_of_vertex_with_color;
+    }
+
+    inline XMHALF2 read_texture_coord(const char*& p, const char* end, Obj_flip_v flip_v)
+    {
+        using DirectX::PackedVector::XMConvertFloatToHalf;
+        float u = 0.0f;
+        float v = 0.0f;
+        read_float(p, end, u);
+        read_float(p, end, v);
+        if (flip_v == Obj_flip_v::yes)
+            v = 1.0f - v;
+        return XMHALF2(XMConvertFloatToHalf(u), XMConvertFloatToHalf(v));
+    }
+
+    inline XMHALF4 read_direction(const char*& p, const char* end)
+    {
+        using DirectX::PackedVector::XMConvertFloatToHalf;
+        float f[3] = {};
+        for (float& component : f)
+            read_float(p, end, component);
+        return XMHALF4(XMConvertFloatToHalf(f[0]), XMConvertFloatToHalf(f[1]),
+            XMConvertFloatToHalf(f[2]), XMConvertFloatToHalf(0.0f));
+    }
+
+    // The references of one face corner: v/vt/vn/vtan/vbt, where all but v are optional.
+    // Zero means that the reference is not present.
+    struct Face_corner
+    {
+        int position;
+        int texture_coord;
+        int normal;
+        int tangent;
+        int bitangent;
+    };
+
+    inline bool read_face_corner(const char*& p, const char* end, Face_corner& corner)
+    {
+        corner = {};
+        skip_blanks(p, end);
+        p = std::from_chars(p, end, corner.position).ptr;
+        int* const optional_references[] = { &corner.texture_coord, &corner.normal,
+                                             &corner.tangent, &corner.bitangent };
+        for (int* reference : optional_references)
+        {
+            if (p == end || *p != '/')
+                break;
+            ++p;
+            p = std::from_chars(p, end, *reference).ptr; // Leaves it at zero if empty.
+        }
+        return corner.position != 0;
+    }
+
+    // Obj indices start at 1, negative indices are relative to the last element read so far.
+    inline bool resolve_index(int reference, size_t count, size_t& index)
+    {
+        if (reference > 0)
+            index = static_cast<size_t>(reference) - 1;
+        else if (reference < 0)
+            index = count - static_cast<size_t>(-static_cast<long long>(reference));
+        else
+            return false;
+        return index < count;
+    }
+
+    // The vertex data that faces can refer to. The counts are the number of elements that
+    // have been read before the face, which is not necessarily the size of the arrays.
+    struct Face_sources
+    {
+        const XMFLOAT4* positions;
+        size_t position_count;
+        const XMHALF4* normals;
+        size_t normal_count;
+        const XMHALF2* texture_coords;
+        size_t texture_coord_count;
+        const XMHALF4* tangents;
+        size_t tangent_count;
+        const XMHALF4* bitangents;
+        size_t bitangent_count;
+        const XMHALF4* colors; // Indexed like positions, nullptr if not every vertex has one.
+    };
+
+    inline uint32_t key_index(size_t index)
+    {
+        return static_cast<uint32_t>(index);
+    }
+
+    // If keys is not nullptr, a vertex key is added for every face corner. The corners of
+    // a face without tangents in the file get zero tangents and bitangents, and are added to
+    // faces_without_tangents, to be calculated later with set_face_tangents. A face with a
+    // corner that can't be read or refers to a vertex that does not exist is left out whole.
+    void read_face(const char*& p, const char* end, const Face_sources& in, Vertices& vertices,
+        vector<Obj_vertex_key>* keys, vector<int>& faces_without_tangents)
+    {
+        const int first_corner = static_cast<int>(vertices.positions.size());
+        // The streams can have different lengths here: colors are only kept when every vertex
+        // has one, and tangents are only added for the corners that have them in the file.
+        const size_t first_tangent = vertices.tangents.size();
+        const size_t first_bitangent = vertices.bitangents.size();
+        const size_t first_color = vertices.colors.size();
+        const size_t first_key = keys ? keys->size() : 0;
+        bool tangents_in_file = false;
+        int corners = 0;
+        for (; corners < vertex_count_per_face; ++corners)
+        {
+            Face_corner corner;
+            size_t vertex_index;
+            if (!read_face_corner(p, end, corner) ||
+                !resolve_index(corner.position, in.position_count, vertex_index))
+                break;
+
+            constexpr uint32_t none = Obj_vertex_key::none;
+            Obj_vertex_key key = { key_index(vertex_index), none, none, none, none };
+
+            size_t i;
+            if (resolve_index(corner.tangent, in.tangent_count, i))
+            {
+                tangents_in_file = true;
+                vertices.tangents.push_back({ in.tangents[i] });
+                key.tangent = key_index(i);
+            }
+            if (resolve_index(corner.bitangent, in.bitangent_count, i))
+            {
+                vertices.bitangents.push_back({ in.bitangents[i] });
+                key.bitangent = key_index(i);
+            }
+
+            XMFLOAT4 position_plus_u = in.positions[vertex_index];
+            XMHALF4 normal_plus_v = {};
+            if (resolve_index(corner.normal, in.normal_count, i))
+            {
+                normal_plus_v = in.normals[i];
+                key.normal = key_index(i);
+            }
+
+            if (resolve_index(corner.texture_coord, in.texture_coord_count, i))
+            {
+                position_plus_u.w = XMConvertHalfToFloat(in.texture_coords[i].x);
+                normal_plus_v.w = in.texture_coords[i].y;
+                key.texture_coord = key_index(i);
+            }
+
+            vertices.positions.push_back({ position_plus_u });
+            vertices.normals.push_back({ normal_plus_v });
+
+            if (in.colors)
+                vertices.colors.push_back({ in.colors[vertex_index] });
+
+            if (keys)
+                keys->push_back(key);
+        }
+
+        if (corners < vertex_count_per_face)
+        {
+            // The corners that were read would leave the indices of the object without whole
+            // triangles, see add_indices.
+            vertices.positions.resize(first_corner);
+            vertices.normals.resize(first_corner);
+            vertices.tangents.resize(first_tangent);
+            vertices.bitangents.resize(first_bitangent);
+            vertices.colors.resize(first_color);
+            if (keys)
+                keys->resize(first_key);
+            return;
+        }
+
+        if (!tangents_in_file)
+            for (int i = 0; i < corners; ++i) // Keep the vertex streams the same length.
+            {
+                faces_without_tangents.push_back(first_corner + i);
+                vertices.tangents.push_back({});
+                vertices.bitangents.push_back({});
+            }
+    }
+
+    void add_indices(const Vertices& vertices, vector<int>& indices)
+    {
+        const size_t start = indices.size();
+        indices.resize(vertices.positions.size());
+        for (size_t i = start; i < indices.size(); ++i)
+            indices[i] = static_cast<int>(i);
+    }
+}
+
+bool read_obj_file(const char*& position, const char* end, Vertices& vertices,
+    vector<int>& indices, vector<XMFLOAT4>& input_vertices, vector<XMHALF4>& input_normals,
+    vector<XMHALF2>& input_texture_coords, vector<XMHALF4>& input_tangents,
+    vector<XMHALF4>& input_bitangents, vector<XMHALF4>& input_colors, string& material,
+    map<string, Material>* materials, Obj_flip_v flip_v)
+{
+    // This gives the same result as the stream based version above, for well-formed files.
+    // See the comment there about the tangent and bitangent extension.
+
+    const char*& p = position;
+    bool more_objects = false;
+    vector<int> faces_without_tangents;
+
+    while (p < end)
+    {
+        skip_blanks_and_newlines(p, end);
+        const string_view keyword = read_token(p, end);
+
+        if (keyword == "v")
+        {
+            XMFLOAT4 vertex;
+            XMHALF4 color;
+            input_vertices.push_back(vertex);
+            if (read_vertex(p, end, input_vertices.back(), color))
+                input_colors.push_back(color);
+        }
+        else if (keyword == "vn")
+        {
+            input_normals.push_back(read_direction(p, end));
+        }
+        else if (keyword == "vt")
+        {
+            input_texture_coords.push_back(read_texture_coord(p, end, flip_v));
+        }
+        else if (keyword == "vtan") // Vertex tangent, my own extension.
+        {
+            input_tangents.push_back(read_direction(p, end));
+        }
+        else if (keyword == "vbt") // Vertex bitangent, my own extension.
+        {
+            input_bitangents.push_back(read_direction(p, end));
+        }
+        else if (keyword == "f")
+        {
+            const Face_sources sources = { input_vertices.data(), input_vertices.size(),
+                input_normals.data(), input_normals.size(),
+                input_texture_coords.data(), input_texture_coords.size(),
+                input_tangents.data(), input_tangents.size(),
+                input_bitangents.data(), input_bitangents.size(),
+                input_colors.size() == input_vertices.size() ? input_colors.data() : nullptr };
+            constexpr vector<Obj_vertex_key>* keys_not_needed = nullptr;
+            read_face(p, end, sources, vertices, keys_not_needed, faces_without_tangents);
+            add_indices(vertices, indices);
+        }
+        else if (keyword == "mtllib")
+        {
+            const string mtl_file(read_token(p, end));
+            if (materials)
+                read_mtl_file(data_path + mtl_file, *materials);
+        }
+        else if (keyword == "usemtl")
+        {
+            material = read_token(p, end);
+        }
+        else if (keyword == "o" || keyword == "g")
+        {
+            skip_line(p, end); // Skip the object name
+            if (!vertices.positions.empty())
+            {
+                more_objects = true;
+                break;
+            }
+            continue;
+        }
+
+        skip_line(p, end); // This also skips comments and unsupported statements.
+    }
+
+    const int thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    set_face_tangents(vertices, faces_without_tangents, thread_count);
+
+    return more_objects;
+}
+
+namespace
+{
+    // Splits the range into at most max_count line aligned chunks.
+    vector<string_view> split_in_chunks(const char* begin, const char* end, int max_count)
+    {
+        constexpr size_t min_chunk_size = 256 * 1024;
+        const size_t size = end - begin;
+        const size_t count = std::max<size_t>(1, std::min<size_t>(max_count,
+            size / min_chunk_size));
+        vector<string_view> chunks;
+        const char* chunk_begin = begin;
+        for (size_t i = 1; i <= count; ++i)
+        {
+            const char* chunk_end = i == count ? end : begin + size * i / count;
+            if (chunk_end < chunk_begin)
+                chunk_end = chunk_begin;
+            if (chunk_end != end && chunk_end != begin && chunk_end[-1] != '\n')
+                skip_line(chunk_end, end);
+            chunks.push_back(string_view(chunk_begin, chunk_end - chunk_begin));
+            chunk_begin = chunk_end;
+        }
+        return chunks;
+    }
+
+    constexpr size_t none = SIZE_MAX;
+
+    // The vertex data of a chunk, and later its position in the complete arrays.
+    struct Chunk_input
+    {
+        vector<XMFLOAT4> positions;
+        vector<XMHALF4> colors;
+        vector<XMHALF4> normals;
+        vector<XMHALF2> texture_coords;
+        vector<XMHALF4> tangents;
+        vector<XMHALF4> bitangents;
+        size_t first_vertex_without_color = none;
+
+        size_t position_offset;
+        size_t normal_offset;
+        size_t texture_coord_offset;
+        size_t tangent_offset;
+        size_t bitangent_offset;
+    };
+
+    // A statement that affects how the faces are divided into objects. Consecutive faces are
+    // collected in the vertices of a faces statement.
+    struct Obj_statement
+    {
+        enum class Type { faces, object, usemtl, mtllib } type;
+        string name;
+        Vertices vertices;
+        vector<Obj_vertex_key> vertex_keys;
+        vector<int> faces_without_tangents;
+    };
+
+    void read_vertex_data(string_view chunk, Obj_flip_v flip_v, Chunk_input& input)
+    {
+        const char* p = chunk.data();
+        const char* end = p + chunk.size();
+        while (p < end)
+        {
+            skip_blanks_and_newlines(p, end);
+            const string_view keyword = read_token(p, end);
+
+            if (keyword == "v")
+            {
+                XMFLOAT4 vertex;
+                XMHALF4 color;
+                input.positions.push_back(vertex);
+                if (read_vertex(p, end, input.positions.back(), color))
+                    input.colors.push_back(color);
+                else if (input.first_vertex_without_color == none)
+                    input.first_vertex_without_color = input.positions.size() - 1;
+            }
+            else if (keyword == "vn")
+                input.normals.push_back(read_direction(p, end));
+            else if (keyword == "vt")
+                input.texture_coords.push_back(read_texture_coord(p, end, flip_v));
+            else if (keyword == "vtan")
+                input.tangents.push_back(read_direction(p, end));
+            else if (keyword == "vbt")
+                input.bitangents.push_back(read_direction(p, end));
+
+            skip_line(p, end);
+        }
+    }
+
+    void read_faces(string_view chunk, const Chunk_input& chunk_input, const Chunk_input& all,
+        size_t first_vertex_without_color, vector<Obj_statement>& statements)
+    {
+        // The counts are needed to resolve relative indices, and to know if the vertex
+        // colors can be used, exactly as the serial parser does.
+        Face_sources sources = { all.positions.data(), chunk_input.position_offset,
+            all.normals.data(), chunk_input.normal_offset,
+            all.texture_coords.data(), chunk_input.texture_coord_offset,
+            all.tangents.data(), chunk_input.tangent_offset,
+            all.bitangents.data(), chunk_input.bitangent_offset, nullptr };
+
+        const char* p = chunk.data();
+        const char* end = p + chunk.size();
+        while (p < end)
+        {
+            skip_blanks_and_newlines(p, end);
+            const string_view keyword = read_token(p, end);
+
+            if (keyword == "f")
+            {
+                if (statements.empty() || statements.back().type != Obj_statement::Type::faces)
+                    statements.push_back({ Obj_statement::Type::faces });
+                sources.colors = sources.position_count <= first_vertex_without_color ?
+                    all.colors.data() : nullptr;
+                Obj_statement& faces = statements.back();
+                read_face(p, end, sources, faces.vertices, &faces.vertex_keys,
+                    faces.faces_without_tangents);
+            }
+            else if (keyword == "v")
+                ++sources.position_count;
+            else if (keyword == "vn")
+                ++sources.normal_count;
+            else if (keyword == "vt")
+                ++sources.texture_coord_count;
+            else if (keyword == "vtan")
+                ++sources.tangent_count;
+            else if (keyword == "vbt")
+                ++sources.bitangent_count;
+            else if (keyword == "o" || keyword == "g")
+                statements.push_back({ Obj_statement::Type::object });
+            else if (keyword == "usemtl")
+                statements.push_back({ Obj_statement::Type::usemtl,
+                    string(read_token(p, end)) });
+            else if (keyword == "mtllib")
+                statements.push_back({ Obj_statement::Type::mtllib,
+                    string(read_token(p, end)) });
+
+            skip_line(p, end);
+        }
+
+        // This already runs on one thread per chunk.
+        constexpr int single_thread = 1;
+        for (auto& statement : statements)
+            set_face_tangents(statement.vertices, statement.faces_without_tangents,
+                single_thread);
+    }
+
+    template<typename T>
+    void append(vector<T>& destination, const vector<T>& source, size_t offset)
+    {
+        std::copy(source.begin(), source.end(), destination.begin() + offset);
+    }
+
+    // Reads the objects of an Obj file from line aligned blocks of it, in the order of the
+    // file. Each block is split in chunks that are parsed in two parallel passes. The first
+    // reads the vertex data, i.e. the v, vn, vt, vtan and vbt records. When those have been
+    // added to the vertex data of the earlier blocks it is known where every chunk starts in
+    // the complete arrays, which makes it possible to resolve the indices of the faces in the
+    // second pass. Finally, the faces are added to the objects in the order of the file. Only
+    // the vertex data has to be kept between the blocks, not the text.
+    class Obj_block_reader
+    {
+    public:
+        Obj_block_reader(map<string, Material>& materials, Obj_flip_v flip_v, int thread_count,
+            vector<string>* material_files) : m_materials(materials), m_flip_v(flip_v),
+            m_thread_count(thread_count), m_material_files(material_files),
+            m_first_vertex_without_color(none), m_objects(1), m_object_color_counts(1)
+        {
+        }
+
+        void read(const char* begin, const char* end);
+        vector<Obj_object> objects() { return std::move(m_objects); }
+    private:
+        void read_vertex_data_in_parallel(const vector<string_view>& chunks,
+            vector<Chunk_input>& chunk_inputs);
+        void add_faces_to_objects(vector<vector<Obj_statement>>& chunk_statements);
+
+        map<string, Material>& m_materials;
+        Obj_flip_v m_flip_v;
+        int m_thread_count;
+        vector<string>* m_material_files;
+        Chunk_input m_all;
+        size_t m_first_vertex_without_color;
+        vector<Obj_object> m_objects;
+        vector<size_t> m_object_color_counts;
+    };
+
+    void Obj_block_reader::read(const char* begin, const char* end)
+    {
+        const vector<string_view> chunks = split_in_chunks(begin, end, m_thread_count);
+        const int chunk_count = static_cast<int>(chunks.size());
+
+        vector<Chunk_input> chunk_inputs(chunks.size());
+        read_vertex_data_in_parallel(chunks, chunk_inputs);
+
+        vector<vector<Obj_statement>> chunk_statements(chunks.size());
+        run_in_parallel(chunk_count, [&](int i) {
+            read_faces(chunks[i], chunk_inputs[i], m_all, m_first_vertex_without_color,
+                chunk_statements[i]); });
+
+        add_faces_to_objects(chunk_statements);
+    }
+
+    void Obj_block_reader::read_vertex_data_in_parallel(const vector<string_view>& chunks,
+        vector<Chunk_input>& chunk_inputs)
+    {
+        const int chunk_count = static_cast<int>(chunks.size());
+        run_in_parallel(chunk_count, [&](int i) {
+            read_vertex_data(chunks[i], m_flip_v, chunk_inputs[i]); });
+
+        Chunk_input& all = m_all;
+        for (auto& chunk : chunk_inputs)
+        {
+            chunk.position_offset = all.positions.size();
+            chunk.normal_offset = all.normals.size();
+            chunk.texture_coord_offset = all.texture_coords.size();
+            chunk.tangent_offset = all.tangents.size();
+            chunk.bitangent_offset = all.bitangents.size();
+            if (m_first_vertex_without_color == none &&
+                chunk.first_vertex_without_color != none)
+                m_first_vertex_without_color = chunk.position_offset +
+                chunk.first_vertex_without_color;
+            all.positions.resize(all.positions.size() + chunk.positions.size());
+            all.normals.resize(all.normals.size() + chunk.normals.size());
+            all.texture_coords.resize(all.texture_coords.size() + chunk.texture_coords.size());
+            all.tangents.resize(all.tangents.size() + chunk.tangents.size());
+            all.bitangents.resize(all.bitangents.size() + chunk.bitangents.size());
+        }
+        // Colors are only used as long as every vertex has one, and then they are indexed like
+        // the positions. Any colors after the first vertex without one are never used.
+        size_t colors = all.colors.size();
+        for (auto& chunk : chunk_inputs)
+            if (chunk.position_offset < m_first_vertex_without_color)
+                colors = std::max(colors, chunk.position_offset + chunk.colors.size());
+        all.colors.resize(colors);
+        run_in_parallel(chunk_count, [&](int i) {
+            const Chunk_input& chunk = chunk_inputs[i];
+            append(all.positions, chunk.positions, chunk.position_offset);
+            append(all.normals, chunk.normals, chunk.normal_offset);
+            append(all.texture_coords, chunk.texture_coords, chunk.texture_coord_offset);
+            append(all.tangents, chunk.tangents, chunk.tangent_offset);
+            append(all.bitangents, chunk.bitangents, chunk.bitangent_offset);
+            if (chunk.position_offset < m_first_vertex_without_color)
+                append(all.colors, chunk.colors, chunk.position_offset);
+        });
+    }
+
+    void Obj_block_reader::add_faces_to_objects(
+        vector<vector<Obj_statement>>& chunk_statements)
+    {
+        // This follows how the serial parser returns at an object statement, if it has read
+        // any faces, and starts with no material for the next object.
+        struct Object_part
+        {
+            const Vertices* source;
+            const vector<Obj_vertex_key>* vertex_keys;
+            size_t object;
+            size_t offset;
+            size_t color_offset;
+        };
+        const size_t first_object = m_objects.size() - 1; // The one that the block continues.
+        vector<vector<Object_part>> chunk_parts(chunk_statements.size());
+        for (size_t i = 0; i < chunk_statements.size(); ++i)
+            for (auto& statement : chunk_statements[i])
+            {
+                Obj_object& object = m_objects.back();
+                switch (statement.type)
+                {
+                    case Obj_statement::Type::faces:
+                        chunk_parts[i].push_back({ &statement.vertices, &statement.vertex_keys,
+                            m_objects.size() - 1, object.indices.size(),
+                            m_object_color_counts.back() });
+                        // Only the size for now, the indices are filled in with the data.
+                        object.indices.resize(object.indices.size() +
+                            statement.vertices.positions.size());
+                        m_object_color_counts.back() += statement.vertices.colors.size();
+                        break;
+                    case Obj_statement::Type::object:
+                        if (!object.indices.empty())
+                        {
+                            m_objects.emplace_back();
+                            m_object_color_counts.push_back(0);
+                        }
+                        break;
+                    case Obj_statement::Type::usemtl:
+                        object.material = statement.name;
+                        break;
+                    case Obj_statement::Type::mtllib:
+                        read_mtl_file(data_path + statement.name, m_materials);
+                        if (m_material_files)
+                            m_material_files->push_back(data_path + statement.name);
+                        break;
+                }
+            }
+
+        for (size_t i = first_object; i < m_objects.size(); ++i)
+        {
+            Obj_object& object = m_objects[i];
+            const size_t size = object.indices.size();
+            object.vertices.positions.resize(size);
+            object.vertices.normals.resize(size);
+            object.vertices.tangents.resize(size);
+            object.vertices.bitangents.resize(size);
+            object.vertices.colors.resize(m_object_color_counts[i]);
+            object.vertex_keys.resize(size);
+        }
+
+        run_in_parallel(static_cast<int>(chunk_parts.size()), [&](int i) {
+            for (auto& part : chunk_parts[i])
+            {
+                Obj_object& object = m_objects[part.object];
+                const Vertices& source = *part.source;
+                append(object.vertices.positions, source.positions, part.offset);
+                append(object.vertices.normals, source.normals, part.offset);
+                append(object.vertices.tangents, source.tangents, part.offset);
+                append(object.vertices.bitangents, source.bitangents, part.offset);
+                append(object.vertices.colors, source.colors, part.color_offset);
+                append(object.vertex_keys, *part.vertex_keys, part.offset);
+                for (size_t j = 0; j < source.positions.size(); ++j)
+                    object.indices[part.offset + j] = static_cast<int>(part.offset + j);
+            }
+        });
+    }
+}
+
+vector<Obj_object> read_obj_objects(const char* begin, const char* end,
+    map<string, Material>& materials, Obj_flip_v flip_v, int thread_count,
+    vector<string>* material_files/* = nullptr*/)
+{
+    Obj_block_reader reader(materials, flip_v, thread_count, material_files);
+    reader.read(begin, end);
+    return reader.objects();
+}
+
+vector<Obj_object> read_obj_objects(std::istream& file, map<string, Material>& materials,
+    Obj_flip_v flip_v, int thread_count, vector<string>* material_files/* = nullptr*/,
+    size_t block_size/* = 8 * 1024 * 1024*/)
+{
+    Obj_block_reader reader(materials, flip_v, thread_count, material_files);
+    vector<char> block(block_size);
+    size_t carried = 0; // The beginning of a line that did not fit in the previous block.
+    for (;;)
+    {
+        file.read(block.data() + carried, block.size() - carried);
+        const size_t size = carried + static_cast<size_t>(file.gcount());
+        const char* begin = block.data();
+        if (!file)
+        {
+            reader.read(begin, begin + size);
+            break;
+        }
+
+        // Only whole lines are parsed, the rest is read again with the next block.
+        const char* line_end = begin + size;
+        while (line_end != begin && line_end[-1] != '\n')
+            --line_end;
+        if (line_end == begin)
+        {
+            // A line that is longer than the block.
+            carried = size;
+            block.resize(block.size() * 2);
+            continue;
+        }
+        reader.read(begin, line_end);
+        carried = begin + size - line_end;
+        std::copy(line_end, begin + size, block.data());
+    }
+    return reader.objects();
+}
+
+namespace
+{
+    struct Vertex_key_hash
+    {
+        size_t operator()(const Obj_vertex_key& key) const
+        {
+            // The position is by far the most distinguishing part, the rest is mostly needed
+            // at seams. Multiplying with large odd constants spreads the bits.
+            uint64_t hash = key.position * 0x9e3779b97f4a7c15ull;
+            hash ^= (key.texture_coord + (uint64_t(key.normal) << 32)) * 0xc2b2ae3d27d4eb4full;
+            hash ^= (key.tangent + (uint64_t(key.bitangent) << 32)) * 0x165667b19e3779f9ull;
+            return static_cast<size_t>(hash ^ (hash >> 29));
+        }
+    };
+
+    struct Vertex_key_equal
+    {
+        bool operator()(const Obj_vertex_key& a, const Obj_vertex_key& b) const
+        {
+            return a.position == b.position && a.texture_coord == b.texture_coord &&
+                a.normal == b.normal && a.tangent == b.tangent && a.bitangent == b.bitangent;
+        }
+    };
+
+    void add_half4(DirectX::XMFLOAT4& sum, const XMHALF4& value)
+    {
+        using namespace DirectX;
+        XMStoreFloat4(&sum, XMLoadFloat4(&sum) + convert_half4_to_vector(value));
+    }
+
+    XMHALF4 normalized(const DirectX::XMFLOAT4& sum)
+    {
+        using namespace DirectX;
+        return convert_vector_to_half4(XMVector3Normalize(XMLoadFloat4(&sum)));
+    }
+}
+
+void weld_vertices(Obj_object& object)
+{
+    using DirectX::XMFLOAT4;
+
+    const Vertices& in = object.vertices;
+    const vector<Obj_vertex_key>& keys = object.vertex_keys;
+    const size_t corner_count = keys.size();
+    if (corner_count != in.positions.size() || corner_count != in.tangents.size() ||
+        corner_count != in.bitangents.size())
+        return; // Malformed faces, leave it as it is.
+
+    std::unordered_map<Obj_vertex_key, int, Vertex_key_hash, Vertex_key_equal> unique_vertices;
+    unique_vertices.reserve(corner_count);
+
+    Vertices out;
+    vector<XMFLOAT4> tangent_sums;
+    vector<XMFLOAT4> bitangent_sums;
+    for (size_t i = 0; i < corner_count; ++i)
+    {
+        const Obj_vertex_key& key = keys[i];
+        const int new_index = static_cast<int>(out.positions.size());
+        auto result = unique_vertices.emplace(key, new_index);
+        const int index = result.first->second;
+        object.indices[i] = index;
+
+        if (result.second)
+        {
+            out.positions.push_back(in.positions[i]);
+            out.normals.push_back(in.normals[i]);
+            out.tangents.push_back(in.tangents[i]);
+            out.bitangents.push_back(in.bitangents[i]);
+            if (i < in.colors.size()) // Vertex colors are only used if all vertices have one.
+                out.colors.push_back(in.colors[i]);
+            tangent_sums.push_back({});
+            bitangent_sums.push_back({});
+        }
+
+        if (key.tangent == Obj_vertex_key::none)
+            add_half4(tangent_sums[index], in.tangents[i]);
+        if (key.bitangent == Obj_vertex_key::none)
+            add_half4(bitangent_sums[index], in.bitangents[i]);
+    }
+
+    for (auto& vertex : unique_vertices)
+    {
+        const int index = vertex.second;
+        if (vertex.first.tangent == Obj_vertex_key::none)
+            out.tangents[index] = normalized(tangent_sums[index]);
+        if (vertex.first.bitangent == Obj_vertex_key::none)
+            out.bitangents[index] = normalized(bitangent_sums[index]);
+    }
+
+    object.vertices = std::move(out);
+    object.vertex_keys = {};
+}
+
 void read_obj_file(const string& filename, Vertices& vertices, vector<int>& indices,
     Obj_flip_v flip_v)
 {
@@ -256,75 +1070,249 @@ void read_obj_file(const string& filename, Vertices& vertices, vector<int>& indi
     vector<XMHALF4> input_colors;
 
     string not_used;
-    ifstream file(filename);
-    read_obj_file(file, vertices, indices, input_vertices, input_normals, input_texture_coords,
-        input_tangents, input_bitangents, input_colors, not_used, nullptr, flip_v);
+    Memory_mapped_file file(filename);
+    const char* position = file.begin();
+    read_obj_file(position, file.end(), vertices, indices, input_vertices, input_normals,
+        input_texture_coords, input_tangents, input_bitangents, input_colors, not_used,
+        nullptr, flip_v);
 }
 
-void create_one_model_per_triangle(std::shared_ptr<Model_collection> collection,
-    ID3D12Device& device, ID3D12GraphicsCommandList& command_list, const string& filename,
-    const Vertices& vertices, const vector<int>& indices, const string& material)
+vector<Obj_object> read_obj_objects(const string& filename, map<string, Material>& materials,
+    Obj_flip_v flip_v, vector<string>* material_files/* = nullptr*/)
 {
-    auto mesh = std::make_shared<Mesh>(device, command_list, vertices, indices, filename, true);
-    constexpr int vertex_count_per_triangle = 3;
-    const int model_count = static_cast<int>(indices.size()) / vertex_count_per_triangle;
-    for (int i = 0; i < model_count; ++i)
+    const int thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    vector<Obj_object> objects;
+    if (is_compressed_file(filename))
     {
-        collection->models.push_back({ mesh, material, i });
+        auto file = open_input_file(filename);
+        objects = read_obj_objects(*file, materials, flip_v, thread_count, material_files);
     }
+    else
+    {
+        Memory_mapped_file file(filename);
+        objects = read_obj_objects(file.begin(), file.end(), materials, flip_v, thread_count,
+            material_files);
+    }
+
+    const int object_count = static_cast<int>(objects.size());
+    run_in_parallel(std::min(thread_count, object_count), [&](int first) {
+        for (int i = first; i < object_count; i += thread_count)
+            weld_vertices(objects[i]);
+    });
+
+    size_t face_corners = 0;
+    size_t vertices_count = 0;
+    for (auto& object : objects)
+    {
+        face_corners += object.indices.size();
+        vertices_count += object.vertices.positions.size();
+    }
+    if (vertices_count != 0)
+        log(filename + ": " + std::to_string(face_corners) + " face corners welded to " +
+            std::to_string(vertices_count) + " vertices, a ratio of " +
+            std::to_string(static_cast<double>(face_corners) / vertices_count));
+
+    prepare_objects_for_rendering(objects, materials, thread_count, filename);
+    return objects;
 }
 
-std::shared_ptr<Model_collection> read_obj_file(const string& filename, 
-    ID3D12Device& device, ID3D12GraphicsCommandList& command_list, Obj_flip_v flip_v)
+void prepare_objects_for_rendering(vector<Obj_object>& objects,
+    const map<string, Material>& materials, int thread_count, const string& name)
 {
-    using namespace Material_settings;
-    std::ifstream file(filename);
+    const int object_count = static_cast<int>(objects.size());
+    vector<Mesh_optimization_result> optimizations(object_count);
+    run_in_parallel(std::min(thread_count, object_count), [&](int first) {
+        for (int i = first; i < object_count; i += thread_count)
+        {
+            optimizations[i] = optimize_mesh(objects[i].vertices, objects[i].indices);
+            auto material = materials.find(objects[i].material);
+            if (material == materials.end() ||
+                !(material->second.settings & Material_settings::transparency))
+                objects[i].lods = generate_lods(objects[i].vertices.positions,
+                    objects[i].indices);
+        }
+    });
 
-    vector<XMFLOAT4> input_vertices;
-    vector<XMHALF4> input_normals;
-    vector<XMHALF2> input_texture_coords;
-    vector<XMHALF4> input_tangents;
-    vector<XMHALF4> input_bitangents;
-    vector<XMHALF4> input_colors;
+    size_t face_corners = 0;
+    size_t vertices_count = 0;
+    size_t lod_face_corners = 0;
+    double misses_before = 0.0;
+    double misses_after = 0.0;
+    for (int i = 0; i < object_count; ++i)
+    {
+        const size_t triangles = objects[i].indices.size() / vertex_count_per_face;
+        face_corners += objects[i].indices.size();
+        if (!objects[i].lods.empty())
+            lod_face_corners += objects[i].lods.back().indices.size();
+        vertices_count += objects[i].vertices.positions.size();
+        misses_before += optimizations[i].before.acmr * triangles;
+        misses_after += optimizations[i].after.acmr * triangles;
+    }
+    if (vertices_count != 0)
+    {
+        const double triangles = static_cast<double>(face_corners / vertex_count_per_face);
+        log(name + ": vertex cache ACMR " + std::to_string(misses_before / triangles) +
+            " -> " + std::to_string(misses_after / triangles) + ", ATVR " +
+            std::to_string(misses_before / vertices_count) + " -> " +
+            std::to_string(misses_after / vertices_count));
+        if (lod_face_corners != 0)
+            log(name + ": " + std::to_string(static_cast<size_t>(triangles)) +
+                " triangles, with " + std::to_string(lod_face_corners / vertex_count_per_face) +
+                " in the coarsest levels of detail");
+    }
+}
+
+namespace
+{
+    // Appends source and makes destination as long as the positions, which keeps the vertex
+    // streams aligned even if some of them are missing.
+    template<typename T>
+    void append_stream(vector<T>& destination, const vector<T>& source, size_t vertex_count)
+    {
+        destination.insert(destination.end(), source.begin(), source.end());
+        destination.resize(vertex_count);
+    }
+
+    void append_indices(vector<int>& destination, const vector<int>& source, int offset)
+    {
+        const size_t start = destination.size();
+        destination.resize(start + source.size());
+        for (size_t i = 0; i < source.size(); ++i)
+            destination[start + i] = source[i] + offset;
+    }
+}
+
+Obj_object merge_objects(const vector<const Obj_object*>& objects)
+{
+    Obj_object result;
+    if (objects.empty())
+        return result;
+    result.material = objects.front()->material;
+
+    size_t lod_count = 0;
+    bool colors = false;
+    for (auto object : objects)
+    {
+        lod_count = std::max(lod_count, object->lods.size());
+        colors = colors || !object->vertices.colors.empty();
+    }
+    result.lods.resize(lod_count);
+
+    Vertices& out = result.vertices;
+    for (auto object : objects)
+    {
+        const Vertices& in = object->vertices;
+        const int offset = static_cast<int>(out.positions.size());
+        const size_t vertex_count = out.positions.size() + in.positions.size();
+        out.positions.insert(out.positions.end(), in.positions.begin(), in.positions.end());
+        append_stream(out.normals, in.normals, vertex_count);
+        append_stream(out.tangents, in.tangents, vertex_count);
+        append_stream(out.bitangents, in.bitangents, vertex_count);
+        if (colors) // The same as the dummy colors that Mesh creates for objects without.
+            append_stream(out.colors, in.colors, vertex_count);
+
+        append_indices(result.indices, object->indices, offset);
+
+        for (size_t level = 0; level < lod_count; ++level)
+        {
+            auto& lods = object->lods;
+            if (lods.empty())
+            {
+                append_indices(result.lods[level].indices, object->indices, offset);
+                continue;
+            }
+            const Mesh_lod& lod = lods[std::min(level, lods.size() - 1)];
+            append_indices(result.lods[level].indices, lod.indices, offset);
+            result.lods[level].error = std::max(result.lods[level].error, lod.error);
+        }
+    }
+    return result;
+}
+
+std::shared_ptr<Model_collection> create_model_collection(const vector<Obj_object>& objects,
+    const map<string, Material>& materials, ID3D12Device& device,
+    ID3D12GraphicsCommandList& command_list, const string& name)
+{
+    using namespace Material_settings;
 
     auto collection = std::make_shared<Model_collection>();
-    bool more_objects = true;
-    while (more_objects)
+    collection->materials = materials;
+
+    // Models exported from modeling tools often have a lot of small objects. Merging the ones
+    // that have the same material gives far fewer buffers and draw calls. The materials are
+    // kept in the order that they first occur in.
+    vector<string> material_order;
+    map<string, vector<const Obj_object*>> objects_per_material;
+    for (auto& object : objects)
     {
-        Vertices vertices;
-        vector<int> indices;
-        string material;
-        more_objects = read_obj_file(file, vertices, indices, input_vertices, input_normals,
-            input_texture_coords, input_tangents, input_bitangents, input_colors, material,
-            &collection->materials, flip_v);
+        auto& material_objects = objects_per_material[object.material];
+        if (material_objects.empty())
+            material_order.push_back(object.material);
+        material_objects.push_back(&object);
+    }
 
-        constexpr int triangle_start_index = 0;
+    for (auto& material : material_order)
+    {
+        // The triangles of transparent meshes are sorted back to front every frame, to be
+        // able to render them with (most of the time) correct alpha blending. Merged
+        // transparent objects are sorted together, which is even better than one at a time.
         auto material_iter = collection->materials.find(material);
-        if (material_iter != collection->materials.end() && // We don't require the obj-file to
-            material_iter->second.settings & transparency)  // reference an mtl file.
-            // We do this to be able to sort the triangles and hence be able to render the
-            // transparent objects with (most of the time) correct alpha blending.
-            create_one_model_per_triangle(collection, device, command_list, filename,
-                vertices, indices, material);
+        const bool transparent = material_iter != collection->materials.end() && // We don't
+            material_iter->second.settings & transparency; // require an mtl file.
+
+        const auto& material_objects = objects_per_material[material];
+        if (material_objects.size() == 1)
+        {
+            const Obj_object& object = *material_objects.front();
+            collection->models.push_back({ std::make_shared<Mesh>(device, command_list,
+                object.vertices, object.indices, object.lods, name, transparent), material });
+        }
         else
-            collection->models.push_back({ std::make_shared<Mesh>(device,
-                command_list, vertices, indices, filename), material, triangle_start_index });
+        {
+            const Obj_object merged = merge_objects(material_objects);
+            collection->models.push_back({ std::make_shared<Mesh>(device, command_list,
+                merged.vertices, merged.indices, merged.lods, name, transparent), material });
+        }
     }
 
+    size_t merged_objects = 0;
+    for (auto& material_objects : objects_per_material)
+        merged_objects += material_objects.second.size();
+    if (merged_objects > material_order.size())
+        log(name + ": " + std::to_string(merged_objects) + " objects merged into " +
+            std::to_string(material_order.size()) + " meshes, one per material");
+
     return collection;
 }
 
+size_t model_collection_size(const vector<Obj_object>& objects)
+{
+    std::unordered_set<string_view> materials;
+    for (auto& object : objects)
+        materials.insert(object.material);
+    return materials.size();
+}
+
+std::shared_ptr<Model_collection> read_obj_file(const string& filename, 
+    ID3D12Device& device, ID3D12GraphicsCommandList& command_list, Obj_flip_v flip_v)
+{
+    map<string, Material> materials;
+    auto objects = read_obj_objects(filename, materials, flip_v);
+    return create_model_collection(objects, materials, device, command_list, filename);
+}
+
 
 void read_mtl_file(const string file_name, map<string, Material>& materials)
 {
     using namespace Material_settings;
-    ifstream file(file_name);
+    auto stream = open_input_file(file_name);
+    std::istream& file = *stream;
     string input;
     string name;
     Material material {}; // There is no "end tag" for newmtl, so we have to be able to save the
                           // last material, when the whole file has been read.
     material.id = -1;
-    while (file.is_open() && !file.eof())
+    while (file && !file.eof())
     {
         file >> input;
 
@@ -369,10 +1357,10 @@ void read_mtl_file(const string file_name, map<string, Material>& materials)
             float d;
             file >> d;  // I don't actually use the d value as transparency for the object,
             if (d < 1)  // instead I use the alpha channel of the map_Kd texture.
-                material.settings |= transparency; // If this flag is set I create one
-                                                   // Graphical_object per triangle, so that
-                                                   // they can be drawn in back to front order
-                                                   // and (somewhat) correctly alpha blended.
+                material.settings |= transparency; // If this flag is set the triangles are
+                                                   // sorted every frame, so that they can be
+                                                   // drawn in back to front order and
+                                                   // (somewhat) correctly alpha blended.
         }
         else if (input == "normal_map_invert_y") // My extension
         {
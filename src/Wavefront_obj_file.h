@@ -23,7 +23,6 @@ struct Model
 {
     std::shared_ptr<Mesh> mesh;
     std::string material;
-    int triangle_start_index;
 };
 
 struct Model_collection
@@ -44,6 +43,79 @@ void read_obj_file(const std::string& filename, Vertices& vertices, std::vector<
 std::shared_ptr<Model_collection> read_obj_file(const std::string& filename,
     ID3D12Device& device, ID3D12GraphicsCommandList& command_list, Obj_flip_v flip_v);
 
+// Identifies the data of a face corner, by the indices of the records in the file that it
+// refers to. The color is indexed like the position. none means that there is no reference,
+// which for the tangent and bitangent also means that they are calculated per face.
+struct Obj_vertex_key
+{
+    static constexpr uint32_t none = UINT32_MAX;
+    uint32_t position;
+    uint32_t texture_coord;
+    uint32_t normal;
+    uint32_t tangent;
+    uint32_t bitangent;
+};
+
+struct Obj_object
+{
+    Vertices vertices;
+    std::vector<int> indices;
+    std::string material;
+    std::vector<Obj_vertex_key> vertex_keys; // One per face corner, until welded.
+    std::vector<Mesh_lod> lods;
+};
+
+// Welds the face corners that have the same vertex key into one vertex, and replaces the
+// indices 0..N with indices to those. Tangents and bitangents that have been calculated per
+// face are averaged over the welded corners.
+void weld_vertices(Obj_object& object);
+
+// Reads all objects of the file, using all hardware threads, welds their vertices, optimizes
+// them for rendering with optimize_mesh and generates their levels of detail, except for the
+// transparent ones.
+// The paths of the mtl files that have been read are added to material_files, if given.
+// Compressed files (.gz) are decompressed while they are parsed, see Compressed_file.h.
+std::vector<Obj_object> read_obj_objects(const std::string& filename,
+    std::map<std::string, Material>& materials, Obj_flip_v flip_v,
+    std::vector<std::string>* material_files = nullptr);
+
+// Optimizes welded objects for rendering with optimize_mesh and generates their levels of
+// detail, except for the transparent ones. This is the part of read_obj_objects above that is
+// not specific to Obj files, so that other model formats can share it.
+void prepare_objects_for_rendering(std::vector<Obj_object>& objects,
+    const std::map<std::string, Material>& materials, int thread_count,
+    const std::string& name);
+
+// Creates the meshes of the objects, and the models that refer to them. The objects that have
+// the same material are merged into one mesh, see merge_objects.
+std::shared_ptr<Model_collection> create_model_collection(
+    const std::vector<Obj_object>& objects, const std::map<std::string, Material>& materials,
+    ID3D12Device& device, ID3D12GraphicsCommandList& command_list, const std::string& name);
+
+// The number of meshes that create_model_collection creates for the objects, i.e. of their
+// different materials, without creating them.
+size_t model_collection_size(const std::vector<Obj_object>& objects);
+
+// Concatenates the vertices, indices and levels of detail of the objects into one object,
+// with the material of the first. Level n of the result has level n of every object, or the
+// coarsest it has, and the biggest error of those. The objects have to be welded.
+Obj_object merge_objects(const std::vector<const Obj_object*>& objects);
+
+// Reads all objects in the memory range [begin, end), using thread_count threads.
+// The result is the same as for the serial read_obj_file below, called until there are
+// no more objects. The vertices are not welded.
+std::vector<Obj_object> read_obj_objects(const char* begin, const char* end,
+    std::map<std::string, Material>& materials, Obj_flip_v flip_v, int thread_count,
+    std::vector<std::string>* material_files = nullptr);
+
+// Reads all objects of the stream in line aligned blocks of about block_size bytes, each of
+// which is parsed like the memory range above, using thread_count threads. This is used for
+// compressed files, so that the text never has to be in memory as a whole, only the vertex
+// data. The result is the same as for the memory range.
+std::vector<Obj_object> read_obj_objects(std::istream& file,
+    std::map<std::string, Material>& materials, Obj_flip_v flip_v, int thread_count,
+    std::vector<std::string>* material_files = nullptr, size_t block_size = 8 * 1024 * 1024);
+
 
 // Exposed for unit tests
 bool read_obj_file(std::istream& file, Vertices& vertices, std::vector<int>& indices,
@@ -55,3 +127,13 @@ bool read_obj_file(std::istream& file, Vertices& vertices, std::vector<int>& ind
     std::vector<DirectX::PackedVector::XMHALF4>& input_colors, std::string& material,
     std::map<std::string, Material>* materials, Obj_flip_v flip_v);
 
+// Parses the memory range [position, end) in place. This is what the file based functions
+// above use, via a memory mapped file. position is advanced to where the next object starts.
+bool read_obj_file(const char*& position, const char* end, Vertices& vertices,
+    std::vector<int>& indices, std::vector<DirectX::XMFLOAT4>& input_vertices,
+    std::vector<DirectX::PackedVector::XMHALF4>& input_normals,
+    std::vector<DirectX::PackedVector::XMHALF2>& input_texture_coords,
+    std::vector<DirectX::PackedVector::XMHALF4>& input_tangents,
+    std::vector<DirectX::PackedVector::XMHALF4>& input_bitangents,
+    std::vector<DirectX::PackedVector::XMHALF4>& input_colors, std::string& material,
+    std::map<std::string, Material>* materials, Obj_flip_v flip_v);
@@ -8,6 +8,11 @@
 #include "pch.h"
 #include "Engine.h"
 #include "util.h"
+#ifndef NO_SCENE_FILE
+#include "Scatter.h"
+#endif
+
+#include <string_view>
 
 
 LRESULT CALLBACK window_procedure(HWND hwnd, UINT message, WPARAM w_param, LPARAM l_param);
@@ -66,6 +71,14 @@ Config read_config(const std::string& config_file)
             file >> config.scene_file;
 #else
             file >> input;
+#endif
+        }
+        else if (input == "cook_scene")
+        {
+#ifndef NO_SCENE_FILE
+            file >> config.cook_scene;
+#else
+            file >> input;
 #endif
         }
         else if (input == "edit_mode")
@@ -100,6 +113,10 @@ Config read_config(const std::string& config_file)
         {
             file >> config.use_vertex_colors;
         }
+        else if (input == "compact_vertex_format")
+        {
+            file >> config.compact_vertex_format;
+        }
         else if (input == "backface_culling")
         {
             file >> config.backface_culling;
@@ -136,6 +153,45 @@ Config read_config(const std::string& config_file)
     return config;
 }
 
+#ifndef NO_SCENE_FILE
+// Writes a scene file with scattered objects, see Scatter.h, from the arguments
+// <scene file> <model file>|cube|plane <texture file>|none|procedural <count>
+// <min x> <min y> <min z> <max x> <max y> <max z> <min scale> <max scale> <random rotation>
+// <dynamic fraction> <rotating fraction> <flying fraction> jittered_grid|poisson_disk <seed>
+// where the files are relative to the data directory. Returns the exit code.
+int generate_scene(const std::string& arguments)
+{
+    std::istringstream input(arguments);
+    std::string scene_file, model_file, texture_file, sampling;
+    Scatter_settings s;
+    input >> scene_file >> model_file >> texture_file >> s.count
+        >> s.region_min.x >> s.region_min.y >> s.region_min.z
+        >> s.region_max.x >> s.region_max.y >> s.region_max.z
+        >> s.min_scale >> s.max_scale >> s.random_rotation
+        >> s.dynamic_fraction >> s.rotating_fraction >> s.flying_fraction >> sampling >> s.seed;
+    if (!input || (sampling != "jittered_grid" && sampling != "poisson_disk"))
+    {
+        print("Usage: generate_scene <scene file> <model file>|cube|plane "
+            "<texture file>|none|procedural <count> <min x> <min y> <min z> <max x> <max y> "
+            "<max z> <min scale> <max scale> <random rotation> <dynamic fraction> "
+            "<rotating fraction> <flying fraction> jittered_grid|poisson_disk <seed>", "Error");
+        return 1;
+    }
+    s.sampling = sampling == "poisson_disk" ? Scatter_sampling::poisson_disk :
+        Scatter_sampling::jittered_grid;
+
+    const std::string scene_path = data_path + scene_file;
+    std::ofstream scene(scene_path);
+    if (!scene)
+    {
+        print("Could not open file: " + scene_path, "Error");
+        return 1;
+    }
+    write_scatter_scene(scene, model_file, texture_file, s);
+    return 0;
+}
+#endif
+
 struct Monitor
 {
     HMONITOR monitor;
@@ -152,8 +208,15 @@ BOOL CALLBACK monitor_enum_proc(HMONITOR h_monitor, HDC, LPRECT monitor_rect, LP
 
 constexpr DWORD windowed_window_style = WS_OVERLAPPED | WS_CAPTION | WS_SYSMENU | WS_MINIMIZEBOX;
 
-int WINAPI WinMain(HINSTANCE instance, HINSTANCE, LPSTR, int cmd_show)
+int WINAPI WinMain(HINSTANCE instance, HINSTANCE, LPSTR command_line, int cmd_show)
 {
+#ifndef NO_SCENE_FILE
+    constexpr std::string_view generate_scene_command = "generate_scene ";
+    if (std::string_view(command_line).substr(0, generate_scene_command.size()) ==
+        generate_scene_command)
+        return generate_scene(command_line + generate_scene_command.size());
+#endif
+
     SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2);
          
 #ifndef NO_CFG_FILE
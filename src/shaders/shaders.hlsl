@@ -11,6 +11,8 @@ struct values_struct
     int dynamic_transform_ref;
     uint material_id;
     uint render_settings;
+    float4 position_offset; // Only used by the compact vertex format,
+    float4 position_scale;  // see Position_dequantization.
 };
 ConstantBuffer<values_struct> values : register(b0);
 
@@ -288,6 +290,57 @@ pixel_shader_vertex_color_input vertex_shader_srv_instance_data_vertex_colors(
 }
 
 
+// The compact vertex format has 16 bit snorm positions relative to the bounding box of the mesh,
+// and the tangent space basis as a quaternion, where the sign of w tells if the bitangent is
+// mirrored. See Vertex_compression.h.
+
+float4 dequantize_position(float4 position)
+{
+    return float4(values.position_offset.xyz + position.xyz * values.position_scale.xyz, 1);
+}
+
+void decode_qtangent(float4 qtangent, out float3 normal, out float4 tangent,
+    out float4 bitangent)
+{
+    float4 q = normalize(qtangent);
+    tangent = float4(1 - 2 * (q.y * q.y + q.z * q.z), 2 * (q.x * q.y + q.w * q.z),
+        2 * (q.x * q.z - q.w * q.y), 0);
+    bitangent = float4(2 * (q.x * q.y - q.w * q.z), 1 - 2 * (q.x * q.x + q.z * q.z),
+        2 * (q.y * q.z + q.w * q.x), 0);
+    normal = float3(2 * (q.x * q.z + q.w * q.y), 2 * (q.y * q.z - q.w * q.x),
+        1 - 2 * (q.x * q.x + q.y * q.y));
+    if (q.w < 0)
+        bitangent = -bitangent;
+}
+
+pixel_shader_input vertex_shader_srv_instance_data_compact(uint instance_id : SV_InstanceID,
+    float4 position : POSITION, float4 qtangent : QTANGENT, float2 texcoord : TEXCOORD)
+{
+    float3 normal;
+    float4 tangent;
+    float4 bitangent;
+    decode_qtangent(qtangent, normal, tangent, bitangent);
+    Model_matrices m = get_matrices(instance_id);
+
+    return vertex_shader_model_matrix(dequantize_position(position), normal,
+        tangent, bitangent, texcoord, m.model, m.scaled_model);
+}
+
+pixel_shader_vertex_color_input vertex_shader_srv_instance_data_vertex_colors_compact(
+    uint instance_id : SV_InstanceID, float4 position : POSITION, float4 qtangent : QTANGENT,
+    float2 texcoord : TEXCOORD, float4 color : COLOR)
+{
+    float3 normal;
+    float4 tangent;
+    float4 bitangent;
+    decode_qtangent(qtangent, normal, tangent, bitangent);
+    Model_matrices m = get_matrices(instance_id);
+
+    return vertex_shader_model_matrix_vertex_colors(dequantize_position(position), normal,
+        tangent, bitangent, texcoord, color, m.model, m.scaled_model);
+}
+
+
 float sample_shadow_map(pixel_shader_input input, int light_index,
     float4 position_in_shadow_map_space, float2 offset, int shadow_map_size)
 {
@@ -555,6 +608,17 @@ depths_alpha_cut_out_vertex_shader_output depths_alpha_cut_out_vertex_shader_srv
 }
 
 
+depths_alpha_cut_out_vertex_shader_output
+    depths_alpha_cut_out_vertex_shader_srv_instance_data_compact(
+        uint instance_id : SV_InstanceID, float4 position : POSITION, float2 texcoord : TEXCOORD)
+{
+    Trans_rot trans_rot = get_trans_rot(instance_id);
+
+    return depths_alpha_cut_out_vertex_shader_model_trans_rot(dequantize_position(position),
+        texcoord, trans_rot.translation, trans_rot.rotation);
+}
+
+
 struct depths_vertex_shader_output
 {
     float4 sv_position : SV_POSITION;
@@ -578,6 +642,14 @@ depths_vertex_shader_output depths_vertex_shader_srv_instance_data(uint instance
         trans_rot.translation, trans_rot.rotation);
 }
 
+depths_vertex_shader_output depths_vertex_shader_srv_instance_data_compact(
+    uint instance_id : SV_InstanceID, float4 position : POSITION)
+{
+    Trans_rot trans_rot = get_trans_rot(instance_id);
+    return depths_vertex_shader_model_trans_rot(dequantize_position(position),
+        trans_rot.translation, trans_rot.rotation);
+}
+
 
 struct object_ids_vertex_shader_output
 {
@@ -628,6 +700,16 @@ object_ids_vertex_shader_output object_ids_vertex_shader_srv_instance_data(
 }
 
 
+object_ids_vertex_shader_output object_ids_vertex_shader_srv_instance_data_compact(
+    uint instance_id : SV_InstanceID, float4 position : POSITION)
+{
+    Trans_rot trans_rot = get_trans_rot(instance_id);
+    const int index = get_index(instance_id);
+    return object_ids_vertex_shader_model_trans_rot(dequantize_position(position),
+        trans_rot.translation, trans_rot.rotation, index);
+}
+
+
 struct object_ids_alpha_cut_out_vertex_shader_output
 {
     float4 sv_position : SV_POSITION;
@@ -676,3 +758,14 @@ object_ids_alpha_cut_out_vertex_shader_output
     return object_ids_alpha_cut_out_vertex_shader_model_trans_rot(float4(position.xyz, 1),
         texcoord, trans_rot.translation, trans_rot.rotation, index);
 }
+
+
+object_ids_alpha_cut_out_vertex_shader_output
+    object_ids_alpha_cut_out_vertex_shader_srv_instance_data_compact(
+        uint instance_id : SV_InstanceID, float4 position : POSITION, float2 texcoord : TEXCOORD)
+{
+    Trans_rot trans_rot = get_trans_rot(instance_id);
+    const int index = get_index(instance_id);
+    return object_ids_alpha_cut_out_vertex_shader_model_trans_rot(dequantize_position(position),
+        texcoord, trans_rot.translation, trans_rot.rotation, index);
+}
@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Bvh.h"
+#include "../Frustum.h"
+#include "../util.h"
+
+#include <cfloat>
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    // Small boxes spread in a cube with the side 2 * half_side, around the origin, with ids that
+    // are not their indices.
+    void create_boxes(int count, float half_side, vector<Aabb>& boxes, vector<int>& ids)
+    {
+        mt19937 generator(1);
+        uniform_real_distribution<float> position(-half_side, half_side);
+        uniform_real_distribution<float> size(0.1f, 2.0f);
+        for (int i = 0; i < count; ++i)
+        {
+            const XMFLOAT3 p = { position(generator), position(generator), position(generator) };
+            boxes.push_back({ p, { p.x + size(generator), p.y + size(generator),
+                p.z + size(generator) } });
+            ids.push_back(i * 3 + 7);
+        }
+    }
+
+    Frustum view_frustum(FXMVECTOR eye, FXMVECTOR focus_point)
+    {
+        return Frustum(XMMatrixLookAtLH(eye, focus_point, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+            XMMatrixPerspectiveFovLH(XMConvertToRadians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f));
+    }
+
+    // The rays in the tests are along the z axis.
+    float ray_distance_along_z(const XMFLOAT3& origin, const Aabb& box)
+    {
+        if (origin.x < box.min_corner.x || origin.x > box.max_corner.x ||
+            origin.y < box.min_corner.y || origin.y > box.max_corner.y ||
+            origin.z > box.max_corner.z)
+            return FLT_MAX;
+        return max(0.0f, box.min_corner.z - origin.z);
+    }
+
+    vector<int> sorted(vector<int> ids)
+    {
+        sort(ids.begin(), ids.end());
+        return ids;
+    }
+}
+
+
+SCENARIO("Frustum culling of boxes")
+{
+    GIVEN("Random boxes around a frustum, a count of them that is not a multiple of four")
+    {
+        vector<Aabb> boxes;
+        vector<int> ids;
+        create_boxes(1003, 30.0f, boxes, ids);
+        const Frustum frustum = view_frustum(XMVectorSet(0.0f, 0.0f, -10.0f, 1.0f),
+            XMVectorSet(1.0f, 2.0f, 3.0f, 1.0f));
+
+        THEN("culling them four at a time gives the same result as testing them one by one")
+        {
+            vector<uint8_t> visible(boxes.size());
+            frustum.cull_boxes(boxes.data(), boxes.size(), visible.data());
+            for (size_t i = 0; i < boxes.size(); ++i)
+                REQUIRE(static_cast<bool>(visible[i]) == frustum.intersects_box(boxes[i]));
+        }
+
+        THEN("culling them through indices does as well")
+        {
+            vector<int> indices;
+            for (int i = static_cast<int>(boxes.size()) - 1; i >= 0; i -= 3)
+                indices.push_back(i);
+            vector<uint8_t> visible(indices.size());
+            frustum.cull_boxes(boxes.data(), indices.data(), indices.size(), visible.data());
+            for (size_t i = 0; i < indices.size(); ++i)
+                REQUIRE(static_cast<bool>(visible[i]) ==
+                    frustum.intersects_box(boxes[indices[i]]));
+        }
+    }
+}
+
+SCENARIO("A bounding volume hierarchy")
+{
+    GIVEN("Many boxes, so that the tree is built in parallel")
+    {
+        vector<Aabb> boxes;
+        vector<int> ids;
+        create_boxes(50000, 50.0f, boxes, ids);
+        Bvh bvh;
+        bvh.build(boxes, ids);
+
+        THEN("it has all of them, with fewer leaves than boxes")
+        {
+            REQUIRE(bvh.size() == boxes.size());
+            REQUIRE(bvh.nodes_count() < 2 * boxes.size() - 1);
+        }
+
+        THEN("it finds the same boxes in a frustum as testing each of them")
+        {
+            for (auto eye : { XMVectorSet(0.0f, 0.0f, -60.0f, 1.0f),
+                XMVectorSet(10.0f, 20.0f, 5.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f) })
+            {
+                const Frustum frustum = view_frustum(eye, XMVectorSet(1.0f, 2.0f, 3.0f, 1.0f));
+                vector<int> expected;
+                for (size_t i = 0; i < boxes.size(); ++i)
+                    if (frustum.intersects_box(boxes[i]))
+                        expected.push_back(ids[i]);
+                vector<int> found;
+                bvh.query(frustum, found);
+                REQUIRE(!expected.empty());
+                REQUIRE(sorted(found) == sorted(expected));
+            }
+        }
+
+        THEN("it finds the same boxes in a sphere as testing each of them")
+        {
+            const XMVECTOR center = XMVectorSet(5.0f, -3.0f, 8.0f, 1.0f);
+            constexpr float radius = 12.0f;
+            vector<int> expected;
+            for (size_t i = 0; i < boxes.size(); ++i)
+                if (intersects_sphere(boxes[i], center, radius))
+                    expected.push_back(ids[i]);
+            vector<int> found;
+            bvh.query(center, radius, found);
+            REQUIRE(!expected.empty());
+            REQUIRE(sorted(found) == sorted(expected));
+        }
+
+        THEN("a ray hits the nearest of the boxes that it goes through")
+        {
+            mt19937 generator(2);
+            uniform_real_distribution<float> position(-50.0f, 50.0f);
+            for (int r = 0; r < 100; ++r)
+            {
+                const XMFLOAT3 origin = { position(generator), position(generator), -60.0f };
+                float expected_distance = FLT_MAX;
+                for (auto& box : boxes)
+                    expected_distance = min(expected_distance,
+                        ray_distance_along_z(origin, box));
+                float distance;
+                const int hit = bvh.first_hit(XMLoadFloat3(&origin),
+                    XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), distance);
+                if (expected_distance == FLT_MAX)
+                    REQUIRE(hit == -1);
+                else
+                {
+                    REQUIRE(hit >= 0);
+                    REQUIRE(distance == Approx(expected_distance));
+                }
+            }
+        }
+    }
+
+    GIVEN("Boxes that are all the same")
+    {
+        vector<Aabb> boxes(100, { { 1.0f, 1.0f, 1.0f }, { 2.0f, 2.0f, 2.0f } });
+        vector<int> ids(boxes.size());
+        for (size_t i = 0; i < ids.size(); ++i)
+            ids[i] = static_cast<int>(i);
+        Bvh bvh;
+        bvh.build(boxes, ids);
+
+        THEN("they are split anyway, and all of them are found")
+        {
+            vector<int> found;
+            bvh.query(XMVectorSet(1.5f, 1.5f, 1.5f, 1.0f), 0.1f, found);
+            REQUIRE(sorted(found) == ids);
+        }
+    }
+
+    GIVEN("No boxes")
+    {
+        Bvh bvh;
+        bvh.build(vector<Aabb>(), vector<int>());
+
+        THEN("nothing is found")
+        {
+            vector<int> found;
+            bvh.query(view_frustum(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f)), found);
+            float distance;
+            REQUIRE(found.empty());
+            REQUIRE(bvh.first_hit(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f),
+                distance) == -1);
+        }
+    }
+}
+
+TEST_CASE("Bounding volume hierarchy build and queries", "[.benchmark]")
+{
+    // The boxes are as dense whatever the count, like in bigger scenes, so the view, which
+    // reaches 100 units, sees more of them only until the scene is bigger than that.
+    constexpr int frustum_queries = 100;
+    constexpr int rays = 100000;
+    for (int count : { 10000, 100000, 1000000 })
+    {
+        vector<Aabb> boxes;
+        vector<int> ids;
+        const float half_side = 50.0f * pow(count / 10000.0f, 1.0f / 3.0f);
+        create_boxes(count, half_side, boxes, ids);
+        const Frustum frustum = view_frustum(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+            XMVectorSet(1.0f, 0.0f, 1.0f, 1.0f));
+
+        Time time;
+        time.seconds_since_last_call();
+        Bvh bvh;
+        bvh.build(boxes, ids);
+        const double build_seconds = time.seconds_since_last_call();
+
+        vector<int> found;
+        for (int i = 0; i < frustum_queries; ++i)
+        {
+            found.clear();
+            bvh.query(frustum, found);
+        }
+        const double query_seconds = time.seconds_since_last_call() / frustum_queries;
+
+        size_t linear_found = 0;
+        for (int i = 0; i < frustum_queries; ++i)
+            for (auto& box : boxes)
+                linear_found += frustum.intersects_box(box);
+        const double linear_seconds = time.seconds_since_last_call() / frustum_queries;
+        REQUIRE(linear_found / frustum_queries == found.size());
+
+        vector<uint8_t> visible(boxes.size());
+        size_t batched_found = 0;
+        for (int i = 0; i < frustum_queries; ++i)
+        {
+            frustum.cull_boxes(boxes.data(), boxes.size(), visible.data());
+            batched_found += count_if(visible.begin(), visible.end(),
+                [](uint8_t v) { return v != 0; });
+        }
+        const double batched_seconds = time.seconds_since_last_call() / frustum_queries;
+        REQUIRE(batched_found == linear_found);
+
+        mt19937 generator(2);
+        uniform_real_distribution<float> position(-half_side, half_side);
+        vector<XMFLOAT3> origins;
+        for (int i = 0; i < rays; ++i)
+            origins.push_back({ position(generator), position(generator), -2.0f * half_side });
+        time.seconds_since_last_call();
+        int hits = 0;
+        for (auto& origin : origins)
+        {
+            float distance;
+            hits += bvh.first_hit(XMLoadFloat3(&origin), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f),
+                distance) >= 0;
+        }
+        const double ray_seconds = time.seconds_since_last_call();
+
+        cout << count << " boxes, " << bvh.nodes_count() << " nodes\n"
+            << "  Build: " << build_seconds * 1000.0 << " ms\n"
+            << "  Frustum query, " << found.size() << " boxes: " << query_seconds * 1000.0
+            << " ms, testing every box: " << linear_seconds * 1000.0
+            << " ms, four at a time: " << batched_seconds * 1000.0 << " ms\n"
+            << "  Rays: " << rays / ray_seconds / 1e6 << " million per second, "
+            << hits << " of " << rays << " hit\n";
+    }
+}
@@ -0,0 +1,441 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Compressed_file.h"
+#include "../Memory_mapped_file.h"
+#include "../Wavefront_obj_file.h"
+#include "../util.h"
+#include "Generated_obj_data.h"
+
+#include <iostream>
+#include <iterator>
+
+
+using namespace std;
+
+
+namespace
+{
+    // "Hello, Jadette! Hello, Jadette!\n", compressed with the fixed Huffman codes.
+    const unsigned char fixed_huffman_gzip[] = {
+        0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0xf3, 0x48, 0xcd, 0xc9,
+        0xc9, 0xd7, 0x51, 0xf0, 0x4a, 0x4c, 0x49, 0x2d, 0x29, 0x49, 0x55, 0x54, 0xf0, 0x40,
+        0xe5, 0x73, 0x01, 0x00, 0x45, 0x89, 0x23, 0x06, 0x20, 0x00, 0x00, 0x00 };
+
+    // "stored", in a stored block.
+    const unsigned char stored_gzip[] = {
+        0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x03, 0x01, 0x06, 0x00, 0xf9,
+        0xff, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x64, 0x0b, 0xf9, 0x43, 0x56, 0x06, 0x00, 0x00,
+        0x00 };
+
+    // The vertices of vertex_lines(30), compressed with dynamic Huffman codes, with the file
+    // name vertices.obj in the header.
+    const unsigned char dynamic_huffman_gzip[] = {
+        0x1f, 0x8b, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x02, 0xff, 0x76, 0x65, 0x72, 0x74,
+        0x69, 0x63, 0x65, 0x73, 0x2e, 0x6f, 0x62, 0x6a, 0x00, 0x1d, 0x8f, 0xc9, 0x11, 0x03,
+        0x31, 0x0c, 0xc3, 0xfe, 0xa9, 0x02, 0x25, 0xac, 0x4e, 0x7b, 0x1b, 0x4b, 0xfd, 0x21,
+        0x33, 0x7e, 0x88, 0x63, 0x5b, 0x80, 0xf4, 0xe5, 0xf1, 0xf9, 0x7c, 0x09, 0x92, 0x52,
+        0x4d, 0x9a, 0x55, 0x2d, 0x96, 0x57, 0xb5, 0xb9, 0x44, 0x2a, 0x0c, 0xf1, 0x10, 0xa3,
+        0xb4, 0xba, 0x20, 0xae, 0xd2, 0x21, 0x9a, 0x0c, 0x25, 0x7d, 0x5a, 0xb2, 0x95, 0x5e,
+        0x3d, 0x91, 0xc7, 0xc8, 0x87, 0x7c, 0xa8, 0x3f, 0x5d, 0x78, 0xf1, 0x2d, 0x50, 0x6f,
+        0x36, 0x65, 0x47, 0x14, 0xb9, 0x94, 0x35, 0xe6, 0x5c, 0xda, 0xa2, 0x18, 0xf5, 0xd0,
+        0x36, 0x89, 0x59, 0x1a, 0xc8, 0xaa, 0x38, 0x54, 0x33, 0x76, 0x89, 0x5f, 0xcb, 0x58,
+        0x16, 0x2f, 0x75, 0x19, 0xdb, 0xa4, 0xea, 0x87, 0xb5, 0x2d, 0x43, 0x24, 0xf6, 0xbf,
+        0x8e, 0xda, 0xb5, 0x90, 0x6d, 0x59, 0xf4, 0xb2, 0xb6, 0x69, 0x80, 0xbe, 0x1c, 0xdb,
+        0x72, 0x98, 0x87, 0x63, 0x9b, 0x66, 0x99, 0xe4, 0xd8, 0x96, 0x47, 0x7c, 0xae, 0x6d,
+        0x1a, 0x6b, 0x96, 0x6b, 0x5b, 0xbe, 0xcc, 0xe5, 0x9e, 0xcf, 0x0f, 0xae, 0xfa, 0x49,
+        0x65, 0x37, 0x01, 0x00, 0x00 };
+
+    string vertex_lines(int count)
+    {
+        string lines;
+        for (int i = 0; i < count; ++i)
+            lines += "v " + to_string(i) + " " + to_string(i * 2) + " " + to_string(i * 3) +
+                "\n";
+        return lines;
+    }
+
+    template<size_t size>
+    string bytes(const unsigned char (&data)[size])
+    {
+        return string(reinterpret_cast<const char*>(data), size);
+    }
+
+    unique_ptr<istream> gzip_stream(const string& compressed)
+    {
+        return open_gzip_stream(make_unique<istringstream>(compressed), "test data");
+    }
+
+    string read_all(istream& stream)
+    {
+        return string(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+    }
+
+    string decompress(const string& compressed)
+    {
+        return read_all(*gzip_stream(compressed));
+    }
+
+    uint32_t crc32(const string& data)
+    {
+        uint32_t crc = 0xffffffff;
+        for (char c : data)
+        {
+            crc ^= static_cast<uint8_t>(c);
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+        }
+        return ~crc;
+    }
+
+    class Bit_writer
+    {
+    public:
+        void put(uint32_t value, int count)
+        {
+            m_bits |= static_cast<uint64_t>(value) << m_count;
+            m_count += count;
+            while (m_count >= 8)
+            {
+                m_data.push_back(static_cast<char>(m_bits & 0xff));
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        // Huffman codes are packed starting with the most significant bit.
+        void put_code(uint32_t code, int length)
+        {
+            uint32_t reversed = 0;
+            for (int bit = 0; bit < length; ++bit)
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            put(reversed, length);
+        }
+
+        string finish()
+        {
+            if (m_count > 0)
+                put(0, 8 - m_count);
+            return m_data;
+        }
+    private:
+        string m_data;
+        uint64_t m_bits = 0;
+        int m_count = 0;
+    };
+
+    void put_fixed_code(Bit_writer& out, int symbol)
+    {
+        if (symbol < 144)
+            out.put_code(0x30 + symbol, 8);
+        else if (symbol < 256)
+            out.put_code(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            out.put_code(symbol - 256, 7);
+        else
+            out.put_code(0xc0 + symbol - 280, 8);
+    }
+
+    // Compresses the data into a gzip file with one block, using the fixed Huffman codes and
+    // the latest earlier position with the same hash as the only match candidate. This
+    // compresses less than gzip, but it gives all kinds of matches, which is what the tests
+    // need, including overlapping ones, and it makes it possible to compress big generated
+    // data without any dependencies.
+    string gzip_compress(const string& data)
+    {
+        const uint16_t length_base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+            31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        const int length_extra_bits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3,
+            3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        const uint16_t distance_base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97,
+            129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+            16385, 24577 };
+        const int distance_extra_bits[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7,
+            7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        constexpr size_t max_length = 258;
+        constexpr size_t max_distance = 32768;
+        constexpr size_t min_length = 3;
+        constexpr int hash_bits = 16;
+
+        Bit_writer out;
+        const char header[] = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff' };
+        for (char c : header)
+            out.put(static_cast<uint8_t>(c), 8);
+        out.put(1, 1); // The last block.
+        out.put(1, 2); // Fixed Huffman codes.
+
+        auto hash = [&](size_t i) {
+            const uint32_t v = static_cast<uint8_t>(data[i]) |
+                static_cast<uint8_t>(data[i + 1]) << 8 | static_cast<uint8_t>(data[i + 2]) << 16;
+            return (v * 2654435761u) >> (32 - hash_bits);
+        };
+        vector<size_t> latest(1 << hash_bits, SIZE_MAX);
+        size_t i = 0;
+        while (i < data.size())
+        {
+            size_t length = 0;
+            size_t distance = 0;
+            if (i + min_length <= data.size())
+            {
+                const uint32_t h = hash(i);
+                const size_t candidate = latest[h];
+                latest[h] = i;
+                if (candidate != SIZE_MAX && i - candidate <= max_distance)
+                {
+                    while (length < max_length && i + length < data.size() &&
+                        data[candidate + length] == data[i + length])
+                        ++length;
+                    distance = i - candidate;
+                }
+            }
+            if (length < min_length)
+            {
+                put_fixed_code(out, static_cast<uint8_t>(data[i]));
+                ++i;
+                continue;
+            }
+
+            int code = 28;
+            while (length_base[code] > length)
+                --code;
+            put_fixed_code(out, 257 + code);
+            out.put(static_cast<uint32_t>(length - length_base[code]), length_extra_bits[code]);
+            code = 29;
+            while (distance_base[code] > distance)
+                --code;
+            out.put_code(code, 5);
+            out.put(static_cast<uint32_t>(distance - distance_base[code]),
+                distance_extra_bits[code]);
+
+            for (size_t j = i + 1; j < i + length && j + min_length <= data.size(); ++j)
+                latest[hash(j)] = j;
+            i += length;
+        }
+        put_fixed_code(out, 256); // End of block.
+
+        string gzip = out.finish();
+        const uint32_t trailer[] = { crc32(data), static_cast<uint32_t>(data.size()) };
+        for (uint32_t value : trailer)
+            for (int b = 0; b < 4; ++b)
+                gzip.push_back(static_cast<char>(value >> (b * 8)));
+        return gzip;
+    }
+}
+
+
+SCENARIO("Gzip decompression")
+{
+    GIVEN("Data compressed with the fixed Huffman codes")
+    {
+        REQUIRE(decompress(bytes(fixed_huffman_gzip)) == "Hello, Jadette! Hello, Jadette!\n");
+    }
+
+    GIVEN("Data compressed with dynamic Huffman codes and a file name in the header")
+    {
+        REQUIRE(decompress(bytes(dynamic_huffman_gzip)) == vertex_lines(30));
+    }
+
+    GIVEN("Data in a stored block")
+    {
+        REQUIRE(decompress(bytes(stored_gzip)) == "stored");
+    }
+
+    GIVEN("A file with several gzip members")
+    {
+        THEN("they are decompressed after each other")
+        {
+            REQUIRE(decompress(bytes(stored_gzip) + bytes(fixed_huffman_gzip)) ==
+                "storedHello, Jadette! Hello, Jadette!\n");
+        }
+    }
+
+    GIVEN("Data that is much bigger than the blocks that are handed over to the reader")
+    {
+        string data = generate_grid_obj(150);
+        for (int i = 0; i < 20000; ++i)
+            data += string(i % 300, static_cast<char>('a' + i % 7)) + to_string(i * i);
+        const string compressed = gzip_compress(data);
+        REQUIRE(compressed.size() < data.size() / 2);
+
+        THEN("it is decompressed in full")
+        {
+            REQUIRE(decompress(compressed) == data);
+        }
+
+        THEN("the stream can be destroyed before all of it has been read")
+        {
+            auto stream = gzip_stream(compressed);
+            string first_line;
+            getline(*stream, first_line);
+            REQUIRE(first_line == data.substr(0, data.find('\n')));
+        }
+    }
+
+    GIVEN("No data")
+    {
+        REQUIRE(decompress(gzip_compress("")).empty());
+    }
+
+    GIVEN("Corrupt data")
+    {
+        string wrong_crc = bytes(fixed_huffman_gzip);
+        wrong_crc[wrong_crc.size() - 6] ^= 1;
+        const string truncated = bytes(dynamic_huffman_gzip).substr(0, 100);
+        string wrong_method = bytes(stored_gzip);
+        wrong_method[2] = 7;
+
+        THEN("the reads throw")
+        {
+            REQUIRE_THROWS_AS(decompress(wrong_crc), Decompression_error);
+            REQUIRE_THROWS_AS(decompress(truncated), Decompression_error);
+            REQUIRE_THROWS_AS(decompress(wrong_method), Decompression_error);
+            REQUIRE_THROWS_AS(decompress("v 1 2 3\n"), Decompression_error);
+            REQUIRE_THROWS_AS(decompress(bytes(stored_gzip) + "garbage"), Decompression_error);
+        }
+
+        THEN("the parser does not take the error for the end of the file")
+        {
+            auto stream = gzip_stream(truncated);
+            string token;
+            REQUIRE_THROWS_AS([&] { while (*stream >> token); }(), Decompression_error);
+        }
+    }
+}
+
+
+SCENARIO("Compressed input files")
+{
+    GIVEN("File names")
+    {
+        REQUIRE(is_compressed_file("model.obj.gz"));
+        REQUIRE(is_compressed_file("scene.TXT.GZ"));
+        REQUIRE(is_compressed_file("model.obj.zst"));
+        REQUIRE(!is_compressed_file("model.obj"));
+        REQUIRE(!is_compressed_file("gz"));
+        REQUIRE(uncompressed_file_name("models/model.glb.gz") == "models/model.glb");
+        REQUIRE(uncompressed_file_name("model.obj") == "model.obj");
+    }
+
+    GIVEN("A compressed and an uncompressed file")
+    {
+        const string data = vertex_lines(1000);
+        write_file("compressed_test.txt.gz", gzip_compress(data));
+        write_file("compressed_test.txt", data);
+
+        THEN("both read the same")
+        {
+            REQUIRE(read_all(*open_input_file("compressed_test.txt.gz")) == data);
+            REQUIRE(read_all(*open_input_file("compressed_test.txt")) == data);
+        }
+
+        remove("compressed_test.txt.gz");
+        remove("compressed_test.txt");
+    }
+
+    GIVEN("A file that does not exist")
+    {
+        THEN("the stream has failed, just as an ifstream")
+        {
+            REQUIRE(!*open_input_file("does_not_exist.obj.gz"));
+            REQUIRE(!*open_input_file("does_not_exist.obj"));
+        }
+    }
+
+    GIVEN("A Zstandard file")
+    {
+        REQUIRE_THROWS_AS(open_input_file("model.obj.zst"), Decompression_error);
+    }
+
+    GIVEN("Compressed Obj data")
+    {
+        const string obj_data = "o first\n" + generate_grid_obj(100) + "o second\n" +
+            generate_grid_obj(50, true, true);
+        const string compressed = gzip_compress(obj_data);
+        map<string, Material> materials;
+
+        THEN("the objects are the same as for the uncompressed data")
+        {
+            const auto expected = read_obj_objects(obj_data.data(),
+                obj_data.data() + obj_data.size(), materials, Obj_flip_v::yes, 2);
+            auto stream = gzip_stream(compressed);
+            const auto objects = read_obj_objects(*stream, materials, Obj_flip_v::yes, 2,
+                nullptr, 64 * 1024);
+            REQUIRE(objects.size() == expected.size());
+            for (size_t i = 0; i < objects.size(); ++i)
+            {
+                REQUIRE(objects[i].indices == expected[i].indices);
+                REQUIRE(objects[i].vertices.positions.size() ==
+                    expected[i].vertices.positions.size());
+                REQUIRE(memcmp(objects[i].vertices.positions.data(),
+                    expected[i].vertices.positions.data(),
+                    objects[i].vertices.positions.size() * sizeof(DirectX::XMFLOAT4)) == 0);
+                REQUIRE(objects[i].vertices.colors.size() ==
+                    expected[i].vertices.colors.size());
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Reading compressed Obj files", "[.benchmark]")
+{
+    constexpr int quads_per_side = 1000; // Two million triangles.
+    const string obj_data = generate_grid_obj(quads_per_side);
+    const string file_name = "benchmark_grid.obj";
+    write_file(file_name, obj_data);
+    write_file(file_name + ".gz", gzip_compress(obj_data));
+    const double megabytes = obj_data.size() / (1024.0 * 1024.0);
+    const double compressed_megabytes = ifstream(file_name + ".gz",
+        ios::binary | ios::ate).tellg() / (1024.0 * 1024.0);
+
+    const int thread_count = max(1, static_cast<int>(thread::hardware_concurrency()));
+    map<string, Material> materials;
+    Time time;
+    time.seconds_since_last_call();
+
+    size_t raw_corners = 0;
+    {
+        Memory_mapped_file file(file_name);
+        auto objects = read_obj_objects(file.begin(), file.end(), materials, Obj_flip_v::yes,
+            thread_count);
+        raw_corners = objects[0].indices.size();
+    }
+    const double raw_seconds = time.seconds_since_last_call();
+
+    size_t decompressed_size = 0;
+    {
+        auto file = open_input_file(file_name + ".gz");
+        vector<char> buffer(1024 * 1024);
+        while (file->read(buffer.data(), buffer.size()) || file->gcount() > 0)
+            decompressed_size += file->gcount();
+    }
+    const double decompression_seconds = time.seconds_since_last_call();
+
+    size_t compressed_corners = 0;
+    {
+        auto file = open_input_file(file_name + ".gz");
+        auto objects = read_obj_objects(*file, materials, Obj_flip_v::yes, thread_count);
+        compressed_corners = objects[0].indices.size();
+    }
+    const double compressed_seconds = time.seconds_since_last_call();
+
+    remove(file_name.c_str());
+    remove((file_name + ".gz").c_str());
+
+    cout << "Obj file of " << megabytes << " MB, " << compressed_megabytes
+        << " MB compressed, " << raw_corners / 3 << " triangles, " << thread_count
+        << " threads\n"
+        << "  Memory mapped:             " << raw_seconds * 1000.0 << " ms\n"
+        << "  Only decompression:        " << decompression_seconds * 1000.0 << " ms, "
+        << megabytes / decompression_seconds << " MB/s\n"
+        << "  Streamed and decompressed: " << compressed_seconds * 1000.0 << " ms\n";
+
+    REQUIRE(decompressed_size == obj_data.size());
+    REQUIRE(compressed_corners == raw_corners);
+}
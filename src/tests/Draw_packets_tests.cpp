@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Draw_packets.h"
+#include "../Render_queue.h"
+#include "../Job_system.h"
+#include "../util.h"
+
+#include <climits>
+#include <iostream>
+
+
+using namespace std;
+
+
+namespace
+{
+    // A queue of plain objects, without meshes or a device. The objects use the meshes in
+    // runs, as the scene sorts them, and each mesh has an index buffer and one index range of
+    // its own. Objects 10 to 13 are an array, and every fourth of the others, from object 1,
+    // is dynamic.
+    struct Test_queue
+    {
+        Test_queue(int object_count, int mesh_count);
+
+        vector<D3D12_INDEX_BUFFER_VIEW> index_buffers;
+        vector<Index_range> ranges;
+        Render_queue queue;
+    };
+
+    Test_queue::Test_queue(int object_count, int mesh_count) :
+        index_buffers(mesh_count, D3D12_INDEX_BUFFER_VIEW()), ranges(mesh_count)
+    {
+        for (int i = 0; i < mesh_count; ++i)
+            ranges[i] = { 0, static_cast<UINT>(36 + 3 * i), 0 };
+        vector<Queued_object> objects;
+        for (int i = 0; i < object_count; i += objects.back().instances)
+        {
+            const bool in_array = i >= 10 && i < 14;
+            const UINT mesh = static_cast<UINT>(static_cast<size_t>(i) * mesh_count /
+                object_count);
+            const Draw_ranges r = { &index_buffers[mesh], &ranges[mesh], 1 };
+            objects.push_back({ i, !in_array && i % 4 == 1 ? i / 4 : -1, i % 7, mesh,
+                in_array ? 14 - i : 1, r, r });
+        }
+        queue.build(objects);
+    }
+
+    struct Packet_recorder
+    {
+        void record(const Draw_packet& packet) { packets.push_back(packet); }
+        vector<Draw_packet> packets;
+    };
+}
+
+
+SCENARIO("The draw packet stream")
+{
+    // More draws than a part of the stream has, so that it is built in several parts.
+    Test_queue t(1200, 2);
+    Draw_packet_stream stream;
+
+    GIVEN("A stream built from all the draws of a queue of objects with one index range each")
+    {
+        stream.build(t.queue, Frustum_culling::disabled, Meshlet_culling::disabled);
+        Packet_recorder recorder;
+        stream.replay(recorder);
+        auto& packets = recorder.packets;
+        auto& draws = t.queue.draws(Frustum_culling::disabled);
+
+        THEN("it has a packet per draw, in order, with the values of the draw")
+        {
+            REQUIRE(draws.size() == 1200 - 3);
+            REQUIRE(stream.size() == draws.size());
+            REQUIRE(packets.size() == draws.size());
+            for (size_t i = 0; i < packets.size(); ++i)
+            {
+                const UINT object = draws[i].object;
+                auto& p = packets[i];
+                REQUIRE(p.object == object);
+                REQUIRE(p.object_id == t.queue.object_ids()[object]);
+                REQUIRE(p.dynamic_transform_ref == t.queue.dynamic_transform_refs()[object]);
+                REQUIRE(p.material_id == t.queue.material_ids()[object]);
+                REQUIRE(p.instances == t.queue.instances()[object]);
+                REQUIRE(p.index_count ==
+                    t.ranges[t.queue.mesh_ids()[object]].index_count);
+            }
+        }
+
+        THEN("only the packets where the mesh changes have it changed, across the parts too")
+        {
+            auto& mesh_ids = t.queue.mesh_ids();
+            for (size_t i = 0; i < packets.size(); ++i)
+            {
+                const bool changed = i == 0 ||
+                    mesh_ids[packets[i].object] != mesh_ids[packets[i - 1].object];
+                const UINT changes = changed ? Draw_packet::object_changed |
+                    Draw_packet::mesh_changed | Draw_packet::index_buffer_changed :
+                    Draw_packet::object_changed;
+                REQUIRE(packets[i].changes == changes);
+            }
+        }
+
+        THEN("a null recorder counts what would be recorded")
+        {
+            Null_draw_recorder null_recorder;
+            stream.replay(null_recorder);
+            REQUIRE(null_recorder.draw_calls == draws.size());
+            REQUIRE(null_recorder.instances == 1200);
+            REQUIRE(null_recorder.indices == 600 * t.ranges[0].index_count +
+                600 * t.ranges[1].index_count);
+            REQUIRE(null_recorder.object_changes == draws.size());
+            REQUIRE(null_recorder.mesh_changes == 2);
+            REQUIRE(null_recorder.index_buffer_changes == 2);
+        }
+    }
+
+    GIVEN("A stream built from the visible draws of the queue, with some instances of the "
+        "array, some static objects and a dynamic object visible")
+    {
+        vector<uint8_t> static_visible(1200, 0);
+        for (int id : { 0, 11, 12, 900 })
+            static_visible[id] = 1;
+        vector<uint8_t> dynamic_visible(300, 0);
+        dynamic_visible[250] = 1; // Object 1001.
+        t.queue.cull(static_visible, dynamic_visible);
+        stream.build(t.queue, Frustum_culling::enabled, Meshlet_culling::disabled);
+        Packet_recorder recorder;
+        stream.replay(recorder);
+        auto& packets = recorder.packets;
+
+        THEN("the packets have the ids of the first instances that they draw")
+        {
+            REQUIRE(packets.size() == 4);
+            const vector<int> object_ids = { 0, 11, 900, 1001 };
+            const vector<int> dynamic_transform_refs = { -1, -1, -1, 250 };
+            const vector<int> instances = { 1, 2, 1, 1 };
+            for (size_t i = 0; i < packets.size(); ++i)
+            {
+                REQUIRE(packets[i].object_id == object_ids[i]);
+                REQUIRE(packets[i].dynamic_transform_ref == dynamic_transform_refs[i]);
+                REQUIRE(packets[i].instances == instances[i]);
+            }
+            REQUIRE(packets[0].changes & Draw_packet::mesh_changed);
+            REQUIRE(!(packets[1].changes & Draw_packet::mesh_changed));
+            REQUIRE(packets[2].changes & Draw_packet::mesh_changed);
+            REQUIRE(!(packets[3].changes & Draw_packet::mesh_changed));
+        }
+
+        WHEN("nothing is visible")
+        {
+            std::fill(static_visible.begin(), static_visible.end(), uint8_t(0));
+            dynamic_visible[250] = 0;
+            t.queue.cull(static_visible, dynamic_visible);
+            stream.build(t.queue, Frustum_culling::enabled, Meshlet_culling::disabled);
+
+            THEN("the stream is empty")
+            {
+                Null_draw_recorder null_recorder;
+                stream.replay(null_recorder);
+                REQUIRE(stream.size() == 0);
+                REQUIRE(null_recorder.draw_calls == 0);
+            }
+        }
+    }
+
+    GIVEN("A stream that is updated from the queue")
+    {
+        stream.update(t.queue, Frustum_culling::enabled, Meshlet_culling::disabled);
+        const size_t all_draws = t.queue.draws(Frustum_culling::disabled).size();
+        REQUIRE(stream.size() == all_draws);
+
+        WHEN("the queue is culled")
+        {
+            vector<uint8_t> static_visible(1200, 0);
+            static_visible[0] = 1;
+            static_visible[900] = 1;
+            t.queue.cull(static_visible, vector<uint8_t>(300, 0));
+            stream.update(t.queue, Frustum_culling::enabled, Meshlet_culling::disabled);
+
+            THEN("it is built again from the visible draws")
+            {
+                REQUIRE(stream.size() == 2);
+            }
+
+            THEN("it is built again when the culling changes, but not otherwise")
+            {
+                stream.update(t.queue, Frustum_culling::disabled, Meshlet_culling::disabled);
+                REQUIRE(stream.size() == all_draws);
+                stream.update(t.queue, Frustum_culling::disabled, Meshlet_culling::disabled);
+                REQUIRE(stream.size() == all_draws);
+                stream.update(t.queue, Frustum_culling::enabled, Meshlet_culling::disabled);
+                REQUIRE(stream.size() == 2);
+            }
+        }
+    }
+}
+
+TEST_CASE("Draw packet stream generation", "[.benchmark]")
+{
+    // The draws of a queue as the scene recorded them before it had draw packets, serially in
+    // each pass, compared to building a stream of packets once per cull, with 1 to N workers,
+    // and replaying it in each pass, both without a graphics API. A null recorder costs next
+    // to nothing, unlike recording into a command list, so the serial walk is what a pass
+    // costs beyond its API calls. Building the packets does that walk and also stores them,
+    // so on one worker it has to be slower than one walk. It is only made up for by the build
+    // being split over the workers, and by the passes after the first replaying the packets.
+    constexpr int object_count = 100000;
+    constexpr int frames = 10;
+    constexpr int passes = 2; // E.g. the early z pass and the main pass.
+    Test_queue t(object_count, 16);
+    auto& ranges = t.queue.ranges(Meshlet_culling::disabled);
+    auto& mesh_ids = t.queue.mesh_ids();
+
+    Time time;
+    time.seconds_since_last_call();
+    Null_draw_recorder serial;
+    for (int n = 0; n < frames * passes; ++n)
+    {
+        UINT current_mesh = UINT_MAX;
+        for (auto& draw : t.queue.draws(Frustum_culling::disabled))
+        {
+            const UINT i = draw.object;
+            Draw_packet packet = { i, 0, 0, 0, t.queue.object_ids()[i] + draw.first_instance,
+                t.queue.dynamic_transform_refs()[i] < 0 ? -1 :
+                t.queue.dynamic_transform_refs()[i] + draw.first_instance,
+                t.queue.material_ids()[i],
+                draw.instances, Draw_packet::object_changed };
+            if (mesh_ids[i] != current_mesh)
+                packet.changes |= Draw_packet::mesh_changed | Draw_packet::index_buffer_changed;
+            current_mesh = mesh_ids[i];
+            for (UINT j = 0; j < ranges[i].range_count; ++j)
+            {
+                packet.start_index = ranges[i].ranges[j].start_index;
+                packet.index_count = ranges[i].ranges[j].index_count;
+                packet.base_vertex = ranges[i].ranges[j].base_vertex;
+                serial.record(packet);
+                packet.changes = 0;
+            }
+        }
+    }
+    const double serial_seconds = time.seconds_since_last_call() / frames;
+    cout << "Recording " << object_count << " draws in " << passes << " passes per frame\n"
+        << "  Serially from the queue in each pass: " << serial_seconds * 1000.0 << " ms\n";
+
+    const int max_worker_count = Job_system::default_worker_count();
+    for (int worker_count = 1; worker_count <= max_worker_count; worker_count *= 2)
+    {
+        Job_system jobs(worker_count);
+        Draw_packet_stream stream;
+        Null_draw_recorder replayed;
+        double build_seconds = 0.0;
+        double replay_seconds = 0.0;
+        time.seconds_since_last_call();
+        for (int n = 0; n < frames; ++n)
+        {
+            stream.build(t.queue, Frustum_culling::disabled, Meshlet_culling::disabled, jobs);
+            build_seconds += time.seconds_since_last_call();
+            for (int pass = 0; pass < passes; ++pass)
+                stream.replay(replayed);
+            replay_seconds += time.seconds_since_last_call();
+        }
+
+        REQUIRE(replayed.draw_calls == serial.draw_calls);
+        REQUIRE(replayed.mesh_changes == serial.mesh_changes);
+        cout << "  Built as packets once, " << worker_count << " workers: "
+            << build_seconds / frames * 1000.0 << " ms, replayed in each pass: "
+            << replay_seconds / frames * 1000.0 << " ms\n";
+    }
+}
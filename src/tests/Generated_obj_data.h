@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#pragma once
+
+
+// Generates Wavefront Obj data for a flat grid of quads_per_side * quads_per_side quads,
+// i.e. two triangles per quad, with positions, texture coordinates and normals.
+// Used for the benchmarks, where we want big files without having to ship them.
+// The faces only refer to the vertex data of the grid itself when relative_indices is true,
+// otherwise they refer to the first vertices in the file.
+inline std::string generate_grid_obj(int quads_per_side, bool vertex_colors = false,
+    bool relative_indices = false)
+{
+    std::ostringstream obj;
+    obj.setf(std::ios::fixed);
+    obj.precision(6);
+
+    const int vertices_per_side = quads_per_side + 1;
+    const int vertex_count = vertices_per_side * vertices_per_side;
+    const float scale = 1.0f / quads_per_side;
+    for (int y = 0; y < vertices_per_side; ++y)
+        for (int x = 0; x < vertices_per_side; ++x)
+        {
+            obj << "v " << x * scale << " " << 0.1f * ((x + y) % 7) << " " << y * scale;
+            if (vertex_colors)
+                obj << " " << x * scale << " " << y * scale << " 0.5";
+            obj << "\n";
+        }
+    for (int y = 0; y < vertices_per_side; ++y)
+        for (int x = 0; x < vertices_per_side; ++x)
+            obj << "vt " << x * scale << " " << y * scale << "\n";
+    obj << "vn 0.0 1.0 0.0\n";
+
+    // Obj indices start at 1, or -1 for the last one read.
+    const int first = relative_indices ? -vertex_count : 1;
+    const int normal = relative_indices ? -1 : 1;
+    auto corner = [&](int i) {
+        obj << " " << i << "/" << i << "/" << normal;
+    };
+    for (int y = 0; y < quads_per_side; ++y)
+        for (int x = 0; x < quads_per_side; ++x)
+        {
+            const int i0 = y * vertices_per_side + x + first;
+            const int i1 = i0 + 1;
+            const int i2 = i0 + vertices_per_side;
+            const int i3 = i2 + 1;
+            obj << "f";
+            corner(i0);
+            corner(i2);
+            corner(i1);
+            obj << "\nf";
+            corner(i1);
+            corner(i2);
+            corner(i3);
+            obj << "\n";
+        }
+
+    return obj.str();
+}
+
+inline void write_file(const std::string& file_name, const std::string& content)
+{
+    std::ofstream file(file_name, std::ios::binary);
+    file << content;
+}
@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Gltf_file.h"
+#include "../util.h"
+
+#include <cstring>
+#include <iostream>
+
+
+using namespace std;
+using namespace DirectX;
+using DirectX::PackedVector::XMConvertHalfToFloat;
+
+
+namespace
+{
+    // Builds glb files in memory, with the binary chunk from the added arrays.
+    class Glb_builder
+    {
+    public:
+        // Returns the byte offset of the data in the binary chunk.
+        template <typename T>
+        size_t add(const vector<T>& data)
+        {
+            const size_t offset = m_binary.size();
+            const char* bytes = reinterpret_cast<const char*>(data.data());
+            m_binary.insert(m_binary.end(), bytes, bytes + data.size() * sizeof(T));
+            while (m_binary.size() % 4 != 0)
+                m_binary.push_back(0);
+            return offset;
+        }
+
+        size_t binary_size() const { return m_binary.size(); }
+
+        string build(string json) const
+        {
+            while (json.size() % 4 != 0)
+                json += ' ';
+            string glb;
+            auto add_uint32 = [&](uint32_t value)
+            {
+                glb.append(reinterpret_cast<const char*>(&value), sizeof(value));
+            };
+            constexpr uint32_t header_size = 12;
+            constexpr uint32_t chunk_header_size = 8;
+            add_uint32(0x46546C67);
+            add_uint32(2);
+            add_uint32(static_cast<uint32_t>(header_size + 2 * chunk_header_size +
+                json.size() + m_binary.size()));
+            add_uint32(static_cast<uint32_t>(json.size()));
+            add_uint32(0x4E4F534A);
+            glb += json;
+            add_uint32(static_cast<uint32_t>(m_binary.size()));
+            add_uint32(0x004E4942);
+            glb.append(m_binary.data(), m_binary.size());
+            return glb;
+        }
+    private:
+        vector<char> m_binary;
+    };
+
+    string view_json(size_t offset, size_t length, size_t stride = 0)
+    {
+        return "{ \"buffer\": 0, \"byteOffset\": " + to_string(offset) + ", \"byteLength\": " +
+            to_string(length) + (stride ? ", \"byteStride\": " + to_string(stride) : "") +
+            " }";
+    }
+
+    string accessor_json(int view, size_t count, int component_type, const string& type,
+        size_t offset = 0)
+    {
+        return "{ \"bufferView\": " + to_string(view) + ", \"byteOffset\": " +
+            to_string(offset) + ", \"count\": " + to_string(count) +
+            ", \"componentType\": " + to_string(component_type) + ", \"type\": \"" + type +
+            "\" }";
+    }
+
+    vector<Obj_object> read(const string& glb, map<string, Material>& materials,
+        const string& texture_directory = "")
+    {
+        return read_glb_objects(glb.data(), glb.data() + glb.size(), texture_directory,
+            materials);
+    }
+
+    vector<Obj_object> read(const string& glb)
+    {
+        map<string, Material> materials;
+        return read(glb, materials);
+    }
+
+    XMVECTOR position(const Vertices& v, int i)
+    {
+        return XMVectorSetW(XMLoadFloat4(&v.positions[i]), 0.0f);
+    }
+
+    XMVECTOR vector3(const DirectX::PackedVector::XMHALF4& h)
+    {
+        return XMVectorSetW(convert_half4_to_vector(h), 0.0f);
+    }
+
+    bool near(FXMVECTOR a, FXMVECTOR b, float epsilon = 1e-3f)
+    {
+        return XMVectorGetX(XMVector3Length(a - b)) <= epsilon;
+    }
+
+    constexpr int float_type = 5126;
+    constexpr int unsigned_short_type = 5123;
+    constexpr int unsigned_byte_type = 5121;
+
+    // A unit quad facing +z, with u along x and v down along -y, as textures in glTF.
+    struct Quad
+    {
+        vector<XMFLOAT3> positions = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } };
+        vector<XMFLOAT3> normals = { { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 } };
+        vector<XMFLOAT2> texture_coords = { { 0, 1 }, { 1, 1 }, { 1, 0 }, { 0, 0 } };
+        vector<uint16_t> indices = { 0, 1, 2, 0, 2, 3 };
+    };
+
+    // The quad in separate buffer views, placed by a node with the given properties.
+    string quad_glb(const string& node, const string& material = "",
+        const string& extra = "", const string& more_nodes = "")
+    {
+        Quad quad;
+        Glb_builder b;
+        const size_t p = b.add(quad.positions);
+        const size_t n = b.add(quad.normals);
+        const size_t t = b.add(quad.texture_coords);
+        const size_t i = b.add(quad.indices);
+        return b.build("{ \"asset\": { \"version\": \"2.0\" }, \"scene\": 0, "
+            "\"scenes\": [ { \"nodes\": [ 0 ] } ], "
+            "\"nodes\": [ { " + node + (node.empty() ? "" : ", ") + "\"mesh\": 0 }" +
+            more_nodes + " ], "
+            "\"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, "
+            "\"NORMAL\": 1, \"TEXCOORD_0\": 2 }, \"indices\": 3" +
+            (material.empty() ? "" : ", \"material\": 0") + " } ] } ], "
+            "\"bufferViews\": [ " + view_json(p, n - p) + ", " + view_json(n, t - n) + ", " +
+            view_json(t, i - t) + ", " + view_json(i, b.binary_size() - i) + " ], "
+            "\"accessors\": [ " + accessor_json(0, 4, float_type, "VEC3") + ", " +
+            accessor_json(1, 4, float_type, "VEC3") + ", " +
+            accessor_json(2, 4, float_type, "VEC2") + ", " +
+            accessor_json(3, 6, unsigned_short_type, "SCALAR") + " ]" +
+            (material.empty() ? "" : ", \"materials\": [ " + material + " ]") + extra +
+            ", \"buffers\": [ { \"byteLength\": " + to_string(b.binary_size()) + " } ] }");
+    }
+}
+
+
+SCENARIO("Reading glb files")
+{
+    GIVEN("A quad that is placed by a node with a translation")
+    {
+        const string glb = quad_glb("\"translation\": [ 1, 2, 3 ]");
+
+        WHEN("it is read")
+        {
+            auto objects = read(glb);
+
+            THEN("it has the vertices and indices of the file, transformed by the node")
+            {
+                REQUIRE(objects.size() == 1);
+                const Vertices& v = objects[0].vertices;
+                REQUIRE(v.positions.size() == 4);
+                REQUIRE(objects[0].indices == vector<int>({ 0, 1, 2, 0, 2, 3 }));
+                REQUIRE(near(position(v, 2), XMVectorSet(2, 3, 3, 0)));
+                REQUIRE(near(vector3(v.normals[2]), XMVectorSet(0, 0, 1, 0)));
+                REQUIRE(v.positions[1].w == 1.0f); // u
+                REQUIRE(XMConvertHalfToFloat(v.normals[1].w) == 1.0f); // v
+                REQUIRE(XMConvertHalfToFloat(v.normals[2].w) == 0.0f);
+                REQUIRE(v.colors.empty());
+                REQUIRE(objects[0].material.empty());
+            }
+
+            THEN("the calculated bitangents point up in the texture, like for glTF tangents")
+            {
+                const Vertices& v = objects[0].vertices;
+                REQUIRE(v.tangents.size() == 4);
+                REQUIRE(v.bitangents.size() == 4);
+                for (int i = 0; i < 4; ++i)
+                {
+                    REQUIRE(near(vector3(v.tangents[i]), XMVectorSet(1, 0, 0, 0)));
+                    REQUIRE(near(vector3(v.bitangents[i]), XMVectorSet(0, 1, 0, 0)));
+                }
+            }
+        }
+    }
+
+    GIVEN("A quad in a node that mirrors it")
+    {
+        auto objects = read(quad_glb("\"scale\": [ -1, 1, 1 ]"));
+
+        THEN("the winding is flipped, so that it is still front facing")
+        {
+            REQUIRE(objects[0].indices == vector<int>({ 0, 2, 1, 0, 3, 2 }));
+            REQUIRE(near(position(objects[0].vertices, 1), XMVectorSet(-1, 0, 0, 0)));
+        }
+    }
+
+    GIVEN("A quad in a child node")
+    {
+        // The mesh of the parent is used by the child too.
+        const string glb = quad_glb("\"matrix\": [ 2, 0, 0, 0,  0, 2, 0, 0,  0, 0, 2, 0,  "
+            "5, 0, 0, 1 ], \"children\": [ 1 ]", "", "",
+            ", { \"translation\": [ 0, 0, 1 ], \"mesh\": 0 }");
+
+        THEN("its transform is relative to the parent")
+        {
+            auto objects = read(glb);
+            REQUIRE(objects.size() == 2);
+            REQUIRE(near(position(objects[0].vertices, 2), XMVectorSet(7, 2, 0, 0)));
+            REQUIRE(near(position(objects[1].vertices, 2), XMVectorSet(7, 2, 2, 0)));
+        }
+    }
+
+    GIVEN("A material with textures")
+    {
+        const string material = "{ \"name\": \"glass\", \"alphaMode\": \"BLEND\", "
+            "\"doubleSided\": true, \"pbrMetallicRoughness\": { "
+            "\"baseColorTexture\": { \"index\": 0 }, "
+            "\"metallicRoughnessTexture\": { \"index\": 1 } }, "
+            "\"normalTexture\": { \"index\": 2 }, \"occlusionTexture\": { \"index\": 1 } }";
+        const string textures = ", \"textures\": [ { \"source\": 0 }, { \"source\": 1 }, "
+            "{ \"source\": 2 } ], \"images\": [ { \"uri\": \"base%20color.png\" }, "
+            "{ \"uri\": \"orm.png\" }, { \"uri\": \"normal.png\" } ]";
+        map<string, Material> materials;
+        auto objects = read(quad_glb("", material, textures), materials, "models/");
+
+        THEN("it is mapped to the material settings, with the textures relative to the file")
+        {
+            using namespace Material_settings;
+            REQUIRE(objects[0].material == "glass");
+            REQUIRE(materials.size() == 1);
+            const Material& m = materials["glass"];
+            REQUIRE(m.diffuse_map == "models/base color.png");
+            REQUIRE(m.normal_map == "models/normal.png");
+            REQUIRE(m.ao_roughness_metalness_map == "models/orm.png");
+            REQUIRE(m.id == -1);
+            REQUIRE(m.settings == (diffuse_map_exists | normal_map_exists | aorm_map_exists |
+                use_ao_in_aorm_map | transparency | two_sided));
+        }
+    }
+
+    GIVEN("Interleaved vertices with tangents, colors and 8 bit indices")
+    {
+        struct Vertex
+        {
+            XMFLOAT3 position;
+            XMFLOAT3 normal;
+            XMFLOAT4 tangent;
+            uint8_t color[4];
+        };
+        const vector<Vertex> vertices = {
+            { { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0, -1 }, { 255, 0, 0, 255 } },
+            { { 1, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0, -1 }, { 0, 255, 0, 255 } },
+            { { 0, 1, 0 }, { 0, 0, 1 }, { 1, 0, 0, -1 }, { 0, 0, 255, 0 } } };
+        const vector<uint8_t> indices = { 0, 1, 2 };
+        Glb_builder b;
+        const size_t v = b.add(vertices);
+        const size_t i = b.add(indices);
+        const string json = "{ \"asset\": { \"version\": \"2.0\" }, "
+            "\"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, "
+            "\"NORMAL\": 1, \"TANGENT\": 2, \"COLOR_0\": 3 }, \"indices\": 4 }, "
+            "{ \"attributes\": { \"POSITION\": 0 }, \"mode\": 1 } ] } ], "
+            "\"bufferViews\": [ " + view_json(v, i - v, sizeof(Vertex)) + ", " +
+            view_json(i, 3) + " ], \"accessors\": [ " +
+            accessor_json(0, 3, float_type, "VEC3", offsetof(Vertex, position)) + ", " +
+            accessor_json(0, 3, float_type, "VEC3", offsetof(Vertex, normal)) + ", " +
+            accessor_json(0, 3, float_type, "VEC4", offsetof(Vertex, tangent)) + ", " +
+            "{ \"bufferView\": 0, \"byteOffset\": " + to_string(offsetof(Vertex, color)) +
+            ", \"count\": 3, \"componentType\": 5121, \"normalized\": true, "
+            "\"type\": \"VEC4\" }, " + accessor_json(1, 3, unsigned_byte_type, "SCALAR") +
+            " ] }";
+
+        auto objects = read(b.build(json));
+
+        THEN("they are read through the strides, and the lines are skipped")
+        {
+            REQUIRE(objects.size() == 1);
+            const Vertices& out = objects[0].vertices;
+            REQUIRE(objects[0].indices == vector<int>({ 0, 1, 2 }));
+            REQUIRE(near(position(out, 1), XMVectorSet(1, 0, 0, 0)));
+            REQUIRE(near(position(out, 2), XMVectorSet(0, 1, 0, 0)));
+            REQUIRE(near(vector3(out.tangents[0]), XMVectorSet(1, 0, 0, 0)));
+            // The handedness in w flips the bitangent.
+            REQUIRE(near(vector3(out.bitangents[0]), XMVectorSet(0, -1, 0, 0)));
+            REQUIRE(out.colors.size() == 3);
+            REQUIRE(near(convert_half4_to_vector(out.colors[1]), XMVectorSet(0, 1, 0, 1)));
+            REQUIRE(XMConvertHalfToFloat(out.colors[2].w) == 0.0f);
+        }
+    }
+
+    GIVEN("Invalid files")
+    {
+        THEN("they are reported with Gltf_read_error")
+        {
+            REQUIRE_THROWS_AS(read("not a glb file at all"), Gltf_read_error);
+
+            string glb = quad_glb("");
+            string wrong_count = glb;
+            const string count = "\"count\": 6";
+            wrong_count.replace(wrong_count.find(count), count.size(), "\"count\": 9");
+            REQUIRE_THROWS_AS(read(wrong_count), Gltf_read_error); // Outside of its view.
+
+            string bad_json = glb;
+            bad_json[bad_json.find("\"scenes\"")] = '?';
+            REQUIRE_THROWS_AS(read(bad_json), Gltf_read_error);
+
+            REQUIRE_THROWS_AS(read(glb.substr(0, glb.size() - 8)), Gltf_read_error);
+        }
+    }
+
+    THEN("glb files are recognized by their extension")
+    {
+        REQUIRE(is_glb_file("models/ship.glb"));
+        REQUIRE(is_glb_file("SHIP.GLB"));
+        REQUIRE_FALSE(is_glb_file("ship.obj"));
+        REQUIRE_FALSE(is_glb_file("glb"));
+    }
+}
+
+
+TEST_CASE("Reading glb compared to Obj", "[.benchmark]")
+{
+    // The same grid, with positions, normals and texture coordinates, in both formats.
+    constexpr int quads_per_side = 700;
+    constexpr int vertices_per_side = quads_per_side + 1;
+    vector<XMFLOAT3> positions;
+    vector<XMFLOAT3> normals;
+    vector<XMFLOAT2> texture_coords;
+    vector<uint32_t> indices;
+    string obj;
+    for (int y = 0; y < vertices_per_side; ++y)
+        for (int x = 0; x < vertices_per_side; ++x)
+        {
+            const float u = x / float(quads_per_side);
+            const float v = y / float(quads_per_side);
+            const float height = 0.1f * std::sin(x * 0.1f) * std::cos(y * 0.1f);
+            positions.push_back({ float(x), height, float(y) });
+            normals.push_back({ 0, 1, 0 });
+            texture_coords.push_back({ u, v });
+            obj += "v " + to_string(x) + " " + to_string(height) + " " + to_string(y) +
+                "\nvt " + to_string(u) + " " + to_string(1.0f - v) + "\nvn 0 1 0\n";
+        }
+    for (int y = 0; y < quads_per_side; ++y)
+        for (int x = 0; x < quads_per_side; ++x)
+        {
+            const uint32_t i0 = y * vertices_per_side + x;
+            const uint32_t i1 = i0 + 1;
+            const uint32_t i2 = i0 + vertices_per_side;
+            const uint32_t i3 = i2 + 1;
+            indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+            for (size_t c = indices.size() - 6; c < indices.size(); c += 3)
+            {
+                obj += "f";
+                for (int k = 0; k < 3; ++k)
+                {
+                    const string i = to_string(indices[c + k] + 1);
+                    obj += " " + i + "/" + i + "/" + i;
+                }
+                obj += "\n";
+            }
+        }
+
+    Glb_builder b;
+    const size_t p = b.add(positions);
+    const size_t n = b.add(normals);
+    const size_t t = b.add(texture_coords);
+    const size_t i = b.add(indices);
+    const size_t vertex_count = positions.size();
+    const string glb = b.build("{ \"asset\": { \"version\": \"2.0\" }, "
+        "\"meshes\": [ { \"primitives\": [ { \"attributes\": { \"POSITION\": 0, "
+        "\"NORMAL\": 1, \"TEXCOORD_0\": 2 }, \"indices\": 3 } ] } ], "
+        "\"bufferViews\": [ " + view_json(p, n - p) + ", " + view_json(n, t - n) + ", " +
+        view_json(t, i - t) + ", " + view_json(i, b.binary_size() - i) + " ], "
+        "\"accessors\": [ " + accessor_json(0, vertex_count, float_type, "VEC3") + ", " +
+        accessor_json(1, vertex_count, float_type, "VEC3") + ", " +
+        accessor_json(2, vertex_count, float_type, "VEC2") + ", " +
+        accessor_json(3, indices.size(), 5125, "SCALAR") + " ] }");
+
+    const int thread_count = max(1, static_cast<int>(thread::hardware_concurrency()));
+    map<string, Material> materials;
+    Time time;
+    time.seconds_since_last_call();
+    auto obj_objects = read_obj_objects(obj.data(), obj.data() + obj.size(), materials,
+        Obj_flip_v::yes, thread_count);
+    for (auto& o : obj_objects)
+        weld_vertices(o);
+    const double obj_seconds = time.seconds_since_last_call();
+
+    auto glb_objects = read(glb);
+    const double glb_seconds = time.seconds_since_last_call();
+
+    REQUIRE(obj_objects.size() == 1);
+    REQUIRE(glb_objects.size() == 1);
+    REQUIRE(obj_objects[0].vertices.positions.size() == glb_objects[0].vertices.positions.size());
+
+    cout << indices.size() / 3 << " triangles, " << vertex_count << " vertices, read with "
+        "tangents calculated:\n"
+        << "  Obj, " << obj.size() / 1000000.0 << " MB, with " << thread_count
+        << " threads and welding: " << obj_seconds * 1000.0 << " ms\n"
+        << "  glb, " << glb.size() / 1000000.0 << " MB: " << glb_seconds * 1000.0 << " ms\n";
+}
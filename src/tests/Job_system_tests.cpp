@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Job_system.h"
+#include "../util.h"
+
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+
+
+using namespace std;
+
+
+namespace
+{
+    // Whether function(begin, end) was called for every index of [0, count) once.
+    bool covers_each_index_once(Job_system& jobs, size_t count, size_t grain_size)
+    {
+        vector<atomic<int>> calls(count);
+        atomic<bool> too_big = false;
+        jobs.parallel_for(count, grain_size, [&](size_t begin, size_t end) {
+            if (end - begin > grain_size)
+                too_big = true;
+            for (size_t i = begin; i < end; ++i)
+                ++calls[i];
+        });
+        for (auto& c : calls)
+            if (c != 1)
+                return false;
+        return !too_big;
+    }
+}
+
+SCENARIO("Job system")
+{
+    GIVEN("A job system with three workers")
+    {
+        Job_system jobs(3);
+
+        THEN("parallel_for calls the function once for each index, in ranges of at most the "
+            "grain size")
+        {
+            REQUIRE(covers_each_index_once(jobs, 0, 1));
+            REQUIRE(covers_each_index_once(jobs, 1, 1));
+            REQUIRE(covers_each_index_once(jobs, 1000, 1));
+            REQUIRE(covers_each_index_once(jobs, 1000, 7));
+            REQUIRE(covers_each_index_once(jobs, 1000, 5000));
+            REQUIRE(covers_each_index_once(jobs, 123457, 256));
+        }
+
+        THEN("a parallel_for can be run from within the jobs of another")
+        {
+            atomic<int> sum = 0;
+            jobs.parallel_for(16, 1, [&](size_t, size_t) {
+                jobs.parallel_for(100, 3, [&](size_t begin, size_t end) {
+                    sum += static_cast<int>(end - begin);
+                });
+            });
+            REQUIRE(sum == 1600);
+        }
+
+        WHEN("jobs are added to a counter")
+        {
+            Job_system::Job_counter counter;
+            atomic<int> runs = 0;
+            for (int i = 0; i < 100; ++i)
+                jobs.run(counter, [&] { ++runs; });
+
+            THEN("waiting for it waits for all of them")
+            {
+                jobs.wait(counter);
+                REQUIRE(counter.done());
+                REQUIRE(runs == 100);
+            }
+        }
+
+        WHEN("jobs depend on other jobs")
+        {
+            // Each stage adds one to all the values, after the previous stage has finished.
+            constexpr int stage_count = 5;
+            constexpr int count = 64;
+            vector<int> values(count, 0);
+            vector<int> values_seen_by_last_stage(count, -1);
+            Job_system::Job_counter stages[stage_count];
+            for (int stage = 0; stage < stage_count; ++stage)
+                for (int i = 0; i < count; ++i)
+                {
+                    auto job = [&, stage, i] {
+                        ++values[i];
+                        if (stage == stage_count - 1)
+                            values_seen_by_last_stage[i] = values[(i + 1) % count];
+                    };
+                    if (stage == 0)
+                        jobs.run(stages[stage], job);
+                    else
+                        jobs.run_after(stages[stage - 1], stages[stage], job);
+                }
+
+            THEN("they are started when all of those have finished")
+            {
+                jobs.wait(stages[stage_count - 1]);
+                for (int i = 0; i < count; ++i)
+                {
+                    REQUIRE(values[i] == stage_count);
+                    // The neighbour is either in the last stage or done with it.
+                    REQUIRE(values_seen_by_last_stage[i] >= stage_count - 1);
+                }
+                for (auto& stage : stages)
+                    REQUIRE(stage.done());
+            }
+        }
+
+        WHEN("a job throws")
+        {
+            THEN("the exception is rethrown by the wait, and the other jobs are still run")
+            {
+                atomic<int> sum = 0;
+                REQUIRE_THROWS_AS(jobs.parallel_for(100, 1, [&](size_t begin, size_t) {
+                    if (begin == 42)
+                        throw runtime_error("job failed");
+                    ++sum;
+                }), runtime_error);
+                REQUIRE(sum == 99);
+
+                Job_system::Job_counter counter;
+                jobs.run(counter, [] { throw runtime_error("job failed"); });
+                REQUIRE_THROWS_AS(jobs.wait(counter), runtime_error);
+                REQUIRE_NOTHROW(jobs.wait(counter));
+            }
+        }
+
+        WHEN("background jobs are submitted")
+        {
+            vector<future<int>> results;
+            for (int i = 0; i < 100; ++i)
+                results.push_back(jobs.submit([i] { return i * 2; }));
+            auto failed = jobs.submit([]() -> int { throw runtime_error("job failed"); });
+
+            THEN("their results and exceptions are given by their futures")
+            {
+                for (int i = 0; i < 100; ++i)
+                    REQUIRE(results[i].get() == i * 2);
+                REQUIRE_THROWS_AS(failed.get(), runtime_error);
+            }
+        }
+    }
+
+    GIVEN("The shared job system")
+    {
+        THEN("it has at least one worker")
+        {
+            REQUIRE(job_system().worker_count() >= 1);
+            REQUIRE(covers_each_index_once(job_system(), 10000, 100));
+        }
+    }
+}
+
+TEST_CASE("Job system fork and join", "[.benchmark]")
+{
+    // The cost of splitting work that is too small to be worth it, which is what the
+    // scheduler itself costs. The threads are what run_in_parallel used to start each time.
+    constexpr int repetitions = 1000;
+    const int thread_count = Job_system::default_worker_count() + 1;
+    Job_system jobs;
+    atomic<size_t> sum = 0;
+    auto add_range = [&](size_t begin, size_t end) { sum += end - begin; };
+
+    Time time;
+    time.seconds_since_last_call();
+    for (int r = 0; r < repetitions; ++r)
+    {
+        vector<thread> threads;
+        for (int i = 1; i < thread_count; ++i)
+            threads.emplace_back(add_range, 0, 1);
+        add_range(0, 1);
+        for (auto& t : threads)
+            t.join();
+    }
+    const double thread_seconds = time.seconds_since_last_call() / repetitions;
+
+    for (int r = 0; r < repetitions; ++r)
+        jobs.parallel_for(thread_count, 1, add_range);
+    const double job_seconds = time.seconds_since_last_call() / repetitions;
+
+    constexpr size_t many_jobs = 1024;
+    for (int r = 0; r < repetitions; ++r)
+        jobs.parallel_for(many_jobs, 1, add_range);
+    const double many_jobs_seconds = time.seconds_since_last_call() / repetitions;
+
+    for (int r = 0; r < repetitions; ++r)
+    {
+        Job_system::Job_counter counter;
+        jobs.run(counter, [] {});
+        jobs.wait(counter);
+    }
+    const double single_job_seconds = time.seconds_since_last_call() / repetitions;
+
+    REQUIRE(sum == static_cast<size_t>(repetitions) * (2 * thread_count + many_jobs));
+    cout << "Fork and join of " << thread_count << " empty parts:\n"
+        << "  One thread each: " << thread_seconds * 1e6 << " us\n"
+        << "  One job each: " << job_seconds * 1e6 << " us\n"
+        << "Fork and join of " << many_jobs << " empty jobs: "
+        << many_jobs_seconds * 1e6 << " us, "
+        << many_jobs_seconds * 1e9 / many_jobs << " ns per job\n"
+        << "Run and wait for one empty job: " << single_job_seconds * 1e6 << " us\n";
+}
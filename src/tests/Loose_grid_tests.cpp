@@ -0,0 +1,284 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Loose_grid.h"
+#include "../Bvh.h"
+#include "../Frustum.h"
+#include "../util.h"
+
+#include <cfloat>
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    Aabb random_box(mt19937& generator, float half_side)
+    {
+        uniform_real_distribution<float> position(-half_side, half_side);
+        uniform_real_distribution<float> size(0.1f, 2.0f);
+        const XMFLOAT3 p = { position(generator), position(generator), position(generator) };
+        return { p, { p.x + size(generator), p.y + size(generator), p.z + size(generator) } };
+    }
+
+    Aabb moved_box(const Aabb& box, const XMFLOAT3& offset)
+    {
+        return { { box.min_corner.x + offset.x, box.min_corner.y + offset.y,
+            box.min_corner.z + offset.z }, { box.max_corner.x + offset.x,
+            box.max_corner.y + offset.y, box.max_corner.z + offset.z } };
+    }
+
+    Frustum view_frustum(FXMVECTOR eye, FXMVECTOR focus_point)
+    {
+        return Frustum(XMMatrixLookAtLH(eye, focus_point, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+            XMMatrixPerspectiveFovLH(XMConvertToRadians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f));
+    }
+
+    vector<int> sorted(vector<int> ids)
+    {
+        sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    // The grid finds what testing each of the boxes does. Those with an empty box are not in
+    // the grid.
+    void require_same_as_testing_each_box(const Loose_grid& grid, const vector<Aabb>& boxes)
+    {
+        auto in_grid = [&](size_t i) { return boxes[i].max_corner.x >= boxes[i].min_corner.x; };
+        const Frustum frustum = view_frustum(XMVectorSet(10.0f, 20.0f, -60.0f, 1.0f),
+            XMVectorSet(1.0f, 2.0f, 3.0f, 1.0f));
+        vector<int> expected;
+        for (size_t i = 0; i < boxes.size(); ++i)
+            if (in_grid(i) && frustum.intersects_box(boxes[i]))
+                expected.push_back(static_cast<int>(i));
+        vector<int> found;
+        grid.query(frustum, found);
+        REQUIRE(!expected.empty());
+        REQUIRE(sorted(found) == expected);
+
+        const XMVECTOR center = XMVectorSet(5.0f, -3.0f, 8.0f, 1.0f);
+        constexpr float radius = 12.0f;
+        expected.clear();
+        for (size_t i = 0; i < boxes.size(); ++i)
+            if (in_grid(i) && intersects_sphere(boxes[i], center, radius))
+                expected.push_back(static_cast<int>(i));
+        found.clear();
+        grid.query(center, radius, found);
+        REQUIRE(!expected.empty());
+        REQUIRE(sorted(found) == expected);
+
+        mt19937 generator(2);
+        uniform_real_distribution<float> position(-50.0f, 50.0f);
+        const XMFLOAT3 direction = { 0.0f, 0.0f, 1.0f };
+        for (int r = 0; r < 100; ++r)
+        {
+            const XMFLOAT3 origin = { position(generator), position(generator), -60.0f };
+            float expected_distance = FLT_MAX;
+            for (size_t i = 0; i < boxes.size(); ++i)
+                if (in_grid(i))
+                    expected_distance = min(expected_distance,
+                        ray_distance(origin, direction, boxes[i]));
+            float distance;
+            const int hit = grid.first_hit(XMLoadFloat3(&origin), XMLoadFloat3(&direction),
+                distance);
+            if (expected_distance == FLT_MAX)
+                REQUIRE(hit == -1);
+            else
+            {
+                REQUIRE(hit >= 0);
+                REQUIRE(distance == Approx(expected_distance));
+            }
+        }
+    }
+}
+
+
+SCENARIO("A loose grid")
+{
+    GIVEN("Many boxes in a grid")
+    {
+        mt19937 generator(1);
+        vector<Aabb> boxes;
+        for (int i = 0; i < 20000; ++i)
+            boxes.push_back(random_box(generator, 50.0f));
+        Loose_grid grid(Loose_grid::cell_size_for(boxes));
+        for (size_t i = 0; i < boxes.size(); ++i)
+            grid.set(static_cast<int>(i), boxes[i]);
+
+        THEN("it has all of them, with fewer cells than boxes")
+        {
+            REQUIRE(grid.size() == boxes.size());
+            REQUIRE(grid.cells_count() < boxes.size() / 2);
+            require_same_as_testing_each_box(grid, boxes);
+        }
+
+        WHEN("they move, some of them far, and they grow")
+        {
+            uniform_real_distribution<float> small_move(-0.5f, 0.5f);
+            uniform_real_distribution<float> big_move(-40.0f, 40.0f);
+            for (size_t i = 0; i < boxes.size(); ++i)
+            {
+                auto& move = i % 10 == 0 ? big_move : small_move;
+                boxes[i] = moved_box(boxes[i], { move(generator), move(generator),
+                    move(generator) });
+                if (i % 7 == 0)
+                    boxes[i].max_corner.y += 5.0f;
+                grid.set(static_cast<int>(i), boxes[i]);
+            }
+
+            THEN("it finds them where they are")
+            {
+                REQUIRE(grid.size() == boxes.size());
+                require_same_as_testing_each_box(grid, boxes);
+            }
+        }
+
+        WHEN("some of them are removed")
+        {
+            for (size_t i = 0; i < boxes.size(); i += 3)
+            {
+                grid.remove(static_cast<int>(i));
+                boxes[i] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+            }
+
+            THEN("the others are still found")
+            {
+                REQUIRE(grid.size() == boxes.size() - (boxes.size() + 2) / 3);
+                require_same_as_testing_each_box(grid, boxes);
+            }
+        }
+
+        WHEN("all of them move to the same place")
+        {
+            for (size_t i = 0; i < boxes.size(); ++i)
+                grid.set(static_cast<int>(i), { { 0.1f, 0.1f, 0.1f }, { 0.2f, 0.2f, 0.2f } });
+
+            THEN("the cells that they left are gone")
+            {
+                REQUIRE(grid.cells_count() == 1);
+                vector<int> found;
+                grid.query(XMVectorSet(20.0f, 20.0f, 20.0f, 1.0f), 10.0f, found);
+                REQUIRE(found.empty());
+            }
+        }
+    }
+
+    GIVEN("Boxes far outside of the cells that the grid has coordinates for")
+    {
+        Loose_grid grid(0.001f);
+        grid.set(0, { { 1e5f, 0.0f, 0.0f }, { 1e5f + 1.0f, 1.0f, 1.0f } });
+        grid.set(1, { { 2e5f, 0.0f, 0.0f }, { 2e5f + 1.0f, 1.0f, 1.0f } });
+
+        THEN("they share a cell at the edge, which reaches both of them")
+        {
+            REQUIRE(grid.cells_count() == 1);
+            vector<int> found;
+            grid.query(XMVectorSet(1e5f, 0.0f, 0.0f, 1.0f), 1.0f, found);
+            REQUIRE(found == vector<int>{ 0 });
+            found.clear();
+            grid.query(XMVectorSet(2e5f, 0.0f, 0.0f, 1.0f), 1.0f, found);
+            REQUIRE(found == vector<int>{ 1 });
+        }
+    }
+
+    GIVEN("An empty grid")
+    {
+        Loose_grid grid;
+
+        THEN("nothing is found")
+        {
+            vector<int> found;
+            grid.query(view_frustum(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f)), found);
+            float distance;
+            REQUIRE(found.empty());
+            REQUIRE(grid.first_hit(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f),
+                distance) == -1);
+        }
+    }
+}
+
+TEST_CASE("Loose grid updates and queries", "[.benchmark]")
+{
+    // The boxes fly in circles, like the flying objects of a scene, and all of them move every
+    // frame. The grid is compared to rebuilding a bounding volume hierarchy of them each frame.
+    constexpr int count = 100000;
+    constexpr int frames = 60;
+    const float half_side = 50.0f * pow(count / 10000.0f, 1.0f / 3.0f);
+    mt19937 generator(1);
+    uniform_real_distribution<float> angle(0.0f, XM_2PI);
+    uniform_real_distribution<float> radius(1.0f, 10.0f);
+    vector<Aabb> centers;
+    vector<float> angles, radii;
+    for (int i = 0; i < count; ++i)
+    {
+        centers.push_back(random_box(generator, half_side));
+        angles.push_back(angle(generator));
+        radii.push_back(radius(generator));
+    }
+    auto box_in_frame = [&](int i, int frame) {
+        const float a = angles[i] + frame * 0.05f;
+        return moved_box(centers[i], { radii[i] * cos(a), 0.0f, radii[i] * sin(a) });
+    };
+    vector<Aabb> boxes(count);
+    vector<int> ids(count);
+    for (int i = 0; i < count; ++i)
+    {
+        boxes[i] = box_in_frame(i, 0);
+        ids[i] = i;
+    }
+    const Frustum frustum = view_frustum(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+        XMVectorSet(1.0f, 0.0f, 1.0f, 1.0f));
+
+    Time time;
+    time.seconds_since_last_call();
+    Loose_grid grid(Loose_grid::cell_size_for(boxes));
+    for (int i = 0; i < count; ++i)
+        grid.set(i, boxes[i]);
+    const double insert_seconds = time.seconds_since_last_call();
+
+    double update_seconds = 0.0;
+    double query_seconds = 0.0;
+    double rebuild_seconds = 0.0;
+    double bvh_query_seconds = 0.0;
+    vector<int> found;
+    vector<int> bvh_found;
+    for (int frame = 1; frame <= frames; ++frame)
+    {
+        for (int i = 0; i < count; ++i)
+            boxes[i] = box_in_frame(i, frame);
+        time.seconds_since_last_call();
+        for (int i = 0; i < count; ++i)
+            grid.set(i, boxes[i]);
+        update_seconds += time.seconds_since_last_call();
+        found.clear();
+        grid.query(frustum, found);
+        query_seconds += time.seconds_since_last_call();
+
+        Bvh bvh;
+        bvh.build(boxes, ids);
+        rebuild_seconds += time.seconds_since_last_call();
+        bvh_found.clear();
+        bvh.query(frustum, bvh_found);
+        bvh_query_seconds += time.seconds_since_last_call();
+        REQUIRE(found.size() == bvh_found.size());
+    }
+
+    cout << count << " moving boxes, " << grid.cells_count() << " cells\n"
+        << "  Insert: " << insert_seconds * 1000.0 << " ms\n"
+        << "  Update: " << update_seconds / frames * 1000.0 << " ms per frame, "
+        << "rebuilding a bounding volume hierarchy: " << rebuild_seconds / frames * 1000.0
+        << " ms\n"
+        << "  Frustum query, " << found.size() << " boxes: " << query_seconds / frames * 1000.0
+        << " ms, with the bounding volume hierarchy: " << bvh_query_seconds / frames * 1000.0
+        << " ms\n";
+}
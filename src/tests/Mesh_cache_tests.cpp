@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Mesh_cache.h"
+#include "../util.h"
+#include "Generated_obj_data.h"
+
+#include <iostream>
+
+
+using namespace std;
+
+
+namespace
+{
+    template<typename T>
+    bool same_bytes(const vector<T>& a, const vector<T>& b)
+    {
+        return a.size() == b.size() && (a.empty() ||
+            memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    }
+
+    bool same_objects(const vector<Obj_object>& a, const vector<Obj_object>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (!same_bytes(a[i].vertices.positions, b[i].vertices.positions) ||
+                !same_bytes(a[i].vertices.normals, b[i].vertices.normals) ||
+                !same_bytes(a[i].vertices.tangents, b[i].vertices.tangents) ||
+                !same_bytes(a[i].vertices.bitangents, b[i].vertices.bitangents) ||
+                !same_bytes(a[i].vertices.colors, b[i].vertices.colors) ||
+                a[i].indices != b[i].indices || a[i].material != b[i].material ||
+                a[i].lods.size() != b[i].lods.size())
+                return false;
+            else
+                for (size_t j = 0; j < a[i].lods.size(); ++j)
+                    if (a[i].lods[j].indices != b[i].lods[j].indices ||
+                        a[i].lods[j].error != b[i].lods[j].error)
+                        return false;
+        return true;
+    }
+}
+
+
+SCENARIO("The mesh cache")
+{
+    const string model_file = "mesh_cache_test.obj";
+    write_file(model_file, "o first\n" + generate_grid_obj(20, true) +
+                           "o second\nusemtl some_material\n" + generate_grid_obj(10));
+
+    map<string, Material> materials;
+    auto objects = read_obj_objects(model_file, materials, Obj_flip_v::yes);
+    materials["some_material"] = { "diffuse.png", "normal.png", "", 5, -1 };
+    const vector<string> no_material_files;
+
+    GIVEN("A cache that has been written for a model file")
+    {
+        REQUIRE(write_mesh_cache(model_file, Obj_flip_v::yes, objects, materials,
+            no_material_files));
+
+        WHEN("it is read")
+        {
+            vector<Obj_object> cached_objects;
+            map<string, Material> cached_materials;
+            bool cache_valid = read_mesh_cache(model_file, Obj_flip_v::yes, cached_objects,
+                cached_materials);
+
+            THEN("it contains the same objects, with their levels of detail, and materials")
+            {
+                REQUIRE(cache_valid);
+                REQUIRE(!objects[0].lods.empty());
+                REQUIRE(same_objects(objects, cached_objects));
+                REQUIRE(cached_materials.size() == 1);
+                auto& material = cached_materials["some_material"];
+                REQUIRE(material.diffuse_map == "diffuse.png");
+                REQUIRE(material.normal_map == "normal.png");
+                REQUIRE(material.ao_roughness_metalness_map.empty());
+                REQUIRE(material.settings == 5);
+                REQUIRE(material.id == -1);
+            }
+        }
+
+        WHEN("it is read with another flip_v setting")
+        {
+            vector<Obj_object> cached_objects;
+            THEN("it is not valid")
+            {
+                REQUIRE(!read_mesh_cache(model_file, Obj_flip_v::no, cached_objects, materials));
+                REQUIRE(cached_objects.empty());
+            }
+        }
+
+        WHEN("the model file has been changed")
+        {
+            write_file(model_file, generate_grid_obj(21));
+            vector<Obj_object> cached_objects;
+            THEN("it is not valid")
+            {
+                REQUIRE(!read_mesh_cache(model_file, Obj_flip_v::yes, cached_objects,
+                    materials));
+            }
+        }
+
+        WHEN("the cache file has been truncated")
+        {
+            ifstream cache(mesh_cache_file_name(model_file), ios::binary);
+            string content((istreambuf_iterator<char>(cache)), istreambuf_iterator<char>());
+            cache.close();
+            write_file(mesh_cache_file_name(model_file), content.substr(0, content.size() / 2));
+
+            vector<Obj_object> cached_objects;
+            THEN("it is not valid")
+            {
+                REQUIRE(!read_mesh_cache(model_file, Obj_flip_v::yes, cached_objects,
+                    materials));
+                REQUIRE(cached_objects.empty());
+            }
+        }
+    }
+
+    GIVEN("A cache that depends on an mtl file")
+    {
+        const vector<string> material_files = { "mesh_cache_test.mtl" };
+        write_file(material_files[0], "newmtl some_material\n");
+        REQUIRE(write_mesh_cache(model_file, Obj_flip_v::yes, objects, materials,
+            material_files));
+
+        THEN("reading it gives the mtl file, which e.g. a scene snapshot is checked against")
+        {
+            vector<Obj_object> cached_objects;
+            vector<string> cached_material_files;
+            REQUIRE(read_mesh_cache(model_file, Obj_flip_v::yes, cached_objects, materials,
+                &cached_material_files));
+            REQUIRE(cached_material_files == material_files);
+        }
+        remove(material_files[0].c_str());
+    }
+
+    GIVEN("A cache that depends on an mtl file that no longer exists")
+    {
+        const vector<string> material_files = { "mesh_cache_test.mtl" };
+        write_file(material_files[0], "newmtl some_material\n");
+        REQUIRE(write_mesh_cache(model_file, Obj_flip_v::yes, objects, materials,
+            material_files));
+        remove(material_files[0].c_str());
+
+        THEN("it is not valid")
+        {
+            vector<Obj_object> cached_objects;
+            REQUIRE(!read_mesh_cache(model_file, Obj_flip_v::yes, cached_objects, materials));
+        }
+    }
+
+    remove(model_file.c_str());
+    remove(mesh_cache_file_name(model_file).c_str());
+}
+
+
+TEST_CASE("Mesh cache load time", "[.benchmark]")
+{
+    const string model_file = "mesh_cache_benchmark.obj";
+    constexpr int quads_per_side = 1000; // Two million triangles.
+    write_file(model_file, generate_grid_obj(quads_per_side));
+    remove(mesh_cache_file_name(model_file).c_str());
+
+    Time time;
+    time.seconds_since_last_call();
+
+    map<string, Material> materials;
+    vector<string> material_files;
+    auto objects = read_obj_objects(model_file, materials, Obj_flip_v::yes, &material_files);
+    const double cold_seconds = time.seconds_since_last_call();
+    write_mesh_cache(model_file, Obj_flip_v::yes, objects, materials, material_files);
+    const double write_seconds = time.seconds_since_last_call();
+
+    vector<Obj_object> cached_objects;
+    REQUIRE(read_mesh_cache(model_file, Obj_flip_v::yes, cached_objects, materials));
+    const double warm_seconds = time.seconds_since_last_call();
+
+    cout << "Cold, parsing the obj file: " << cold_seconds * 1000.0 << " ms\n"
+        << "Writing the cache:          " << write_seconds * 1000.0 << " ms\n"
+        << "Warm, reading the cache:    " << warm_seconds * 1000.0 << " ms\n";
+
+    remove(model_file.c_str());
+    remove(mesh_cache_file_name(model_file).c_str());
+
+    REQUIRE(same_objects(objects, cached_objects));
+}
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Mesh_optimizer.h"
+#include "../util.h"
+
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+
+
+namespace
+{
+    // A grid of quads_per_side * quads_per_side quads, with the triangles in random order,
+    // which is about as bad as it gets for the vertex cache.
+    void create_shuffled_grid(int quads_per_side, Vertices& vertices, vector<int>& indices)
+    {
+        const int vertices_per_side = quads_per_side + 1;
+        for (int y = 0; y < vertices_per_side; ++y)
+            for (int x = 0; x < vertices_per_side; ++x)
+            {
+                vertices.positions.push_back({ float(x), 0.0f, float(y), 1.0f });
+                vertices.normals.push_back({ 0.0f, 1.0f, 0.0f, 0.0f });
+            }
+
+        vector<array<int, vertex_count_per_face>> triangles;
+        for (int y = 0; y < quads_per_side; ++y)
+            for (int x = 0; x < quads_per_side; ++x)
+            {
+                const int i0 = y * vertices_per_side + x;
+                const int i1 = i0 + 1;
+                const int i2 = i0 + vertices_per_side;
+                const int i3 = i2 + 1;
+                triangles.push_back({ i0, i2, i1 });
+                triangles.push_back({ i1, i2, i3 });
+            }
+        constexpr unsigned int seed = 1;
+        shuffle(triangles.begin(), triangles.end(), mt19937(seed));
+        for (auto& triangle : triangles)
+            indices.insert(indices.end(), triangle.begin(), triangle.end());
+    }
+
+    // The triangles as positions, sorted, so that meshes can be compared independently of
+    // the order of the triangles and the vertices.
+    vector<array<float, 9>> sorted_triangles(const Vertices& vertices, const vector<int>& indices)
+    {
+        vector<array<float, 9>> triangles;
+        for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+        {
+            array<float, 9> triangle;
+            for (int j = 0; j < vertex_count_per_face; ++j)
+            {
+                auto& p = vertices.positions[indices[i + j]];
+                triangle[j * 3] = p.x;
+                triangle[j * 3 + 1] = p.y;
+                triangle[j * 3 + 2] = p.z;
+            }
+            triangles.push_back(triangle);
+        }
+        sort(triangles.begin(), triangles.end());
+        return triangles;
+    }
+
+    bool vertices_in_order_of_first_use(const vector<int>& indices)
+    {
+        int next_new = 0;
+        for (int index : indices)
+        {
+            if (index > next_new)
+                return false;
+            if (index == next_new)
+                ++next_new;
+        }
+        return true;
+    }
+}
+
+
+SCENARIO("The vertex cache simulation")
+{
+    GIVEN("One triangle")
+    {
+        const vector<int> indices = { 0, 1, 2 };
+        THEN("all its vertices are transformed once")
+        {
+            auto statistics = simulate_vertex_cache(indices, 3);
+            REQUIRE(statistics.acmr == 3.0f);
+            REQUIRE(statistics.atvr == 1.0f);
+        }
+    }
+
+    GIVEN("Two triangles sharing an edge")
+    {
+        const vector<int> indices = { 0, 1, 2, 2, 1, 3 };
+        THEN("the shared vertices are only transformed once")
+        {
+            auto statistics = simulate_vertex_cache(indices, 4);
+            REQUIRE(statistics.acmr == 2.0f);
+            REQUIRE(statistics.atvr == 1.0f);
+        }
+    }
+
+    GIVEN("Triangles that reuse a vertex after it has left the cache")
+    {
+        const vector<int> indices = { 0, 1, 2, 3, 4, 5, 0, 1, 2 };
+        constexpr int cache_size = 4;
+        THEN("it is transformed again")
+        {
+            auto statistics = simulate_vertex_cache(indices, 6, cache_size);
+            REQUIRE(statistics.acmr == 3.0f);
+            REQUIRE(statistics.atvr == 1.5f);
+        }
+    }
+}
+
+SCENARIO("Mesh optimization")
+{
+    GIVEN("A grid with the triangles in random order")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_shuffled_grid(30, vertices, indices);
+        const Vertices original_vertices = vertices;
+        const vector<int> original_indices = indices;
+
+        WHEN("it is optimized")
+        {
+            auto result = optimize_mesh(vertices, indices);
+
+            THEN("it has the same triangles")
+            {
+                REQUIRE(indices.size() == original_indices.size());
+                REQUIRE(vertices.positions.size() == original_vertices.positions.size());
+                REQUIRE(vertices.normals.size() == original_vertices.normals.size());
+                REQUIRE(sorted_triangles(vertices, indices) ==
+                    sorted_triangles(original_vertices, original_indices));
+            }
+            THEN("the vertex cache is used much better")
+            {
+                REQUIRE(result.before.acmr > 2.0f);
+                REQUIRE(result.after.acmr < 0.8f);
+                REQUIRE(result.after.atvr < 1.5f);
+                auto statistics = simulate_vertex_cache(indices, vertices.positions.size());
+                REQUIRE(statistics.acmr == result.after.acmr);
+            }
+            THEN("the vertices are in the order that they are first used")
+            {
+                REQUIRE(vertices_in_order_of_first_use(indices));
+            }
+        }
+    }
+
+    GIVEN("A mesh with an unused vertex, and vertex colors only for the first vertices")
+    {
+        Vertices vertices;
+        vertices.positions = { { 0, 0, 0, 1 }, { 9, 9, 9, 1 }, { 1, 0, 0, 1 }, { 0, 1, 0, 1 } };
+        const auto white = convert_vector_to_half4(DirectX::XMVectorSet(1, 1, 1, 1));
+        vertices.colors = { white, white };
+        vector<int> indices = { 2, 3, 0 };
+
+        WHEN("it is optimized")
+        {
+            optimize_mesh(vertices, indices);
+
+            THEN("the unused vertex is removed and the vertices without color get zero")
+            {
+                REQUIRE(vertices.positions.size() == 3);
+                REQUIRE(vertices.colors.size() == 3);
+                REQUIRE(vertices.positions[indices[2]].x == 0.0f);
+                REQUIRE(vertices.colors[indices[2]].x == white.x);
+                REQUIRE(vertices.colors[indices[0]].x == 0);
+            }
+        }
+    }
+
+    GIVEN("A mesh with an index outside of the vertices")
+    {
+        Vertices vertices;
+        vertices.positions = { { 0, 0, 0, 1 }, { 1, 0, 0, 1 }, { 0, 1, 0, 1 } };
+        vector<int> indices = { 2, 1, 3 };
+
+        THEN("it is left as it is")
+        {
+            optimize_mesh(vertices, indices);
+            REQUIRE(indices == vector<int>({ 2, 1, 3 }));
+        }
+    }
+}
+
+
+namespace
+{
+    // The indices of the original vertices, from the compact ones.
+    vector<int> expanded_indices(const Compact_indices& compact)
+    {
+        vector<int> indices;
+        for (auto& range : compact.ranges)
+            for (UINT i = range.start_index; i < range.start_index + range.index_count; ++i)
+            {
+                const int index = compact.indices_16[i] + range.base_vertex;
+                indices.push_back(compact.vertex_remap.empty() ? index :
+                    compact.vertex_remap[index]);
+            }
+        return indices;
+    }
+}
+
+SCENARIO("Compact indices")
+{
+    GIVEN("A mesh with few vertices")
+    {
+        const vector<int> indices = { 0, 1, 2, 2, 1, 3 };
+        THEN("it gets 16 bit indices in one range, and the same vertices")
+        {
+            auto compact = compact_indices(indices, 4);
+            REQUIRE(compact.indices_32.empty());
+            REQUIRE(compact.vertex_remap.empty());
+            REQUIRE(compact.ranges.size() == 1);
+            REQUIRE(compact.ranges[0].start_index == 0);
+            REQUIRE(compact.ranges[0].index_count == 6);
+            REQUIRE(compact.ranges[0].base_vertex == 0);
+            REQUIRE(expanded_indices(compact) == indices);
+        }
+    }
+
+    GIVEN("A mesh with more vertices than 16 bits can address")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_shuffled_grid(300, vertices, indices);
+        optimize_mesh(vertices, indices);
+        const size_t vertex_count = vertices.positions.size();
+        REQUIRE(vertex_count > 65536);
+
+        THEN("it gets 16 bit indices in several ranges, with only a few vertices duplicated")
+        {
+            auto compact = compact_indices(indices, vertex_count);
+            REQUIRE(compact.indices_32.empty());
+            REQUIRE(compact.ranges.size() == 2);
+            REQUIRE(compact.vertex_remap.size() < vertex_count * 1.05);
+            for (auto& range : compact.ranges)
+                REQUIRE(range.index_count % vertex_count_per_face == 0);
+            REQUIRE(expanded_indices(compact) == indices);
+
+            auto remapped = remapped_vertices(vertices, compact.vertex_remap);
+            REQUIRE(remapped.positions.size() == compact.vertex_remap.size());
+            REQUIRE(remapped.normals.size() == compact.vertex_remap.size());
+            REQUIRE(remapped.colors.empty());
+            REQUIRE(remapped.positions.back().x ==
+                vertices.positions[compact.vertex_remap.back()].x);
+        }
+    }
+
+    GIVEN("A mesh with an index outside of the vertices")
+    {
+        const vector<int> indices = { 0, 1, 2, 0, 70000, 2 };
+        THEN("it gets 32 bit indices")
+        {
+            auto compact = compact_indices(indices, 3);
+            REQUIRE(compact.indices_16.empty());
+            REQUIRE(compact.indices_32 == indices);
+            REQUIRE(compact.ranges.size() == 1);
+            REQUIRE(compact.ranges[0].index_count == 6);
+        }
+    }
+}
+
+
+TEST_CASE("Mesh optimization of a big mesh", "[.benchmark]")
+{
+    Vertices vertices;
+    vector<int> indices;
+    create_shuffled_grid(1000, vertices, indices);
+
+    Time time;
+    time.seconds_since_last_call();
+    auto result = optimize_mesh(vertices, indices);
+    const double seconds = time.seconds_since_last_call();
+
+    cout << indices.size() / vertex_count_per_face << " triangles optimized in "
+        << seconds * 1000.0 << " ms\n"
+        << "ACMR: " << result.before.acmr << " -> " << result.after.acmr << "\n"
+        << "ATVR: " << result.before.atvr << " -> " << result.after.atvr << "\n";
+
+    auto compact = compact_indices(indices, vertices.positions.size());
+    cout << "Index memory: " << indices.size() * sizeof(int) << " -> "
+        << compact.indices_16.size() * sizeof(uint16_t) << " bytes in "
+        << compact.ranges.size() << " ranges, with " << compact.vertex_remap.size() -
+        vertices.positions.size() << " vertices duplicated\n";
+}
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Mesh_simplifier.h"
+#include "../Mesh_optimizer.h"
+#include "../Wavefront_obj_file.h"
+#include "../util.h"
+
+#include <filesystem>
+#include <iostream>
+#include <set>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    // A sphere with a UV seam where the first and the last column of vertices meet, and
+    // with one vertex per triangle at the poles.
+    void create_sphere(int segments, float radius, Vertices& vertices, vector<int>& indices)
+    {
+        const int rings = segments / 2;
+        for (int r = 0; r <= rings; ++r)
+            for (int s = 0; s <= segments; ++s)
+            {
+                const float theta = XM_PI * r / rings;
+                const float phi = XM_2PI * s / segments;
+                vertices.positions.push_back({ radius * sin(theta) * cos(phi),
+                    radius * cos(theta), radius * sin(theta) * sin(phi), 0.0f });
+            }
+
+        for (int r = 0; r < rings; ++r)
+            for (int s = 0; s < segments; ++s)
+            {
+                const int i0 = r * (segments + 1) + s;
+                const int i1 = i0 + 1;
+                const int i2 = i0 + segments + 1;
+                const int i3 = i2 + 1;
+                if (r != 0)
+                    indices.insert(indices.end(), { i0, i1, i2 });
+                if (r != rings - 1)
+                    indices.insert(indices.end(), { i1, i3, i2 });
+            }
+    }
+
+    // A flat grid in the xz plane, which has a border all around.
+    void create_grid(int quads_per_side, Vertices& vertices, vector<int>& indices)
+    {
+        const int vertices_per_side = quads_per_side + 1;
+        for (int z = 0; z < vertices_per_side; ++z)
+            for (int x = 0; x < vertices_per_side; ++x)
+                vertices.positions.push_back({ float(x), 0.0f, float(z), 0.0f });
+
+        for (int z = 0; z < quads_per_side; ++z)
+            for (int x = 0; x < quads_per_side; ++x)
+            {
+                const int i0 = z * vertices_per_side + x;
+                const int i1 = i0 + 1;
+                const int i2 = i0 + vertices_per_side;
+                const int i3 = i2 + 1;
+                indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+            }
+    }
+
+    float max_distance_from_sphere(const Vertices& vertices, const vector<int>& indices,
+        float radius)
+    {
+        // Checks the centers of the triangles, since the vertices are all on the sphere.
+        float max_distance = 0.0f;
+        for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+        {
+            XMVECTOR center = XMVectorZero();
+            for (int j = 0; j < vertex_count_per_face; ++j)
+                center += XMVectorSetW(XMLoadFloat4(&vertices.positions[indices[i + j]]), 0.0f);
+            center = center / static_cast<float>(vertex_count_per_face);
+            max_distance = max(max_distance,
+                abs(XMVectorGetX(XMVector3Length(center)) - radius));
+        }
+        return max_distance;
+    }
+
+    bool all_triangles_face_outwards(const Vertices& vertices, const vector<int>& indices)
+    {
+        for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+        {
+            XMVECTOR p[vertex_count_per_face];
+            for (int j = 0; j < vertex_count_per_face; ++j)
+                p[j] = XMVectorSetW(XMLoadFloat4(&vertices.positions[indices[i + j]]), 0.0f);
+            const XMVECTOR normal = XMVector3Cross(p[1] - p[0], p[2] - p[0]);
+            if (XMVectorGetX(XMVector3Dot(normal, p[0] + p[1] + p[2])) <= 0.0f)
+                return false;
+        }
+        return true;
+    }
+}
+
+
+SCENARIO("Mesh simplification")
+{
+    GIVEN("A sphere with a UV seam")
+    {
+        constexpr float radius = 10.0f;
+        Vertices vertices;
+        vector<int> indices;
+        create_sphere(64, radius, vertices, indices);
+
+        WHEN("it is simplified to a quarter of the triangles")
+        {
+            const size_t target = indices.size() / 4 / vertex_count_per_face *
+                vertex_count_per_face;
+            float error;
+            auto simplified = simplify_mesh(vertices.positions, indices, target, FLT_MAX, error);
+
+            THEN("it gets that many triangles, without flipping any of them")
+            {
+                REQUIRE(simplified.size() <= target);
+                REQUIRE(simplified.size() > target * 3 / 4);
+                REQUIRE(simplified.size() % vertex_count_per_face == 0);
+                REQUIRE(all_triangles_face_outwards(vertices, simplified));
+            }
+            THEN("it stays close to the sphere, and the error is about the distance to it")
+            {
+                const float distance = max_distance_from_sphere(vertices, simplified, radius);
+                REQUIRE(distance < radius * 0.05f);
+                REQUIRE(error > 0.0f);
+                REQUIRE(error < radius * 0.05f);
+            }
+            THEN("the vertices on the seam are kept")
+            {
+                set<int> used(simplified.begin(), simplified.end());
+                const int vertices_per_ring = 65;
+                for (int r = 1; r < 32; ++r)
+                {
+                    REQUIRE(used.count(r * vertices_per_ring));
+                    REQUIRE(used.count(r * vertices_per_ring + 64));
+                }
+            }
+        }
+
+        WHEN("the error is limited")
+        {
+            float error;
+            const float max_error = radius * 0.001f;
+            auto simplified = simplify_mesh(vertices.positions, indices, 0, max_error, error);
+            THEN("it stops before the error gets bigger than that")
+            {
+                REQUIRE(error <= max_error);
+                REQUIRE(simplified.size() > indices.size() / 2);
+            }
+        }
+    }
+
+    GIVEN("A flat grid")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_grid(20, vertices, indices);
+
+        THEN("the inside is simplified without error, and the border is kept")
+        {
+            float error;
+            auto simplified = simplify_mesh(vertices.positions, indices, 0, 0.0f, error);
+            REQUIRE(error == 0.0f);
+            REQUIRE(simplified.size() < indices.size() / 4);
+            set<int> used(simplified.begin(), simplified.end());
+            for (int i = 0; i <= 20; ++i)
+            {
+                REQUIRE(used.count(i));
+                REQUIRE(used.count(20 * 21 + i));
+            }
+        }
+    }
+}
+
+SCENARIO("Levels of detail")
+{
+    GIVEN("A dense sphere")
+    {
+        constexpr float radius = 1.0f;
+        Vertices vertices;
+        vector<int> indices;
+        create_sphere(128, radius, vertices, indices);
+        optimize_mesh(vertices, indices);
+
+        WHEN("its levels of detail are generated")
+        {
+            auto lods = generate_lods(vertices.positions, indices);
+
+            THEN("each level has about half the triangles and more error than the previous")
+            {
+                REQUIRE(lods.size() == max_lod_count - 1);
+                size_t previous_size = indices.size();
+                float previous_error = 0.0f;
+                for (auto& lod : lods)
+                {
+                    REQUIRE(lod.indices.size() <= previous_size / 2 + vertex_count_per_face);
+                    REQUIRE(lod.error > previous_error);
+                    REQUIRE(all_triangles_face_outwards(vertices, lod.indices));
+                    REQUIRE(max_distance_from_sphere(vertices, lod.indices, radius) <=
+                        lod.error * 2.0f);
+                    previous_size = lod.indices.size();
+                    previous_error = lod.error;
+                }
+            }
+        }
+    }
+
+    GIVEN("A mesh that can't be simplified")
+    {
+        Vertices vertices;
+        vertices.positions = { { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 } };
+        THEN("it gets no levels of detail")
+        {
+            REQUIRE(generate_lods(vertices.positions, { 0, 1, 2 }).empty());
+        }
+    }
+
+    GIVEN("The errors of four levels")
+    {
+        const vector<float> errors = { 0.0f, 0.01f, 0.02f, 0.04f };
+
+        THEN("the coarsest level with at most one pixel of error is selected")
+        {
+            REQUIRE(select_lod(errors, 1000.0f, 0) == 0);
+            REQUIRE(select_lod(errors, 70.0f, 0) == 1);
+            REQUIRE(select_lod(errors, 10.0f, 0) == 3);
+            REQUIRE(select_lod(errors, 10.0f, 3) == 3);
+            REQUIRE(select_lod(errors, 1000.0f, 3) == 0);
+        }
+        THEN("it only switches to a coarser level when clearly under the limit")
+        {
+            // The error of level 2 is 0.96 pixels at 48 pixels per unit.
+            REQUIRE(select_lod(errors, 48.0f, 1) == 1);
+            REQUIRE(select_lod(errors, 48.0f, 2) == 2);
+            REQUIRE(select_lod(errors, 30.0f, 1) == 2);
+        }
+        THEN("it switches to a finer level as soon as the limit is passed")
+        {
+            REQUIRE(select_lod(errors, 51.0f, 2) == 1);
+        }
+    }
+}
+
+
+TEST_CASE("Level of detail generation", "[.benchmark]")
+{
+    struct Benchmark_mesh
+    {
+        string name;
+        Vertices vertices;
+        vector<int> indices;
+    };
+    vector<Benchmark_mesh> meshes(1);
+    meshes[0].name = "Sphere";
+    create_sphere(1024, 1.0f, meshes[0].vertices, meshes[0].indices);
+    optimize_mesh(meshes[0].vertices, meshes[0].indices);
+
+    // The models of the standard scene, if the data directory can be found from here.
+    for (auto& directory : { string(data_path), "../" + string(data_path) })
+        if (filesystem::exists(directory + "scene.sce"))
+        {
+            for (auto& file : { "spaceship.obj", "platform.obj", "cube.obj" })
+            {
+                map<string, Material> materials;
+                for (auto& object : read_obj_objects(directory + file, materials,
+                    Obj_flip_v::yes))
+                    meshes.push_back({ file, object.vertices, object.indices });
+            }
+            break;
+        }
+
+    for (auto& mesh : meshes)
+    {
+        Time time;
+        time.seconds_since_last_call();
+        auto lods = generate_lods(mesh.vertices.positions, mesh.indices);
+        const double seconds = time.seconds_since_last_call();
+
+        cout << mesh.name << ": " << mesh.indices.size() / vertex_count_per_face
+            << " triangles, levels of detail generated in " << seconds * 1000.0 << " ms\n";
+        size_t lod_indices = 0;
+        for (size_t i = 0; i < lods.size(); ++i)
+        {
+            lod_indices += lods[i].indices.size();
+            cout << "  Level " << i + 1 << ": " << lods[i].indices.size() / vertex_count_per_face
+                << " triangles (" << 100.0 * lods[i].indices.size() / mesh.indices.size()
+                << "%), error " << lods[i].error << "\n";
+        }
+        cout << "  Index memory: " << mesh.indices.size() * sizeof(int) << " -> "
+            << (mesh.indices.size() + lod_indices) * sizeof(int) << " bytes\n";
+    }
+}
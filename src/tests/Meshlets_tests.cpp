@@ -0,0 +1,313 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Meshlets.h"
+#include "../Frustum.h"
+#include "../Mesh_optimizer.h"
+
+#include <iostream>
+#include <set>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    // A flat grid in the xz plane, facing up.
+    void create_grid(int quads_per_side, Vertices& vertices, vector<int>& indices)
+    {
+        const int vertices_per_side = quads_per_side + 1;
+        for (int z = 0; z < vertices_per_side; ++z)
+            for (int x = 0; x < vertices_per_side; ++x)
+                vertices.positions.push_back({ float(x), 0.0f, float(z), 0.0f });
+
+        for (int z = 0; z < quads_per_side; ++z)
+            for (int x = 0; x < quads_per_side; ++x)
+            {
+                const int i0 = z * vertices_per_side + x;
+                const int i1 = i0 + 1;
+                const int i2 = i0 + vertices_per_side;
+                const int i3 = i2 + 1;
+                indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+            }
+    }
+
+    // A sphere with the triangles facing outwards, which is the reference scene for the culling.
+    void create_sphere(int segments, Vertices& vertices, vector<int>& indices)
+    {
+        const int rings = segments / 2;
+        for (int r = 0; r <= rings; ++r)
+            for (int s = 0; s <= segments; ++s)
+            {
+                const float theta = XM_PI * r / rings;
+                const float phi = XM_2PI * s / segments;
+                vertices.positions.push_back({ sin(theta) * cos(phi), cos(theta),
+                    sin(theta) * sin(phi), 0.0f });
+            }
+
+        for (int r = 0; r < rings; ++r)
+            for (int s = 0; s < segments; ++s)
+            {
+                const int i0 = r * (segments + 1) + s;
+                const int i1 = i0 + 1;
+                const int i2 = i0 + segments + 1;
+                const int i3 = i2 + 1;
+                if (r != 0)
+                    indices.insert(indices.end(), { i0, i1, i2 });
+                if (r != rings - 1)
+                    indices.insert(indices.end(), { i1, i3, i2 });
+            }
+    }
+
+    XMVECTOR position(const Vertices& vertices, int index)
+    {
+        return XMVectorSetW(XMLoadFloat4(&vertices.positions[index]), 0.0f);
+    }
+
+    bool triangle_is_front_facing(const Vertices& vertices, const vector<int>& indices,
+        UINT first_index, XMVECTOR eye)
+    {
+        const XMVECTOR p0 = position(vertices, indices[first_index]);
+        const XMVECTOR p1 = position(vertices, indices[first_index + 1]);
+        const XMVECTOR p2 = position(vertices, indices[first_index + 2]);
+        const XMVECTOR normal = XMVector3Cross(p1 - p0, p2 - p0);
+        return XMVectorGetX(XMVector3Dot(normal, eye - p0)) > 0.0f;
+    }
+
+    // Checks the limits, and that the meshlets cover all the triangles, in order.
+    bool meshlets_are_valid(const vector<Meshlet>& meshlets, const vector<int>& indices)
+    {
+        UINT next_index = 0;
+        for (auto& m : meshlets)
+        {
+            set<int> unique_vertices(indices.begin() + m.range.start_index,
+                indices.begin() + m.range.start_index + m.range.index_count);
+            if (m.range.start_index != next_index ||
+                m.range.index_count % vertex_count_per_face != 0 ||
+                m.range.index_count > max_meshlet_triangles * vertex_count_per_face ||
+                unique_vertices.size() > max_meshlet_vertices)
+                return false;
+            next_index += m.range.index_count;
+        }
+        return next_index == indices.size();
+    }
+
+    bool bounds_contain_vertices(const vector<Meshlet>& meshlets, const Vertices& vertices,
+        const vector<int>& indices)
+    {
+        constexpr float epsilon = 1e-5f;
+        for (auto& m : meshlets)
+        {
+            const XMVECTOR center = XMLoadFloat4(&m.bounding_sphere);
+            for (UINT i = m.range.start_index; i < m.range.start_index + m.range.index_count; ++i)
+            {
+                const XMVECTOR p = position(vertices, indices[i]);
+                if (XMVectorGetX(XMVector3Length(p - XMVectorSetW(center, 0.0f))) >
+                    m.bounding_sphere.w + epsilon)
+                    return false;
+                const XMVECTOR e = XMVectorReplicate(epsilon);
+                if (!XMVector3GreaterOrEqual(p, XMLoadFloat3(&m.aabb_min) - e) ||
+                    !XMVector3LessOrEqual(p, XMLoadFloat3(&m.aabb_max) + e))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    const Frustum everything(XMMatrixScaling(0.001f, 0.001f, 0.001f) *
+        XMMatrixTranslation(0.0f, 0.0f, 0.5f));
+}
+
+
+SCENARIO("Meshlet generation")
+{
+    GIVEN("A grid with many more triangles than fit in one meshlet")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_grid(100, vertices, indices);
+        optimize_mesh(vertices, indices);
+
+        WHEN("it is partitioned into meshlets")
+        {
+            auto meshlets = build_meshlets(indices, vertices.positions, {});
+
+            THEN("they are within the limits and cover all the triangles")
+            {
+                REQUIRE(meshlets_are_valid(meshlets, indices));
+            }
+            THEN("they are not much more than the minimum number")
+            {
+                const size_t triangles = indices.size() / vertex_count_per_face;
+                const size_t min_meshlets = triangles / max_meshlet_triangles;
+                REQUIRE(meshlets.size() < min_meshlets * 2);
+            }
+            THEN("the bounds contain all the vertices")
+            {
+                REQUIRE(bounds_contain_vertices(meshlets, vertices, indices));
+            }
+            THEN("the normal cones are narrow, and face up")
+            {
+                for (auto& m : meshlets)
+                {
+                    REQUIRE(m.cone_cutoff < 1e-3f);
+                    REQUIRE(m.cone_axis.y > 0.999f);
+                }
+            }
+        }
+    }
+
+    GIVEN("Indices split in ranges")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_grid(20, vertices, indices);
+        const UINT split = 33 * vertex_count_per_face;
+        const vector<Index_range> ranges = { { 0, split, 0 },
+            { split, static_cast<UINT>(indices.size()) - split, 7 } };
+
+        THEN("the meshlets don't cross the ranges, and keep their base vertices")
+        {
+            auto meshlets = build_meshlets(indices, vertices.positions, ranges);
+            REQUIRE(meshlets_are_valid(meshlets, indices));
+            for (auto& m : meshlets)
+            {
+                const bool first_range = m.range.start_index < split;
+                REQUIRE(m.range.base_vertex == (first_range ? 0 : 7));
+                if (first_range)
+                    REQUIRE(m.range.start_index + m.range.index_count <= split);
+            }
+        }
+    }
+
+    GIVEN("A mesh with an index outside of the vertices")
+    {
+        const Vertices vertices = { { { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 } } };
+        const vector<int> indices = { 0, 1, 3 };
+        THEN("it gets no meshlets")
+        {
+            REQUIRE(build_meshlets(indices, vertices.positions, {}).empty());
+        }
+    }
+}
+
+SCENARIO("Meshlet culling")
+{
+    GIVEN("The meshlets of a flat grid")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_grid(50, vertices, indices);
+        optimize_mesh(vertices, indices);
+        auto meshlets = build_meshlets(indices, vertices.positions, {});
+        vector<Index_range> visible;
+
+        THEN("all of them are visible from above, merged into one range")
+        {
+            cull_meshlets(meshlets, everything, XMVectorSet(25, 10, 25, 0),
+                Backface_culling::enabled, visible);
+            REQUIRE(visible.size() == 1);
+            REQUIRE(visible[0].index_count == indices.size());
+        }
+        THEN("none of them are visible from below")
+        {
+            cull_meshlets(meshlets, everything, XMVectorSet(25, -10, 25, 0),
+                Backface_culling::enabled, visible);
+            REQUIRE(visible.empty());
+        }
+        THEN("all of them are visible from below without backface culling")
+        {
+            cull_meshlets(meshlets, everything, XMVectorSet(25, -10, 25, 0),
+                Backface_culling::disabled, visible);
+            REQUIRE(visible.size() == 1);
+        }
+        THEN("only the ones inside the frustum are visible")
+        {
+            // Looking down at the corner of the grid at the origin.
+            const XMMATRIX view = XMMatrixLookAtRH(XMVectorSet(0, 10, 0, 1),
+                XMVectorSet(0, 0, 0, 1), XMVectorSet(0, 0, 1, 0));
+            const XMMATRIX projection = XMMatrixPerspectiveFovRH(XM_PIDIV4, 1.0f, 0.1f, 100.0f);
+            cull_meshlets(meshlets, Frustum(view * projection), XMVectorSet(0, 10, 0, 0),
+                Backface_culling::enabled, visible);
+            UINT visible_indices = 0;
+            for (auto& r : visible)
+                visible_indices += r.index_count;
+            REQUIRE(visible_indices > 0);
+            REQUIRE(visible_indices < indices.size() / 4);
+        }
+    }
+
+    GIVEN("The meshlets of a sphere, seen from outside")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_sphere(128, vertices, indices);
+        optimize_mesh(vertices, indices);
+        auto meshlets = build_meshlets(indices, vertices.positions, {});
+        REQUIRE(meshlets_are_valid(meshlets, indices));
+        REQUIRE(bounds_contain_vertices(meshlets, vertices, indices));
+
+        const XMVECTOR eyes[] = { XMVectorSet(0, 0, 3, 0), XMVectorSet(2, 2, -2, 0),
+            XMVectorSet(0, -1.5f, 0, 0), XMVectorSet(10, 1, 0, 0) };
+        for (XMVECTOR eye : eyes)
+        {
+            size_t culled_triangles = 0;
+            bool culled_front_facing_triangle = false;
+            for (auto& m : meshlets)
+            {
+                if (!meshlet_is_backfacing(m, eye))
+                    continue;
+                for (UINT i = m.range.start_index;
+                    i < m.range.start_index + m.range.index_count; i += vertex_count_per_face)
+                {
+                    culled_front_facing_triangle |= triangle_is_front_facing(vertices,
+                        indices, i, eye);
+                    ++culled_triangles;
+                }
+            }
+
+            THEN("no front facing triangle is culled, and a good part of the back is")
+            {
+                REQUIRE_FALSE(culled_front_facing_triangle);
+                // From a distance, about half of the sphere faces away from the eye.
+                const size_t triangles = indices.size() / vertex_count_per_face;
+                REQUIRE(culled_triangles > triangles / 5);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Meshlet generation and culling of a big mesh", "[.benchmark]")
+{
+    Vertices vertices;
+    vector<int> indices;
+    create_sphere(1024, vertices, indices);
+    optimize_mesh(vertices, indices);
+
+    Time time;
+    time.seconds_since_last_call();
+    auto meshlets = build_meshlets(indices, vertices.positions, {});
+    const double build_seconds = time.seconds_since_last_call();
+    vector<Index_range> visible;
+    cull_meshlets(meshlets, everything, XMVectorSet(0, 0, 3, 0), Backface_culling::enabled,
+        visible);
+    const double cull_seconds = time.seconds_since_last_call();
+
+    UINT visible_indices = 0;
+    for (auto& r : visible)
+        visible_indices += r.index_count;
+    cout << indices.size() / vertex_count_per_face << " triangles in " << meshlets.size()
+        << " meshlets, built in " << build_seconds * 1000.0 << " ms, culled in "
+        << cull_seconds * 1000.0 << " ms\n"
+        << "Visible triangles: " << visible_indices / vertex_count_per_face << " in "
+        << visible.size() << " draw calls\n";
+}
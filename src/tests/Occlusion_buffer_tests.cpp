@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Occlusion_buffer.h"
+#include "../util.h"
+
+#include <cfloat>
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    // A cube from -1 to 1.
+    const vector<XMFLOAT3> cube_vertices = { { -1.0f, -1.0f, -1.0f }, { 1.0f, -1.0f, -1.0f },
+        { 1.0f, 1.0f, -1.0f }, { -1.0f, 1.0f, -1.0f }, { -1.0f, -1.0f, 1.0f },
+        { 1.0f, -1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }, { -1.0f, 1.0f, 1.0f } };
+    const vector<UINT> cube_indices = { 0, 2, 1, 0, 3, 2, 4, 5, 6, 4, 6, 7, 0, 1, 5, 0, 5, 4,
+        3, 6, 2, 3, 7, 6, 0, 4, 7, 0, 7, 3, 1, 2, 6, 1, 6, 5 };
+
+    Occluder box_occluder(const XMFLOAT3& center, const XMFLOAT3& half_extent,
+        float angle_around_y = 0.0f)
+    {
+        Occluder occluder = { &cube_vertices, &cube_indices, {} };
+        XMStoreFloat4x4(&occluder.model, XMMatrixScaling(half_extent.x, half_extent.y,
+            half_extent.z) * XMMatrixRotationRollPitchYaw(0.0f, angle_around_y, 0.0f) *
+            XMMatrixTranslation(center.x, center.y, center.z));
+        return occluder;
+    }
+
+    Aabb box(const XMFLOAT3& center, float half_side)
+    {
+        return { { center.x - half_side, center.y - half_side, center.z - half_side },
+            { center.x + half_side, center.y + half_side, center.z + half_side } };
+    }
+
+    XMMATRIX view_projection(FXMVECTOR eye, FXMVECTOR focus_point, int width, int height)
+    {
+        return XMMatrixLookAtLH(eye, focus_point, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+            XMMatrixPerspectiveFovLH(XMConvertToRadians(70.0f),
+                static_cast<float>(width) / height, 1.0f, 100.0f);
+    }
+
+    struct Sample
+    {
+        float depth;
+        int triangle; // -1 where there is none.
+    };
+
+    // The nearest triangle of the occluders at a point of each pixel, by casting a ray through
+    // it, in double precision, instead of rasterizing the triangles. The points are offset from
+    // the top left corners of the pixels, and there can be more of them than of pixels, e.g.
+    // at the corners of all the pixels.
+    vector<Sample> reference_raster(const vector<Occluder>& occluders,
+        FXMMATRIX view_projection, int width, int height, float offset = 0.5f,
+        int columns = 0, int rows = 0)
+    {
+        columns = columns ? columns : width;
+        rows = rows ? rows : height;
+        struct Vector
+        {
+            double x, y, z;
+            Vector operator-(const Vector& v) const { return { x - v.x, y - v.y, z - v.z }; }
+            Vector cross(const Vector& v) const
+            { return { y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x }; }
+            double dot(const Vector& v) const { return x * v.x + y * v.y + z * v.z; }
+        };
+        auto to_vector = [](FXMVECTOR v) {
+            return Vector{ XMVectorGetX(v), XMVectorGetY(v), XMVectorGetZ(v) }; };
+
+        vector<Vector> triangles;
+        for (auto& occluder : occluders)
+            for (UINT index : *occluder.indices)
+                triangles.push_back(to_vector(XMVector3TransformCoord(
+                    XMLoadFloat3(&(*occluder.vertices)[index]),
+                    XMLoadFloat4x4(&occluder.model))));
+
+        const XMMATRIX inverse = XMMatrixInverse(nullptr, view_projection);
+        vector<Sample> samples(static_cast<size_t>(columns) * rows, { 1.0f, -1 });
+        for (int y = 0; y < rows; ++y)
+            for (int x = 0; x < columns; ++x)
+            {
+                const float ndc_x = (x + offset) / width * 2.0f - 1.0f;
+                const float ndc_y = 1.0f - (y + offset) / height * 2.0f;
+                const Vector origin = to_vector(XMVector3TransformCoord(
+                    XMVectorSet(ndc_x, ndc_y, 0.0f, 1.0f), inverse));
+                const Vector direction = to_vector(XMVector3TransformCoord(
+                    XMVectorSet(ndc_x, ndc_y, 1.0f, 1.0f), inverse)) - origin;
+                double nearest = DBL_MAX;
+                int nearest_triangle = -1;
+                for (size_t t = 0; t < triangles.size(); t += 3)
+                {
+                    // Möller-Trumbore.
+                    const Vector edge1 = triangles[t + 1] - triangles[t];
+                    const Vector edge2 = triangles[t + 2] - triangles[t];
+                    const Vector p = direction.cross(edge2);
+                    const double determinant = edge1.dot(p);
+                    if (determinant == 0.0)
+                        continue;
+                    const Vector s = origin - triangles[t];
+                    const double u = s.dot(p) / determinant;
+                    const Vector q = s.cross(edge1);
+                    const double v = direction.dot(q) / determinant;
+                    const double distance = edge2.dot(q) / determinant;
+                    if (u >= 0.0 && v >= 0.0 && u + v <= 1.0 && distance >= 0.0 &&
+                        distance < nearest)
+                    {
+                        nearest = distance;
+                        nearest_triangle = static_cast<int>(t / 3);
+                    }
+                }
+                if (nearest == DBL_MAX)
+                    continue;
+                const XMVECTOR hit = XMVectorSet(
+                    static_cast<float>(origin.x + direction.x * nearest),
+                    static_cast<float>(origin.y + direction.y * nearest),
+                    static_cast<float>(origin.z + direction.z * nearest), 1.0f);
+                const XMVECTOR clip = XMVector4Transform(hit, view_projection);
+                samples[y * columns + x] = { XMVectorGetZ(clip) / XMVectorGetW(clip),
+                    nearest_triangle };
+            }
+        return samples;
+    }
+}
+
+
+SCENARIO("The occlusion buffer")
+{
+    GIVEN("Occluders at different depths and angles, overlapping each other, a floor that "
+        "reaches behind the camera, and one that is partly outside of the screen")
+    {
+        const vector<Occluder> occluders = {
+            box_occluder({ 0.0f, 0.0f, 10.0f }, { 3.0f, 2.0f, 0.2f }),
+            box_occluder({ 2.0f, 1.0f, 7.0f }, { 1.5f, 1.5f, 0.2f }, 0.6f),
+            box_occluder({ -4.0f, -1.0f, 14.0f }, { 2.0f, 4.0f, 2.0f }, 1.1f),
+            box_occluder({ 0.0f, -3.0f, 0.0f }, { 20.0f, 0.1f, 30.0f }),
+            box_occluder({ 12.0f, 0.0f, 9.0f }, { 4.0f, 6.0f, 1.0f }, -0.3f) };
+        Occlusion_buffer buffer(100, 60);
+        const XMMATRIX transform = view_projection(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+            XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f), buffer.width(), buffer.height());
+        buffer.rasterize(occluders, transform);
+
+        THEN("it is rounded up to whole tiles")
+        {
+            REQUIRE(buffer.width() == 128);
+            REQUIRE(buffer.height() == 64);
+        }
+
+        THEN("it has the depths of a reference raster, but never nearer, and the triangles "
+            "behind the camera are clipped")
+        {
+            const int width = buffer.width();
+            const int height = buffer.height();
+            const vector<Sample> centers = reference_raster(occluders, transform, width,
+                height);
+            const vector<Sample> corners = reference_raster(occluders, transform, width,
+                height, 0.0f, width + 1, height + 1);
+            int covered = 0;
+            int within_triangles = 0;
+            int mismatches = 0;
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < width; ++x)
+                {
+                    const Sample& expected = centers[y * width + x];
+                    const float depth = buffer.depth(x, y);
+                    covered += expected.triangle >= 0;
+                    // Only where an edge goes through the pixel center can the rasters
+                    // disagree on which triangles cover it.
+                    if ((depth < 1.0f) != (expected.triangle >= 0) ||
+                        depth < expected.depth - 1e-5f)
+                    {
+                        ++mismatches;
+                        continue;
+                    }
+
+                    // The depth is the farthest of the triangle within the pixel, so where it
+                    // covers the whole pixel, it is at most the farthest at the corners.
+                    const Sample pixel_corners[] = { corners[y * (width + 1) + x],
+                        corners[y * (width + 1) + x + 1], corners[(y + 1) * (width + 1) + x],
+                        corners[(y + 1) * (width + 1) + x + 1] };
+                    float farthest = expected.depth;
+                    bool same_triangle = expected.triangle >= 0;
+                    for (auto& corner : pixel_corners)
+                    {
+                        farthest = max(farthest, corner.depth);
+                        same_triangle = same_triangle && corner.triangle == expected.triangle;
+                    }
+                    if (same_triangle)
+                    {
+                        ++within_triangles;
+                        REQUIRE(depth <= farthest + 1e-5f);
+                    }
+                }
+            REQUIRE(covered > width * height / 2);
+            REQUIRE(within_triangles > covered / 2);
+            REQUIRE(mismatches < 4);
+        }
+
+        THEN("a box is occluded only when it is behind the occluders where it is on the screen")
+        {
+            // Behind the wall in the middle, and in front of it.
+            REQUIRE(buffer.occluded(box({ 0.0f, 0.0f, 15.0f }, 1.0f)));
+            REQUIRE(!buffer.occluded(box({ 0.0f, 0.0f, 8.0f }, 0.5f)));
+            // Behind it, but bigger than it on the screen.
+            REQUIRE(!buffer.occluded(box({ 0.0f, 0.0f, 20.0f }, 8.0f)));
+            // Under the floor.
+            REQUIRE(buffer.occluded(box({ 5.0f, -6.0f, 10.0f }, 1.0f)));
+            // Partly behind the near plane, and outside of the screen.
+            REQUIRE(!buffer.occluded(box({ 0.0f, -4.0f, 0.5f }, 1.0f)));
+            REQUIRE(!buffer.occluded(box({ 0.0f, 0.0f, -10.0f }, 1.0f)));
+        }
+
+        THEN("the boxes that it finds occluded are behind the reference raster")
+        {
+            const vector<Sample> reference = reference_raster(occluders, transform,
+                buffer.width(), buffer.height());
+            mt19937 generator(1);
+            uniform_real_distribution<float> position(-15.0f, 15.0f);
+            uniform_real_distribution<float> depth(2.0f, 40.0f);
+            uniform_real_distribution<float> size(0.1f, 3.0f);
+            int occluded = 0;
+            for (int i = 0; i < 2000; ++i)
+            {
+                const Aabb b = box({ position(generator), position(generator),
+                    depth(generator) }, size(generator));
+                if (!buffer.occluded(b))
+                    continue;
+                ++occluded;
+                float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+                float min_depth = FLT_MAX;
+                for (int corner = 0; corner < 8; ++corner)
+                {
+                    const XMVECTOR clip = XMVector4Transform(XMVectorSet(
+                        corner & 1 ? b.max_corner.x : b.min_corner.x,
+                        corner & 2 ? b.max_corner.y : b.min_corner.y,
+                        corner & 4 ? b.max_corner.z : b.min_corner.z, 1.0f), transform);
+                    const float w = XMVectorGetW(clip);
+                    min_x = min(min_x, (XMVectorGetX(clip) / w * 0.5f + 0.5f) * buffer.width());
+                    max_x = max(max_x, (XMVectorGetX(clip) / w * 0.5f + 0.5f) * buffer.width());
+                    min_y = min(min_y, (0.5f - XMVectorGetY(clip) / w * 0.5f) * buffer.height());
+                    max_y = max(max_y, (0.5f - XMVectorGetY(clip) / w * 0.5f) * buffer.height());
+                    min_depth = min(min_depth, XMVectorGetZ(clip) / w);
+                }
+                for (int y = max(0, static_cast<int>(min_y));
+                    y <= min(buffer.height() - 1, static_cast<int>(max_y)); ++y)
+                    for (int x = max(0, static_cast<int>(min_x));
+                        x <= min(buffer.width() - 1, static_cast<int>(max_x)); ++x)
+                        REQUIRE(reference[y * buffer.width() + x].depth < min_depth);
+            }
+            REQUIRE(occluded > 100);
+        }
+
+        WHEN("it is rasterized again without occluders")
+        {
+            buffer.rasterize(vector<Occluder>(), transform);
+
+            THEN("it is cleared, and nothing is occluded")
+            {
+                REQUIRE(buffer.triangles_count() == 0);
+                REQUIRE(buffer.depth(buffer.width() / 2, buffer.height() / 2) == 1.0f);
+                REQUIRE(!buffer.occluded(box({ 0.0f, 0.0f, 15.0f }, 1.0f)));
+            }
+        }
+    }
+}
+
+TEST_CASE("Occlusion buffer rasterization and tests", "[.benchmark]")
+{
+    // A room with walls, which the view looks along, and boxes spread over it and behind it.
+    constexpr int boxes_count = 100000;
+    constexpr int frames = 20;
+    vector<Occluder> occluders;
+    for (int i = 0; i < 32; ++i)
+        occluders.push_back(box_occluder({ (i % 4 - 1.5f) * 8.0f, 0.0f, 6.0f + (i / 4) * 6.0f },
+            { 3.0f, 5.0f, 0.2f }, (i % 3 - 1) * 0.3f));
+    occluders.push_back(box_occluder({ 0.0f, -5.0f, 25.0f }, { 30.0f, 0.1f, 30.0f }));
+    mt19937 generator(1);
+    uniform_real_distribution<float> position(-20.0f, 20.0f);
+    uniform_real_distribution<float> depth(2.0f, 80.0f);
+    uniform_real_distribution<float> size(0.1f, 1.0f);
+    vector<Aabb> boxes;
+    for (int i = 0; i < boxes_count; ++i)
+        boxes.push_back(box({ position(generator), position(generator) * 0.2f,
+            depth(generator) }, size(generator)));
+
+    Occlusion_buffer buffer;
+    const XMMATRIX transform = view_projection(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+        XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f), buffer.width(), buffer.height());
+    Time time;
+    time.seconds_since_last_call();
+    for (int i = 0; i < frames; ++i)
+        buffer.rasterize(occluders, transform);
+    const double rasterize_seconds = time.seconds_since_last_call() / frames;
+    int occluded = 0;
+    for (auto& b : boxes)
+        occluded += buffer.occluded(b);
+    const double test_seconds = time.seconds_since_last_call();
+
+    cout << buffer.width() << "x" << buffer.height() << " occlusion buffer, "
+        << buffer.triangles_count() << " occluder triangles\n"
+        << "  Rasterization: " << rasterize_seconds * 1000.0 << " ms\n"
+        << "  Box tests: " << boxes_count / test_seconds / 1e6 << " million per second, "
+        << occluded << " of " << boxes_count << " occluded\n";
+}
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Render_queue.h"
+#include "../Primitives.h"
+#include "../util.h"
+#include "../dx12_util.h"
+
+#include <climits>
+#include <iostream>
+
+
+using namespace std;
+
+
+ComPtr<ID3D12Device> create_device(); // See Scene_file_tests.cpp.
+
+
+namespace
+{
+    struct Test_objects
+    {
+        Test_objects(int object_count, int mesh_count);
+
+        ComPtr<ID3D12Device> device;
+        ComPtr<ID3D12CommandAllocator> allocator;
+        ComPtr<ID3D12GraphicsCommandList> command_list;
+        vector<shared_ptr<Mesh>> meshes;
+        vector<shared_ptr<Graphical_object>> objects;
+    };
+
+    // Every fourth object is dynamic, and the objects use the meshes in turn.
+    Test_objects::Test_objects(int object_count, int mesh_count) : device(create_device())
+    {
+        throw_if_failed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+            IID_PPV_ARGS(&allocator)));
+        command_list = create_command_list(*device.Get(), allocator);
+        for (int i = 0; i < mesh_count; ++i)
+            meshes.push_back(make_shared<Cube>(*device.Get(), *command_list.Get()));
+        for (int i = 0; i < object_count; ++i)
+            objects.push_back(make_shared<Graphical_object>(meshes[i % mesh_count],
+                vector<shared_ptr<Texture>>(), i, i % 7, i % 4 == 0 ? i / 4 : -1));
+    }
+}
+
+// Outside of the anonymous namespace, so that it is found by argument dependent lookup, e.g.
+// from the comparison of vectors in std.
+bool operator==(const Queued_draw& d1, const Queued_draw& d2)
+{
+    return d1.object == d2.object && d1.first_instance == d2.first_instance &&
+        d1.instances == d2.instances;
+}
+
+
+SCENARIO("The render queue")
+{
+    GIVEN("A queue built from some objects, where some of them are drawn as instances")
+    {
+        Test_objects t(10, 2);
+        // Objects 3 to 6 are instances of a static array, which is drawn by object 3.
+        for (int i = 3; i < 7; ++i)
+            t.objects[i] = make_shared<Graphical_object>(t.meshes[0],
+                vector<shared_ptr<Texture>>(), i, 0, -1, 7 - i);
+        Render_queue queue;
+        queue.build(t.objects);
+
+        THEN("it has a draw for each object that is not drawn by the object before it")
+        {
+            const vector<int> drawn = { 0, 1, 2, 3, 7, 8, 9 };
+            REQUIRE(queue.size() == drawn.size());
+            for (size_t i = 0; i < drawn.size(); ++i)
+            {
+                auto& object = *t.objects[drawn[i]];
+                REQUIRE(queue.object_ids()[i] == object.id());
+                REQUIRE(queue.dynamic_transform_refs()[i] == object.dynamic_transform_ref());
+                REQUIRE(queue.material_ids()[i] == object.material_id());
+                REQUIRE(&queue.mesh(static_cast<UINT>(i)) == &object.mesh());
+                REQUIRE(queue.instances()[i] == object.instances());
+            }
+            REQUIRE(queue.instances()[3] == 4);
+        }
+
+        THEN("the whole meshes are drawn, with and without meshlet culling")
+        {
+            for (auto meshlet_culling : { Meshlet_culling::disabled, Meshlet_culling::enabled })
+                for (size_t i = 0; i < queue.size(); ++i)
+                {
+                    const Draw_ranges& r = queue.ranges(meshlet_culling)[i];
+                    const Mesh& mesh = queue.mesh(static_cast<UINT>(i));
+                    REQUIRE(r.index_buffer == &mesh.index_buffer_view());
+                    REQUIRE(r.ranges == mesh.lod_ranges(0).data());
+                    REQUIRE(r.range_count == mesh.lod_ranges(0).size());
+                }
+        }
+
+        THEN("the objects with the same mesh have the same mesh id")
+        {
+            auto& mesh_ids = queue.mesh_ids();
+            REQUIRE(mesh_ids[0] == mesh_ids[2]);
+            REQUIRE(mesh_ids[0] == mesh_ids[3]);
+            REQUIRE(mesh_ids[1] != mesh_ids[0]);
+        }
+
+        WHEN("it is built again from fewer objects")
+        {
+            t.objects.resize(2);
+            queue.build(t.objects);
+
+            THEN("it only has those")
+            {
+                REQUIRE(queue.size() == 2);
+                REQUIRE(queue.ranges(Meshlet_culling::enabled).size() == 2);
+                REQUIRE(queue.object_ids()[1] == 1);
+            }
+        }
+    }
+
+    GIVEN("A queue built from plain objects, without meshes")
+    {
+        const D3D12_INDEX_BUFFER_VIEW index_buffer = {};
+        const Index_range range = { 0, 36, 0 };
+        const Index_range culled_range = { 0, 12, 0 };
+        const Draw_ranges r = { &index_buffer, &range, 1 };
+        const Draw_ranges culled = { &index_buffer, &culled_range, 1 };
+        const vector<Queued_object> objects = { { 0, -1, 2, 0, 1, r, culled },
+            { 1, 0, 3, 1, 4, r, culled } };
+        Render_queue queue;
+        queue.build(objects);
+
+        THEN("it has their values, and draws all their instances")
+        {
+            REQUIRE(queue.size() == 2);
+            REQUIRE(queue.object_ids()[1] == 1);
+            REQUIRE(queue.dynamic_transform_refs()[1] == 0);
+            REQUIRE(queue.material_ids()[1] == 3);
+            REQUIRE(queue.mesh_ids()[1] == 1);
+            REQUIRE(queue.instances_count() == 5);
+            const vector<Queued_draw> expected = { { 0, 0, 1 }, { 1, 0, 4 } };
+            REQUIRE(queue.draws(Frustum_culling::disabled) == expected);
+        }
+
+        WHEN("its ranges are updated")
+        {
+            queue.update_ranges();
+
+            THEN("they are kept")
+            {
+                REQUIRE(queue.ranges(Meshlet_culling::disabled)[1].ranges == &range);
+                REQUIRE(queue.ranges(Meshlet_culling::enabled)[1].ranges == &culled_range);
+            }
+        }
+    }
+}
+
+SCENARIO("Culling of the render queue")
+{
+    Test_objects t(0, 1);
+    const auto& mesh = t.meshes[0];
+    auto add = [&](int instances, int dynamic_transform_ref = -1)
+    {
+        const int id = static_cast<int>(t.objects.size());
+        for (int i = 0; i < instances; ++i)
+            t.objects.push_back(make_shared<Graphical_object>(mesh,
+                vector<shared_ptr<Texture>>(), id + i, 0, dynamic_transform_ref, instances - i));
+    };
+
+    GIVEN("A mesh")
+    {
+        THEN("it has bounds around its vertices")
+        {
+            REQUIRE(mesh->aabb_min().x == -0.5f);
+            REQUIRE(mesh->aabb_max().z == 0.5f);
+        }
+    }
+
+    GIVEN("A queue of an array of 20 instances, a dynamic object, a static object and an array "
+        "of 12 instances")
+    {
+        add(20);
+        add(1, 0);
+        add(1);
+        add(12);
+        Render_queue queue;
+        queue.build(t.objects);
+        vector<uint8_t> static_visible(t.objects.size(), 0);
+        vector<uint8_t> dynamic_visible(1, 0);
+
+        THEN("all the instances are drawn before it is culled")
+        {
+            REQUIRE(queue.instances_count() == 34);
+            REQUIRE(queue.visible_instances_count() == 34);
+            REQUIRE(queue.draws(Frustum_culling::enabled) ==
+                queue.draws(Frustum_culling::disabled));
+        }
+
+        WHEN("it is culled with instances 5 to 15 of the first array visible, except 10, the "
+            "static object, and only the first and last instance of the second array")
+        {
+            for (int id : { 5, 6, 7, 8, 9, 11, 12, 13, 14, 15, 21, 22, 33 })
+                static_visible[id] = 1;
+            queue.cull(static_visible, dynamic_visible);
+
+            THEN("only the visible instances are drawn, with culled ones between them only when "
+                "they are a few")
+            {
+                REQUIRE(queue.visible_instances_count() == 10 + 1 + 2);
+                const vector<Queued_draw> expected = { { 0, 5, 11 }, { 2, 0, 1 }, { 3, 0, 1 },
+                    { 3, 11, 1 } };
+                REQUIRE(queue.draws(Frustum_culling::enabled) == expected);
+            }
+
+            THEN("everything is still drawn without the culling, e.g. to the shadow maps")
+            {
+                const vector<Queued_draw> expected = { { 0, 0, 20 }, { 1, 0, 1 }, { 2, 0, 1 },
+                    { 3, 0, 12 } };
+                REQUIRE(queue.draws(Frustum_culling::disabled) == expected);
+            }
+        }
+
+        WHEN("it is culled with the visibility of both the static and the dynamic instances "
+            "given, as queries of a bounding volume hierarchy and a loose grid give it")
+        {
+            for (int id : { 0, 1, 33 })
+                static_visible[id] = 1;
+            dynamic_visible[0] = 1;
+            queue.cull(static_visible, dynamic_visible);
+
+            THEN("the given instances are drawn")
+            {
+                REQUIRE(queue.visible_instances_count() == 4);
+                const vector<Queued_draw> expected = { { 0, 0, 2 }, { 1, 0, 1 }, { 3, 11, 1 } };
+                REQUIRE(queue.draws(Frustum_culling::enabled) == expected);
+            }
+        }
+    }
+}
+
+TEST_CASE("Render queue traversal", "[.benchmark]")
+{
+    // What drawing the objects reads of them, as the scene did before it had render queues,
+    // and with a render queue. The objects are drawn several times per frame, e.g. for the
+    // shadow maps and the early z pass, so each list is traversed a few times.
+    constexpr int object_count = 100000;
+    constexpr int traversals = 10;
+    Test_objects t(object_count, 16);
+    Render_queue queue;
+    queue.build(t.objects);
+
+    Time time;
+    time.seconds_since_last_call();
+    size_t object_sum = 0;
+    for (int n = 0; n < traversals; ++n)
+        for (size_t i = 0; i < t.objects.size(); i += t.objects[i]->instances())
+        {
+            auto& object = t.objects[i];
+            const Draw_ranges r = object->draw_ranges(Meshlet_culling::enabled);
+            object_sum += object->id() + object->dynamic_transform_ref() +
+                object->material_id() + object->instances() + r.range_count +
+                static_cast<int>(object->mesh().vertex_format());
+        }
+    const double object_seconds = time.seconds_since_last_call();
+
+    size_t queue_sum = 0;
+    for (int n = 0; n < traversals; ++n)
+    {
+        auto& ranges = queue.ranges(Meshlet_culling::enabled);
+        UINT current_mesh = UINT_MAX;
+        int vertex_format = 0;
+        for (UINT i = 0; i < queue.size(); ++i)
+        {
+            if (queue.mesh_ids()[i] != current_mesh)
+            {
+                current_mesh = queue.mesh_ids()[i];
+                vertex_format = static_cast<int>(queue.mesh(i).vertex_format());
+            }
+            queue_sum += queue.object_ids()[i] + queue.dynamic_transform_refs()[i] +
+                queue.material_ids()[i] + queue.instances()[i] + ranges[i].range_count +
+                vertex_format;
+        }
+    }
+    const double queue_seconds = time.seconds_since_last_call();
+
+    REQUIRE(queue_sum == object_sum);
+    cout << "Traversing " << object_count << " objects " << traversals << " times\n"
+        << "  Through shared_ptrs: " << object_seconds * 1000.0 << " ms\n"
+        << "  In a render queue:   " << queue_seconds * 1000.0 << " ms\n";
+}
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Scatter.h"
+#include "../util.h"
+
+#include <iostream>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    Scatter_settings settings(int count, Scatter_sampling sampling)
+    {
+        Scatter_settings s;
+        s.count = count;
+        s.region_min = XMFLOAT3(-100.0f, 0.0f, -50.0f);
+        s.region_max = XMFLOAT3(100.0f, 20.0f, 50.0f);
+        s.min_scale = 0.5f;
+        s.max_scale = 2.0f;
+        s.random_rotation = true;
+        s.dynamic_fraction = 0.2f;
+        s.rotating_fraction = 0.1f;
+        s.flying_fraction = 0.05f;
+        s.sampling = sampling;
+        s.seed = 1;
+        return s;
+    }
+
+    bool inside(const vector<XMFLOAT3>& positions, const Scatter_settings& s)
+    {
+        for (auto& p : positions)
+            if (p.x < s.region_min.x || p.x > s.region_max.x ||
+                p.y < s.region_min.y || p.y > s.region_max.y ||
+                p.z < s.region_min.z || p.z > s.region_max.z)
+                return false;
+        return true;
+    }
+
+    float min_distance(const vector<XMFLOAT3>& positions)
+    {
+        float min_squared = FLT_MAX;
+        for (size_t i = 0; i < positions.size(); ++i)
+            for (size_t j = i + 1; j < positions.size(); ++j)
+            {
+                const XMVECTOR d = XMVectorSubtract(XMLoadFloat3(&positions[i]),
+                    XMLoadFloat3(&positions[j]));
+                min_squared = min(min_squared, XMVectorGetX(XMVector3LengthSq(d)));
+            }
+        return sqrt(min_squared);
+    }
+
+    bool same_positions(const vector<XMFLOAT3>& a, const vector<XMFLOAT3>& b)
+    {
+        return a.size() == b.size() &&
+            memcmp(a.data(), b.data(), a.size() * sizeof(XMFLOAT3)) == 0;
+    }
+
+    vector<Scattered_object> scattered_objects(const Scatter_settings& s)
+    {
+        vector<Scattered_object> objects;
+        scatter(s, [&](const Scattered_object& o) { objects.push_back(o); });
+        return objects;
+    }
+}
+
+
+SCENARIO("Scatter places the objects")
+{
+    for (auto sampling : { Scatter_sampling::jittered_grid, Scatter_sampling::poisson_disk })
+    {
+        GIVEN((sampling == Scatter_sampling::jittered_grid ? "Jittered grid sampling" :
+            "Poisson disk sampling"))
+        {
+            const Scatter_settings s = settings(2000, sampling);
+
+            THEN("there are as many positions as objects, and they are inside the region")
+            {
+                for (int count : { 0, 1, 7, 1000, 2000 })
+                {
+                    Scatter_settings with_count = s;
+                    with_count.count = count;
+                    const auto positions = scatter_positions(with_count);
+                    REQUIRE(positions.size() == count);
+                    REQUIRE(inside(positions, s));
+                }
+            }
+
+            THEN("the same seed gives the same positions, and another seed other positions")
+            {
+                Scatter_settings other_seed = s;
+                other_seed.seed = 2;
+                REQUIRE(same_positions(scatter_positions(s), scatter_positions(s)));
+                REQUIRE(!same_positions(scatter_positions(s), scatter_positions(other_seed)));
+            }
+
+            THEN("a flat region gives positions in its plane, covering all of it")
+            {
+                Scatter_settings flat = s;
+                flat.region_max.y = flat.region_min.y;
+                const auto positions = scatter_positions(flat);
+                REQUIRE(positions.size() == s.count);
+                XMFLOAT2 min_xz(FLT_MAX, FLT_MAX), max_xz(-FLT_MAX, -FLT_MAX);
+                for (auto& p : positions)
+                {
+                    REQUIRE(p.y == flat.region_min.y);
+                    min_xz = XMFLOAT2(min(min_xz.x, p.x), min(min_xz.y, p.z));
+                    max_xz = XMFLOAT2(max(max_xz.x, p.x), max(max_xz.y, p.z));
+                }
+                REQUIRE(min_xz.x < -90.0f);
+                REQUIRE(min_xz.y < -40.0f);
+                REQUIRE(max_xz.x > 90.0f);
+                REQUIRE(max_xz.y > 40.0f);
+            }
+        }
+    }
+
+    GIVEN("Poisson disk sampling")
+    {
+        const Scatter_settings s = settings(2000, Scatter_sampling::poisson_disk);
+
+        THEN("no two positions are much closer than the average distance between them")
+        {
+            const float volume = 200.0f * 20.0f * 100.0f;
+            const float average_distance = cbrt(volume / s.count);
+            REQUIRE(min_distance(scatter_positions(s)) > 0.5f * average_distance);
+        }
+    }
+
+    GIVEN("Some objects that have been scattered")
+    {
+        constexpr int count = 20000;
+        const Scatter_settings s = settings(count, Scatter_sampling::jittered_grid);
+        const auto objects = scattered_objects(s);
+        REQUIRE(objects.size() == count);
+
+        THEN("about the requested fractions of them move in each way")
+        {
+            int motions[4] = {};
+            for (auto& o : objects)
+                ++motions[static_cast<int>(o.motion)];
+            REQUIRE(abs(motions[static_cast<int>(Object_motion::dynamic)] - 0.2 * count) <
+                0.02 * count);
+            REQUIRE(abs(motions[static_cast<int>(Object_motion::rotating)] - 0.1 * count) <
+                0.02 * count);
+            REQUIRE(abs(motions[static_cast<int>(Object_motion::flying)] - 0.05 * count) <
+                0.02 * count);
+        }
+
+        THEN("they have scales in the range, and rotations that are unit quaternions")
+        {
+            for (auto& o : objects)
+            {
+                REQUIRE(o.position.w >= s.min_scale);
+                REQUIRE(o.position.w <= s.max_scale);
+                REQUIRE(abs(XMVectorGetX(XMVector4Length(XMLoadFloat4(&o.rotation))) - 1.0f) <
+                    1e-4f);
+            }
+        }
+
+        THEN("the flying objects fly around axes through them")
+        {
+            for (auto& o : objects)
+            {
+                const XMVECTOR axis = XMLoadFloat3(&o.rotation_axis);
+                const XMVECTOR radius = XMLoadFloat3(&o.point_on_radius);
+                REQUIRE(abs(XMVectorGetX(XMVector3Length(axis)) - 1.0f) < 1e-4f);
+                REQUIRE(abs(XMVectorGetX(XMVector3Dot(axis, radius))) < 1e-3f);
+                REQUIRE(XMVectorGetX(XMVector3Length(radius)) >= o.position.w);
+                REQUIRE(o.speed > 0.0f);
+            }
+        }
+
+        WHEN("they are scattered without random rotations")
+        {
+            Scatter_settings without_rotation = s;
+            without_rotation.random_rotation = false;
+            const auto not_rotated = scattered_objects(without_rotation);
+
+            THEN("they all have the identity rotation, and are otherwise the same")
+            {
+                for (size_t i = 0; i < objects.size(); ++i)
+                {
+                    REQUIRE(not_rotated[i].rotation.x == 0.0f);
+                    REQUIRE(not_rotated[i].rotation.y == 0.0f);
+                    REQUIRE(not_rotated[i].rotation.z == 0.0f);
+                    REQUIRE(not_rotated[i].rotation.w == 1.0f);
+                    REQUIRE(memcmp(&not_rotated[i].position, &objects[i].position,
+                        sizeof(XMFLOAT4)) == 0);
+                    REQUIRE(not_rotated[i].motion == objects[i].motion);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("A scene file with scattered objects")
+{
+    GIVEN("A scene file written with some scattered objects")
+    {
+        const Scatter_settings s = settings(1000, Scatter_sampling::jittered_grid);
+        ostringstream scene;
+        write_scatter_scene(scene, "model.obj", "texture.png", s);
+
+        THEN("it has a statement for each object, and for each that rotates or flies")
+        {
+            int motions[4] = {};
+            for (auto& o : scattered_objects(s))
+                ++motions[static_cast<int>(o.motion)];
+
+            istringstream lines(scene.str());
+            map<string, int> statements;
+            int static_objects = 0;
+            for (string line; getline(lines, line);)
+            {
+                const string statement = line.substr(0, line.find(' '));
+                ++statements[statement];
+                if (statement == "object" && line.find(" static ") != string::npos)
+                    ++static_objects;
+            }
+            REQUIRE(statements["object"] == s.count);
+            REQUIRE(static_objects == motions[static_cast<int>(Object_motion::none)]);
+            REQUIRE(statements["rotate"] == motions[static_cast<int>(Object_motion::rotating)]);
+            REQUIRE(statements["fly"] == motions[static_cast<int>(Object_motion::flying)]);
+            REQUIRE(statements["model"] == 1);
+            REQUIRE(statements["texture"] == 1);
+        }
+    }
+}
+
+TEST_CASE("Scatter a million objects", "[.benchmark]")
+{
+    constexpr int count = 1000000;
+    Time time;
+    for (auto sampling : { Scatter_sampling::jittered_grid, Scatter_sampling::poisson_disk })
+    {
+        const Scatter_settings s = settings(count, sampling);
+        time.seconds_since_last_call();
+        size_t objects = 0;
+        scatter(s, [&](const Scattered_object&) { ++objects; });
+        const double seconds = time.seconds_since_last_call();
+        REQUIRE(objects == count);
+        cout << (sampling == Scatter_sampling::jittered_grid ? "Jittered grid" :
+            "Poisson disk") << ", " << count << " objects: " << seconds << " s\n";
+    }
+}
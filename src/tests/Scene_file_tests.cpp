@@ -8,9 +8,15 @@
 #include "pch_tests.h"
 
 #include "../Scene_file.h"
+#include "../Compressed_file.h"
 #include "../Scene_components.h"
+#include "../Job_system.h"
+#include "../Mesh_cache.h"
 #include "../util.h"
 #include "../dx12_util.h"
+#include "Generated_obj_data.h"
+
+#include <iostream>
 
 
 using namespace std;
@@ -43,6 +49,50 @@ ComPtr<ID3D12Device> create_device()
 }
 
 
+namespace
+{
+    constexpr int objects_per_array = 1000;
+
+    // A scene with some named objects, followed by dynamic arrays of 10 x 10 x 10 objects, and
+    // some fly and rotate statements that refer to them. All the objects are dynamic, so the
+    // transform ref of an object is the same as its id.
+    string generate_scene(int named_objects, int arrays)
+    {
+        ostringstream scene;
+        scene << "model cube cube\n";
+        for (int i = 0; i < named_objects; ++i)
+            scene << "object o" << i << " dynamic cube none " << i % 100 << " " <<
+                i / 100 % 100 << " " << i / 10000 << " 1\n";
+        for (int i = 0; i < arrays; ++i)
+            scene << "array dynamic cube none 0 0 " << i * 20 << " 10 10 10 2 2 2 1\n";
+        for (int i = 0; i < arrays; ++i)
+            scene << "fly arrayobject" << named_objects + i * objects_per_array + i <<
+                " 1 0 0 0 1 0 10\n";
+        for (int i = 0; i < named_objects; i += 1000)
+            scene << "rotate o" << i << "\n";
+        return scene.str();
+    }
+
+    // The data in one stored block of a gzip file, which is cut off in the middle of the data.
+    string truncated_gzip(const string& data)
+    {
+        const uint16_t length = static_cast<uint16_t>(data.size());
+        string gzip = { '\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff',
+            1, // The last block, stored.
+            static_cast<char>(length & 0xff), static_cast<char>(length >> 8),
+            static_cast<char>(~length & 0xff), static_cast<char>(~length >> 8 & 0xff) };
+        return gzip + data.substr(0, data.size() / 2);
+    }
+
+    XMFLOAT4 translation(const Per_instance_transform& transform)
+    {
+        XMFLOAT4 t;
+        XMStoreFloat4(&t, convert_half4_to_vector(transform.translation));
+        return t;
+    }
+}
+
+
 SCENARIO("The scene parser works")
 {
     auto dev = create_device();
@@ -93,6 +143,20 @@ SCENARIO("The scene parser works")
         }
     }
 
+    GIVEN("A compressed scene file that has been cut off")
+    {
+        const string scene_file = "scene_file_test_truncated.sce.gz";
+        write_file(scene_file, truncated_gzip(generate_scene(100, 0)));
+
+        THEN("reading it throws, instead of giving the part of the scene before the cut")
+        {
+            REQUIRE_THROWS_AS(read_scene_file(scene_file, sc, device, *command_list.Get(),
+                texture_index, heap), Decompression_error);
+        }
+
+        remove(scene_file.c_str());
+    }
+
     GIVEN("Some slightly more complex scene file data")
     {
 
@@ -379,4 +443,234 @@ SCENARIO("The scene parser works")
         }
     }
 
+    GIVEN("Some scene file data that has a malformed number")
+    {
+        istringstream scene_data("model cube cube\n"
+                                 "object name static cube none 94 2x 76 4\n");
+
+        WHEN("the data is parsed")
+        {
+            THEN("the correct exception is thrown")
+            {
+                REQUIRE_THROWS_AS(read_scene_file_stream(scene_data, sc, device,
+                    *command_list.Get(), texture_index, heap),
+                    Read_error);
+            }
+        }
+    }
+
+    GIVEN("A generated scene with named objects and dynamic arrays")
+    {
+        constexpr int named_objects = 5000;
+        constexpr int arrays = 5;
+        istringstream scene_data(generate_scene(named_objects, arrays));
+
+        WHEN("the data has been parsed")
+        {
+            read_scene_file_stream(scene_data, sc, device, *command_list.Get(), texture_index,
+                heap);
+
+            THEN("all the objects are available")
+            {
+                constexpr int objects = named_objects + arrays * objects_per_array;
+                REQUIRE(sc.graphical_objects.size() == objects);
+                REQUIRE(sc.regular_objects.size() == objects);
+                REQUIRE(sc.static_model_transforms.size() == objects);
+                REQUIRE(sc.dynamic_model_transforms.size() == objects);
+                REQUIRE(sc.rotating_objects.size() == named_objects / 1000);
+            }
+
+            THEN("the array objects are found by their ids")
+            {
+                REQUIRE(sc.flying_objects.size() == arrays);
+                for (int i = 0; i < arrays; ++i)
+                {
+                    const auto& flying = sc.flying_objects[i];
+                    const int id = named_objects + i * objects_per_array + i;
+                    REQUIRE(flying.object->id() == id);
+                    REQUIRE(flying.transform_ref == id);
+
+                    // The i:th object of the i:th array, which has z innermost.
+                    const XMFLOAT4 t = translation(sc.dynamic_model_transforms[id]);
+                    REQUIRE(t.x == 2.0f * (i / 100));
+                    REQUIRE(t.y == 2.0f * (i / 10 % 10));
+                    REQUIRE(t.z == 20.0f * i + 2.0f * (i % 10));
+                }
+            }
+
+            THEN("the named objects are found by their names")
+            {
+                for (int i = 0; i < named_objects / 1000; ++i)
+                {
+                    const auto& rotating = sc.rotating_objects[i];
+                    REQUIRE(rotating.object->id() == i * 1000);
+                    REQUIRE(rotating.transform_ref == i * 1000);
+                    REQUIRE(translation(sc.dynamic_model_transforms[i * 1000]).y == i * 10 % 100);
+                }
+            }
+        }
+    }
+
+    GIVEN("Some scene file data with scattered objects")
+    {
+        constexpr int count = 1000;
+        istringstream scene_data("model cube cube\n"
+            "scatter separate cube none 1000 -50 0 -50 50 10 50 0.5 2 1 0.2 0.1 0.05 "
+            "jittered_grid 7\n"
+            "scatter instanced cube none 1000 -50 0 -50 50 10 50 0.5 2 1 0.2 0.1 0.05 "
+            "poisson_disk 7\n");
+
+        WHEN("the data has been parsed")
+        {
+            read_scene_file_stream(scene_data, sc, device, *command_list.Get(), texture_index,
+                heap);
+
+            THEN("all the objects are available, and some of them move")
+            {
+                REQUIRE(sc.graphical_objects.size() == 2 * count);
+                REQUIRE(sc.static_model_transforms.size() == 2 * count);
+                REQUIRE(!sc.dynamic_model_transforms.empty());
+                REQUIRE(!sc.rotating_objects.empty());
+                REQUIRE(!sc.flying_objects.empty());
+            }
+
+            THEN("the instanced objects are in runs of consecutive transform refs")
+            {
+                for (size_t i = count; i < sc.graphical_objects.size();)
+                {
+                    const auto& first = sc.graphical_objects[i];
+                    for (int j = 1; j < first->instances(); ++j)
+                    {
+                        const auto& o = sc.graphical_objects[i + j];
+                        REQUIRE(o->instances() == first->instances() - j);
+                        REQUIRE(o->dynamic_transform_ref() == (first->dynamic_transform_ref() < 0 ?
+                            -1 : first->dynamic_transform_ref() + j));
+                    }
+                    i += first->instances();
+                }
+            }
+        }
+    }
+
+    GIVEN("Some scene file data with a scatter that has an unknown sampling")
+    {
+        istringstream scene_data("model cube cube\n"
+            "scatter separate cube none 10 0 0 0 1 1 1 1 1 0 0 0 0 random 1\n");
+
+        WHEN("the data is parsed")
+        {
+            THEN("the correct exception is thrown")
+            {
+                REQUIRE_THROWS_AS(read_scene_file_stream(scene_data, sc, device,
+                    *command_list.Get(), texture_index, heap),
+                    Read_error);
+            }
+        }
+    }
+
+    GIVEN("Some scene file data that refers to an array object that does not exist")
+    {
+        istringstream scene_data("model cube cube\n"
+                                 "array dynamic cube none 0 0 0 2 2 2 1 1 1 1\n"
+                                 "fly arrayobject8 1 0 0 0 1 0 10\n");
+
+        WHEN("the data is parsed")
+        {
+            THEN("the correct exception is thrown")
+            {
+                REQUIRE_THROWS_AS(read_scene_file_stream(scene_data, sc, device,
+                    *command_list.Get(), texture_index, heap),
+                    Object_not_defined);
+            }
+        }
+    }
+
+}
+
+TEST_CASE("Scene file with a million objects", "[.benchmark]")
+{
+    auto dev = create_device();
+    auto& device = *dev.Get();
+    ComPtr<ID3D12CommandAllocator> allocator;
+    throw_if_failed(device.CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+        IID_PPV_ARGS(&allocator)));
+    auto command_list = create_command_list(device, allocator);
+    ComPtr<ID3D12DescriptorHeap> texture_descriptor_heap;
+    create_texture_descriptor_heap(dev, texture_descriptor_heap, 1);
+    int texture_index = 0;
+
+    // Half of them are named, and half are in arrays.
+    constexpr int named_objects = 500000;
+    constexpr int arrays = 500;
+    istringstream scene_data(generate_scene(named_objects, arrays));
+
+    Scene_components sc;
+    Time time;
+    time.seconds_since_last_call();
+    read_scene_file_stream(scene_data, sc, device, *command_list.Get(), texture_index,
+        *texture_descriptor_heap.Get());
+    const double seconds = time.seconds_since_last_call();
+
+    REQUIRE(sc.graphical_objects.size() == named_objects + arrays * objects_per_array);
+    REQUIRE(sc.flying_objects.size() == arrays);
+    cout << "Parsing a scene file with " << sc.graphical_objects.size() << " objects: " <<
+        seconds << " s, " << sc.graphical_objects.size() / seconds / 1e6 <<
+        " million objects per second\n";
+}
+
+TEST_CASE("Scene file with many models", "[.benchmark]")
+{
+    auto dev = create_device();
+    auto& device = *dev.Get();
+    ComPtr<ID3D12DescriptorHeap> texture_descriptor_heap;
+    create_texture_descriptor_heap(dev, texture_descriptor_heap, 1);
+
+    // The models are read by the background jobs of the job system, while the scene file is
+    // parsed, so the time should go down with more workers until the parsing dominates. It
+    // needs a device, since the scene pass creates the meshes on it. The parsing of one model
+    // over several threads is measured without one, see "Parallel Obj parsing scaling".
+    constexpr int model_count = 64;
+    constexpr int quads_per_side = 150;
+    ostringstream scene;
+    vector<string> model_files;
+    for (int i = 0; i < model_count; ++i)
+    {
+        const string model = "scene_file_benchmark_" + to_string(i) + ".obj";
+        model_files.push_back(data_path + model);
+        write_file(model_files.back(), generate_grid_obj(quads_per_side));
+        scene << "model m" << i << " " << model << "\n"
+            << "object o" << i << " static m" << i << " none " << i << " 0 0 1\n";
+    }
+    const string scene_text = scene.str();
+
+    const int max_worker_count = Job_system::default_worker_count();
+    for (int worker_count = 1; worker_count <= max_worker_count; worker_count *= 2)
+    {
+        // The mesh caches that a read writes would make the next one faster.
+        for (auto& file : model_files)
+            remove(mesh_cache_file_name(file).c_str());
+        Job_system jobs(worker_count);
+        ComPtr<ID3D12CommandAllocator> allocator;
+        throw_if_failed(device.CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT,
+            IID_PPV_ARGS(&allocator)));
+        auto command_list = create_command_list(device, allocator);
+        istringstream scene_data(scene_text);
+        Scene_components sc;
+        int texture_index = 0;
+        Time time;
+        time.seconds_since_last_call();
+        read_scene_file_stream(scene_data, sc, device, *command_list.Get(), texture_index,
+            *texture_descriptor_heap.Get(), jobs);
+        const double seconds = time.seconds_since_last_call();
+
+        REQUIRE(sc.graphical_objects.size() == model_count);
+        cout << "Reading a scene with " << model_count << " models, " << worker_count <<
+            " workers: " << seconds * 1000.0 << " ms\n";
+    }
+
+    for (auto& file : model_files)
+    {
+        remove(file.c_str());
+        remove(mesh_cache_file_name(file).c_str());
+    }
 }
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Scene_snapshot.h"
+#include "../util.h"
+#include "Generated_obj_data.h"
+
+#include <iostream>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    template<typename T>
+    bool same_bytes(const vector<T>& a, const vector<T>& b)
+    {
+        return a.size() == b.size() && (a.empty() ||
+            memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    }
+
+    bool same_snapshots(const Scene_snapshot& a, const Scene_snapshot& b)
+    {
+        bool same_models = a.models.size() == b.models.size();
+        for (size_t i = 0; same_models && i < a.models.size(); ++i)
+            same_models = a.models[i].file == b.models[i].file &&
+                a.models[i].flip_v == b.models[i].flip_v;
+        return same_models && a.dependencies == b.dependencies &&
+            a.texture_files == b.texture_files && a.object_textures == b.object_textures &&
+            same_bytes(a.meshes, b.meshes) && same_bytes(a.objects, b.objects) &&
+            same_bytes(a.flying_objects, b.flying_objects) &&
+            same_bytes(a.rotating_objects, b.rotating_objects) &&
+            same_bytes(a.dynamic_model_transforms, b.dynamic_model_transforms) &&
+            same_bytes(a.static_model_transforms, b.static_model_transforms) &&
+            same_bytes(a.materials, b.materials) && same_bytes(a.lights, b.lights) &&
+            memcmp(&a.ambient_light, &b.ambient_light, sizeof(XMFLOAT4)) == 0 &&
+            a.shadow_casting_lights_count == b.shadow_casting_lights_count &&
+            memcmp(&a.initial_view_position, &b.initial_view_position, sizeof(XMFLOAT3)) == 0 &&
+            memcmp(&a.initial_view_focus_point, &b.initial_view_focus_point,
+                sizeof(XMFLOAT3)) == 0;
+    }
+
+    Per_instance_transform transform(float x, float y, float z)
+    {
+        return { convert_float4_to_half4(XMFLOAT4(x, y, z, 1.0f)),
+            convert_float4_to_half4(XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f)) };
+    }
+
+    // Two objects with a model mesh and one with a cube, where one of them flies, and one
+    // rotates.
+    Scene_snapshot example_snapshot(const string& scene_file, const string& model_file)
+    {
+        Scene_snapshot s;
+        s.dependencies = { scene_file, model_file };
+        s.models = { { model_file, true } };
+        s.meshes = { { 0, 0 }, { 0, 1 }, { Scene_snapshot::cube, 0 } };
+        s.texture_files = { "../data/diffuse.png", "", "../data/normal.png" };
+        s.objects = { { 0, 0, 2, 0, -1, 1, 0 }, { 1, 2, 1, 1, 0, 1, 4 },
+            { 2, 3, 0, 2, 1, 1, 0 } };
+        s.object_textures = { 0, 2, 1 };
+        s.flying_objects = { { 1, XMFLOAT3(1, 2, 3), XMFLOAT3(0, 1, 0), 1.5f, 0 } };
+        s.rotating_objects = { { 2, 1 } };
+        s.static_model_transforms = { transform(0, 0, 0), transform(1, 0, 0),
+            transform(2, 0, 0) };
+        s.dynamic_model_transforms = { transform(1, 0, 0), transform(2, 0, 0) };
+        s.materials = { { 0, 2, 0, 3 }, { 1, 0, 0, 4 }, { 0, 0, 0, 0 } };
+        Light light = {};
+        light.position = XMFLOAT4(1, 10, 1, 1);
+        light.color = XMFLOAT4(1, 1, 1, 1);
+        light.diffuse_intensity = 20.0f;
+        s.lights = { light };
+        s.ambient_light = XMFLOAT4(0.1f, 0.2f, 0.3f, 1.0f);
+        s.shadow_casting_lights_count = 1;
+        s.initial_view_position = XMFLOAT3(0, 5, -10);
+        s.initial_view_focus_point = XMFLOAT3(0, 0, 0);
+        return s;
+    }
+
+    string file_content(const string& file_name)
+    {
+        ifstream file(file_name, ios::binary);
+        return string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    }
+}
+
+
+SCENARIO("The scene snapshot")
+{
+    const string scene_file = "scene_snapshot_test.sce";
+    const string model_file = "scene_snapshot_test.obj";
+    const string snapshot_file = scene_snapshot_file_name(scene_file);
+    write_file(scene_file, "model m " + model_file + "\n");
+    write_file(model_file, generate_grid_obj(2));
+    const Scene_snapshot snapshot = example_snapshot(scene_file, model_file);
+
+    GIVEN("A snapshot that has been written")
+    {
+        REQUIRE(write_scene_snapshot(snapshot_file, snapshot));
+
+        WHEN("it is read")
+        {
+            Scene_snapshot read;
+            bool valid = read_scene_snapshot(snapshot_file, read);
+
+            THEN("it is the same")
+            {
+                REQUIRE(valid);
+                REQUIRE(same_snapshots(snapshot, read));
+            }
+        }
+
+        WHEN("the scene file has been changed")
+        {
+            write_file(scene_file, "model m " + model_file + "\nmodel c cube\n");
+            Scene_snapshot read;
+            THEN("it is not valid")
+            {
+                REQUIRE(!read_scene_snapshot(snapshot_file, read));
+                REQUIRE(read.objects.empty());
+            }
+        }
+
+        WHEN("a model file has been changed")
+        {
+            write_file(model_file, generate_grid_obj(3));
+            Scene_snapshot read;
+            THEN("it is not valid")
+            {
+                REQUIRE(!read_scene_snapshot(snapshot_file, read));
+            }
+        }
+
+        WHEN("the snapshot file has been truncated")
+        {
+            const string content = file_content(snapshot_file);
+            Scene_snapshot read;
+            THEN("it is not valid, wherever it was cut")
+            {
+                for (size_t size : { size_t(0), size_t(10), content.size() / 2,
+                    content.size() - 1 })
+                {
+                    write_file(snapshot_file, content.substr(0, size));
+                    REQUIRE(!read_scene_snapshot(snapshot_file, read));
+                }
+                REQUIRE(read.objects.empty());
+            }
+        }
+    }
+
+    GIVEN("Snapshots with references to a mesh, a material, a transform or lights that don't "
+        "exist")
+    {
+        vector<Scene_snapshot> invalid(8, snapshot);
+        invalid[0].objects[1].mesh = 3;
+        invalid[1].objects[1].material_id = 3;
+        invalid[2].objects[1].dynamic_transform_ref = 2;
+        invalid[3].objects[2].instances = 2; // Its transforms would be 1 and 2.
+        invalid[4].flying_objects[0].transform_ref = 2;
+        invalid[5].rotating_objects[0].transform_ref = -1;
+        invalid[6].shadow_casting_lights_count = 2;
+        invalid[7].static_model_transforms.pop_back();
+
+        THEN("they are not valid")
+        {
+            for (auto& s : invalid)
+            {
+                REQUIRE(write_scene_snapshot(snapshot_file, s));
+                Scene_snapshot read;
+                REQUIRE(!read_scene_snapshot(snapshot_file, read));
+            }
+        }
+    }
+
+    GIVEN("A snapshot with an object without a material")
+    {
+        Scene_snapshot without_material = snapshot;
+        without_material.objects[0].material_id = -1;
+        REQUIRE(write_scene_snapshot(snapshot_file, without_material));
+
+        THEN("it is valid")
+        {
+            Scene_snapshot read;
+            REQUIRE(read_scene_snapshot(snapshot_file, read));
+        }
+    }
+
+    GIVEN("A snapshot that depends on a file that does not exist")
+    {
+        Scene_snapshot invalid = snapshot;
+        invalid.dependencies.push_back("scene_snapshot_test_missing.obj");
+
+        THEN("it is not written")
+        {
+            REQUIRE(!write_scene_snapshot(snapshot_file, invalid));
+        }
+    }
+
+    remove(scene_file.c_str());
+    remove(model_file.c_str());
+    remove(snapshot_file.c_str());
+}
+
+TEST_CASE("Scene snapshot reading", "[.benchmark]")
+{
+    // The part of the startup that the snapshot replaces, for a scene with many objects: the
+    // records are copied as they are, instead of being parsed and resolved by name.
+    constexpr int object_count = 100000;
+    const string scene_file = "scene_snapshot_benchmark.sce";
+    const string snapshot_file = scene_snapshot_file_name(scene_file);
+    ostringstream scene;
+    scene << "texture t diffuse.png\nmodel m cube\n";
+    Scene_snapshot snapshot;
+    snapshot.dependencies = { scene_file };
+    snapshot.meshes = { { Scene_snapshot::cube, 0 } };
+    snapshot.texture_files = { "../data/diffuse.png" };
+    snapshot.object_textures = { 0 };
+    for (int i = 0; i < object_count; ++i)
+    {
+        scene << "object o" << i << " static m t " << i % 100 << " " << i / 100 << " 0 1\n";
+        snapshot.objects.push_back({ 0, 0, 1, 0, -1, 1, 0 });
+        snapshot.static_model_transforms.push_back(transform(static_cast<float>(i % 100),
+            static_cast<float>(i / 100), 0.0f));
+    }
+    snapshot.materials = { { 0, 0, 0, 1 } };
+    write_file(scene_file, scene.str());
+
+    Time time;
+    time.seconds_since_last_call();
+    REQUIRE(write_scene_snapshot(snapshot_file, snapshot));
+    const double write_seconds = time.seconds_since_last_call();
+    Scene_snapshot read;
+    REQUIRE(read_scene_snapshot(snapshot_file, read));
+    const double read_seconds = time.seconds_since_last_call();
+    REQUIRE(read.objects.size() == object_count);
+
+    cout << object_count << " objects, scene file " << scene.str().size() / 1024 <<
+        " KB, snapshot " << file_content(snapshot_file).size() / 1024 << " KB\n"
+        << "  Writing the snapshot: " << write_seconds * 1000.0 << " ms\n"
+        << "  Reading the snapshot: " << read_seconds * 1000.0 << " ms\n";
+
+    remove(scene_file.c_str());
+    remove(snapshot_file.c_str());
+}
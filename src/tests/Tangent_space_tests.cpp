@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Tangent_space.h"
+#include "../util.h"
+
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+using namespace DirectX;
+using DirectX::PackedVector::XMConvertFloatToHalf;
+using DirectX::PackedVector::XMConvertHalfToFloat;
+
+
+namespace
+{
+    // Unindexed faces with random positions and texture coordinates, like the Obj parser
+    // gives before welding. The texture coordinates are rounded to half, as in the vertices.
+    void create_random_faces(size_t face_count, Vertices& vertices, vector<int>& indices)
+    {
+        mt19937 random(1);
+        uniform_real_distribution<float> position(-10.0f, 10.0f);
+        uniform_real_distribution<float> texture_coord(0.0f, 1.0f);
+        for (size_t i = 0; i < face_count * vertex_count_per_face; ++i)
+        {
+            const float u = XMConvertHalfToFloat(XMConvertFloatToHalf(texture_coord(random)));
+            vertices.positions.push_back({ position(random), position(random),
+                position(random), u });
+            vertices.normals.push_back({ 0, 0, 0, XMConvertFloatToHalf(texture_coord(random)) });
+            indices.push_back(static_cast<int>(i));
+        }
+    }
+
+    XMVECTOR position(const Vertices& vertices, int i)
+    {
+        return XMVectorSetW(XMLoadFloat4(&vertices.positions[i]), 0.0f);
+    }
+
+    XMVECTOR texture_coords(const Vertices& vertices, int i)
+    {
+        return XMVectorSet(vertices.positions[i].w,
+            XMConvertHalfToFloat(vertices.normals[i].w), 0.0f, 0.0f);
+    }
+
+    XMVECTOR load(const Vector_components& v, size_t i)
+    {
+        return XMVectorSet(v.x[i], v.y[i], v.z[i], 0.0f);
+    }
+
+    bool near(FXMVECTOR a, FXMVECTOR b, float epsilon)
+    {
+        return XMVectorGetX(XMVector3Length(a - b)) <= epsilon;
+    }
+
+    // A flat grid in the xz plane facing up, with u along x and v along z. If mirrored, u
+    // goes the other way.
+    void create_grid(int quads_per_side, bool mirrored, Vertices& vertices,
+        vector<int>& indices)
+    {
+        const int vertices_per_side = quads_per_side + 1;
+        for (int z = 0; z < vertices_per_side; ++z)
+            for (int x = 0; x < vertices_per_side; ++x)
+            {
+                const float u = (mirrored ? quads_per_side - x : x) / float(quads_per_side);
+                const float v = z / float(quads_per_side);
+                vertices.positions.push_back({ float(x), 0.0f, float(z), u });
+                vertices.normals.push_back({ XMConvertFloatToHalf(0.0f),
+                    XMConvertFloatToHalf(1.0f), XMConvertFloatToHalf(0.0f),
+                    XMConvertFloatToHalf(v) });
+            }
+
+        for (int z = 0; z < quads_per_side; ++z)
+            for (int x = 0; x < quads_per_side; ++x)
+            {
+                const int i0 = z * vertices_per_side + x;
+                const int i1 = i0 + 1;
+                const int i2 = i0 + vertices_per_side;
+                const int i3 = i2 + 1;
+                indices.insert(indices.end(), { i0, i2, i1, i1, i2, i3 });
+            }
+    }
+}
+
+
+SCENARIO("Tangent space calculation for whole meshes")
+{
+    GIVEN("Faces with random positions and texture coordinates")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        constexpr size_t face_count = 40003; // Not a multiple of four, and enough for threads.
+        create_random_faces(face_count, vertices, indices);
+
+        THEN("the faces get the same tangents and bitangents as with the per face function")
+        {
+            constexpr int max_thread_count = 4;
+            auto frames = calculate_face_tangent_frames(tangent_space_input(vertices), indices,
+                max_thread_count);
+            REQUIRE(frames.tangents.x.size() == face_count);
+            REQUIRE(frames.bitangents.z.size() == face_count);
+
+            constexpr float epsilon = 1e-4f;
+            for (size_t face = 0; face < face_count; ++face)
+            {
+                XMVECTOR v[vertex_count_per_face];
+                XMVECTOR uv[vertex_count_per_face];
+                for (int c = 0; c < vertex_count_per_face; ++c)
+                {
+                    const int i = indices[face * vertex_count_per_face + c];
+                    v[c] = position(vertices, i);
+                    uv[c] = texture_coords(vertices, i);
+                }
+                XMVECTOR tangent, bitangent;
+                calculate_tangent_space_basis(v, uv, tangent, bitangent);
+                if (XMVectorGetX(XMVector3Length(tangent)) > 0.99f) // I.e. not NaN.
+                {
+                    REQUIRE(near(load(frames.tangents, face), tangent, epsilon));
+                    REQUIRE(near(load(frames.bitangents, face), bitangent, epsilon));
+                }
+            }
+        }
+
+        THEN("set_face_tangents stores them in the corners of the faces")
+        {
+            Vertices per_face = vertices;
+            per_face.tangents.clear();
+            per_face.bitangents.clear();
+            for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+            {
+                XMVECTOR v[vertex_count_per_face];
+                XMVECTOR uv[vertex_count_per_face];
+                for (int c = 0; c < vertex_count_per_face; ++c)
+                {
+                    v[c] = position(vertices, indices[i + c]);
+                    uv[c] = texture_coords(vertices, indices[i + c]);
+                }
+                calculate_and_add_tangent_and_bitangent(v, uv, per_face);
+            }
+
+            set_face_tangents(vertices, indices, 1);
+            REQUIRE(vertices.tangents.size() == vertices.positions.size());
+            REQUIRE(vertices.bitangents.size() == vertices.positions.size());
+            // They are rounded to half, so allow for one step of that.
+            constexpr float epsilon = 2e-3f;
+            for (size_t i = 0; i < vertices.positions.size(); ++i)
+            {
+                const XMVECTOR tangent = convert_half4_to_vector(per_face.tangents[i]);
+                if (XMVectorGetX(XMVector3Length(tangent)) > 0.99f)
+                {
+                    REQUIRE(near(convert_half4_to_vector(vertices.tangents[i]), tangent,
+                        epsilon));
+                    REQUIRE(near(convert_half4_to_vector(vertices.bitangents[i]),
+                        convert_half4_to_vector(per_face.bitangents[i]), epsilon));
+                }
+            }
+        }
+    }
+
+    GIVEN("A face without texture mapping")
+    {
+        Vertices vertices;
+        vertices.positions = { { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 } };
+        vertices.normals.resize(3);
+
+        THEN("it gets zero vectors instead of NaN")
+        {
+            auto frames = calculate_face_tangent_frames(tangent_space_input(vertices),
+                { 0, 1, 2 }, 1);
+            REQUIRE(frames.tangents.x[0] == 0.0f);
+            REQUIRE(frames.tangents.y[0] == 0.0f);
+            REQUIRE(frames.tangents.z[0] == 0.0f);
+            REQUIRE(frames.bitangents.x[0] == 0.0f);
+            REQUIRE(frames.bitangents.y[0] == 0.0f);
+            REQUIRE(frames.bitangents.z[0] == 0.0f);
+        }
+    }
+
+    GIVEN("An indexed grid with u along x and v along z")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_grid(8, false, vertices, indices);
+
+        WHEN("the tangents are calculated per vertex")
+        {
+            calculate_vertex_tangents(vertices, indices, 1);
+
+            THEN("every vertex gets one, which follows the texture mapping")
+            {
+                REQUIRE(vertices.tangents.size() == vertices.positions.size());
+                for (size_t i = 0; i < vertices.positions.size(); ++i)
+                {
+                    REQUIRE(near(convert_half4_to_vector(vertices.tangents[i]),
+                        XMVectorSet(1, 0, 0, 0), 1e-3f));
+                    REQUIRE(near(convert_half4_to_vector(vertices.bitangents[i]),
+                        XMVectorSet(0, 0, 1, 0), 1e-3f));
+                }
+            }
+        }
+    }
+
+    GIVEN("An indexed grid with mirrored texture mapping")
+    {
+        Vertices vertices;
+        vector<int> indices;
+        create_grid(8, true, vertices, indices);
+
+        THEN("the tangent is flipped, and the bitangent still follows v")
+        {
+            calculate_vertex_tangents(vertices, indices, 1);
+            for (size_t i = 0; i < vertices.positions.size(); ++i)
+            {
+                REQUIRE(near(convert_half4_to_vector(vertices.tangents[i]),
+                    XMVectorSet(-1, 0, 0, 0), 1e-3f));
+                REQUIRE(near(convert_half4_to_vector(vertices.bitangents[i]),
+                    XMVectorSet(0, 0, 1, 0), 1e-3f));
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Tangent space calculation", "[.benchmark]")
+{
+    Vertices vertices;
+    vector<int> indices;
+    constexpr size_t face_count = 1000000;
+    create_random_faces(face_count, vertices, indices);
+
+    Time time;
+    time.seconds_since_last_call();
+    Vertices per_face;
+    for (size_t i = 0; i < indices.size(); i += vertex_count_per_face)
+    {
+        XMVECTOR v[vertex_count_per_face];
+        XMVECTOR uv[vertex_count_per_face];
+        for (int c = 0; c < vertex_count_per_face; ++c)
+        {
+            v[c] = position(vertices, indices[i + c]);
+            uv[c] = texture_coords(vertices, indices[i + c]);
+        }
+        calculate_and_add_tangent_and_bitangent(v, uv, per_face);
+    }
+    const double per_face_seconds = time.seconds_since_last_call();
+
+    set_face_tangents(vertices, indices, 1);
+    const double batch_seconds = time.seconds_since_last_call();
+
+    const int thread_count = max(1, static_cast<int>(thread::hardware_concurrency()));
+    set_face_tangents(vertices, indices, thread_count);
+    const double parallel_seconds = time.seconds_since_last_call();
+
+    cout << face_count << " faces, tangent space calculated in:\n"
+        << "  Per face: " << per_face_seconds * 1000.0 << " ms\n"
+        << "  Batch: " << batch_seconds * 1000.0 << " ms\n"
+        << "  Batch with " << thread_count << " threads: " << parallel_seconds * 1000.0
+        << " ms\n";
+}
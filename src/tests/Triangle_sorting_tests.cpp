@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Triangle_sorting.h"
+#include "../Mesh.h"
+#include "../util.h"
+
+#include <iostream>
+#include <memory>
+#include <random>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    vector<XMFLOAT3> random_centers(size_t count, float min, float max)
+    {
+        mt19937 random(1);
+        uniform_real_distribution<float> coordinate(min, max);
+        vector<XMFLOAT3> centers;
+        for (size_t i = 0; i < count; ++i)
+            centers.push_back({ coordinate(random), coordinate(random), coordinate(random) });
+        return centers;
+    }
+
+    float view_depth(const XMFLOAT3& center, FXMMATRIX model_view)
+    {
+        return XMVectorGetZ(XMVector3Transform(XMLoadFloat3(&center), model_view));
+    }
+
+    bool is_permutation_of_triangles(const vector<UINT>& order)
+    {
+        vector<bool> seen(order.size());
+        for (UINT i : order)
+        {
+            if (i >= order.size() || seen[i])
+                return false;
+            seen[i] = true;
+        }
+        return true;
+    }
+}
+
+
+SCENARIO("Triangle sorting")
+{
+    GIVEN("Triangles with centers both in front of and behind the eye")
+    {
+        constexpr size_t count = 10001; // Not a multiple of four.
+        const auto centers = random_centers(count, -100.0f, 100.0f);
+        Triangle_sorter sorter(centers);
+
+        const XMMATRIX model_view = XMMatrixRotationRollPitchYaw(0.3f, 1.2f, -0.5f) *
+            XMMatrixLookAtRH(XMVectorSet(10, 20, 30, 1), XMVectorZero(),
+                XMVectorSet(0, 1, 0, 0));
+
+        WHEN("they are sorted back to front")
+        {
+            const auto& order = sorter.sort_back_to_front(model_view);
+
+            THEN("all of them are there once, with the lowest view space z first")
+            {
+                REQUIRE(order.size() == count);
+                REQUIRE(is_permutation_of_triangles(order));
+                for (size_t i = 1; i < count; ++i)
+                    REQUIRE(view_depth(centers[order[i - 1]], model_view) <=
+                        view_depth(centers[order[i]], model_view));
+            }
+
+            AND_WHEN("they are sorted again from the other side")
+            {
+                const XMMATRIX flipped = model_view * XMMatrixScaling(1, 1, -1);
+                const auto& again = sorter.sort_back_to_front(flipped);
+                REQUIRE(is_permutation_of_triangles(again));
+                for (size_t i = 1; i < count; ++i)
+                    REQUIRE(view_depth(centers[again[i - 1]], model_view) >=
+                        view_depth(centers[again[i]], model_view));
+            }
+        }
+    }
+
+    GIVEN("Triangles at the same depth")
+    {
+        const vector<XMFLOAT3> centers = { { 0, 0, -2 }, { 1, 0, -5 }, { 2, 0, -2 },
+            { 3, 0, -5 }, { 4, 0, -2 } };
+        Triangle_sorter sorter(centers);
+
+        THEN("they are kept in their order")
+        {
+            const auto& order = sorter.sort_back_to_front(XMMatrixIdentity());
+            REQUIRE(order == vector<UINT>({ 1, 3, 0, 2, 4 }));
+        }
+
+        THEN("the count is of the triangles, not of their centers padded to a multiple of "
+            "four, so that all of their indices can be written in the order of the mesh")
+        {
+            REQUIRE(sorter.triangle_count() == centers.size());
+            vector<UINT> order(sorter.triangle_count());
+            vector<UINT> indices(centers.size() * vertex_count_per_face);
+            for (UINT i = 0; i < order.size(); ++i)
+                order[i] = i;
+            for (UINT i = 0; i < indices.size(); ++i)
+                indices[i] = i;
+            vector<uint32_t> destination(indices.size());
+            write_triangles_in_order(order, indices, destination.data());
+            REQUIRE(equal(destination.begin(), destination.end(), indices.begin()));
+        }
+    }
+
+    GIVEN("No triangles")
+    {
+        Triangle_sorter sorter(vector<XMFLOAT3>{});
+        REQUIRE(sorter.sort_back_to_front(XMMatrixIdentity()).empty());
+    }
+
+    GIVEN("The indices of three triangles")
+    {
+        const vector<UINT> indices = { 0, 1, 2, 70000, 70001, 70002, 6, 7, 8 };
+        const vector<UINT> order = { 2, 0, 1 };
+
+        THEN("they are written in order, three indices per triangle")
+        {
+            vector<uint32_t> destination(indices.size());
+            write_triangles_in_order(order, indices, destination.data());
+            REQUIRE(destination == vector<uint32_t>({ 6, 7, 8, 0, 1, 2, 70000, 70001, 70002 }));
+        }
+
+        THEN("they can be written as 16 bit indices")
+        {
+            const vector<UINT> small_indices = { 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+            vector<uint16_t> destination(small_indices.size());
+            write_triangles_in_order(order, small_indices, destination.data());
+            REQUIRE(destination == vector<uint16_t>({ 6, 7, 8, 0, 1, 2, 3, 4, 5 }));
+        }
+    }
+}
+
+
+TEST_CASE("Transparent triangle sorting", "[.benchmark]")
+{
+    constexpr size_t triangle_count = 100000;
+    const auto centers = random_centers(triangle_count, -10.0f, 10.0f);
+    const XMMATRIX model_view = XMMatrixLookAtRH(XMVectorSet(15, 5, 25, 1), XMVectorZero(),
+        XMVectorSet(0, 1, 0, 0));
+    constexpr int frame_count = 100;
+
+    // The way it was done before, with one object per triangle, which were sorted by their
+    // transformed centers, and drawn with one call each.
+    struct Triangle_object
+    {
+        XMFLOAT3 center;
+        XMFLOAT3 transformed_center;
+    };
+    vector<shared_ptr<Triangle_object>> objects;
+    for (auto& c : centers)
+        objects.push_back(make_shared<Triangle_object>(Triangle_object{ c, c }));
+    // Shuffled, since the objects are kept in the order of the last frame.
+    shuffle(objects.begin(), objects.end(), mt19937(1));
+
+    Time time;
+    time.seconds_since_last_call();
+    for (int frame = 0; frame < frame_count; ++frame)
+    {
+        for (auto& o : objects)
+            XMStoreFloat3(&o->transformed_center,
+                XMVector3Transform(XMLoadFloat3(&o->center), model_view));
+        sort(objects.begin(), objects.end(), [](auto& o1, auto& o2)
+            { return o1->transformed_center.z < o2->transformed_center.z; });
+    }
+    const double per_object_seconds = time.seconds_since_last_call() / frame_count;
+
+    vector<UINT> indices(triangle_count * vertex_count_per_face);
+    for (UINT i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+    vector<uint32_t> sorted_indices(indices.size());
+    Triangle_sorter sorter(centers);
+    time.seconds_since_last_call();
+    for (int frame = 0; frame < frame_count; ++frame)
+        write_triangles_in_order(sorter.sort_back_to_front(model_view), indices,
+            sorted_indices.data());
+    const double batch_seconds = time.seconds_since_last_call() / frame_count;
+
+    cout << triangle_count << " transparent triangles, sorted back to front per frame:\n"
+        << "  One object per triangle: " << triangle_count << " draw calls, "
+        << per_object_seconds * 1000.0 << " ms\n"
+        << "  Sorted index buffer: 1 draw call, " << batch_seconds * 1000.0 << " ms\n";
+}
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-3.0-only
+// This file is part of Jadette.
+// Copyright (C) 2021 Joel Jansson
+// Distributed under GNU General Public License v3.0
+// See gpl-3.0.txt or <https://www.gnu.org/licenses/>
+
+
+#include "pch_tests.h"
+
+#include "../Vertex_compression.h"
+#include "../util.h"
+
+#include <iostream>
+#include <random>
+
+
+using namespace std;
+using namespace DirectX;
+
+
+namespace
+{
+    // Vertices with random positions, texture coordinates and tangent frames, where every
+    // other frame is mirrored.
+    Vertices create_random_vertices(size_t count, float size)
+    {
+        constexpr unsigned int seed = 1;
+        mt19937 generator(seed);
+        uniform_real_distribution<float> coordinate(-size, size);
+        uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        uniform_real_distribution<float> texture_coordinate(0.0f, 1.0f);
+        auto random_direction = [&]()
+        {
+            XMVECTOR v;
+            do
+                v = XMVectorSet(unit(generator), unit(generator), unit(generator), 0.0f);
+            while (XMVectorGetX(XMVector3LengthSq(v)) < 0.01f);
+            return XMVector3Normalize(v);
+        };
+
+        Vertices vertices;
+        for (size_t i = 0; i < count; ++i)
+        {
+            const float u = texture_coordinate(generator);
+            const float v = texture_coordinate(generator);
+            vertices.positions.push_back({ coordinate(generator), coordinate(generator),
+                coordinate(generator), u });
+
+            const XMVECTOR normal = random_direction();
+            const XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(normal,
+                random_direction()));
+            XMVECTOR bitangent = XMVector3Cross(normal, tangent);
+            if (i % 2)
+                bitangent = XMVectorNegate(bitangent);
+            vertices.normals.push_back(convert_vector_to_half4(XMVectorSetW(normal, v)));
+            vertices.tangents.push_back(convert_vector_to_half4(tangent));
+            vertices.bitangents.push_back(convert_vector_to_half4(bitangent));
+        }
+        return vertices;
+    }
+
+    XMVECTOR half4_xyz(const PackedVector::XMHALF4& half4)
+    {
+        return XMVectorSetW(convert_half4_to_vector(half4), 0.0f);
+    }
+
+    float angle(XMVECTOR a, const XMFLOAT3& b)
+    {
+        const float cosine = XMVectorGetX(XMVector3Dot(XMVector3Normalize(a),
+            XMVector3Normalize(XMLoadFloat3(&b))));
+        return acos(min(max(cosine, -1.0f), 1.0f));
+    }
+
+    struct Compression_errors
+    {
+        float position;
+        float tangent_frame_angle;
+        float texture_coords;
+    };
+
+    Compression_errors max_errors(const Vertices& vertices, const Compact_vertices& compact)
+    {
+        Compression_errors errors = {};
+        for (size_t i = 0; i < vertices.positions.size(); ++i)
+        {
+            auto d = decompress_vertex(compact, i);
+            auto& p = vertices.positions[i];
+            errors.position = max({ errors.position, abs(d.position.x - p.x),
+                abs(d.position.y - p.y), abs(d.position.z - p.z) });
+            errors.tangent_frame_angle = max({ errors.tangent_frame_angle,
+                angle(half4_xyz(vertices.normals[i]), d.normal),
+                angle(half4_xyz(vertices.tangents[i]), d.tangent),
+                angle(half4_xyz(vertices.bitangents[i]), d.bitangent) });
+            const float v = PackedVector::XMConvertHalfToFloat(vertices.normals[i].w);
+            errors.texture_coords = max({ errors.texture_coords,
+                abs(d.texture_coords.x - p.w), abs(d.texture_coords.y - v) });
+        }
+        return errors;
+    }
+}
+
+
+SCENARIO("Vertex compression")
+{
+    static_assert(full_vertex_size == 40, "The full vertex format has changed.");
+    static_assert(compact_vertex_size == 20, "The compact format should be half the size.");
+
+    GIVEN("Random vertices, with mirrored and not mirrored tangent frames")
+    {
+        constexpr float size = 10.0f;
+        const Vertices vertices = create_random_vertices(1000, size);
+
+        WHEN("they are compressed and decompressed")
+        {
+            const Compact_vertices compact = compress_vertices(vertices);
+            const Compression_errors errors = max_errors(vertices, compact);
+
+            THEN("the positions are within the quantization step of the bounding box")
+            {
+                REQUIRE(compact.positions.size() == vertices.positions.size());
+                constexpr float quantization_step = 2.0f * size / 65534.0f;
+                REQUIRE(errors.position <= quantization_step);
+            }
+            THEN("the tangent frames keep their directions and handedness")
+            {
+                // The full format stores them in 16 bit floats, so some of the error is from
+                // there. Less than a quarter of a degree is not visible in the shading.
+                constexpr float max_angle = XMConvertToRadians(0.25f);
+                REQUIRE(errors.tangent_frame_angle < max_angle);
+            }
+            THEN("the texture coordinates are within the precision of 16 bit floats")
+            {
+                // The coordinates are in [0, 1], where 16 bit floats have at least 11 bits
+                // of precision.
+                constexpr float max_error = 1.0f / 4096.0f;
+                REQUIRE(errors.texture_coords <= max_error);
+            }
+        }
+    }
+
+    GIVEN("A flat mesh, without tangents")
+    {
+        Vertices vertices;
+        vertices.positions = { { 0, 2, 0, 0 }, { 1, 2, 0, 0 }, { 0, 2, 1, 0 } };
+        const auto up = convert_vector_to_half4(XMVectorSet(0, 1, 0, 0));
+        vertices.normals = { up, up, up };
+
+        THEN("the positions and normals are kept, and the tangents are perpendicular")
+        {
+            const Compact_vertices compact = compress_vertices(vertices);
+            for (size_t i = 0; i < vertices.positions.size(); ++i)
+            {
+                auto d = decompress_vertex(compact, i);
+                REQUIRE(d.position.y == 2.0f);
+                REQUIRE(abs(d.position.x - vertices.positions[i].x) < 1e-4f);
+                REQUIRE(angle(XMVectorSet(0, 1, 0, 0), d.normal) < 1e-3f);
+                REQUIRE(abs(XMVectorGetX(XMVector3Dot(XMLoadFloat3(&d.tangent),
+                    XMLoadFloat3(&d.normal)))) < 1e-3f);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Vertex compression of many vertices", "[.benchmark]")
+{
+    const Vertices vertices = create_random_vertices(1000000, 100.0f);
+
+    Time time;
+    time.seconds_since_last_call();
+    const Compact_vertices compact = compress_vertices(vertices);
+    const double compress_seconds = time.seconds_since_last_call();
+    const Compression_errors errors = max_errors(vertices, compact);
+    const double decompress_seconds = time.seconds_since_last_call();
+
+    cout << vertices.positions.size() << " vertices compressed in " << compress_seconds * 1000.0
+        << " ms, decompressed and compared in " << decompress_seconds * 1000.0 << " ms\n"
+        << "Bytes per vertex: " << full_vertex_size << " -> " << compact_vertex_size << "\n"
+        << "Max errors, position: " << errors.position << ", tangent frame: "
+        << XMConvertToDegrees(errors.tangent_frame_angle) << " degrees, texture coordinates: "
+        << errors.texture_coords << "\n";
+}
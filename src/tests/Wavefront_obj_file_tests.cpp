@@ -8,6 +8,10 @@
 #include "pch_tests.h"
 
 #include "../Wavefront_obj_file.h"
+#include "../util.h"
+#include "Generated_obj_data.h"
+
+#include <iostream>
 
  
 using namespace std;
@@ -185,3 +189,564 @@ SCENARIO("The Obj parser works")
         }
     }
 }
+
+
+namespace
+{
+    struct Obj_parse_result
+    {
+        Vertices vertices;
+        vector<int> indices;
+        string material;
+        bool more_objects;
+    };
+
+    Obj_parse_result parse_with_stream(const string& data)
+    {
+        vector<XMFLOAT4> input_vertices;
+        vector<XMHALF4> input_normals;
+        vector<XMHALF2> input_texture_coords;
+        vector<XMHALF4> input_tangents;
+        vector<XMHALF4> input_bitangents;
+        vector<XMHALF4> input_colors;
+        map<string, Material> materials;
+
+        Obj_parse_result result;
+        istringstream obj_data(data);
+        result.more_objects = read_obj_file(obj_data, result.vertices, result.indices,
+            input_vertices, input_normals, input_texture_coords, input_tangents,
+            input_bitangents, input_colors, result.material, &materials, Obj_flip_v::yes);
+        return result;
+    }
+
+    Obj_parse_result parse_in_memory(const string& data)
+    {
+        vector<XMFLOAT4> input_vertices;
+        vector<XMHALF4> input_normals;
+        vector<XMHALF2> input_texture_coords;
+        vector<XMHALF4> input_tangents;
+        vector<XMHALF4> input_bitangents;
+        vector<XMHALF4> input_colors;
+        map<string, Material> materials;
+
+        Obj_parse_result result;
+        const char* position = data.data();
+        result.more_objects = read_obj_file(position, data.data() + data.size(),
+            result.vertices, result.indices, input_vertices, input_normals,
+            input_texture_coords, input_tangents, input_bitangents, input_colors,
+            result.material, &materials, Obj_flip_v::yes);
+        return result;
+    }
+
+    template<typename T>
+    bool same_bytes(const vector<T>& a, const vector<T>& b)
+    {
+        return a.size() == b.size() && (a.empty() ||
+            memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+    }
+
+    bool same_result(const Obj_parse_result& a, const Obj_parse_result& b)
+    {
+        return same_bytes(a.vertices.positions, b.vertices.positions) &&
+            same_bytes(a.vertices.normals, b.vertices.normals) &&
+            same_bytes(a.vertices.tangents, b.vertices.tangents) &&
+            same_bytes(a.vertices.bitangents, b.vertices.bitangents) &&
+            same_bytes(a.vertices.colors, b.vertices.colors) &&
+            a.indices == b.indices && a.material == b.material &&
+            a.more_objects == b.more_objects;
+    }
+}
+
+
+SCENARIO("The in-memory Obj parser gives the same result as the stream based one")
+{
+    GIVEN("Obj data with texture coordinates, normals and vertex colors")
+    {
+        const string obj_data("# A comment\n"
+                              "o quad\n"
+                              "v 0 0 0 1 0 0 1\n"
+                              "v 1 0 0 0 1 0 1\n"
+                              "v 1 1 0 0 0 1 0.5\n"
+                              "v 0 1 0 1 1 1 1\n"
+                              "vt 0 0\n"
+                              "vt 1 0\n"
+                              "vt 1 1\n"
+                              "vt 0 1\n"
+                              "vn 0 0 1\n"
+                              "usemtl some_material\n"
+                              "f 1/1/1 2/2/1 3/3/1\n"
+                              "f 1/1/1 3/3/1 4/4/1\n");
+
+        THEN("both parsers produce identical vertices and indices")
+        {
+            auto stream_result = parse_with_stream(obj_data);
+            auto memory_result = parse_in_memory(obj_data);
+            REQUIRE(memory_result.indices.size() == 6);
+            REQUIRE(same_result(stream_result, memory_result));
+        }
+    }
+
+    GIVEN("Obj data with tangents and bitangents and Windows line endings")
+    {
+        const string obj_data("v -1.5 2e-1 +3\r\n"
+                              "v 1 0 0\r\n"
+                              "v 1 1 0\r\n"
+                              "vt 0.25 0.5\r\n"
+                              "vn 0 0 1\r\n"
+                              "vtan 1 0 0\r\n"
+                              "vbt 0 1 0\r\n"
+                              "f 1/1/1/1/1 2/1/1/1/1 3/1/1/1/1\r\n");
+
+        THEN("both parsers produce identical vertices and indices")
+        {
+            auto stream_result = parse_with_stream(obj_data);
+            auto memory_result = parse_in_memory(obj_data);
+            REQUIRE(memory_result.vertices.tangents.size() == 3);
+            REQUIRE(same_result(stream_result, memory_result));
+        }
+    }
+
+    GIVEN("Obj data with more than one object")
+    {
+        const string obj_data("o first\n"
+                              "v 0 0 0\nv 1 0 0\nv 1 1 0\n"
+                              "vn 0 0 1\n"
+                              "f 1//1 2//1 3//1\n"
+                              "o second\n"
+                              "f 3//1 2//1 1//1\n");
+
+        THEN("the parsing stops at the second object and the position is left there")
+        {
+            const char* position = obj_data.data();
+            const char* end = obj_data.data() + obj_data.size();
+            vector<XMFLOAT4> input_vertices;
+            vector<XMHALF4> input_normals;
+            vector<XMHALF2> input_texture_coords;
+            vector<XMHALF4> input_tangents;
+            vector<XMHALF4> input_bitangents;
+            vector<XMHALF4> input_colors;
+            string material;
+
+            Vertices first;
+            vector<int> first_indices;
+            bool more_objects = read_obj_file(position, end, first, first_indices,
+                input_vertices, input_normals, input_texture_coords, input_tangents,
+                input_bitangents, input_colors, material, nullptr, Obj_flip_v::yes);
+            REQUIRE(more_objects);
+            REQUIRE(first.positions.size() == 3);
+
+            Vertices second;
+            vector<int> second_indices;
+            more_objects = read_obj_file(position, end, second, second_indices,
+                input_vertices, input_normals, input_texture_coords, input_tangents,
+                input_bitangents, input_colors, material, nullptr, Obj_flip_v::yes);
+            REQUIRE(!more_objects);
+            REQUIRE(position == end);
+            REQUIRE(second.positions.size() == 3);
+            REQUIRE(second.positions[0].x == 1.0f);
+            REQUIRE(second.positions[0].y == 1.0f);
+        }
+    }
+
+    GIVEN("Obj data with negative, i.e. relative, indices")
+    {
+        const string relative("v 0 0 0\nv 1 0 0\nv 1 1 0\nvn 0 0 1\nf -3//-1 -2//-1 -1//-1\n");
+        const string absolute("v 0 0 0\nv 1 0 0\nv 1 1 0\nvn 0 0 1\nf 1//1 2//1 3//1\n");
+
+        THEN("they refer to the same vertices as the corresponding absolute indices")
+        {
+            REQUIRE(same_result(parse_in_memory(relative), parse_in_memory(absolute)));
+        }
+    }
+
+    GIVEN("Obj data with references to vertices that do not exist")
+    {
+        const string obj_data("v 0 0 0\nvn 0 0 1\nf 1//1 7//1 -9//1\n");
+
+        THEN("the face is not read outside of the input, and is left out whole")
+        {
+            auto result = parse_in_memory(obj_data);
+            REQUIRE(result.vertices.positions.size() == 0);
+            REQUIRE(result.vertices.normals.size() == 0);
+            REQUIRE(result.vertices.tangents.size() == 0);
+            REQUIRE(result.indices.size() == 0);
+        }
+    }
+}
+
+
+namespace
+{
+    vector<Obj_object> read_all_objects_serially(const string& data)
+    {
+        vector<XMFLOAT4> input_vertices;
+        vector<XMHALF4> input_normals;
+        vector<XMHALF2> input_texture_coords;
+        vector<XMHALF4> input_tangents;
+        vector<XMHALF4> input_bitangents;
+        vector<XMHALF4> input_colors;
+        map<string, Material> materials;
+
+        vector<Obj_object> objects;
+        const char* position = data.data();
+        bool more_objects = true;
+        while (more_objects)
+        {
+            objects.emplace_back();
+            Obj_object& o = objects.back();
+            more_objects = read_obj_file(position, data.data() + data.size(), o.vertices,
+                o.indices, input_vertices, input_normals, input_texture_coords, input_tangents,
+                input_bitangents, input_colors, o.material, &materials, Obj_flip_v::yes);
+        }
+        return objects;
+    }
+
+    bool same_objects(const vector<Obj_object>& a, const vector<Obj_object>& b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            Obj_parse_result first = { a[i].vertices, a[i].indices, a[i].material, false };
+            Obj_parse_result second = { b[i].vertices, b[i].indices, b[i].material, false };
+            if (!same_result(first, second))
+                return false;
+        }
+        return true;
+    }
+}
+
+
+SCENARIO("The parallel Obj parser gives the same result as the serial one")
+{
+    map<string, Material> materials;
+
+    GIVEN("Obj data that is big enough to be split between threads, with several objects")
+    {
+        const string obj_data = "o first\n"
+                                "usemtl first_material\n" + generate_grid_obj(200) +
+                                "g second\n" + generate_grid_obj(150, false, true) +
+                                "o third\n"
+                                "usemtl third_material\n" + generate_grid_obj(100);
+        const auto serial = read_all_objects_serially(obj_data);
+        REQUIRE(serial.size() == 3);
+        REQUIRE(serial[1].material.empty());
+
+        THEN("the objects are the same for any number of threads")
+        {
+            for (int thread_count : { 1, 2, 3, 8, 13 })
+            {
+                auto parallel = read_obj_objects(obj_data.data(),
+                    obj_data.data() + obj_data.size(), materials, Obj_flip_v::yes, thread_count);
+                REQUIRE(same_objects(serial, parallel));
+            }
+        }
+
+        THEN("the objects are the same when the data is read from a stream in blocks")
+        {
+            for (size_t block_size : { 1000, 100000, 1 << 20 })
+            {
+                istringstream stream(obj_data);
+                auto blocks = read_obj_objects(stream, materials, Obj_flip_v::yes, 3, nullptr,
+                    block_size);
+                REQUIRE(same_objects(serial, blocks));
+            }
+        }
+    }
+
+    GIVEN("Obj data where a vertex in the middle of the file has no color")
+    {
+        const string obj_data = generate_grid_obj(150, true) + "v 0 0 0\n" +
+                                generate_grid_obj(150, true, true);
+        const auto serial = read_all_objects_serially(obj_data);
+        REQUIRE(serial.size() == 1);
+        REQUIRE(!serial[0].vertices.colors.empty());
+        REQUIRE(serial[0].vertices.colors.size() < serial[0].vertices.positions.size());
+
+        THEN("the colors are used for the same faces")
+        {
+            auto parallel = read_obj_objects(obj_data.data(), obj_data.data() + obj_data.size(),
+                materials, Obj_flip_v::yes, 8);
+            REQUIRE(same_objects(serial, parallel));
+        }
+
+        THEN("the colors are used for the same faces when it is read in blocks")
+        {
+            istringstream stream(obj_data);
+            auto blocks = read_obj_objects(stream, materials, Obj_flip_v::yes, 2, nullptr,
+                100000);
+            REQUIRE(same_objects(serial, blocks));
+        }
+    }
+
+    GIVEN("Obj data with lines that are longer than the blocks")
+    {
+        const string obj_data = "# " + string(100, '-') + "\nv 0 0 0\nv 1 0 0\nv 0 1 0\n"
+                                "f 1 2 3\n# " + string(100, '-');
+        const auto serial = read_all_objects_serially(obj_data);
+
+        THEN("the lines are read as a whole")
+        {
+            istringstream stream(obj_data);
+            auto blocks = read_obj_objects(stream, materials, Obj_flip_v::yes, 2, nullptr, 16);
+            REQUIRE(same_objects(serial, blocks));
+            REQUIRE(blocks[0].indices.size() == 3);
+        }
+    }
+
+    GIVEN("No Obj data")
+    {
+        const string obj_data;
+
+        THEN("there is one empty object, just as for the serial parser")
+        {
+            auto parallel = read_obj_objects(obj_data.data(), obj_data.data(), materials,
+                Obj_flip_v::yes, 4);
+            REQUIRE(parallel.size() == 1);
+            REQUIRE(parallel[0].indices.empty());
+        }
+    }
+}
+
+
+namespace
+{
+    bool same_vector(const XMHALF4& a, const XMHALF4& b)
+    {
+        auto va = convert_half4_to_vector(a);
+        auto vb = convert_half4_to_vector(b);
+        for (int i = 0; i < 4; ++i)
+            if (va.m128_f32[i] != Approx(vb.m128_f32[i]).margin(0.002))
+                return false;
+        return true;
+    }
+
+    // Checks that every face corner of the unwelded object has the same data in the welded one.
+    // Tangents and bitangents that have been calculated per face are instead the average of
+    // those of the corners that have been welded together.
+    bool same_corners(const Obj_object& unwelded, const Obj_object& welded)
+    {
+        const Vertices& a = unwelded.vertices;
+        const Vertices& b = welded.vertices;
+        if (welded.indices.size() != unwelded.indices.size())
+            return false;
+        vector<XMVECTOR> tangent_sums(b.positions.size(), XMVectorZero());
+        vector<XMVECTOR> bitangent_sums(b.positions.size(), XMVectorZero());
+        for (size_t i = 0; i < welded.indices.size(); ++i)
+        {
+            const int j = welded.indices[i];
+            tangent_sums[j] += convert_half4_to_vector(a.tangents[i]);
+            bitangent_sums[j] += convert_half4_to_vector(a.bitangents[i]);
+        }
+        for (size_t i = 0; i < welded.indices.size(); ++i)
+        {
+            const int j = welded.indices[i];
+            const Obj_vertex_key& key = unwelded.vertex_keys[i];
+            const XMHALF4 tangent = key.tangent == Obj_vertex_key::none ?
+                convert_vector_to_half4(XMVector3Normalize(tangent_sums[j])) : a.tangents[i];
+            const XMHALF4 bitangent = key.bitangent == Obj_vertex_key::none ?
+                convert_vector_to_half4(XMVector3Normalize(bitangent_sums[j])) :
+                a.bitangents[i];
+            if (memcmp(&a.positions[i], &b.positions[j], sizeof(a.positions[i])) != 0 ||
+                memcmp(&a.normals[i], &b.normals[j], sizeof(a.normals[i])) != 0 ||
+                !same_vector(tangent, b.tangents[j]) ||
+                !same_vector(bitangent, b.bitangents[j]))
+                return false;
+            if (!a.colors.empty() && memcmp(&a.colors[i], &b.colors[j], sizeof(a.colors[i])))
+                return false;
+        }
+        return true;
+    }
+
+    Obj_object read_one_object(const string& obj_data)
+    {
+        map<string, Material> materials;
+        auto objects = read_obj_objects(obj_data.data(), obj_data.data() + obj_data.size(),
+            materials, Obj_flip_v::yes, 4);
+        REQUIRE(objects.size() == 1);
+        return objects[0];
+    }
+}
+
+
+SCENARIO("Vertex welding")
+{
+    GIVEN("A grid of quads")
+    {
+        constexpr int quads_per_side = 100;
+        const Obj_object unwelded = read_one_object(generate_grid_obj(quads_per_side, true));
+
+        WHEN("the vertices have been welded")
+        {
+            Obj_object welded = unwelded;
+            weld_vertices(welded);
+
+            THEN("every face corner has the same data as before")
+            {
+                REQUIRE(same_corners(unwelded, welded));
+            }
+
+            THEN("the vertices that are shared between faces only occur once")
+            {
+                constexpr int vertices_per_side = quads_per_side + 1;
+                REQUIRE(welded.vertices.positions.size() == vertices_per_side * vertices_per_side);
+                REQUIRE(welded.vertices.normals.size() == welded.vertices.positions.size());
+                REQUIRE(welded.vertices.tangents.size() == welded.vertices.positions.size());
+                REQUIRE(welded.vertices.colors.size() == welded.vertices.positions.size());
+                REQUIRE(welded.indices.size() == unwelded.indices.size());
+                REQUIRE(welded.vertex_keys.empty());
+            }
+        }
+    }
+
+    GIVEN("Faces that share positions, but not texture coordinates, normals or tangents")
+    {
+        const string obj_data("v 0 0 0\nv 1 0 0\nv 1 1 0\n"
+                              "vt 0 0\nvt 1 0\nvt 1 1\nvt 1 2\n"
+                              "vn 0 0 1\nvn 0 1 0\n"
+                              "vtan 1 0 0\nvtan 0 1 0\n"
+                              "vbt 0 1 0\n"
+                              "f 1/1/1 2/2/1 3/3/1\n"       // Reference
+                              "f 1/1/1 2/2/1 3/4/1\n"       // Other uv, same tangent space
+                              "f 1/1/2 2/2/1 3/3/1\n"       // Other normal
+                              "f 1/1/1/1/1 2/2/1/1/1 3/3/1/1/1\n"
+                              "f 1/1/1/2/1 2/2/1/1/1 3/3/1/1/1\n"); // Other tangent
+        const Obj_object unwelded = read_one_object(obj_data);
+
+        WHEN("the vertices have been welded")
+        {
+            Obj_object welded = unwelded;
+            weld_vertices(welded);
+
+            THEN("only the identical face corners are welded")
+            {
+                REQUIRE(welded.vertices.positions.size() == 3 + 1 + 1 + 3 + 1);
+                REQUIRE(same_corners(unwelded, welded));
+            }
+        }
+    }
+}
+
+
+SCENARIO("Merging objects")
+{
+    GIVEN("Two objects, where only the first has levels of detail")
+    {
+        Obj_object first;
+        first.material = "material";
+        first.vertices.positions = { { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+                                     { 1, 1, 0, 0 } };
+        first.vertices.normals.resize(4);
+        first.vertices.tangents.resize(4);
+        first.vertices.bitangents.resize(4);
+        first.indices = { 0, 1, 2, 2, 1, 3 };
+        first.lods = { { { 0, 1, 2 }, 0.5f }, { { 0, 1, 3 }, 1.0f } };
+
+        Obj_object second;
+        second.material = "material";
+        second.vertices.positions = { { 5, 0, 0, 0 }, { 6, 0, 0, 0 }, { 5, 1, 0, 0 } };
+        second.vertices.normals.resize(3);
+        second.vertices.tangents.resize(3);
+        second.vertices.bitangents.resize(3);
+        const HALF one = XMConvertFloatToHalf(1.0f);
+        second.vertices.colors.resize(3, XMHALF4(one, one, one, one));
+        second.indices = { 0, 1, 2 };
+
+        WHEN("they are merged")
+        {
+            const Obj_object merged = merge_objects({ &first, &second });
+
+            THEN("the vertices and indices of the second come after those of the first")
+            {
+                REQUIRE(merged.material == "material");
+                REQUIRE(merged.vertices.positions.size() == 7);
+                REQUIRE(merged.vertices.normals.size() == 7);
+                REQUIRE(merged.vertices.tangents.size() == 7);
+                REQUIRE(merged.vertices.bitangents.size() == 7);
+                REQUIRE(merged.vertices.positions[4].x == 5.0f);
+                REQUIRE(merged.indices == vector<int>({ 0, 1, 2, 2, 1, 3, 4, 5, 6 }));
+            }
+            THEN("the vertices of the first get the same colors as if it had none")
+            {
+                REQUIRE(merged.vertices.colors.size() == 7);
+                REQUIRE(merged.vertices.colors[0].x == XMHALF4().x);
+                REQUIRE(merged.vertices.colors[4].x == second.vertices.colors[0].x);
+            }
+            THEN("the levels of detail have the full second object")
+            {
+                REQUIRE(merged.lods.size() == 2);
+                REQUIRE(merged.lods[0].indices == vector<int>({ 0, 1, 2, 4, 5, 6 }));
+                REQUIRE(merged.lods[0].error == 0.5f);
+                REQUIRE(merged.lods[1].indices == vector<int>({ 0, 1, 3, 4, 5, 6 }));
+                REQUIRE(merged.lods[1].error == 1.0f);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Obj parsing throughput", "[.benchmark]")
+{
+    // Run with: Jadette_tests.exe [.benchmark]
+    constexpr int quads_per_side = 1000; // Two million triangles.
+    const string file_name = "benchmark_grid.obj";
+    write_file(file_name, generate_grid_obj(quads_per_side));
+    const double megabytes = std::ifstream(file_name, std::ios::binary | std::ios::ate).tellg() /
+        (1024.0 * 1024.0);
+
+    Time time;
+    time.seconds_since_last_call();
+
+    Vertices mapped_vertices;
+    vector<int> mapped_indices;
+    read_obj_file(file_name, mapped_vertices, mapped_indices, Obj_flip_v::yes);
+    const double mapped_seconds = time.seconds_since_last_call();
+
+    Vertices stream_vertices;
+    vector<int> stream_indices;
+    {
+        vector<XMFLOAT4> input_vertices;
+        vector<XMHALF4> input_normals;
+        vector<XMHALF2> input_texture_coords;
+        vector<XMHALF4> input_tangents;
+        vector<XMHALF4> input_bitangents;
+        vector<XMHALF4> input_colors;
+        string material;
+        ifstream file(file_name);
+        read_obj_file(file, stream_vertices, stream_indices, input_vertices, input_normals,
+            input_texture_coords, input_tangents, input_bitangents, input_colors, material,
+            nullptr, Obj_flip_v::yes);
+    }
+    const double stream_seconds = time.seconds_since_last_call();
+
+    cout << "Obj file of " << megabytes << " MB, " << mapped_indices.size() / 3 << " triangles\n"
+        << "Memory mapped: " << megabytes / mapped_seconds << " MB/s\n"
+        << "Stream:        " << megabytes / stream_seconds << " MB/s\n";
+
+    remove(file_name.c_str());
+
+    REQUIRE(mapped_indices == stream_indices);
+    REQUIRE(same_bytes(mapped_vertices.positions, stream_vertices.positions));
+}
+
+
+TEST_CASE("Parallel Obj parsing scaling", "[.benchmark]")
+{
+    constexpr int quads_per_side = 1500; // 4.5 million triangles.
+    const string obj_data = generate_grid_obj(quads_per_side);
+    const double megabytes = obj_data.size() / (1024.0 * 1024.0);
+    map<string, Material> materials;
+    Time time;
+
+    const int max_thread_count = std::max(1, static_cast<int>(thread::hardware_concurrency()));
+    for (int thread_count = 1; thread_count <= max_thread_count; thread_count *= 2)
+    {
+        time.seconds_since_last_call();
+        auto objects = read_obj_objects(obj_data.data(), obj_data.data() + obj_data.size(),
+            materials, Obj_flip_v::yes, thread_count);
+        const double seconds = time.seconds_since_last_call();
+        cout << thread_count << " threads: " << seconds * 1000.0 << " ms, "
+            << megabytes / seconds << " MB/s\n";
+        REQUIRE(objects.size() == 1);
+    }
+}
@@ -10,7 +10,10 @@
 
 #include <stringapiset.h>
 #include <profileapi.h>
+#include <processthreadsapi.h>
+#include <sysinfoapi.h>
 #include <stdlib.h>
+#include <mutex>
 
 
 LARGE_INTEGER get_frequency()
@@ -45,6 +48,20 @@ double elapsed_time_in_seconds()
     return elapsed_seconds_since(start_ticks, current_ticks);
 }
 
+double seconds_since_process_start()
+{
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time);
+    FILETIME now;
+    GetSystemTimePreciseAsFileTime(&now);
+    auto to_ticks = [](const FILETIME& time)
+    {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    constexpr double seconds_per_tick = 100e-9; // FILETIME is in 100 nanosecond units.
+    return static_cast<double>(to_ticks(now) - to_ticks(creation_time)) * seconds_per_tick;
+}
+
 void print(const char* message, const char* title/* = ""*/)
 {
     MessageBoxA(nullptr, message, title, MB_OK);
@@ -64,6 +81,9 @@ void print(int number, const char* title/* = ""*/)
 
 void log(const std::string& text)
 {
+    // The scene is loaded on several threads.
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
     static bool first = true;
     static std::ofstream file;
     if (first)
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include "Job_system.h"
+
 #include <winerror.h>
 #include <exception>
 
@@ -55,6 +57,9 @@ private:
 
 double elapsed_time_in_seconds();
 
+// Including the time it took the operating system to start the process.
+double seconds_since_process_start();
+
 
 std::wstring widen(const std::string& input);
 
@@ -107,6 +112,19 @@ constexpr To bit_cast(const From& source)
     return destination;
 }
 
+// Calls function(i) for i in [0, thread_count), in parallel as jobs of the shared job system,
+// so that it does not start more threads than there are cores when it is called from several
+// threads at once, e.g. when the models of a scene are read.
+template<typename Function>
+void run_in_parallel(int thread_count, Function function)
+{
+    job_system().parallel_for(static_cast<size_t>(std::max(thread_count, 0)), 1,
+        [&function](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                function(static_cast<int>(i));
+        });
+}
+
 class Value_noise
 {
 public: